@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_capture_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NSEC_PER_SEC (1000000000LL)
+
+int32_t AudioCaptureRingInit(struct AudioCaptureRing *ring, uint32_t slotCount, uint32_t slotFrames,
+                             uint32_t frameBytes, uint32_t rate)
+{
+    memset(ring, 0, sizeof(*ring));
+    if (slotCount < 2U || slotFrames == 0 || frameBytes == 0 || rate == 0) {
+        return -1;
+    }
+
+    ring->data = malloc((size_t)slotCount * slotFrames * frameBytes);
+    ring->slots = calloc(slotCount, sizeof(*ring->slots));
+    if (!ring->data || !ring->slots) {
+        AudioCaptureRingDeinit(ring);
+        return -1;
+    }
+    ring->slotCount = slotCount;
+    ring->slotFrames = slotFrames;
+    ring->frameBytes = frameBytes;
+    ring->rate = rate;
+    AudioCaptureRingReset(ring);
+
+    return 0;
+}
+
+void AudioCaptureRingDeinit(struct AudioCaptureRing *ring)
+{
+    free(ring->data);
+    free(ring->slots);
+    memset(ring, 0, sizeof(*ring));
+}
+
+void AudioCaptureRingReset(struct AudioCaptureRing *ring)
+{
+    atomic_store_explicit(&ring->writeSlots, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->readSlots, 0, memory_order_relaxed);
+    ring->readFrames = 0;
+    ring->readOffset = 0;
+    ring->overruns = 0;
+}
+
+uint8_t *AudioCaptureRingWriteBegin(struct AudioCaptureRing *ring)
+{
+    uint64_t w = atomic_load_explicit(&ring->writeSlots, memory_order_relaxed);
+    uint64_t r = atomic_load_explicit(&ring->readSlots, memory_order_acquire);
+
+    // One slot always stays free, so the newest committed one is not rewritten while the
+    // consumer looks at it for AudioCaptureRingAvail()
+    if (w - r >= ring->slotCount - 1U) {
+        ring->overruns++;
+        return NULL;
+    }
+
+    return ring->data + (size_t)(w % ring->slotCount) * ring->slotFrames * ring->frameBytes;
+}
+
+void AudioCaptureRingWriteCommit(struct AudioCaptureRing *ring, uint32_t frames, int64_t timeNs)
+{
+    uint64_t w = atomic_load_explicit(&ring->writeSlots, memory_order_relaxed);
+    struct AudioCaptureRingSlot *slot = &ring->slots[w % ring->slotCount];
+    uint64_t endFrame = w ? ring->slots[(w - 1U) % ring->slotCount].endFrame : 0;
+
+    slot->timeNs = timeNs;
+    slot->frames = frames < ring->slotFrames ? frames : ring->slotFrames;
+    slot->endFrame = endFrame + slot->frames;
+    atomic_store_explicit(&ring->writeSlots, w + 1U, memory_order_release);
+}
+
+uint32_t AudioCaptureRingAvail(const struct AudioCaptureRing *ring)
+{
+    uint64_t w = atomic_load_explicit(&ring->writeSlots, memory_order_acquire);
+
+    if (w == atomic_load_explicit(&ring->readSlots, memory_order_relaxed)) {
+        return 0;
+    }
+
+    return (uint32_t)(ring->slots[(w - 1U) % ring->slotCount].endFrame - ring->readFrames);
+}
+
+uint32_t AudioCaptureRingRead(struct AudioCaptureRing *ring, void *out, uint32_t frames, int64_t *timeNs)
+{
+    uint64_t w = atomic_load_explicit(&ring->writeSlots, memory_order_acquire);
+    uint64_t r = atomic_load_explicit(&ring->readSlots, memory_order_relaxed);
+    uint8_t *dst = (uint8_t *)out;
+    uint32_t done = 0;
+
+    while (done < frames && r < w) {
+        uint32_t index = (uint32_t)(r % ring->slotCount);
+        const struct AudioCaptureRingSlot *slot = &ring->slots[index];
+        uint32_t n = slot->frames - ring->readOffset;
+        if (n > frames - done) {
+            n = frames - done;
+        }
+        if (done == 0 && timeNs) {
+            *timeNs = slot->timeNs + (int64_t)ring->readOffset * NSEC_PER_SEC / ring->rate;
+        }
+        const uint8_t *src = ring->data + ((size_t)index * ring->slotFrames + ring->readOffset) * ring->frameBytes;
+        memcpy(dst + (size_t)done * ring->frameBytes, src, (size_t)n * ring->frameBytes);
+        done += n;
+        ring->readOffset += n;
+        if (ring->readOffset == slot->frames) {
+            ring->readOffset = 0;
+            r++;
+        }
+    }
+
+    ring->readFrames += done;
+    atomic_store_explicit(&ring->readSlots, r, memory_order_release);
+
+    return done;
+}
+
+void AudioCaptureRingSkip(struct AudioCaptureRing *ring, uint32_t keepFrames)
+{
+    uint32_t avail = AudioCaptureRingAvail(ring);
+    uint64_t r = atomic_load_explicit(&ring->readSlots, memory_order_relaxed);
+
+    if (avail <= keepFrames) {
+        return;
+    }
+
+    uint32_t drop = avail - keepFrames;
+    ring->readFrames += drop;
+    while (drop > 0) {
+        const struct AudioCaptureRingSlot *slot = &ring->slots[r % ring->slotCount];
+        uint32_t left = slot->frames - ring->readOffset;
+        if (drop < left) {
+            ring->readOffset += drop;
+            break;
+        }
+        drop -= left;
+        ring->readOffset = 0;
+        r++;
+    }
+
+    atomic_store_explicit(&ring->readSlots, r, memory_order_release);
+}
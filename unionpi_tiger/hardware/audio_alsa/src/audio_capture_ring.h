@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_CAPTURE_RING_H
+#define AUDIO_CAPTURE_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AudioCaptureRingSlot {
+    int64_t timeNs;    // capture time of the first frame
+    uint64_t endFrame; // frames written up to the end of this slot since the ring was reset
+    uint32_t frames;
+};
+
+/*
+ * Captured frames queued by one producer for one consumer, a slot per captured period.
+ * Each slot carries the time its first frame was captured, so a read of any size knows
+ * when its first frame was. Neither side locks or waits: the producer finds no free slot
+ * when the consumer is behind and drops the period, counting an overrun.
+ *
+ * AudioCaptureRingWriteBegin/Commit are the producer's, AudioCaptureRingAvail, Read and
+ * Skip the consumer's; each side is a single thread at a time.
+ */
+struct AudioCaptureRing {
+    uint8_t *data;
+    struct AudioCaptureRingSlot *slots;
+    uint32_t slotCount;
+    uint32_t slotFrames; // room of every slot
+    uint32_t frameBytes;
+    uint32_t rate;       // of the frames, times inside a slot are counted from its first
+
+    _Atomic uint64_t writeSlots; // slots committed since the ring was reset
+    _Atomic uint64_t readSlots;  // slots the consumer is done with
+    uint64_t readFrames;         // consumer only, frames read or skipped
+    uint32_t readOffset;         // consumer only, frames taken from slot readSlots
+
+    uint32_t overruns; // producer only
+};
+
+/* On failure nothing is left allocated */
+int32_t AudioCaptureRingInit(struct AudioCaptureRing *ring, uint32_t slotCount, uint32_t slotFrames,
+                             uint32_t frameBytes, uint32_t rate);
+void AudioCaptureRingDeinit(struct AudioCaptureRing *ring);
+
+/* Empties the ring, only while neither side is using it */
+void AudioCaptureRingReset(struct AudioCaptureRing *ring);
+
+/* The slot to fill, up to slotFrames frames; NULL when the ring is full, which counts an overrun */
+uint8_t *AudioCaptureRingWriteBegin(struct AudioCaptureRing *ring);
+
+/* Hands 'frames' frames of the slot from AudioCaptureRingWriteBegin() to the consumer */
+void AudioCaptureRingWriteCommit(struct AudioCaptureRing *ring, uint32_t frames, int64_t timeNs);
+
+/* Frames the consumer can read */
+uint32_t AudioCaptureRingAvail(const struct AudioCaptureRing *ring);
+
+/* Copies up to 'frames' frames, returns how many; 'timeNs' gets the capture time of the first */
+uint32_t AudioCaptureRingRead(struct AudioCaptureRing *ring, void *out, uint32_t frames, int64_t *timeNs);
+
+/* Drops all but the newest 'keepFrames' frames the consumer has not read */
+void AudioCaptureRingSkip(struct AudioCaptureRing *ring, uint32_t keepFrames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_CAPTURE_RING_H */
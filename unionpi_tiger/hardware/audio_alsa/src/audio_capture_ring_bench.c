@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_capture_ring.h"
+
+#define BENCH_RATE (48000)
+#define BENCH_SECONDS (60)
+#define BENCH_PERIOD (480)
+#define BENCH_SLOTS (16)
+#define CHECK_PERIODS (50000)
+#define CHECK_PACE_PERIODS (8)
+#define CHECK_PACE_US (100)
+#define CHECK_READ_MAX (2048)
+#define NSEC_PER_SEC (1000000000LL)
+
+/*
+ * Every frame is a single int32 holding its own index, and every slot is stamped with the
+ * time that index maps to, so the consumer can tell a frame out of place, a lost frame and
+ * a wrong timestamp apart.
+ */
+struct StreamCheck {
+    struct AudioCaptureRing ring;
+    uint32_t periods;
+    volatile int done;
+    uint64_t produced; // frames, including those dropped
+    uint32_t seed;
+};
+
+static uint32_t Rand(uint32_t *seed)
+{
+    *seed = *seed * 1664525U + 1013904223U;
+    return *seed >> 8;
+}
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int64_t FrameTime(uint64_t index)
+{
+    return (int64_t)(index * NSEC_PER_SEC / BENCH_RATE);
+}
+
+// A time inside a slot is its first frame's plus the offset, each rounded down on its own
+static int TimeMatches(int64_t timeNs, uint64_t index)
+{
+    int64_t diff = timeNs - FrameTime(index);
+    return diff >= -1 && diff <= 1;
+}
+
+static void *Producer(void *arg)
+{
+    struct StreamCheck *check = (struct StreamCheck *)arg;
+    uint32_t seed = check->seed;
+
+    for (uint32_t p = 0; p < check->periods; p++) {
+        // Periods of any length up to the slot size, a converter does not emit a constant count
+        uint32_t frames = 1U + Rand(&seed) % check->ring.slotFrames;
+        int32_t *slot = (int32_t *)AudioCaptureRingWriteBegin(&check->ring);
+        if (slot) {
+            for (uint32_t i = 0; i < frames; i++) {
+                slot[i] = (int32_t)(check->produced + i);
+            }
+            AudioCaptureRingWriteCommit(&check->ring, frames, FrameTime(check->produced));
+        }
+        check->produced += frames;
+        // Roughly paced like a capture, a consumer without delay has to keep up
+        if (p % CHECK_PACE_PERIODS == 0) {
+            usleep(CHECK_PACE_US);
+        }
+    }
+    __atomic_store_n(&check->done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+// A consumer with 'readerDelayUs' between reads falls behind and has to see whole periods dropped
+static int CheckStream(uint32_t readerDelayUs, uint32_t *overruns)
+{
+    static int32_t buf[CHECK_READ_MAX];
+    struct StreamCheck check = {.periods = CHECK_PERIODS, .seed = 0x1234567};
+    uint32_t seed = 0x89abcdef;
+    uint64_t expect = 0;
+    uint64_t lost = 0;
+    uint64_t read = 0;
+    int failures = 0;
+    pthread_t thread;
+
+    if (AudioCaptureRingInit(&check.ring, BENCH_SLOTS, BENCH_PERIOD, sizeof(int32_t), BENCH_RATE) < 0) {
+        return 1;
+    }
+    pthread_create(&thread, NULL, Producer, &check);
+
+    for (;;) {
+        int finished = __atomic_load_n(&check.done, __ATOMIC_ACQUIRE);
+        uint32_t want = 1U + Rand(&seed) % CHECK_READ_MAX;
+        int64_t timeNs = -1;
+        uint32_t n = AudioCaptureRingRead(&check.ring, buf, want, &timeNs);
+        if (n == 0) {
+            if (finished) {
+                break;
+            }
+            if (readerDelayUs) {
+                usleep(readerDelayUs);
+            }
+            continue;
+        }
+        if (buf[0] != (int32_t)expect) {
+            // Only a whole dropped period may be missing, never a frame out of order
+            if ((uint64_t)(uint32_t)buf[0] < expect) {
+                failures++;
+            }
+            lost += (uint32_t)buf[0] - expect;
+            expect = (uint32_t)buf[0];
+        }
+        if (!TimeMatches(timeNs, expect)) {
+            failures++;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (buf[i] != (int32_t)(expect + i)) {
+                // A gap inside one read is fine too, as long as it is forward
+                if ((uint32_t)buf[i] < expect + i) {
+                    failures++;
+                }
+                lost += (uint32_t)buf[i] - (expect + i);
+                expect = (uint32_t)buf[i] - i;
+            }
+        }
+        expect += n;
+        read += n;
+        if (readerDelayUs) {
+            usleep(readerDelayUs);
+        }
+    }
+    pthread_join(thread, NULL);
+
+    // Whatever was produced was either read or dropped as a whole period
+    lost += check.produced - expect;
+    if (read + lost != check.produced || (check.ring.overruns == 0 && lost != 0) ||
+        (check.ring.overruns != 0 && lost == 0)) {
+        failures++;
+    }
+    *overruns = check.ring.overruns;
+    printf("  consumer delay %4u us: %llu frames read, %llu lost in %u overruns, %d failures\n", readerDelayUs,
+           (unsigned long long)read, (unsigned long long)lost, check.ring.overruns, failures);
+    AudioCaptureRingDeinit(&check.ring);
+
+    return failures;
+}
+
+/* The newest frames survive a skip, with the timestamps they were captured at */
+static int CheckSkip(void)
+{
+    struct AudioCaptureRing ring;
+    int32_t buf[BENCH_PERIOD * 4];
+    uint64_t produced = 0;
+    int failures = 0;
+
+    if (AudioCaptureRingInit(&ring, BENCH_SLOTS, BENCH_PERIOD, sizeof(int32_t), BENCH_RATE) < 0) {
+        return 1;
+    }
+
+    for (uint32_t keep = 0; keep < BENCH_PERIOD * 3; keep += 97U) {
+        for (uint32_t p = 0; p < 10; p++) {
+            uint32_t frames = BENCH_PERIOD - p * 7U;
+            int32_t *slot = (int32_t *)AudioCaptureRingWriteBegin(&ring);
+            if (!slot) {
+                failures++;
+                break;
+            }
+            for (uint32_t i = 0; i < frames; i++) {
+                slot[i] = (int32_t)(produced + i);
+            }
+            AudioCaptureRingWriteCommit(&ring, frames, FrameTime(produced));
+            produced += frames;
+            AudioCaptureRingSkip(&ring, keep);
+        }
+
+        int64_t timeNs = -1;
+        uint32_t avail = AudioCaptureRingAvail(&ring);
+        uint32_t n = AudioCaptureRingRead(&ring, buf, BENCH_PERIOD * 4, &timeNs);
+        if (avail != keep || n != keep || AudioCaptureRingAvail(&ring) != 0) {
+            failures++;
+        }
+        if (n > 0 && (buf[0] != (int32_t)(produced - keep) || buf[n - 1] != (int32_t)(produced - 1U) ||
+                      !TimeMatches(timeNs, produced - keep))) {
+            failures++;
+        }
+    }
+    if (ring.overruns != 0) {
+        failures++;
+    }
+
+    printf("skip check: %d failures\n", failures);
+    AudioCaptureRingDeinit(&ring);
+
+    return failures;
+}
+
+/* One 10 ms stereo S16 period in and out again, read in pieces the size clients ask for */
+static void Bench(void)
+{
+    static uint8_t buf[BENCH_PERIOD * 4];
+    struct AudioCaptureRing ring;
+    uint32_t periods = BENCH_SECONDS * BENCH_RATE / BENCH_PERIOD;
+    uint32_t seed = 0x2468ace;
+
+    if (AudioCaptureRingInit(&ring, BENCH_SLOTS, BENCH_PERIOD, 4, BENCH_RATE) < 0) {
+        return;
+    }
+    memset(buf, 0x5a, sizeof(buf));
+
+    double start = NowMs();
+    for (uint32_t p = 0; p < periods; p++) {
+        uint8_t *slot = AudioCaptureRingWriteBegin(&ring);
+        if (slot) {
+            memcpy(slot, buf, sizeof(buf));
+            AudioCaptureRingWriteCommit(&ring, BENCH_PERIOD, FrameTime((uint64_t)p * BENCH_PERIOD));
+        }
+        while (AudioCaptureRingAvail(&ring) > 0) {
+            int64_t timeNs;
+            (void)AudioCaptureRingRead(&ring, buf, 1U + Rand(&seed) % BENCH_PERIOD, &timeNs);
+        }
+    }
+    double ms = NowMs() - start;
+
+    printf("%u periods of %u frames (%d s of 48 kHz stereo S16)\n", periods, BENCH_PERIOD, BENCH_SECONDS);
+    printf("  write + read %.3f us/period, %.0fx realtime\n", ms * 1e3 / periods, BENCH_SECONDS * 1e3 / ms);
+    AudioCaptureRingDeinit(&ring);
+}
+
+int main(void)
+{
+    uint32_t fastOverruns = 0;
+    uint32_t slowOverruns = 0;
+    int failures = 0;
+
+    printf("stream check:\n");
+    failures += CheckStream(0, &fastOverruns);
+    failures += CheckStream(2000, &slowOverruns);
+    // The slow consumer has to have lost periods, or the overrun path went untested
+    if (slowOverruns == 0) {
+        failures++;
+    }
+    failures += CheckSkip();
+    Bench();
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,663 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_converter.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONV_USE_NEON
+#define CONV_USE_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CONV_USE_SSE2
+#define CONV_USE_SIMD
+#endif
+
+#define LANES (4U)
+// Passband edge as a fraction of the lower Nyquist rate, and the Kaiser window shape (~80 dB stopband)
+#define FILTER_ROLLOFF (0.9)
+#define FILTER_KAISER_BETA (8.0)
+#define S32_MAX_F (2147483520.0f) // the largest float below 2^31
+#define PI (3.14159265358979323846)
+
+static uint32_t Gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static bool FormatValid(const struct AudioConverterFormat *format)
+{
+    bool bitsValid = format->bits == 8U || format->bits == 16U || format->bits == 24U || format->bits == 32U;
+
+    return bitsValid && format->rate > 0 && format->channels > 0 && format->channels <= AUDIO_CONVERTER_MAX_CHANNELS;
+}
+
+static inline uint32_t SampleBytes(uint32_t bits)
+{
+    // 24 bit samples come in 32 bit containers
+    return bits == 24U ? 4U : bits / 8U;
+}
+
+uint32_t AudioConverterFrameBytes(const struct AudioConverterFormat *format)
+{
+    return SampleBytes(format->bits) * format->channels;
+}
+
+static inline float FullScale(uint32_t bits)
+{
+    return (float)(1U << (bits - 1U));
+}
+
+// The largest sample value as a float, for S32 the largest float that still converts without overflow
+static inline float MaxSample(uint32_t bits)
+{
+    return bits == 32U ? S32_MAX_F : FullScale(bits) - 1.0f;
+}
+
+static inline int32_t LoadSample(const uint8_t *p, uint32_t bits)
+{
+    switch (bits) {
+        case 8U:
+            return (int8_t)p[0];
+        case 16U: {
+            int16_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        default: {
+            int32_t v;
+            memcpy(&v, p, sizeof(v));
+            // S24_LE sits in the low 24 bits of its container
+            return bits == 24U ? (int32_t)((uint32_t)v << 8) >> 8 : v;
+        }
+    }
+}
+
+static inline void StoreSample(uint8_t *p, float v, uint32_t bits)
+{
+    float hi = MaxSample(bits);
+    float lo = -FullScale(bits);
+    v *= FullScale(bits);
+    int32_t s = (int32_t)(v < lo ? lo : (v > hi ? hi : v));
+
+    switch (bits) {
+        case 8U:
+            p[0] = (uint8_t)(int8_t)s;
+            break;
+        case 16U: {
+            int16_t s16 = (int16_t)s;
+            memcpy(p, &s16, sizeof(s16));
+            break;
+        }
+        default:
+            memcpy(p, &s, sizeof(s));
+            break;
+    }
+}
+
+/* ---------------------------------------------------------------- filter design ----- */
+
+static double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        double t = x / (2.0 * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+/*
+ * One Kaiser windowed sinc of taps * interp points at the upsampled rate, cut off below
+ * the lower of the two Nyquist rates and split into interp phases. Every phase is scaled
+ * to a DC gain of 1, so no phase stands out as a tone at the phase rate.
+ */
+static int32_t DesignBank(struct AudioConverter *conv)
+{
+    uint32_t interp = conv->interp;
+    uint32_t taps = AUDIO_CONVERTER_TAPS;
+
+    if (conv->decim > interp) {
+        // A lower cutoff needs a longer filter for the same transition band
+        taps = (uint32_t)(((uint64_t)AUDIO_CONVERTER_TAPS * conv->decim + interp - 1) / interp);
+    }
+    taps = (taps + LANES - 1) / LANES * LANES;
+    if (taps > AUDIO_CONVERTER_MAX_TAPS) {
+        taps = AUDIO_CONVERTER_MAX_TAPS;
+    }
+
+    conv->taps = taps;
+    conv->bank = malloc((size_t)interp * taps * sizeof(float));
+    if (!conv->bank) {
+        return -1;
+    }
+
+    uint32_t length = taps * interp;
+    double fc = 0.5 * FILTER_ROLLOFF / (double)(interp > conv->decim ? interp : conv->decim);
+    double center = (double)(length - 1) / 2.0;
+    double i0Beta = BesselI0(FILTER_KAISER_BETA);
+
+    for (uint32_t p = 0; p < interp; p++) {
+        float *phase = conv->bank + (size_t)p * taps;
+        double sum = 0.0;
+        for (uint32_t k = 0; k < taps; k++) {
+            // Tap k weighs the input k frames before the newest, stored oldest first
+            uint32_t n = k * interp + p;
+            double t = (double)n - center;
+            double x = 2.0 * PI * fc * t;
+            double sinc = t == 0.0 ? 1.0 : sin(x) / x;
+            double r = length > 1 ? 2.0 * (double)n / (double)(length - 1) - 1.0 : 0.0;
+            double w = BesselI0(FILTER_KAISER_BETA * sqrt(1.0 - r * r)) / i0Beta;
+            double h = sinc * w;
+            phase[taps - 1 - k] = (float)h;
+            sum += h;
+        }
+        for (uint32_t k = 0; k < taps; k++) {
+            phase[k] = (float)(phase[k] / sum);
+        }
+    }
+
+    return 0;
+}
+
+/* ---------------------------------------------------------------- SIMD kernels ------ */
+
+#ifdef CONV_USE_NEON
+static inline float HorizontalSum(float32x4_t v)
+{
+    float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+static float DotMono(const float *h, const float *x, uint32_t taps)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+
+    for (uint32_t j = 0; j < taps; j += 2U * LANES) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(h + j), vld1q_f32(x + j));
+        if (j + LANES < taps) {
+            acc1 = vmlaq_f32(acc1, vld1q_f32(h + j + LANES), vld1q_f32(x + j + LANES));
+        }
+    }
+    return HorizontalSum(vaddq_f32(acc0, acc1));
+}
+
+// Interleaved stereo: each coefficient is doubled up to line up with an L/R pair
+static void DotStereo(const float *h, const float *x, uint32_t taps, float *out)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+
+    for (uint32_t j = 0; j < taps; j += LANES) {
+        float32x4x2_t hh = vzipq_f32(vld1q_f32(h + j), vld1q_f32(h + j));
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + 2U * j), hh.val[0]);
+        acc1 = vmlaq_f32(acc1, vld1q_f32(x + 2U * j + LANES), hh.val[1]);
+    }
+    float32x4_t s = vaddq_f32(acc0, acc1);
+    vst1_f32(out, vadd_f32(vget_low_f32(s), vget_high_f32(s)));
+}
+
+static inline float32x4_t LoadS16x4(const int16_t *p)
+{
+    return vcvtq_f32_s32(vmovl_s16(vld1_s16(p)));
+}
+
+static inline float32x4_t LoadS32x4(const int32_t *p, uint32_t bits)
+{
+    int32x4_t v = vld1q_s32(p);
+    if (bits == 24U) {
+        v = vshrq_n_s32(vshlq_n_s32(v, 8), 8);
+    }
+    return vcvtq_f32_s32(v);
+}
+
+static inline int32x4_t ToInt(const float *src, float scale, float lo, float hi)
+{
+    float32x4_t v = vmulq_n_f32(vld1q_f32(src), scale);
+    return vcvtq_s32_f32(vminq_f32(vmaxq_f32(v, vdupq_n_f32(lo)), vdupq_n_f32(hi)));
+}
+
+static inline void StoreS16x4(int16_t *p, int32x4_t v)
+{
+    vst1_s16(p, vqmovn_s32(v));
+}
+
+static inline void StoreS32x4(int32_t *p, int32x4_t v)
+{
+    vst1q_s32(p, v);
+}
+
+static inline void StoreF32x4(float *p, float32x4_t v, float scale)
+{
+    vst1q_f32(p, vmulq_n_f32(v, scale));
+}
+#elif defined(CONV_USE_SSE2)
+static inline float HorizontalSum(__m128 v)
+{
+    __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+static float DotMono(const float *h, const float *x, uint32_t taps)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    for (uint32_t j = 0; j < taps; j += 2U * LANES) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(h + j), _mm_loadu_ps(x + j)));
+        if (j + LANES < taps) {
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(h + j + LANES), _mm_loadu_ps(x + j + LANES)));
+        }
+    }
+    return HorizontalSum(_mm_add_ps(acc0, acc1));
+}
+
+// Interleaved stereo: each coefficient is doubled up to line up with an L/R pair
+static void DotStereo(const float *h, const float *x, uint32_t taps, float *out)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    for (uint32_t j = 0; j < taps; j += LANES) {
+        __m128 hv = _mm_loadu_ps(h + j);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + 2U * j), _mm_unpacklo_ps(hv, hv)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + 2U * j + LANES), _mm_unpackhi_ps(hv, hv)));
+    }
+    __m128 s = _mm_add_ps(acc0, acc1);
+    _mm_storel_pi((__m64 *)out, _mm_add_ps(s, _mm_movehl_ps(s, s)));
+}
+
+static inline __m128 LoadS16x4(const int16_t *p)
+{
+    __m128i v = _mm_loadl_epi64((const __m128i *)p);
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+static inline __m128 LoadS32x4(const int32_t *p, uint32_t bits)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    if (bits == 24U) {
+        v = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+    }
+    return _mm_cvtepi32_ps(v);
+}
+
+static inline __m128i ToInt(const float *src, float scale, float lo, float hi)
+{
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(scale));
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, _mm_set1_ps(lo)), _mm_set1_ps(hi)));
+}
+
+static inline void StoreS16x4(int16_t *p, __m128i v)
+{
+    _mm_storel_epi64((__m128i *)p, _mm_packs_epi32(v, v));
+}
+
+static inline void StoreS32x4(int32_t *p, __m128i v)
+{
+    _mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline void StoreF32x4(float *p, __m128 v, float scale)
+{
+    _mm_storeu_ps(p, _mm_mul_ps(v, _mm_set1_ps(scale)));
+}
+#else
+static float DotMono(const float *h, const float *x, uint32_t taps)
+{
+    float acc = 0.0f;
+
+    for (uint32_t j = 0; j < taps; j++) {
+        acc += h[j] * x[j];
+    }
+    return acc;
+}
+
+static void DotStereo(const float *h, const float *x, uint32_t taps, float *out)
+{
+    float left = 0.0f;
+    float right = 0.0f;
+
+    for (uint32_t j = 0; j < taps; j++) {
+        left += h[j] * x[2U * j];
+        right += h[j] * x[2U * j + 1U];
+    }
+    out[0] = left;
+    out[1] = right;
+}
+#endif
+
+static void DotMulti(const float *h, const float *x, uint32_t taps, uint32_t channels, float *out)
+{
+    for (uint32_t c = 0; c < channels; c++) {
+        float acc = 0.0f;
+        for (uint32_t j = 0; j < taps; j++) {
+            acc += h[j] * x[j * channels + c];
+        }
+        out[c] = acc;
+    }
+}
+
+/* ---------------------------------------------------------------- decode / encode --- */
+
+// Same channels on both sides: a straight run of samples
+static void DecodeSamples(const uint8_t *src, uint32_t samples, uint32_t bits, float *dst)
+{
+    float scale = 1.0f / FullScale(bits);
+    uint32_t i = 0;
+
+#ifdef CONV_USE_SIMD
+    if (bits == 16U) {
+        for (; i + LANES <= samples; i += LANES) {
+            StoreF32x4(dst + i, LoadS16x4((const int16_t *)src + i), scale);
+        }
+    } else if (bits != 8U) {
+        for (; i + LANES <= samples; i += LANES) {
+            StoreF32x4(dst + i, LoadS32x4((const int32_t *)src + i, bits), scale);
+        }
+    }
+#endif
+
+    uint32_t sampleBytes = SampleBytes(bits);
+    for (; i < samples; i++) {
+        dst[i] = (float)LoadSample(src + (size_t)i * sampleBytes, bits) * scale;
+    }
+}
+
+static void EncodeSamples(const float *src, uint32_t samples, uint32_t bits, uint8_t *dst)
+{
+    uint32_t i = 0;
+
+#ifdef CONV_USE_SIMD
+    float scale = FullScale(bits);
+    float lo = -scale;
+    float hi = MaxSample(bits);
+    if (bits == 16U) {
+        for (; i + LANES <= samples; i += LANES) {
+            StoreS16x4((int16_t *)dst + i, ToInt(src + i, scale, lo, hi));
+        }
+    } else if (bits != 8U) {
+        for (; i + LANES <= samples; i += LANES) {
+            StoreS32x4((int32_t *)dst + i, ToInt(src + i, scale, lo, hi));
+        }
+    }
+#endif
+
+    uint32_t sampleBytes = SampleBytes(bits);
+    for (; i < samples; i++) {
+        StoreSample(dst + (size_t)i * sampleBytes, src[i], bits);
+    }
+}
+
+static void Decode(const struct AudioConverter *conv, const uint8_t *src, uint32_t frames, float *dst)
+{
+    const struct AudioConverterFormat *in = &conv->in;
+    uint32_t channels = conv->channels;
+
+    if (in->channels == channels) {
+        DecodeSamples(src, frames * channels, in->bits, dst);
+        return;
+    }
+
+    // Downmix
+    uint32_t sampleBytes = SampleBytes(in->bits);
+    uint32_t frameBytes = sampleBytes * in->channels;
+    float scale = 1.0f / FullScale(in->bits);
+    for (uint32_t i = 0; i < frames; i++, src += frameBytes, dst += channels) {
+        if (channels == 1U) {
+            float sum = 0.0f;
+            for (uint32_t c = 0; c < in->channels; c++) {
+                sum += (float)LoadSample(src + c * sampleBytes, in->bits);
+            }
+            dst[0] = sum * scale / (float)in->channels;
+            continue;
+        }
+        for (uint32_t c = 0; c < channels; c++) {
+            dst[c] = (float)LoadSample(src + c * sampleBytes, in->bits) * scale;
+        }
+    }
+}
+
+static void Encode(const struct AudioConverter *conv, const float *src, uint32_t frames, uint8_t *dst)
+{
+    const struct AudioConverterFormat *out = &conv->out;
+    uint32_t channels = conv->channels;
+
+    if (out->channels == channels) {
+        EncodeSamples(src, frames * channels, out->bits, dst);
+        return;
+    }
+
+    // Upmix
+    uint32_t sampleBytes = SampleBytes(out->bits);
+    for (uint32_t i = 0; i < frames; i++, src += channels) {
+        for (uint32_t c = 0; c < out->channels; c++, dst += sampleBytes) {
+            float v = channels == 1U ? src[0] : (c < channels ? src[c] : 0.0f);
+            StoreSample(dst, v, out->bits);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------- resampling -------- */
+
+// Filters up to maxFrames frames the history completes into work, returns how many
+static uint32_t Filter(struct AudioConverter *conv, uint32_t maxFrames)
+{
+    uint32_t channels = conv->channels;
+    uint32_t taps = conv->taps;
+    uint32_t n = 0;
+
+    if (maxFrames > conv->workCap) {
+        maxFrames = conv->workCap;
+    }
+
+    for (; n < maxFrames && conv->pos < conv->histFrames; n++) {
+        const float *h = conv->bank + (size_t)conv->phase * taps;
+        const float *x = conv->hist + (size_t)(conv->pos + 1U - taps) * channels;
+        float *y = conv->work + (size_t)n * channels;
+        if (channels == 1U) {
+            y[0] = DotMono(h, x, taps);
+        } else if (channels == 2U) {
+            DotStereo(h, x, taps, y);
+        } else {
+            DotMulti(h, x, taps, channels, y);
+        }
+        conv->phase += conv->decim;
+        conv->pos += conv->phase / conv->interp;
+        conv->phase %= conv->interp;
+    }
+
+    return n;
+}
+
+// Drops the history no later output reaches back to
+static void Compact(struct AudioConverter *conv)
+{
+    uint32_t drop = conv->pos + 1U - conv->taps;
+
+    if (drop > conv->histFrames) {
+        drop = conv->histFrames;
+    }
+    if (drop == 0) {
+        return;
+    }
+
+    uint32_t channels = conv->channels;
+    memmove(conv->hist, conv->hist + (size_t)drop * channels,
+            (size_t)(conv->histFrames - drop) * channels * sizeof(float));
+    conv->histFrames -= drop;
+    conv->pos -= drop;
+}
+
+void AudioConverterReset(struct AudioConverter *conv)
+{
+    if (!conv->hist) {
+        return;
+    }
+
+    // Starts on taps - 1 frames of silence, the first output already has the first input frame
+    memset(conv->hist, 0, (size_t)conv->histCap * conv->channels * sizeof(float));
+    conv->histFrames = conv->taps - 1U;
+    conv->pos = conv->taps - 1U;
+    conv->phase = 0;
+}
+
+int32_t AudioConverterInit(struct AudioConverter *conv, const struct AudioConverterFormat *in,
+                           const struct AudioConverterFormat *out)
+{
+    memset(conv, 0, sizeof(*conv));
+    if (!FormatValid(in) || !FormatValid(out)) {
+        return -1;
+    }
+
+    conv->in = *in;
+    conv->out = *out;
+    if (in->rate == out->rate && in->channels == out->channels && in->bits == out->bits) {
+        conv->passthrough = true;
+        return 0;
+    }
+
+    uint32_t g = Gcd(in->rate, out->rate);
+    conv->interp = out->rate / g;
+    conv->decim = in->rate / g;
+    if (conv->interp > AUDIO_CONVERTER_MAX_PHASES) {
+        return -1;
+    }
+
+    conv->channels = in->channels < out->channels ? in->channels : out->channels;
+    conv->workCap = AUDIO_CONVERTER_BLOCK;
+    conv->work = malloc((size_t)conv->workCap * conv->channels * sizeof(float));
+    if (!conv->work) {
+        return -1;
+    }
+    if (conv->interp == conv->decim) {
+        return 0;
+    }
+
+    if (DesignBank(conv) < 0) {
+        AudioConverterDeinit(conv);
+        return -1;
+    }
+    conv->histCap = conv->taps + AUDIO_CONVERTER_BLOCK;
+    conv->hist = malloc((size_t)conv->histCap * conv->channels * sizeof(float));
+    if (!conv->hist) {
+        AudioConverterDeinit(conv);
+        return -1;
+    }
+    AudioConverterReset(conv);
+
+    return 0;
+}
+
+void AudioConverterDeinit(struct AudioConverter *conv)
+{
+    free(conv->bank);
+    free(conv->hist);
+    free(conv->work);
+    memset(conv, 0, sizeof(*conv));
+}
+
+uint32_t AudioConverterOutFrames(const struct AudioConverter *conv, uint32_t inFrames)
+{
+    if (!conv->hist) {
+        return inFrames;
+    }
+
+    uint64_t total = (uint64_t)conv->histFrames + inFrames;
+    if (conv->pos >= total) {
+        return 0;
+    }
+
+    // Output n needs input frame pos + (phase + n * decim) / interp
+    uint64_t span = (total - conv->pos) * conv->interp - conv->phase;
+    return (uint32_t)((span + conv->decim - 1U) / conv->decim);
+}
+
+uint32_t AudioConverterInFrames(const struct AudioConverter *conv, uint32_t outFrames)
+{
+    if (!conv->hist) {
+        return outFrames;
+    }
+    if (outFrames == 0) {
+        return 0;
+    }
+
+    uint64_t newest = conv->pos + (conv->phase + (uint64_t)(outFrames - 1U) * conv->decim) / conv->interp;
+    return newest < conv->histFrames ? 0 : (uint32_t)(newest + 1U - conv->histFrames);
+}
+
+uint32_t AudioConverterProcess(struct AudioConverter *conv, const void *in, uint32_t inFrames, void *out,
+                               uint32_t outFrames)
+{
+    const uint8_t *src = (const uint8_t *)in;
+    uint8_t *dst = (uint8_t *)out;
+    uint32_t inBytes = AudioConverterFrameBytes(&conv->in);
+    uint32_t outBytes = AudioConverterFrameBytes(&conv->out);
+
+    if (conv->passthrough || !conv->hist) {
+        uint32_t frames = inFrames < outFrames ? inFrames : outFrames;
+        if (conv->passthrough) {
+            memcpy(dst, src, (size_t)frames * inBytes);
+            return frames;
+        }
+        // Same rate, only the format or the channels change
+        for (uint32_t done = 0; done < frames;) {
+            uint32_t chunk = frames - done < conv->workCap ? frames - done : conv->workCap;
+            Decode(conv, src + (size_t)done * inBytes, chunk, conv->work);
+            Encode(conv, conv->work, chunk, dst + (size_t)done * outBytes);
+            done += chunk;
+        }
+        return frames;
+    }
+
+    uint32_t produced = 0;
+    for (;;) {
+        // Whatever the history completes goes out before more input comes in
+        while (produced < outFrames && conv->pos < conv->histFrames) {
+            uint32_t n = Filter(conv, outFrames - produced);
+            Encode(conv, conv->work, n, dst + (size_t)produced * outBytes);
+            produced += n;
+        }
+        if (inFrames == 0) {
+            break;
+        }
+
+        Compact(conv);
+        uint32_t room = conv->histCap - conv->histFrames;
+        if (room == 0) {
+            break;
+        }
+        uint32_t chunk = inFrames < room ? inFrames : room;
+        Decode(conv, src, chunk, conv->hist + (size_t)conv->histFrames * conv->channels);
+        conv->histFrames += chunk;
+        src += (size_t)chunk * inBytes;
+        inFrames -= chunk;
+    }
+
+    return produced;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_CONVERTER_H
+#define AUDIO_CONVERTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_CONVERTER_MAX_CHANNELS (8)
+// Taps of every phase when upsampling, downsampling lengthens them by the ratio
+#define AUDIO_CONVERTER_TAPS (32)
+#define AUDIO_CONVERTER_MAX_PHASES (1024)
+#define AUDIO_CONVERTER_MAX_TAPS (512)
+// Input frames decoded into the history at a time
+#define AUDIO_CONVERTER_BLOCK (256)
+
+struct AudioConverterFormat {
+    uint32_t rate;
+    uint32_t channels;
+    uint32_t bits; // 8, 16, 24 (in 32 bit containers) or 32
+};
+
+/*
+ * Converts interleaved PCM between rates, channel counts and sample formats.
+ *
+ * Samples are decoded to float and mixed to the fewer of the two channel counts first:
+ * down to mono averages every channel, any other downmix keeps the first channels.
+ * The rate is then changed by a polyphase FIR, interp / decim being the reduced ratio of
+ * the two rates; its bank holds one windowed sinc split into interp phases, computed
+ * once at init. Mono upmixes to every output channel, other upmixes leave the new
+ * channels silent. Samples are truncated toward zero and saturated on the way out.
+ *
+ * Nothing here locks, the owner serializes every call.
+ */
+struct AudioConverter {
+    struct AudioConverterFormat in;
+    struct AudioConverterFormat out;
+    bool passthrough; // same format both sides, the data is copied as it is
+    uint32_t channels; // what the filter runs on, the fewer of in and out
+
+    uint32_t interp;
+    uint32_t decim;
+    uint32_t taps;     // per phase, a multiple of 4
+    float *bank;       // interp phases of taps coefficients, each in history order
+
+    // Interleaved float input; the frames before pos are only kept as filter memory
+    float *hist;
+    uint32_t histCap;
+    uint32_t histFrames;
+    uint32_t pos;   // newest input frame of the next output
+    uint32_t phase; // of the next output, in 1 / interp input frames past pos
+
+    float *work; // filtered frames waiting to be encoded
+    uint32_t workCap;
+};
+
+/* On failure nothing is left allocated. Unsupported: more than AUDIO_CONVERTER_MAX_PHASES */
+int32_t AudioConverterInit(struct AudioConverter *conv, const struct AudioConverterFormat *in,
+                           const struct AudioConverterFormat *out);
+void AudioConverterDeinit(struct AudioConverter *conv);
+
+/* Forgets the filter memory and anything pending, as at init */
+void AudioConverterReset(struct AudioConverter *conv);
+
+uint32_t AudioConverterFrameBytes(const struct AudioConverterFormat *format);
+
+/* Frames 'inFrames' more input frames complete, counting those pending already */
+uint32_t AudioConverterOutFrames(const struct AudioConverter *conv, uint32_t inFrames);
+
+/* Input frames still needed to complete 'outFrames' output frames */
+uint32_t AudioConverterInFrames(const struct AudioConverter *conv, uint32_t outFrames);
+
+/*
+ * Takes all of 'in' and writes up to 'outFrames' frames to 'out', returns how many.
+ * Either 'outFrames' is at least AudioConverterOutFrames() of 'inFrames' (push), or
+ * 'inFrames' is at most AudioConverterInFrames() of 'outFrames' (pull); the history
+ * has no room for more and drops what does not fit.
+ */
+uint32_t AudioConverterProcess(struct AudioConverter *conv, const void *in, uint32_t inFrames, void *out,
+                               uint32_t outFrames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_CONVERTER_H */
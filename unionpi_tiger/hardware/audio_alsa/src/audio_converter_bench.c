@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_converter.h"
+
+#define HW_RATE (48000)
+#define BENCH_SECONDS (60)
+#define BENCH_BLOCK_MS (10)
+#define CHECK_FRAMES (1000)
+#define TONE_HZ (1000.0)
+#define TONE_AMPLITUDE (0.5)
+#define TONE_SECONDS (1)
+#define MIN_SNR_DB (70.0)
+#define PI (3.14159265358979323846)
+
+static uint32_t g_seed = 0x12345678;
+
+static uint32_t Rand(void)
+{
+    g_seed = g_seed * 1664525U + 1013904223U;
+    return g_seed;
+}
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *Alloc(const struct AudioConverterFormat *format, uint32_t frames)
+{
+    return calloc((size_t)frames + 1U, AudioConverterFrameBytes(format));
+}
+
+static int64_t Sample(const void *data, uint32_t i, uint32_t bits)
+{
+    switch (bits) {
+        case 8U:
+            return ((const int8_t *)data)[i];
+        case 16U:
+            return ((const int16_t *)data)[i];
+        case 24U:
+            return (int32_t)((uint32_t)((const int32_t *)data)[i] << 8) >> 8;
+        default:
+            return ((const int32_t *)data)[i];
+    }
+}
+
+static void SetSample(void *data, uint32_t i, uint32_t bits, double v)
+{
+    double full = (double)(1ULL << (bits - 1U));
+    int64_t s = (int64_t)(v * full);
+    switch (bits) {
+        case 8U:
+            ((int8_t *)data)[i] = (int8_t)s;
+            break;
+        case 16U:
+            ((int16_t *)data)[i] = (int16_t)s;
+            break;
+        default:
+            ((int32_t *)data)[i] = (int32_t)s;
+            break;
+    }
+}
+
+/*
+ * Same rate: formats and channel maps against the plain definition. S32 keeps only the
+ * 24 bits a float holds, so it may land one step off after narrowing.
+ */
+static int CheckMap(uint32_t inBits, uint32_t inChannels, uint32_t outBits, uint32_t outChannels)
+{
+    struct AudioConverterFormat in = {HW_RATE, inChannels, inBits};
+    struct AudioConverterFormat out = {HW_RATE, outChannels, outBits};
+    struct AudioConverter conv;
+    uint8_t *src = Alloc(&in, CHECK_FRAMES);
+    uint8_t *dst = Alloc(&out, CHECK_FRAMES);
+    int failures = 0;
+
+    if (!src || !dst || AudioConverterInit(&conv, &in, &out) < 0) {
+        free(src);
+        free(dst);
+        return 1;
+    }
+    for (uint32_t i = 0; i < CHECK_FRAMES * inChannels; i++) {
+        SetSample(src, i, inBits, ((double)(int32_t)Rand()) / 2147483648.0);
+    }
+
+    // Odd sizes so the vector loops leave a tail
+    uint32_t first = 333;
+    AudioConverterProcess(&conv, src, first, dst, first);
+    AudioConverterProcess(&conv, src + first * AudioConverterFrameBytes(&in), CHECK_FRAMES - first,
+                          dst + first * AudioConverterFrameBytes(&out), CHECK_FRAMES - first);
+
+    double inFull = (double)(1ULL << (inBits - 1U));
+    double outFull = (double)(1ULL << (outBits - 1U));
+    int64_t tolerance = inBits == 32U && outBits == 32U ? 128 : (inBits > outBits || inBits == 32U ? 1 : 0);
+    for (uint32_t f = 0; f < CHECK_FRAMES; f++) {
+        for (uint32_t c = 0; c < outChannels; c++) {
+            double v = 0.0;
+            if (outChannels < inChannels && outChannels == 1U) {
+                for (uint32_t k = 0; k < inChannels; k++) {
+                    v += (double)Sample(src, f * inChannels + k, inBits);
+                }
+                v /= inChannels;
+            } else if (inChannels == 1U || c < inChannels) {
+                v = (double)Sample(src, f * inChannels + (inChannels == 1U ? 0 : c), inBits);
+            }
+            int64_t want = (int64_t)(v / inFull * outFull);
+            int64_t got = Sample(dst, f * outChannels + c, outBits);
+            if (got - want > tolerance || want - got > tolerance) {
+                if (failures++ == 0) {
+                    printf("  S%u x%u -> S%u x%u frame %u: got %lld want %lld\n", inBits, inChannels, outBits,
+                           outChannels, f, (long long)got, (long long)want);
+                }
+            }
+        }
+    }
+
+    AudioConverterDeinit(&conv);
+    free(src);
+    free(dst);
+    return failures;
+}
+
+static int CheckMaps(void)
+{
+    const uint32_t bits[] = {8U, 16U, 24U, 32U};
+    const uint32_t channels[][2] = {{2U, 2U}, {1U, 2U}, {2U, 1U}, {6U, 2U}, {2U, 6U}};
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); i++) {
+        for (size_t o = 0; o < sizeof(bits) / sizeof(bits[0]); o++) {
+            for (size_t c = 0; c < sizeof(channels) / sizeof(channels[0]); c++) {
+                failures += CheckMap(bits[i], channels[c][0], bits[o], channels[c][1]);
+            }
+        }
+    }
+
+    printf("format and channel check: %d failures\n", failures);
+    return failures;
+}
+
+/*
+ * A 1 kHz tone through the resampler against the ideal tone at the output rate, delayed
+ * by the filter's half length. Pushing in random blocks and pulling random blocks has to
+ * give exactly what one call over the whole tone does.
+ */
+static int CheckRate(uint32_t inRate, uint32_t outRate)
+{
+    struct AudioConverterFormat in = {inRate, 2U, 32U};
+    struct AudioConverterFormat out = {outRate, 2U, 32U};
+    struct AudioConverter conv;
+    uint32_t inFrames = inRate * TONE_SECONDS;
+    uint32_t outCap = (uint32_t)((uint64_t)inFrames * outRate / inRate) + 2U;
+    int32_t *src = Alloc(&in, inFrames);
+    int32_t *whole = Alloc(&out, outCap);
+    int32_t *pushed = Alloc(&out, outCap);
+    int32_t *pulled = Alloc(&out, outCap);
+    int failures = 0;
+
+    if (!src || !whole || !pushed || !pulled || AudioConverterInit(&conv, &in, &out) < 0) {
+        printf("  %u -> %u: init failed\n", inRate, outRate);
+        free(src);
+        free(whole);
+        free(pushed);
+        free(pulled);
+        return 1;
+    }
+    for (uint32_t i = 0; i < inFrames; i++) {
+        double v = TONE_AMPLITUDE * sin(2.0 * PI * TONE_HZ * i / inRate);
+        SetSample(src, i * 2U, 32U, v);
+        SetSample(src, i * 2U + 1U, 32U, -v);
+    }
+
+    uint32_t total = AudioConverterOutFrames(&conv, inFrames);
+    uint32_t got = AudioConverterProcess(&conv, src, inFrames, whole, total);
+    failures += got != total;
+
+    // Push: whatever the input completes
+    AudioConverterReset(&conv);
+    uint32_t pushedFrames = 0;
+    for (uint32_t done = 0; done < inFrames;) {
+        uint32_t n = Rand() % 700U + 1U;
+        n = n > inFrames - done ? inFrames - done : n;
+        uint32_t want = AudioConverterOutFrames(&conv, n);
+        pushedFrames += AudioConverterProcess(&conv, src + done * 2U, n, pushed + pushedFrames * 2U, want);
+        done += n;
+    }
+
+    // Pull: exactly what is asked for
+    AudioConverterReset(&conv);
+    uint32_t pulledFrames = 0;
+    uint32_t consumed = 0;
+    while (pulledFrames < total) {
+        uint32_t n = Rand() % 700U + 1U;
+        n = n > total - pulledFrames ? total - pulledFrames : n;
+        uint32_t need = AudioConverterInFrames(&conv, n);
+        uint32_t out = AudioConverterProcess(&conv, src + consumed * 2U, need, pulled + pulledFrames * 2U, n);
+        failures += out != n;
+        consumed += need;
+        pulledFrames += n;
+    }
+    failures += pushedFrames != total || consumed > inFrames;
+    failures += memcmp(whole, pushed, (size_t)total * 8U) != 0;
+    failures += memcmp(whole, pulled, (size_t)total * 8U) != 0;
+
+    // Output n stands for input time (n * decim - center) / interp, center being the filter's middle
+    double center = ((double)conv.taps * conv.interp - 1.0) / 2.0;
+    double signal = 0.0;
+    double noise = 0.0;
+    uint32_t settle = conv.taps * conv.interp / conv.decim + 1U; // until the silence the history starts on is out
+    for (uint32_t n = settle; n < total; n++) {
+        double t = ((double)n * conv.decim - center) / conv.interp / inRate;
+        double want = TONE_AMPLITUDE * sin(2.0 * PI * TONE_HZ * t);
+        double l = (double)whole[n * 2U] / 2147483648.0;
+        double r = (double)whole[n * 2U + 1U] / 2147483648.0;
+        signal += 2.0 * want * want;
+        noise += (l - want) * (l - want) + (r + want) * (r + want);
+    }
+    double snr = 10.0 * log10(signal / noise);
+    if (snr < MIN_SNR_DB) {
+        failures++;
+    }
+    printf("  %6u -> %6u: %2u phases x %3u taps, %u frames, SNR %.1f dB%s\n", inRate, outRate, conv.interp,
+           conv.taps, total, snr, failures ? "  FAIL" : "");
+
+    AudioConverterDeinit(&conv);
+    free(src);
+    free(whole);
+    free(pushed);
+    free(pulled);
+    return failures;
+}
+
+static int CheckRates(void)
+{
+    const uint32_t rates[] = {8000U, 11025U, 16000U, 22050U, 32000U, 44100U, 64000U, 88200U, 96000U};
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        failures += CheckRate(rates[i], HW_RATE);
+        failures += CheckRate(HW_RATE, rates[i]);
+    }
+
+    printf("resampler check: %d failures\n", failures);
+    return failures;
+}
+
+struct BenchPair {
+    const char *use;
+    struct AudioConverterFormat in;
+    struct AudioConverterFormat out;
+};
+
+// One stream's conversion, fed BENCH_BLOCK_MS of input at a time as the HAL does
+static void Bench(const struct BenchPair *pair)
+{
+    struct AudioConverter conv;
+    uint32_t block = pair->in.rate * BENCH_BLOCK_MS / 1000U;
+    uint32_t outBlock = (uint32_t)((uint64_t)block * pair->out.rate / pair->in.rate) + 2U;
+    uint8_t *src = Alloc(&pair->in, block);
+    uint8_t *dst = Alloc(&pair->out, outBlock);
+
+    if (!src || !dst || AudioConverterInit(&conv, &pair->in, &pair->out) < 0) {
+        free(src);
+        free(dst);
+        return;
+    }
+    for (uint32_t i = 0; i < block * pair->in.channels; i++) {
+        SetSample(src, i, pair->in.bits, ((double)(int32_t)Rand()) / 4294967296.0);
+    }
+
+    uint32_t blocks = BENCH_SECONDS * 1000U / BENCH_BLOCK_MS;
+    double begin = NowMs();
+    for (uint32_t b = 0; b < blocks; b++) {
+        AudioConverterProcess(&conv, src, block, dst, AudioConverterOutFrames(&conv, block));
+    }
+    double ms = NowMs() - begin;
+
+    printf("  %-7s %6u S%-2u x%u -> %6u S%-2u x%u: %6.3f%% of a core, %.2f us per block\n", pair->use,
+           pair->in.rate, pair->in.bits, pair->in.channels, pair->out.rate, pair->out.bits, pair->out.channels,
+           ms * 100.0 / (BENCH_SECONDS * 1e3), ms * 1e3 / blocks);
+
+    AudioConverterDeinit(&conv);
+    free(src);
+    free(dst);
+}
+
+int main(void)
+{
+    // What the HAL runs: render streams into the S16 stereo mixer or the S32 mmap DMA, capture out of S32 stereo
+    const struct BenchPair pairs[] = {
+        {"render", {48000U, 2U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {48000U, 1U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {48000U, 2U, 24U}, {HW_RATE, 2U, 16U}},
+        {"render", {44100U, 2U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {32000U, 2U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {22050U, 2U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {16000U, 1U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {11025U, 2U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {8000U, 1U, 16U}, {HW_RATE, 2U, 16U}},
+        {"render", {96000U, 2U, 32U}, {HW_RATE, 2U, 16U}},
+        {"mmap", {48000U, 2U, 16U}, {HW_RATE, 2U, 32U}},
+        {"mmap", {44100U, 2U, 16U}, {HW_RATE, 2U, 32U}},
+        {"capture", {HW_RATE, 2U, 32U}, {48000U, 2U, 16U}},
+        {"capture", {HW_RATE, 2U, 32U}, {44100U, 2U, 16U}},
+        {"capture", {HW_RATE, 2U, 32U}, {16000U, 1U, 16U}},
+        {"capture", {HW_RATE, 2U, 32U}, {8000U, 1U, 16U}},
+        {"capture", {HW_RATE, 2U, 32U}, {96000U, 2U, 24U}},
+    };
+    int failures = CheckMaps() + CheckRates();
+
+    printf("%d s per stream in %d ms blocks\n", BENCH_SECONDS, BENCH_BLOCK_MS);
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        Bench(&pairs[i]);
+    }
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
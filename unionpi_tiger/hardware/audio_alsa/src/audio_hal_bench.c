@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "audio_interface_lib_capture.h"
+#include "audio_interface_lib_render.h"
+#include "audio_pcm_sim.h"
+
+/*
+ * Runs the render and capture HALs against the simulated pcm, so their latency, CPU cost and
+ * xruns can be measured without the sound card:
+ *
+ *     audio_hal_bench [seconds per case] [period jitter in us] [busy processes for load]
+ *
+ * Every case runs once on an idle system and once with the busy processes spinning.
+ */
+
+#define BENCH_SECONDS (5)
+#define BENCH_JITTER_US (1000)
+#define BENCH_PERIOD_MS (10)
+#define BENCH_PERIOD_COUNT (4)
+#define BENCH_MAX_RENDERS (8)
+#define BENCH_MAX_LOAD (64)
+#define BENCH_MMAP_TRANSFER_FRAMES (240)
+#define BENCH_MMAP_RING_FRAMES (4800)
+#define BENCH_POLL_US (5000)
+#define BENCH_MIN_THROUGHPUT (0.9)
+#define BENCH_HW_RATE (48000)
+#define MS_PER_SEC (1000)
+#define NSEC_PER_USEC (1000.0)
+#define NSEC_PER_SEC (1000000000LL)
+
+struct BenchFormat {
+    uint32_t rate;
+    uint32_t channels;
+    enum AudioFormat format;
+    uint32_t bytes; // per sample
+};
+
+// What render clients play, the first ones are the common case
+static const struct BenchFormat g_renderFormats[BENCH_MAX_RENDERS] = {
+    {48000, 2, AUDIO_FORMAT_PCM_16_BIT, 2}, {44100, 2, AUDIO_FORMAT_PCM_16_BIT, 2},
+    {16000, 1, AUDIO_FORMAT_PCM_16_BIT, 2}, {48000, 2, AUDIO_FORMAT_PCM_32_BIT, 4},
+    {22050, 2, AUDIO_FORMAT_PCM_16_BIT, 2}, {48000, 1, AUDIO_FORMAT_PCM_16_BIT, 2},
+    {32000, 2, AUDIO_FORMAT_PCM_16_BIT, 2}, {8000, 1, AUDIO_FORMAT_PCM_16_BIT, 2},
+};
+static const struct BenchFormat g_captureFormat = {16000, 1, AUDIO_FORMAT_PCM_16_BIT, 2};
+
+struct BenchCase {
+    const char *name;
+    uint32_t renders;
+    bool mmap;
+    bool capture;
+};
+
+static const struct BenchCase g_cases[] = {
+    {"render x1", 1, false, false},
+    {"render x8", BENCH_MAX_RENDERS, false, false},
+    {"render mmap", 0, true, false},
+    {"capture", 0, false, true},
+    {"render x4 + capture", 4, false, true},
+};
+
+// Durations of one kind of call, in ns
+struct CallStats {
+    double *ns;
+    uint32_t count;
+    uint32_t room;
+    uint32_t failures;
+};
+
+struct Client {
+    pthread_t thread;
+    struct BenchFormat format;
+    atomic_bool *stop;
+    struct CallStats calls;
+    struct CallStats age; // capture only, how old the newest frame of a read is
+};
+
+static int64_t NowNs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int CallStatsInit(struct CallStats *stats, uint32_t room)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->ns = malloc(room * sizeof(*stats->ns));
+    stats->room = stats->ns ? room : 0;
+
+    return stats->ns ? 0 : -1;
+}
+
+static void CallStatsAdd(struct CallStats *stats, double ns)
+{
+    if (stats->count < stats->room) {
+        stats->ns[stats->count++] = ns;
+    }
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Merges 'from' into 'into' and frees it
+static void CallStatsMerge(struct CallStats *into, struct CallStats *from)
+{
+    for (uint32_t i = 0; i < from->count; i++) {
+        CallStatsAdd(into, from->ns[i]);
+    }
+    into->failures += from->failures;
+    free(from->ns);
+    from->ns = NULL;
+}
+
+static void CallStatsPrint(const char *what, struct CallStats *stats)
+{
+    double sum = 0;
+
+    if (stats->count == 0) {
+        printf("  %-8s no calls, %u failed\n", what, stats->failures);
+        return;
+    }
+
+    qsort(stats->ns, stats->count, sizeof(*stats->ns), CompareDouble);
+    for (uint32_t i = 0; i < stats->count; i++) {
+        sum += stats->ns[i];
+    }
+    printf("  %-8s %6u calls, avg %8.1f us, p50 %8.1f us, p99 %8.1f us, max %8.1f us, %u failed\n", what,
+           stats->count, sum / stats->count / NSEC_PER_USEC, stats->ns[stats->count / 2] / NSEC_PER_USEC,
+           stats->ns[(uint64_t)stats->count * 99 / 100] / NSEC_PER_USEC,
+           stats->ns[stats->count - 1] / NSEC_PER_USEC, stats->failures);
+}
+
+static void SetAttrs(struct AudioFrameMode *mode, const struct BenchFormat *format, uint32_t periodFrames)
+{
+    mode->attrs.format = format->format;
+    mode->attrs.channelCount = format->channels;
+    mode->attrs.sampleRate = format->rate;
+    mode->periodSize = periodFrames;
+    mode->periodCount = BENCH_PERIOD_COUNT;
+}
+
+/* Writes a period at a time for as long as the case runs, the HAL paces it */
+static void *RenderClient(void *arg)
+{
+    struct Client *client = (struct Client *)arg;
+    struct AudioHwRenderParam param;
+    uint32_t frames = client->format.rate * BENCH_PERIOD_MS / MS_PER_SEC;
+    uint32_t bytes = frames * client->format.channels * client->format.bytes;
+    char *buf = calloc(1, bytes);
+    struct DevHandle *handle = AudioBindServiceRender("render");
+
+    if (!handle || !buf) {
+        client->calls.failures++;
+        free(buf);
+        return NULL;
+    }
+
+    memset(&param, 0, sizeof(param));
+    SetAttrs(&param.frameRenderMode, &client->format, frames);
+    int32_t ret = AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTL_HW_PARAMS);
+    ret |= AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTL_PREPARE);
+    ret |= AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTRL_START);
+    if (ret != 0) {
+        client->calls.failures++;
+    }
+
+    param.frameRenderMode.buffer = buf;
+    while (ret == 0 && !atomic_load(client->stop)) {
+        param.frameRenderMode.bufferSize = bytes;
+        int64_t start = NowNs(CLOCK_MONOTONIC);
+        if (AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTL_WRITE) != 0) {
+            client->calls.failures++;
+        }
+        CallStatsAdd(&client->calls, (double)(NowNs(CLOCK_MONOTONIC) - start));
+    }
+
+    (void)AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTRL_STOP);
+    (void)AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTRL_RENDER_CLOSE);
+    AudioCloseServiceRender(handle);
+    free(buf);
+
+    return NULL;
+}
+
+/*
+ * The framework fills the shared ring on its own in mmap mode, the HAL is only asked where
+ * the DMA is. The position has to keep up with the time that passed.
+ */
+static void *MmapClient(void *arg)
+{
+    struct Client *client = (struct Client *)arg;
+    struct AudioHwRenderParam param;
+    uint32_t frameBytes = client->format.channels * client->format.bytes;
+    char *ring = calloc(BENCH_MMAP_RING_FRAMES, frameBytes);
+    struct DevHandle *handle = AudioBindServiceRender("render");
+
+    if (!handle || !ring) {
+        client->calls.failures++;
+        free(ring);
+        return NULL;
+    }
+
+    memset(&param, 0, sizeof(param));
+    SetAttrs(&param.frameRenderMode, &client->format, BENCH_MMAP_TRANSFER_FRAMES);
+    param.frameRenderMode.mmapBufDesc.memoryAddress = ring;
+    param.frameRenderMode.mmapBufDesc.totalBufferFrames = BENCH_MMAP_RING_FRAMES;
+    param.frameRenderMode.mmapBufDesc.transferFrameSize = BENCH_MMAP_TRANSFER_FRAMES;
+    int32_t ret = AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTL_HW_PARAMS);
+    ret |= AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTL_MMAP_BUFFER);
+    ret |= AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTRL_START);
+    if (ret != 0) {
+        client->calls.failures++;
+    }
+
+    int64_t begin = NowNs(CLOCK_MONOTONIC);
+    uint64_t played = 0;
+    while (ret == 0 && !atomic_load(client->stop)) {
+        usleep(BENCH_POLL_US);
+        int64_t start = NowNs(CLOCK_MONOTONIC);
+        if (AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTL_MMAP_POSITION) != 0) {
+            client->calls.failures++;
+        }
+        CallStatsAdd(&client->calls, (double)(NowNs(CLOCK_MONOTONIC) - start));
+        played = param.frameRenderMode.frames;
+    }
+    double seconds = (double)(NowNs(CLOCK_MONOTONIC) - begin) / NSEC_PER_SEC;
+    printf("  mmap position %.2f s after %.2f s\n", (double)played / client->format.rate, seconds);
+
+    (void)AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTRL_STOP);
+    (void)AudioInterfaceLibModeRender(handle, &param, AUDIO_DRV_PCM_IOCTRL_RENDER_CLOSE);
+    AudioCloseServiceRender(handle);
+    free(ring);
+
+    return NULL;
+}
+
+/* Reads a period at a time; the age is how long ago the newest frame read was captured */
+static void *CaptureClient(void *arg)
+{
+    struct Client *client = (struct Client *)arg;
+    struct AudioHwCaptureParam param;
+    uint32_t frames = client->format.rate * BENCH_PERIOD_MS / MS_PER_SEC;
+    uint32_t bytes = frames * client->format.channels * client->format.bytes;
+    char *buf = calloc(1, bytes);
+    struct DevHandleCapture *handle = AudioBindServiceCapture("capture");
+
+    if (!handle || !buf) {
+        client->calls.failures++;
+        free(buf);
+        return NULL;
+    }
+
+    memset(&param, 0, sizeof(param));
+    SetAttrs(&param.frameCaptureMode, &client->format, frames);
+    int32_t ret = AudioInterfaceLibModeCapture(handle, &param, AUDIO_DRV_PCM_IOCTL_HW_PARAMS);
+    ret |= AudioInterfaceLibModeCapture(handle, &param, AUDIO_DRV_PCM_IOCTL_PREPARE_CAPTURE);
+    ret |= AudioInterfaceLibModeCapture(handle, &param, AUDIO_DRV_PCM_IOCTRL_START_CAPTURE);
+    if (ret != 0) {
+        client->calls.failures++;
+    }
+
+    param.frameCaptureMode.buffer = buf;
+    while (ret == 0 && !atomic_load(client->stop)) {
+        param.frameCaptureMode.bufferSize = bytes;
+        int64_t start = NowNs(CLOCK_MONOTONIC);
+        if (AudioInterfaceLibModeCapture(handle, &param, AUDIO_DRV_PCM_IOCTL_READ) != 0) {
+            client->calls.failures++;
+            continue;
+        }
+        int64_t now = NowNs(CLOCK_MONOTONIC);
+        CallStatsAdd(&client->calls, (double)(now - start));
+        int64_t firstNs = param.frameCaptureMode.time.tvSec * NSEC_PER_SEC + param.frameCaptureMode.time.tvNSec;
+        int64_t lastNs = firstNs + (int64_t)param.frameCaptureMode.bufferFrameSize * NSEC_PER_SEC / client->format.rate;
+        CallStatsAdd(&client->age, (double)(now - lastNs));
+    }
+
+    (void)AudioInterfaceLibModeCapture(handle, &param, AUDIO_DRV_PCM_IOCTRL_STOP_CAPTURE);
+    (void)AudioInterfaceLibModeCapture(handle, &param, AUDIO_DRV_PCM_IOCTRL_CAPTURE_CLOSE);
+    AudioCloseServiceCapture(handle);
+    free(buf);
+
+    return NULL;
+}
+
+// Busy processes rather than threads, so their CPU time is not counted as the HAL's
+static void LoadStart(pid_t *pids, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            volatile uint64_t spin = 0;
+            for (;;) {
+                spin++;
+            }
+        }
+    }
+}
+
+static void LoadStop(const pid_t *pids, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (pids[i] > 0) {
+            kill(pids[i], SIGKILL);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+}
+
+static int StartClient(struct Client *client, const struct BenchFormat *format, atomic_bool *stop,
+                       uint32_t seconds, void *(*run)(void *))
+{
+    // A period a call at most, plus room for calls that return early
+    uint32_t room = seconds * (MS_PER_SEC / BENCH_PERIOD_MS) * 4U + 16U;
+
+    client->format = *format;
+    client->stop = stop;
+    if (CallStatsInit(&client->calls, room) < 0 || CallStatsInit(&client->age, room) < 0) {
+        return -1;
+    }
+
+    return pthread_create(&client->thread, NULL, run, client) == 0 ? 0 : -1;
+}
+
+static int RunCase(const struct BenchCase *bench, uint32_t seconds, uint32_t loadProcs)
+{
+    struct Client clients[BENCH_MAX_RENDERS + 2];
+    struct CallStats render;
+    struct CallStats capture;
+    struct CallStats age;
+    struct AudioPcmSimStats sim;
+    pid_t pids[BENCH_MAX_LOAD];
+    atomic_bool stop = false;
+    uint32_t count = 0;
+    int failures = 0;
+
+    printf("%s, %u busy processes:\n", bench->name, loadProcs);
+    uint32_t room = seconds * (MS_PER_SEC / BENCH_PERIOD_MS) * 4U * (BENCH_MAX_RENDERS + 2U);
+    if (CallStatsInit(&render, room) < 0 || CallStatsInit(&capture, room) < 0 || CallStatsInit(&age, room) < 0) {
+        return 1;
+    }
+
+    LoadStart(pids, loadProcs);
+    AudioPcmSimResetStats();
+    int64_t wallStart = NowNs(CLOCK_MONOTONIC);
+    int64_t cpuStart = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+
+    for (uint32_t i = 0; i < bench->renders; i++) {
+        failures += StartClient(&clients[count++], &g_renderFormats[i], &stop, seconds, RenderClient) < 0;
+    }
+    if (bench->mmap) {
+        failures += StartClient(&clients[count++], &g_renderFormats[0], &stop, seconds, MmapClient) < 0;
+    }
+    if (bench->capture) {
+        failures += StartClient(&clients[count++], &g_captureFormat, &stop, seconds, CaptureClient) < 0;
+    }
+
+    sleep(seconds);
+    atomic_store(&stop, true);
+    for (uint32_t i = 0; i < count; i++) {
+        pthread_join(clients[i].thread, NULL);
+    }
+
+    double wall = (double)(NowNs(CLOCK_MONOTONIC) - wallStart) / NSEC_PER_SEC;
+    double cpu = (double)(NowNs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart) / NSEC_PER_SEC;
+    AudioPcmSimGetStats(&sim);
+    LoadStop(pids, loadProcs);
+
+    for (uint32_t i = 0; i < count; i++) {
+        bool isCapture = bench->capture && i == count - 1U;
+        CallStatsMerge(isCapture ? &capture : &render, &clients[i].calls);
+        CallStatsMerge(&age, &clients[i].age);
+    }
+    if (bench->renders > 0 || bench->mmap) {
+        CallStatsPrint(bench->mmap ? "position" : "write", &render);
+    }
+    if (bench->capture) {
+        CallStatsPrint("read", &capture);
+        CallStatsPrint("age", &age);
+    }
+
+    // The pcm runs HW_RATE whatever the clients play, it has to have been kept fed
+    double written = (double)sim.framesWritten / BENCH_HW_RATE / wall;
+    double read = (double)sim.framesRead / BENCH_HW_RATE / wall;
+    printf("  cpu %.2f%% of a core, pcm opens %u, underruns %u, overruns %u, written %.1f%%, read %.1f%% of real time\n",
+           cpu * 100.0 / wall, sim.opens, sim.underruns, sim.overruns, written * 100.0, read * 100.0);
+
+    failures += (int)(render.failures + capture.failures);
+    if ((bench->renders > 0 || bench->mmap) && written < BENCH_MIN_THROUGHPUT) {
+        failures++;
+    }
+    if (bench->capture && read < BENCH_MIN_THROUGHPUT) {
+        failures++;
+    }
+    free(render.ns);
+    free(capture.ns);
+    free(age.ns);
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = argc > 1 ? (uint32_t)atoi(argv[1]) : BENCH_SECONDS;
+    uint32_t jitterUs = argc > 2 ? (uint32_t)atoi(argv[2]) : BENCH_JITTER_US;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t loadProcs = argc > 3 ? (uint32_t)atoi(argv[3]) : (uint32_t)(cpus > 0 ? cpus : 1);
+    struct AudioPcmSimConfig config = {.rate = 0, .jitterUs = jitterUs, .seed = 1};
+    int failures = 0;
+
+    if (seconds == 0) {
+        seconds = 1;
+    }
+    if (loadProcs > BENCH_MAX_LOAD) {
+        loadProcs = BENCH_MAX_LOAD;
+    }
+
+    AudioPcmSetBackend(&g_audioPcmSim);
+    AudioPcmSimSetConfig(&config);
+    printf("simulated pcm, periods up to %u us late, %u s per case\n", jitterUs, seconds);
+
+    for (uint32_t load = 0; load < (loadProcs ? 2U : 1U); load++) {
+        for (size_t i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+            failures += RunCase(&g_cases[i], seconds, load ? loadProcs : 0);
+        }
+    }
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+
+    return failures ? 1 : 0;
+}
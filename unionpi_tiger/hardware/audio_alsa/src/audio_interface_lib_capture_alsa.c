@@ -13,26 +13,92 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <linux/soundcard.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/prctl.h>
 #include "sound/asound.h"
 
 #include "hdf_log.h"
 #include "tinyalsa/asoundlib.h"
 
+#include "audio_capture_ring.h"
+#include "audio_converter.h"
+#include "audio_pcm.h"
+#include "audio_soft_gain.h"
 #include "audio_interface_lib_capture.h"
 
 #define HDF_LOG_TAG HDI_AUDIO_C_ALSA
 
-// treat hats.
-#define PLEASURE_HATS
-
 #define SOUND_CARD_ID (0)
 #define SOUND_DEV_ID (4)
 
+// The pcm only ever runs this, every client format is converted from it
+#define HW_RATE (48000)
+#define HW_CHANNELS (2)
+#define HW_FORMAT PCM_FORMAT_S32_LE
+#define HW_BITS (32U)
+// Captured frames taken through the gain and the converter at a time
+#define CONVERT_FRAMES (1024)
+
+// MMAP mode keeps only MMAP_PERIOD_COUNT short periods in the DMA ring, ~10ms at 48kHz
+#define MMAP_PERIOD_SIZE (256)
+#define MMAP_PERIOD_SIZE_MIN (64)
+#define MMAP_PERIOD_SIZE_MAX (1024)
+#define MMAP_PERIOD_COUNT (2)
+#define MMAP_WAIT_MS (100)
+#define MMAP_THREAD_PRIORITY (2)
+#define NSEC_PER_SEC (1000000000LL)
+#define NSEC_PER_MSEC (1000000LL)
+
+// pcm_read mode: alsa_capture keeps up to this much queued for a client that falls behind
+#define CAPTURE_RING_MS (500)
+// While paused the newest this much stays queued, the first reads after resuming return it
+#ifndef CAPTURE_PREROLL_MS
+#define CAPTURE_PREROLL_MS (500)
+#endif
+#define CAPTURE_READ_BYTES (8192) // See to 'buffer_size' in audio_policy_config.xml
+#define CAPTURE_READ_TIMEOUT_MS (500)
+#define CAPTURE_THREAD_PRIORITY (2)
+
+struct AlsaMmapCtx {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    atomic_bool running;
+    bool active;
+
+    // The framework's shared ring, filled from the DMA ring as soon as a period is captured
+    uint8_t *ring;
+    uint32_t ringFrames;
+    uint32_t frameBytes;
+
+    uint64_t framesCaptured; // frames put into the framework ring since the stream started
+    uint32_t xruns;
+};
+
+struct AlsaReadCtx {
+    pthread_t thread;
+    atomic_bool running;  // read by readers too, a stopped capture fails their reads
+    atomic_bool paused;   // keeps capturing, only the newest prerollFrames stay queued
+
+    // Periods in the client's format, alsa_capture produces and readers consume
+    struct AudioCaptureRing ring;
+    uint32_t prerollFrames;
+    pthread_mutex_t lock; // serializes the consumer side: readers, and the skip while paused
+    pthread_cond_t cond;
+    atomic_bool waiting;  // a reader sleeps on cond until enough is queued
+
+    uint32_t xruns;
+};
+
 struct AlsaCtx {
-    struct pcm *pcmHandler;
-    struct pcm_config config;
+    struct AudioPcm *pcmHandler;
+    struct pcm_config config; // the HW_ format, only the timing follows the client
     struct mixer *mixerHandler;
+    struct mixer_ctl *micVolumeCtl; // looked up once, the master level
 
     int initFlag;
     int volume;
@@ -42,6 +108,17 @@ struct AlsaCtx {
     float gainMin;
     float gain;
     bool mute;
+
+    // Gain and mute in software, ramped so neither clicks; volume stays on the codec
+    struct AudioSoftGain softGain;
+    pthread_mutex_t gainLock;
+
+    // From the hardware format to the client's, the gain is applied before it
+    struct AudioConverter conv;
+    int32_t convBuf[CONVERT_FRAMES * HW_CHANNELS];
+
+    struct AlsaReadCtx capture;
+    struct AlsaMmapCtx mmap;
 };
 
 static struct AlsaCtx s_alsaCtx = {.initFlag = 0};
@@ -71,19 +148,14 @@ static int32_t AlsaVolumeUpdate(struct AlsaCtx *aCtx)
     int32_t ret = 0;
     int volumeSet = 0;
 
-    if (!aCtx->mixerHandler) {
+    if (!aCtx->micVolumeCtl) {
         return -1;
     }
 
-    if (aCtx->mute) {
-        volumeSet = 0;
-    } else {
-        volumeSet = aCtx->volume * 1312U / (aCtx->volMax - aCtx->volMin);
-    }
+    // Mute is a software ramp now, the codec only carries the volume
+    volumeSet = aCtx->volume * 1312U / (aCtx->volMax - aCtx->volMin);
 
-    ret = mixer_ctl_set_value(
-        mixer_get_ctl_by_name(aCtx->mixerHandler, "Linein Mic1 Volume"), 0,
-        volumeSet);
+    ret = mixer_ctl_set_value(aCtx->micVolumeCtl, 0, volumeSet);
 
     HDF_LOGV("Set Volume: volume=%{public}d, mute=%{public}d, "
              "volumeSet=%{public}d, ret=%{public}d",
@@ -92,6 +164,42 @@ static int32_t AlsaVolumeUpdate(struct AlsaCtx *aCtx)
     return ret;
 }
 
+// gainMax is 0 dB, the default; lower gains attenuate
+static void SoftGainUpdate(struct AlsaCtx *aCtx)
+{
+    float linear = aCtx->mute ? 0.0f : AudioSoftGainFromDb(aCtx->gain - aCtx->gainMax);
+
+    pthread_mutex_lock(&aCtx->gainLock);
+    AudioSoftGainSetTarget(&aCtx->softGain, linear);
+    pthread_mutex_unlock(&aCtx->gainLock);
+}
+
+static uint32_t FormatBits(enum pcm_format format)
+{
+    switch (format) {
+        case PCM_FORMAT_S8:
+            return 8U;
+        case PCM_FORMAT_S24_LE:
+            return 24U;
+        case PCM_FORMAT_S32_LE:
+            return 32U;
+        default:
+            return 16U;
+    }
+}
+
+// Must be called with gainLock held, 'data' is in the hardware format
+static void SoftGainApply(struct AlsaCtx *aCtx, void *data, uint32_t frames)
+{
+    (void)AudioSoftGainApply(&aCtx->softGain, data, frames, HW_CHANNELS, HW_BITS);
+}
+
+// The same span of time in frames at HW_RATE
+static uint32_t ToHwFrames(uint32_t frames, uint32_t rate)
+{
+    return rate ? (uint32_t)((uint64_t)frames * HW_RATE / rate) : frames;
+}
+
 static enum pcm_format ConvertFormatToAlsa(enum AudioFormat format)
 {
     switch (format) {
@@ -129,8 +237,16 @@ static struct AlsaCtx *AlsaCtxInstanceGet(void)
         s_alsaCtx.gainMax = 15.0f;
         s_alsaCtx.gain = s_alsaCtx.gainMax;
         s_alsaCtx.mute = false;
+        pthread_mutex_init(&s_alsaCtx.mmap.lock, NULL);
+        pthread_mutex_init(&s_alsaCtx.capture.lock, NULL);
+        pthread_cond_init(&s_alsaCtx.capture.cond, NULL);
+        pthread_mutex_init(&s_alsaCtx.gainLock, NULL);
+        AudioSoftGainInit(&s_alsaCtx.softGain, 1.0f, AudioSoftGainRampFrames(HW_RATE));
         s_alsaCtx.mixerHandler = mixer_open(SOUND_CARD_ID);
         MixerInit(s_alsaCtx.mixerHandler);
+        if (s_alsaCtx.mixerHandler) {
+            s_alsaCtx.micVolumeCtl = mixer_get_ctl_by_name(s_alsaCtx.mixerHandler, "Linein Mic1 Volume");
+        }
         s_alsaCtx.initFlag = 1;
 
         AlsaVolumeUpdate(&s_alsaCtx);
@@ -155,13 +271,14 @@ static int AlsaOpen(struct AlsaCtx *aCtx)
     }
 
     struct pcm_config config;
-    (void)memcpy_s(&config, sioef(config), &aCtx->config, sizeof(config));
-    struct pcm *pcm = pcm_open(sound_card_id, sound_dev_id, PCM_IN, &config);
-    if (!pcm_is_ready(pcm)) {
+    (void)memcpy_s(&config, sizeof(config), &aCtx->config, sizeof(config));
+    // Monotonic timestamps, as the capture thread stamps its periods with them
+    struct AudioPcm *pcm = AudioPcmOpen(sound_card_id, sound_dev_id, PCM_IN | PCM_MONOTONIC, &config);
+    if (!AudioPcmIsReady(pcm)) {
         HDF_LOGE("Error: %{public}s() Cannot open PCM_IN(card %{public}d, "
                  "device %{public}d): %{public}s",
-                 __func__, sound_card_id, sound_dev_id, pcm_get_error(pcm));
-        pcm_close(pcm);
+                 __func__, sound_card_id, sound_dev_id, AudioPcmGetError(pcm));
+        AudioPcmClose(pcm);
 
         return -1;
     }
@@ -176,7 +293,7 @@ static int AlsaOpen(struct AlsaCtx *aCtx)
 static int AlsaClose(struct AlsaCtx *aCtx)
 {
     if (aCtx->pcmHandler) {
-        pcm_close(aCtx->pcmHandler);
+        AudioPcmClose(aCtx->pcmHandler);
         aCtx->pcmHandler = NULL;
     }
 
@@ -233,22 +350,6 @@ static int AlsaConfig(struct AlsaCtx *aCtx, struct AudioHwCaptureParam *handleDa
     config.period_count = handleData->frameCaptureMode.periodCount; // 4
     config.period_size = handleData->frameCaptureMode.periodSize;   // 1024
 
-#ifdef PLEASURE_HATS
-    if (config.rate == 12000) {
-        config.rate = 8000;
-    } else if (config.rate == 24000) {
-        config.rate = 22050;
-    } else if (config.rate == 64000) {
-        config.rate = 48000;
-    } else if (config.rate == 96000) {
-        config.rate = 48000;
-    }
-
-    if (config.format == PCM_FORMAT_S24_LE) {
-        config.format = PCM_FORMAT_S16_LE;
-    }
-#endif
-
     HDF_LOGV("DUMP Alsa Config 1#: channels=%{public}d, rate=%{public}d, "
              "format=%{public}d, period_count=%{public}d, period_size=%{public}d",
              config.channels, config.rate, config.format, config.period_count,
@@ -259,6 +360,26 @@ static int AlsaConfig(struct AlsaCtx *aCtx, struct AudioHwCaptureParam *handleDa
              aCtx->config.channels, aCtx->config.rate, aCtx->config.format,
              aCtx->config.period_count, aCtx->config.period_size);
 
+    // A new client format only swaps the converter, the pcm is reopened for a new timing
+    struct AudioConverterFormat hwFormat = {HW_RATE, HW_CHANNELS, HW_BITS};
+    struct AudioConverterFormat clientFormat = {config.rate, config.channels, FormatBits(config.format)};
+    const struct AudioConverterFormat *out = &aCtx->conv.out;
+    if (out->rate != clientFormat.rate || out->channels != clientFormat.channels || out->bits != clientFormat.bits) {
+        struct AudioConverter conv;
+        if (AudioConverterInit(&conv, &hwFormat, &clientFormat) < 0) {
+            HDF_LOGE("Error: in %{public}s, no converter to %{public}u Hz %{public}u ch %{public}u bits",
+                     __func__, clientFormat.rate, clientFormat.channels, clientFormat.bits);
+            return -1;
+        }
+        AudioConverterDeinit(&aCtx->conv);
+        aCtx->conv = conv;
+    }
+
+    config.channels = HW_CHANNELS;
+    config.rate = HW_RATE;
+    config.format = HW_FORMAT;
+    config.period_size = ToHwFrames(config.period_size, clientFormat.rate);
+
     if (aCtx->pcmHandler && !memcmp(&config, &aCtx->config, sizeof(config))) {
         HDF_LOGW("Warn: Same Audio Hw config. No need to change.");
         return 0;
@@ -288,10 +409,15 @@ static int32_t DoCtlCaptureSetPauseStu(const struct DevHandleCapture *handle,
         return HDF_FAILURE;
     }
 
-    if (pcm_ioctl(aCtx->pcmHandler, SNDRV_PCM_IOCTL_PAUSE,
-                  handleData->captureMode.ctlParam.pause ? 1 : 0) < 0) {
-        HDF_LOGE("Error: pcm_ioctl(SNDRV_PCM_IOCTL_PAUSE) failed: %{public}s\n",
-                 pcm_get_error(aCtx->pcmHandler));
+    if (aCtx->capture.running) {
+        // The pcm keeps running, so a resume starts with what was captured just before it
+        aCtx->capture.paused = handleData->captureMode.ctlParam.pause;
+        return HDF_SUCCESS;
+    }
+
+    if (AudioPcmPause(aCtx->pcmHandler, handleData->captureMode.ctlParam.pause) < 0) {
+        HDF_LOGE("Error: AudioPcmPause() failed: %{public}s\n",
+                 AudioPcmGetError(aCtx->pcmHandler));
         return HDF_FAILURE;
     }
 
@@ -337,8 +463,9 @@ static int32_t DoCtlCaptureSetMuteStu(const struct DevHandleCapture *handle,
     struct AlsaCtx *aCtx = (struct AlsaCtx *)handle->object;
 
     aCtx->mute = handleData->captureMode.ctlParam.mute;
+    SoftGainUpdate(aCtx);
 
-    return AlsaVolumeUpdate(aCtx);
+    return HDF_SUCCESS;
 }
 
 static int32_t DoCtlCaptureGetMuteStu(const struct DevHandleCapture *handle,
@@ -366,6 +493,7 @@ static int32_t DoCtlCaptureSetGainStu(const struct DevHandleCapture *handle,
     }
 
     aCtx->gain = gain;
+    SoftGainUpdate(aCtx);
 
     return HDF_SUCCESS;
 }
@@ -455,6 +583,375 @@ static int32_t HandleCtlCaptureCmd(const struct DevHandleCapture *handle,
     return ret;
 }
 
+// Converts captured frames into the framework ring, wrapping around the end of the latter
+static void MmapRingPut(struct AlsaCtx *aCtx, const uint8_t *data, uint32_t frames)
+{
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    uint32_t hwFrameBytes = AudioConverterFrameBytes(&aCtx->conv.in);
+
+    do {
+        uint32_t pos = (uint32_t)(mCtx->framesCaptured % mCtx->ringFrames);
+        uint32_t space = mCtx->ringFrames - pos;
+        // No more input than what fills the ring up to its end
+        uint32_t chunk = AudioConverterInFrames(&aCtx->conv, space);
+        if (chunk > frames) {
+            chunk = frames;
+        }
+        mCtx->framesCaptured += AudioConverterProcess(&aCtx->conv, data, chunk, mCtx->ring + pos * mCtx->frameBytes,
+                                                      space);
+        data += chunk * hwFrameBytes;
+        frames -= chunk;
+    } while (frames > 0);
+}
+
+// Takes frames of the DMA ring through the gain and into the framework ring
+static void MmapDrainDma(struct AlsaCtx *aCtx, const uint8_t *dma, uint32_t frames)
+{
+    uint32_t hwFrameBytes = AudioConverterFrameBytes(&aCtx->conv.in);
+
+    while (frames > 0) {
+        uint32_t chunk = frames < CONVERT_FRAMES ? frames : CONVERT_FRAMES;
+        (void)memcpy_s(aCtx->convBuf, sizeof(aCtx->convBuf), dma, chunk * hwFrameBytes);
+        pthread_mutex_lock(&aCtx->gainLock);
+        SoftGainApply(aCtx, aCtx->convBuf, chunk);
+        pthread_mutex_unlock(&aCtx->gainLock);
+        MmapRingPut(aCtx, (const uint8_t *)aCtx->convBuf, chunk);
+        dma += chunk * hwFrameBytes;
+        frames -= chunk;
+    }
+}
+
+// Must be called with mmap.lock held
+static int MmapTransfer(struct AlsaCtx *aCtx)
+{
+    int avail = AudioPcmMmapAvail(aCtx->pcmHandler);
+    if (avail < 0) {
+        return avail;
+    }
+
+    while (avail > 0) {
+        void *area = NULL;
+        unsigned int offset = 0;
+        unsigned int frames = (unsigned int)avail;
+        if (AudioPcmMmapBegin(aCtx->pcmHandler, &area, &offset, &frames) < 0 || frames == 0) {
+            return -1;
+        }
+        MmapDrainDma(aCtx, (const uint8_t *)area + AudioPcmFramesToBytes(aCtx->pcmHandler, offset), frames);
+        if (AudioPcmMmapCommit(aCtx->pcmHandler, offset, frames) < 0) {
+            return -1;
+        }
+        avail -= (int)frames;
+    }
+
+    return 0;
+}
+
+// Must be called with mmap.lock held
+static int MmapStartDma(struct AlsaCtx *aCtx)
+{
+    if (AudioPcmPrepare(aCtx->pcmHandler) < 0) {
+        return -1;
+    }
+
+    return AudioPcmStart(aCtx->pcmHandler);
+}
+
+static void *MmapCaptureThread(void *arg)
+{
+    struct AlsaCtx *aCtx = (struct AlsaCtx *)arg;
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    struct sched_param param = {.sched_priority = MMAP_THREAD_PRIORITY};
+
+    prctl(PR_SET_NAME, "alsa_mmap_in");
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        HDF_LOGW("Warn: %{public}s no SCHED_FIFO, keep the default policy", __func__);
+    }
+
+    while (mCtx->running) {
+        int ret = AudioPcmWait(aCtx->pcmHandler, MMAP_WAIT_MS);
+
+        pthread_mutex_lock(&mCtx->lock);
+        if (ret >= 0) {
+            ret = MmapTransfer(aCtx);
+        }
+        if (ret < 0 && mCtx->running) {
+            // Overrun: the hardware stopped, what it dropped is lost, restart from now
+            mCtx->xruns++;
+            AudioPcmStop(aCtx->pcmHandler);
+            ret = MmapStartDma(aCtx);
+        }
+        pthread_mutex_unlock(&mCtx->lock);
+
+        if (ret < 0) {
+            // The device is gone or wedged, do not spin on it
+            usleep(MMAP_WAIT_MS * 1000);
+        }
+    }
+
+    return NULL;
+}
+
+static void MmapStop(struct AlsaCtx *aCtx)
+{
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+
+    if (!mCtx->active) {
+        return;
+    }
+
+    mCtx->running = false;
+    pthread_join(mCtx->thread, NULL);
+
+    // The position query reads the pcm under mmap.lock
+    pthread_mutex_lock(&mCtx->lock);
+    mCtx->active = false;
+
+    // The mmap pcm is of no use to the pcm_read path
+    AlsaClose(aCtx);
+    pthread_mutex_unlock(&mCtx->lock);
+
+    HDF_LOGI("MMAP capture stopped: %{public}llu frames, %{public}u xruns",
+             (unsigned long long)mCtx->framesCaptured, mCtx->xruns);
+}
+
+static int MmapOpen(struct AlsaCtx *aCtx, const struct AudioMmapBufferDescripter *desc)
+{
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    struct pcm_config config;
+    uint32_t periodSize = MMAP_PERIOD_SIZE;
+
+    if (desc->transferFrameSize >= MMAP_PERIOD_SIZE_MIN && desc->transferFrameSize <= MMAP_PERIOD_SIZE_MAX) {
+        periodSize = ToHwFrames((uint32_t)desc->transferFrameSize, aCtx->conv.out.rate);
+    }
+
+    (void)memcpy_s(&config, sizeof(config), &aCtx->config, sizeof(config));
+    config.period_size = periodSize;
+    config.period_count = MMAP_PERIOD_COUNT;
+    config.start_threshold = 1;
+    config.stop_threshold = periodSize * MMAP_PERIOD_COUNT;
+    config.silence_threshold = 0;
+    config.avail_min = periodSize;
+
+    AlsaClose(aCtx);
+    struct AudioPcm *pcm = AudioPcmOpen(SOUND_CARD_ID, SOUND_DEV_ID, PCM_IN | PCM_MMAP | PCM_MONOTONIC, &config);
+    if (!AudioPcmIsReady(pcm)) {
+        HDF_LOGE("Error: %{public}s() Cannot open mmap pcm_in: %{public}s", __func__, AudioPcmGetError(pcm));
+        AudioPcmClose(pcm);
+        return -1;
+    }
+    aCtx->pcmHandler = pcm;
+
+    mCtx->ring = (uint8_t *)desc->memoryAddress;
+    mCtx->ringFrames = (uint32_t)desc->totalBufferFrames;
+    mCtx->frameBytes = AudioConverterFrameBytes(&aCtx->conv.out);
+    mCtx->framesCaptured = 0;
+    mCtx->xruns = 0;
+    AudioConverterReset(&aCtx->conv);
+
+    pthread_mutex_lock(&mCtx->lock);
+    int ret = MmapStartDma(aCtx);
+    pthread_mutex_unlock(&mCtx->lock);
+    if (ret < 0) {
+        HDF_LOGE("Error: %{public}s() start dma failed: %{public}s", __func__, AudioPcmGetError(pcm));
+        AlsaClose(aCtx);
+        return -1;
+    }
+
+    mCtx->running = true;
+    if (pthread_create(&mCtx->thread, NULL, MmapCaptureThread, aCtx) != 0) {
+        HDF_LOGE("Error: %{public}s() create thread failed", __func__);
+        mCtx->running = false;
+        AlsaClose(aCtx);
+        return -1;
+    }
+    pthread_mutex_lock(&mCtx->lock);
+    mCtx->active = true;
+    pthread_mutex_unlock(&mCtx->lock);
+
+    HDF_LOGI("MMAP capture started: ring %{public}u frames, dma %{public}u x %{public}u frames",
+             mCtx->ringFrames, MMAP_PERIOD_COUNT, periodSize);
+
+    return 0;
+}
+
+// Absolute CLOCK_REALTIME deadline for pthread_cond_timedwait()
+static void DeadlineAfter(struct timespec *deadline, uint64_t ns)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += (time_t)(ns / NSEC_PER_SEC);
+    deadline->tv_nsec += (long)(ns % NSEC_PER_SEC);
+    if (deadline->tv_nsec >= NSEC_PER_SEC) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+// Frames alsa_capture reads at a time: a period, unless that is longer than convBuf
+static uint32_t CaptureChunkFrames(const struct AlsaCtx *aCtx)
+{
+    uint32_t frames = aCtx->config.period_size;
+
+    return (frames == 0 || frames > CONVERT_FRAMES) ? CONVERT_FRAMES : frames;
+}
+
+// Capture time of the first of the 'frames' frames AudioPcmRead() just returned
+static int64_t CaptureTimeNs(struct AudioPcm *pcm, uint32_t frames)
+{
+    unsigned int avail = 0;
+    struct timespec tstamp;
+
+    // The timestamp is that of the newest frame captured, avail frames after the last one read
+    if (AudioPcmGetHtimestamp(pcm, &avail, &tstamp) < 0) {
+        clock_gettime(CLOCK_MONOTONIC, &tstamp);
+        avail = 0;
+    }
+
+    return (int64_t)tstamp.tv_sec * NSEC_PER_SEC + tstamp.tv_nsec -
+           (int64_t)(avail + frames) * NSEC_PER_SEC / HW_RATE;
+}
+
+static void CaptureWake(struct AlsaReadCtx *rCtx)
+{
+    // Pairs with CaptureWait(): either the reader sees the commit or this sees the reader waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&rCtx->waiting, memory_order_relaxed)) {
+        pthread_mutex_lock(&rCtx->lock);
+        pthread_cond_signal(&rCtx->cond);
+        pthread_mutex_unlock(&rCtx->lock);
+    }
+}
+
+// Must be called with capture.lock held, returns the frames queued when it gave up or had enough
+static uint32_t CaptureWait(struct AlsaReadCtx *rCtx, uint32_t frames, const struct timespec *deadline)
+{
+    uint32_t avail = 0;
+
+    atomic_store_explicit(&rCtx->waiting, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (rCtx->running && (avail = AudioCaptureRingAvail(&rCtx->ring)) < frames) {
+        if (pthread_cond_timedwait(&rCtx->cond, &rCtx->lock, deadline) == ETIMEDOUT) {
+            avail = rCtx->running ? AudioCaptureRingAvail(&rCtx->ring) : 0;
+            break;
+        }
+    }
+    atomic_store_explicit(&rCtx->waiting, false, memory_order_relaxed);
+
+    return avail;
+}
+
+static void *CaptureThread(void *arg)
+{
+    struct AlsaCtx *aCtx = (struct AlsaCtx *)arg;
+    struct AlsaReadCtx *rCtx = &aCtx->capture;
+    struct sched_param param = {.sched_priority = CAPTURE_THREAD_PRIORITY};
+    uint32_t frames = CaptureChunkFrames(aCtx);
+    unsigned int bytes = AudioPcmFramesToBytes(aCtx->pcmHandler, frames);
+
+    prctl(PR_SET_NAME, "alsa_capture");
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        HDF_LOGW("Warn: %{public}s no SCHED_FIFO, keep the default policy", __func__);
+    }
+
+    while (rCtx->running) {
+        if (AudioPcmRead(aCtx->pcmHandler, aCtx->convBuf, bytes) < 0) {
+            // tinyalsa has prepared the pcm again after an overrun, the next read restarts it
+            rCtx->xruns++;
+            if (errno != EPIPE) {
+                // The device is gone or wedged, do not spin on it
+                usleep(MMAP_WAIT_MS * 1000);
+            }
+            continue;
+        }
+        int64_t timeNs = CaptureTimeNs(aCtx->pcmHandler, frames);
+
+        pthread_mutex_lock(&aCtx->gainLock);
+        SoftGainApply(aCtx, aCtx->convBuf, frames);
+        pthread_mutex_unlock(&aCtx->gainLock);
+
+        uint8_t *slot = AudioCaptureRingWriteBegin(&rCtx->ring);
+        if (!slot) {
+            // The client fell behind, this period is lost; start the filter over after the gap
+            AudioConverterReset(&aCtx->conv);
+            continue;
+        }
+        uint32_t out = AudioConverterProcess(&aCtx->conv, aCtx->convBuf, frames, slot, rCtx->ring.slotFrames);
+        AudioCaptureRingWriteCommit(&rCtx->ring, out, timeNs);
+        CaptureWake(rCtx);
+
+        if (rCtx->paused) {
+            pthread_mutex_lock(&rCtx->lock);
+            AudioCaptureRingSkip(&rCtx->ring, rCtx->prerollFrames);
+            pthread_mutex_unlock(&rCtx->lock);
+        }
+    }
+
+    return NULL;
+}
+
+static void CaptureStop(struct AlsaCtx *aCtx)
+{
+    struct AlsaReadCtx *rCtx = &aCtx->capture;
+
+    if (!rCtx->running) {
+        return;
+    }
+
+    rCtx->running = false;
+    pthread_join(rCtx->thread, NULL);
+
+    // A reader still waiting gives up once it holds the lock again
+    pthread_mutex_lock(&rCtx->lock);
+    HDF_LOGI("Capture stopped: %{public}u overruns, %{public}u device xruns", rCtx->ring.overruns, rCtx->xruns);
+    AudioCaptureRingDeinit(&rCtx->ring);
+    pthread_cond_broadcast(&rCtx->cond);
+    pthread_mutex_unlock(&rCtx->lock);
+}
+
+static int CaptureStart(struct AlsaCtx *aCtx)
+{
+    struct AlsaReadCtx *rCtx = &aCtx->capture;
+    const struct AudioConverterFormat *client = &aCtx->conv.out;
+
+    if (rCtx->running) {
+        return 0;
+    }
+    if (!aCtx->pcmHandler || aCtx->mmap.active) {
+        return -1;
+    }
+
+    // Room for the queue, the pre-roll and the largest read, in slots the size of a converted chunk
+    uint32_t frameBytes = AudioConverterFrameBytes(client);
+    uint32_t slotFrames = (uint32_t)((uint64_t)CaptureChunkFrames(aCtx) * client->rate / HW_RATE) + 2U;
+    uint32_t ringFrames = (uint32_t)((uint64_t)client->rate * (CAPTURE_RING_MS + CAPTURE_PREROLL_MS) / 1000U) +
+                          CAPTURE_READ_BYTES / frameBytes;
+    uint32_t slotFill = slotFrames > 3U ? slotFrames - 2U : 1U;
+    uint32_t slots = (ringFrames + slotFill - 1U) / slotFill + 2U;
+
+    pthread_mutex_lock(&rCtx->lock);
+    int ret = AudioCaptureRingInit(&rCtx->ring, slots, slotFrames, frameBytes, client->rate);
+    pthread_mutex_unlock(&rCtx->lock);
+    if (ret < 0) {
+        HDF_LOGE("Error: %{public}s() no memory for %{public}u slots", __func__, slots);
+        return -1;
+    }
+    rCtx->prerollFrames = (uint32_t)((uint64_t)client->rate * CAPTURE_PREROLL_MS / 1000U);
+    rCtx->paused = false;
+    rCtx->xruns = 0;
+    AudioConverterReset(&aCtx->conv);
+
+    rCtx->running = true;
+    if (pthread_create(&rCtx->thread, NULL, CaptureThread, aCtx) != 0) {
+        HDF_LOGE("Error: %{public}s() create thread failed", __func__);
+        rCtx->running = false;
+        AudioCaptureRingDeinit(&rCtx->ring);
+        return -1;
+    }
+
+    HDF_LOGI("Capture started: %{public}u slots of %{public}u frames", slots, slotFrames);
+
+    return 0;
+}
+
 static int32_t DoOutputCaptureHwParams(const struct DevHandleCapture *handle,
                                        int cmdId,
                                        struct AudioHwCaptureParam *handleData)
@@ -463,6 +960,8 @@ static int32_t DoOutputCaptureHwParams(const struct DevHandleCapture *handle,
 
     HDF_LOGV("INFO: enter %{public}s()", __func__);
 
+    MmapStop(aCtx);
+    CaptureStop(aCtx);
     if (AlsaConfig(aCtx, handleData) < 0) {
         HDF_LOGE("Error: in %{public}s, AlsaConfig() failed.", __func__);
         return HDF_FAILURE;
@@ -476,28 +975,53 @@ static int32_t DoOutputCaptureRead(const struct DevHandleCapture *handle,
                                    struct AudioHwCaptureParam *handleData)
 {
     struct AlsaCtx *aCtx = (struct AlsaCtx *)handle->object;
+    struct AlsaReadCtx *rCtx = &aCtx->capture;
 
-    if (!aCtx->pcmHandler) {
-        HDF_LOGE("Error: in %{public}s, Pcm is not opened!", __func__);
+    if (aCtx->mmap.active) {
+        HDF_LOGE("Error: %{public}s, capture is in mmap mode", __func__);
         return HDF_FAILURE;
     }
 
-    uint32_t dataSize = 8192; // See to 'buffer_size' in audio_policy_config.xml
+    // A client asking for less than a whole buffer gets just that
+    uint64_t dataSize = handleData->frameCaptureMode.bufferSize;
+    if (dataSize == 0 || dataSize > CAPTURE_READ_BYTES) {
+        dataSize = CAPTURE_READ_BYTES;
+    }
+    uint32_t frameBytes = AudioConverterFrameBytes(&aCtx->conv.out);
+    uint32_t frames = (uint32_t)dataSize / frameBytes;
 
-    if (!handleData->frameCaptureMode.buffer) {
+    if (!handleData->frameCaptureMode.buffer || frames == 0) {
         return HDF_FAILURE;
     }
 
-    if (pcm_read(aCtx->pcmHandler, handleData->frameCaptureMode.buffer,
-                 dataSize) < 0) {
-        HDF_LOGE("Error: pcm_read() failed: %{public}s\n",
-                 pcm_get_error(aCtx->pcmHandler));
+    // alsa_capture owns the pcm, it only runs while the pcm is open
+    if (!rCtx->running) {
+        HDF_LOGE("Error: in %{public}s, capture is not started!", __func__);
         return HDF_FAILURE;
     }
 
-    handleData->frameCaptureMode.bufferSize = dataSize;
-    handleData->frameCaptureMode.bufferFrameSize =
-        pcm_bytes_to_frames(aCtx->pcmHandler, dataSize);
+    struct timespec deadline;
+    DeadlineAfter(&deadline, (uint64_t)frames * NSEC_PER_SEC / aCtx->conv.out.rate +
+                                 (uint64_t)CAPTURE_READ_TIMEOUT_MS * NSEC_PER_MSEC);
+
+    // Blocks until the whole request is captured, which paces the client at the capture rate
+    int64_t timeNs = 0;
+    uint32_t done = 0;
+    pthread_mutex_lock(&rCtx->lock);
+    if (CaptureWait(rCtx, frames, &deadline) > 0) {
+        done = AudioCaptureRingRead(&rCtx->ring, handleData->frameCaptureMode.buffer, frames, &timeNs);
+    }
+    pthread_mutex_unlock(&rCtx->lock);
+
+    if (done == 0) {
+        HDF_LOGE("Error: %{public}s, nothing captured in time", __func__);
+        return HDF_FAILURE;
+    }
+
+    handleData->frameCaptureMode.bufferSize = (uint64_t)done * frameBytes;
+    handleData->frameCaptureMode.bufferFrameSize = done;
+    handleData->frameCaptureMode.time.tvSec = timeNs / NSEC_PER_SEC;
+    handleData->frameCaptureMode.time.tvNSec = timeNs % NSEC_PER_SEC;
 
     return HDF_SUCCESS;
 }
@@ -509,7 +1033,15 @@ static int32_t DoOutputCaptureStartPrepare(const struct DevHandleCapture *handle
 
     HDF_LOGV("INFO: enter %{public}s()", __func__);
 
-    AlsaOpen(aCtx);
+    if (aCtx->mmap.active) {
+        // The DMA was started when the mmap buffer was requested
+        return HDF_SUCCESS;
+    }
+
+    if (AlsaOpen(aCtx) < 0 || CaptureStart(aCtx) < 0) {
+        HDF_LOGE("Error: in %{public}s, capture did not start", __func__);
+        return HDF_FAILURE;
+    }
 
     return HDF_SUCCESS;
 }
@@ -535,6 +1067,8 @@ static int32_t DoOutputCaptureClose(const struct DevHandleCapture *handle, int c
         return HDF_FAILURE;
     }
 
+    MmapStop(aCtx);
+    CaptureStop(aCtx);
     AlsaClose(aCtx);
 
     return HDF_SUCCESS;
@@ -553,6 +1087,8 @@ static int32_t DoOutputCaptureStop(const struct DevHandleCapture *handle,
         return HDF_FAILURE;
     }
 
+    MmapStop(aCtx);
+    CaptureStop(aCtx);
     AlsaClose(aCtx);
 
     return HDF_SUCCESS;
@@ -561,12 +1097,67 @@ static int32_t DoOutputCaptureStop(const struct DevHandleCapture *handle,
 static int32_t DoOutputCaptureReqMmapBuffer(const struct DevHandleCapture *handle, int cmdId,
                                             struct AudioHwCaptureParam *handleData)
 {
+    struct AlsaCtx *aCtx = (struct AlsaCtx *)handle->object;
+    const struct AudioMmapBufferDescripter *desc = &handleData->frameCaptureMode.mmapBufDesc;
+
+    HDF_LOGV("INFO: enter %{public}s()", __func__);
+
+    if (desc->memoryAddress == NULL || desc->totalBufferFrames <= 0) {
+        HDF_LOGE("Error: %{public}s invalid mmap buffer", __func__);
+        return HDF_FAILURE;
+    }
+
+    if (aCtx->config.rate == 0) {
+        HDF_LOGE("Error: %{public}s hw params are not set", __func__);
+        return HDF_FAILURE;
+    }
+
+    MmapStop(aCtx);
+    CaptureStop(aCtx);
+    if (MmapOpen(aCtx, desc) < 0) {
+        return HDF_FAILURE;
+    }
+
     return HDF_SUCCESS;
 }
 
 static int32_t DoOutputCaptureGetMmapPosition(const struct DevHandleCapture *handle, int cmdId,
                                               struct AudioHwCaptureParam *handleData)
 {
+    struct AlsaCtx *aCtx = (struct AlsaCtx *)handle->object;
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    unsigned int avail = 0;
+    struct timespec tstamp = {0};
+    uint64_t captured = 0;
+
+    if (!mCtx->active || !aCtx->pcmHandler) {
+        HDF_LOGE("Error: in %{public}s, mmap is not started!", __func__);
+        return HDF_FAILURE;
+    }
+
+    pthread_mutex_lock(&mCtx->lock);
+    if (!mCtx->active || !aCtx->pcmHandler) {
+        // Stopped since the check above
+        pthread_mutex_unlock(&mCtx->lock);
+        return HDF_FAILURE;
+    }
+    int ret = AudioPcmGetHtimestamp(aCtx->pcmHandler, &avail, &tstamp);
+    captured = mCtx->framesCaptured;
+    pthread_mutex_unlock(&mCtx->lock);
+
+    if (ret < 0) {
+        return HDF_FAILURE;
+    }
+
+    // The timestamp is that of the newest frame in the DMA ring, the last frame handed to the
+    // framework was captured avail frames earlier
+    int64_t ns = (int64_t)tstamp.tv_sec * NSEC_PER_SEC + tstamp.tv_nsec -
+                 (int64_t)avail * NSEC_PER_SEC / aCtx->config.rate;
+
+    handleData->frameCaptureMode.frames = captured;
+    handleData->frameCaptureMode.time.tvSec = ns / NSEC_PER_SEC;
+    handleData->frameCaptureMode.time.tvNSec = ns % NSEC_PER_SEC;
+
     return HDF_SUCCESS;
 }
 
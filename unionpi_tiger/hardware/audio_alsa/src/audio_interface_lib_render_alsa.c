@@ -14,27 +14,91 @@
  */
 
 #include <linux/soundcard.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/prctl.h>
 #include "sound/asound.h"
 
 #include "hdf_log.h"
 #include "tinyalsa/asoundlib.h"
 
+#include "audio_converter.h"
+#include "audio_pcm.h"
+#include "audio_soft_gain.h"
 #include "audio_interface_lib_render.h"
+#include "audio_render_mixer.h"
 
 #define HDF_LOG_TAG HDI_AUDIO_R_ALSA
 
-// treat hats.
-#define PLEASURE_HATS
-
 #define SOUND_CARD_ID (0)
 #define SOUND_DEV_ID (1)
 
+// The pcm only ever runs this, every stream is converted to it so none reconfigures the TDM
+#define HW_RATE (48000)
+#define HW_CHANNELS AUDIO_MIXER_CHANNELS
+#define HW_FORMAT PCM_FORMAT_S32_LE
+#define HW_BITS (32U)
+
 #define VOLUME_DEFAULT (50)
 
+// MMAP mode keeps only MMAP_PERIOD_COUNT short periods in the DMA ring, ~10ms at 48kHz
+#define MMAP_PERIOD_SIZE (256)
+#define MMAP_PERIOD_SIZE_MIN (64)
+#define MMAP_PERIOD_SIZE_MAX (1024)
+#define MMAP_PERIOD_COUNT (2)
+#define MMAP_WAIT_MS (100)
+#define MMAP_THREAD_PRIORITY (2)
+
+#define LANE_VOLUME_MAX (255U)
+
+#define MIXER_PERIOD_DEFAULT (512)
+#define MIXER_WRITE_TIMEOUT_MS (1000)
+#define MIXER_RETRY_MS (100)
+#define MS_PER_SEC (1000)
+#define NSEC_PER_USEC (1000)
+#define NSEC_PER_MSEC (1000000)
+#define NSEC_PER_SEC (1000000000)
+
+// How long an idle pcm keeps running on silence before it is closed, 0 closes it right away
+#ifndef RENDER_STANDBY_MS
+#define RENDER_STANDBY_MS (3000)
+#endif
+#define STANDBY_SILENCE_FRAMES (1024)
+
+enum AlsaPcmState {
+    ALSA_PCM_CLOSED = 0,
+    ALSA_PCM_STANDBY, // open and fed with silence, nothing to mix
+    ALSA_PCM_ACTIVE,
+};
+
+struct AlsaMmapCtx {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    atomic_bool running;
+    bool active;
+
+    // The framework's shared ring, the DMA ring is filled from it at the hardware pace
+    uint8_t *ring;
+    uint32_t ringFrames;
+    uint32_t frameBytes;
+
+    uint64_t framesCommitted; // frames taken from the framework ring since the stream started
+    uint32_t xruns;
+
+    // From the owner's format to the hardware's, then its volume and mute on the DMA ring
+    struct AudioConverter conv;
+    struct AudioSoftGain gain;
+
+    const struct AlsaDevObject *owner; // the one render stream the DMA ring belongs to
+};
+
 struct AlsaCtx {
-    struct pcm *pcmHandler;
+    struct AudioPcm *pcmHandler;
     struct pcm_config config;
     struct mixer *mixerHandler;
+    struct mixer_ctl *laneVolumeCtl; // looked up once, the master level
 
     int initFlag;
     int renderRefCount;
@@ -48,15 +112,70 @@ struct AlsaCtx {
     float gainMax;
 
     bool mute;
+
+    struct AlsaMmapCtx mmap;
+
+    // Render streams are mixed into the one pcm, which runs the HW_ format and is owned by mixerThread
+    struct AudioMixer mixer;
+    struct AlsaDevObject *renders[AUDIO_MIXER_MAX_STREAMS];
+    pthread_mutex_t mixerLock;
+    pthread_cond_t mixerCond; // a stream started or got its first data, or the thread has to quit
+    pthread_cond_t spaceCond; // the mixer consumed a period, or a stream stopped
+    pthread_t mixerThread;
+    bool mixerActive;
+    bool mixerQuit;
+    uint32_t xruns;
+
+    enum AlsaPcmState pcmState;
+    uint64_t standbySinceNs;
 };
 
 static struct AlsaCtx s_alsaCtx = {.initFlag = 0};
+// Serializes bind/close and every command except the data path, streams come from several clients at once
+static pthread_mutex_t s_ctlLock = PTHREAD_MUTEX_INITIALIZER;
 
 struct AlsaDevObject {
     char serviceName[64];
     struct AlsaCtx *pAlsaCtx;
+
+    // Render handles only
+    struct AudioMixerStream *stream;
+    struct pcm_config config; // the stream's own format
+    const struct AudioHwRenderParam *param;
+    int volume;
+    bool mute;
+
+    // Time to first sample: from START until the first written frame is due at the DAC
+    enum AlsaPcmState startState; // what the pcm was doing when the stream started
+    uint64_t startNs;
+    uint64_t startCallNs; // time spent in START itself
+    bool firstSampleSeen;
 };
 
+static const int32_t s_silence[STANDBY_SILENCE_FRAMES * HW_CHANNELS];
+
+static const char *g_pcmStateName[] = {"closed", "standby", "active"};
+
+static uint64_t MonotonicNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+// Absolute CLOCK_REALTIME deadline for pthread_cond_timedwait()
+static void DeadlineAfter(struct timespec *deadline, uint64_t ns)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += (time_t)(ns / NSEC_PER_SEC);
+    deadline->tv_nsec += (long)(ns % NSEC_PER_SEC);
+    if (deadline->tv_nsec >= NSEC_PER_SEC) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
 static enum pcm_format ConvertFormatToAlsa(enum AudioFormat format)
 {
     switch (format) {
@@ -125,32 +244,19 @@ static int32_t MixerInit(struct mixer *mixer)
     return ret;
 }
 
+// The lane volume is the master level only, volume and mute of the streams are applied in software
 static int32_t AlsaVolumeUpdate(struct AlsaCtx *aCtx)
 {
     int32_t ret = 0;
-    int volumeSet = 0;
 
-    if (!aCtx->mixerHandler) {
+    if (!aCtx->laneVolumeCtl) {
         return -1;
     }
 
-    if (aCtx->mute) {
-        volumeSet = 0;
-    } else {
-        volumeSet = aCtx->volume * 255U /
-                    (aCtx->volMax - aCtx->volMin); // need adjustment
-    }
-
-    ret |= mixer_ctl_set_value(
-        mixer_get_ctl_by_name(aCtx->mixerHandler, "TDMOUT_B Lane 0 Volume"), 0,
-        volumeSet);
-    ret |= mixer_ctl_set_value(
-        mixer_get_ctl_by_name(aCtx->mixerHandler, "TDMOUT_B Lane 0 Volume"), 1,
-        volumeSet);
+    ret |= mixer_ctl_set_value(aCtx->laneVolumeCtl, 0, LANE_VOLUME_MAX);
+    ret |= mixer_ctl_set_value(aCtx->laneVolumeCtl, 1, LANE_VOLUME_MAX);
 
-    HDF_LOGV("Set Volume: volume=%{public}d, mute=%{public}d, "
-             "volumeSet=%{public}d, ret=%{public}d",
-             aCtx->volume, aCtx->mute, volumeSet, ret);
+    HDF_LOGV("Set master volume: volumeSet=%{public}u, ret=%{public}d", LANE_VOLUME_MAX, ret);
 
     return ret;
 }
@@ -168,8 +274,17 @@ static struct AlsaCtx *AlsaCtxInstanceGet(void)
         s_alsaCtx.gainMax = 15.0f;
         s_alsaCtx.gain = s_alsaCtx.gainMax;
         s_alsaCtx.mute = false;
+        pthread_mutex_init(&s_alsaCtx.mmap.lock, NULL);
+        pthread_mutex_init(&s_alsaCtx.mixerLock, NULL);
+        pthread_cond_init(&s_alsaCtx.mixerCond, NULL);
+        pthread_cond_init(&s_alsaCtx.spaceCond, NULL);
+        AudioMixerInit(&s_alsaCtx.mixer, HW_RATE, MIXER_PERIOD_DEFAULT);
+        AudioMixerSetRamp(&s_alsaCtx.mixer, AudioSoftGainRampFrames(HW_RATE));
         s_alsaCtx.mixerHandler = mixer_open(SOUND_CARD_ID);
         MixerInit(s_alsaCtx.mixerHandler);
+        if (s_alsaCtx.mixerHandler) {
+            s_alsaCtx.laneVolumeCtl = mixer_get_ctl_by_name(s_alsaCtx.mixerHandler, "TDMOUT_B Lane 0 Volume");
+        }
         s_alsaCtx.initFlag = 1;
 
         AlsaVolumeUpdate(&s_alsaCtx);
@@ -195,12 +310,12 @@ static int AlsaOpen(struct AlsaCtx *aCtx)
 
     struct pcm_config config;
     (void)memcpy_s(&config, sizeof(config), &aCtx->config, sizeof(config));
-    struct pcm *pcm = pcm_open(sound_card_id, sound_dev_id, PCM_OUT, &config);
-    if (!pcm_is_ready(pcm)) {
+    struct AudioPcm *pcm = AudioPcmOpen(sound_card_id, sound_dev_id, PCM_OUT, &config);
+    if (!AudioPcmIsReady(pcm)) {
         HDF_LOGE("Error: %{public}s() Cannot open pcm_out(card %{public}d, "
                  "device %{public}d): %{public}s",
-                 __func__, sound_card_id, sound_dev_id, pcm_get_error(pcm));
-        pcm_close(pcm);
+                 __func__, sound_card_id, sound_dev_id, AudioPcmGetError(pcm));
+        AudioPcmClose(pcm);
 
         return -1;
     }
@@ -215,15 +330,305 @@ static int AlsaOpen(struct AlsaCtx *aCtx)
 static int AlsaClose(struct AlsaCtx *aCtx)
 {
     if (aCtx->pcmHandler) {
-        pcm_close(aCtx->pcmHandler);
+        AudioPcmClose(aCtx->pcmHandler);
         aCtx->pcmHandler = NULL;
     }
+    aCtx->pcmState = ALSA_PCM_CLOSED;
 
     HDF_LOGI("Close Alsa Success.");
 
     return 0;
 }
 
+/*
+ * The HDI hands the same AudioHwRenderParam of a render to both its data and its control
+ * handle, which is how a control command finds the stream it is meant for.
+ * Must be called with mixerLock held.
+ */
+static struct AlsaDevObject *RenderFind(struct AlsaCtx *aCtx, const struct DevHandle *handle,
+                                        const struct AudioHwRenderParam *param)
+{
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+
+    if (devObject->stream) {
+        return devObject;
+    }
+
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        if (aCtx->renders[i] && aCtx->renders[i]->param == param) {
+            return aCtx->renders[i];
+        }
+    }
+
+    return NULL;
+}
+
+// The inverse of the framework's volume = (volMax - volMin) / 2 * log10(Vol) + volMin, Vol in [1, 100]
+static float VolumeToGain(const struct AlsaCtx *aCtx, int volume, bool mute)
+{
+    if (mute || volume <= aCtx->volMin) {
+        return 0.0f;
+    }
+
+    // volMin..volMax spans -40..0 dB
+    return AudioSoftGainFromDb(40.0f * (float)(volume - aCtx->volMax) / (float)(aCtx->volMax - aCtx->volMin));
+}
+
+// Must be called with mixerLock held
+static void RenderUpdateGain(struct AlsaDevObject *render)
+{
+    struct AlsaCtx *aCtx = render->pAlsaCtx;
+    float linear = VolumeToGain(aCtx, render->volume, render->mute);
+
+    AudioMixerStreamSetVolume(render->stream, linear);
+    if (aCtx->mmap.owner == render) {
+        pthread_mutex_lock(&aCtx->mmap.lock);
+        AudioSoftGainSetTarget(&aCtx->mmap.gain, linear);
+        pthread_mutex_unlock(&aCtx->mmap.lock);
+    }
+}
+
+// Must be called with mixerLock held
+static bool OtherStreamRunning(struct AlsaCtx *aCtx, const struct AudioMixerStream *self)
+{
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        const struct AudioMixerStream *stream = &aCtx->mixer.streams[i];
+        if (stream != self && stream->inUse && stream->running) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t FormatBits(enum pcm_format format)
+{
+    switch (format) {
+        case PCM_FORMAT_S8:
+            return 8U;
+        case PCM_FORMAT_S24_LE:
+            return 24U;
+        case PCM_FORMAT_S32_LE:
+            return 32U;
+        default:
+            return 16U;
+    }
+}
+
+// The same span of time in frames at HW_RATE
+static uint32_t ToHwFrames(uint32_t frames, uint32_t rate)
+{
+    return rate ? (uint32_t)((uint64_t)frames * HW_RATE / rate) : frames;
+}
+
+// Frames written to the pcm that the DAC has not played yet
+static uint32_t MixerQueuedFrames(struct AudioPcm *pcm)
+{
+    unsigned int avail = 0;
+    struct timespec ts;
+    unsigned int bufferFrames = AudioPcmGetBufferSize(pcm);
+
+    if (AudioPcmGetHtimestamp(pcm, &avail, &ts) != 0 || avail >= bufferFrames) {
+        return 0;
+    }
+
+    return bufferFrames - avail;
+}
+
+static void MixerWriteSilence(struct AlsaCtx *aCtx, struct AudioPcm *pcm, uint32_t frames)
+{
+    while (frames > 0) {
+        uint32_t chunk = frames < STANDBY_SILENCE_FRAMES ? frames : STANDBY_SILENCE_FRAMES;
+        if (AudioPcmWrite(pcm, s_silence, chunk * HW_CHANNELS * sizeof(int32_t)) < 0) {
+            aCtx->xruns++;
+            HDF_LOGW("Warn: standby AudioPcmWrite() failed: %{public}s", AudioPcmGetError(pcm));
+            return;
+        }
+        frames -= chunk;
+    }
+}
+
+/*
+ * While there is only silence to play, waits for half a period if a period is queued already,
+ * or until a stream starts or is written to. Called with mixerLock held.
+ */
+static bool MixerWaitQueued(struct AlsaCtx *aCtx, struct AudioPcm *pcm)
+{
+    uint32_t period = aCtx->mixer.periodFrames;
+
+    if (MixerQueuedFrames(pcm) < period) {
+        return false;
+    }
+
+    struct timespec deadline;
+    DeadlineAfter(&deadline, (uint64_t)period * NSEC_PER_SEC / (2U * aCtx->config.rate));
+    pthread_cond_timedwait(&aCtx->mixerCond, &aCtx->mixerLock, &deadline);
+
+    return true;
+}
+
+// Called with mixerLock held
+static bool MixerHasData(const struct AlsaCtx *aCtx)
+{
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        const struct AudioMixerStream *stream = &aCtx->mixer.streams[i];
+        if (stream->inUse && stream->running && stream->primed && !stream->paused) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Nothing to mix: keep the pcm prepared and running on silence until RENDER_STANDBY_MS has
+ * passed, so a stream starting meanwhile skips AudioPcmOpen() and the depop. Only about one
+ * period is kept queued, which bounds what a resuming stream waits behind.
+ * Called with mixerLock held, returns after one step of waiting or writing.
+ */
+static void MixerIdle(struct AlsaCtx *aCtx)
+{
+    if (!aCtx->pcmHandler) {
+        pthread_cond_wait(&aCtx->mixerCond, &aCtx->mixerLock);
+        return;
+    }
+
+    uint64_t now = MonotonicNs();
+    if (aCtx->pcmState != ALSA_PCM_STANDBY) {
+        aCtx->pcmState = ALSA_PCM_STANDBY;
+        aCtx->standbySinceNs = now;
+        HDF_LOGI("Render pcm enters standby for %{public}d ms", RENDER_STANDBY_MS);
+    }
+    if (now - aCtx->standbySinceNs >= (uint64_t)RENDER_STANDBY_MS * NSEC_PER_MSEC) {
+        HDF_LOGI("Render pcm standby timed out");
+        AlsaClose(aCtx);
+        return;
+    }
+
+    struct AudioPcm *pcm = aCtx->pcmHandler;
+    uint32_t period = aCtx->mixer.periodFrames;
+    if (MixerWaitQueued(aCtx, pcm)) {
+        return;
+    }
+
+    pthread_mutex_unlock(&aCtx->mixerLock);
+    MixerWriteSilence(aCtx, pcm, period);
+    pthread_mutex_lock(&aCtx->mixerLock);
+}
+
+// Called with mixerLock held, right after a period was mixed and before it is written
+static void MixerReportFirstSample(struct AlsaCtx *aCtx, struct AudioPcm *pcm)
+{
+    uint64_t dueNs = 0;
+
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        struct AlsaDevObject *render = aCtx->renders[i];
+        if (!render || render->firstSampleSeen || !render->stream->running || render->stream->readFrames == 0) {
+            continue;
+        }
+        if (dueNs == 0) {
+            // The new frames play once everything already queued has
+            dueNs = MonotonicNs() + (uint64_t)MixerQueuedFrames(pcm) * NSEC_PER_SEC / aCtx->config.rate;
+        }
+        render->firstSampleSeen = true;
+        HDF_LOGI("Render stream %{public}d time to first sample %{public}llu us, started from %{public}s "
+                 "in %{public}llu us",
+                 i, (unsigned long long)((dueNs - render->startNs) / NSEC_PER_USEC),
+                 g_pcmStateName[render->startState], (unsigned long long)(render->startCallNs / NSEC_PER_USEC));
+    }
+}
+
+static void *MixerThread(void *arg)
+{
+    struct AlsaCtx *aCtx = (struct AlsaCtx *)arg;
+    int32_t *out = NULL;
+    uint32_t outFrames = 0;
+
+    prctl(PR_SET_NAME, "alsa_mixer");
+
+    pthread_mutex_lock(&aCtx->mixerLock);
+    while (!aCtx->mixerQuit) {
+        if (!AudioMixerAnyRunning(&aCtx->mixer)) {
+            MixerIdle(aCtx);
+            continue;
+        }
+
+        if (!aCtx->pcmHandler && AlsaOpen(aCtx) < 0) {
+            // Writers time out rather than block for good
+            pthread_mutex_unlock(&aCtx->mixerLock);
+            usleep(MIXER_RETRY_MS * 1000);
+            pthread_mutex_lock(&aCtx->mixerLock);
+            continue;
+        }
+        aCtx->pcmState = ALSA_PCM_ACTIVE;
+
+        // Streams started but not written yet: queue no more silence than standby does
+        if (!MixerHasData(aCtx) && MixerWaitQueued(aCtx, aCtx->pcmHandler)) {
+            continue;
+        }
+
+        uint32_t period = aCtx->mixer.periodFrames;
+        if (outFrames != period) {
+            int32_t *buf = realloc(out, (size_t)period * HW_CHANNELS * sizeof(int32_t));
+            if (!buf) {
+                break;
+            }
+            out = buf;
+            outFrames = period;
+        }
+
+        // Only this thread opens and closes the pcm while it runs, so it can be written unlocked
+        struct AudioPcm *pcm = aCtx->pcmHandler;
+        AudioMixerMix(&aCtx->mixer, out);
+        MixerReportFirstSample(aCtx, pcm);
+        pthread_cond_broadcast(&aCtx->spaceCond);
+
+        pthread_mutex_unlock(&aCtx->mixerLock);
+        if (AudioPcmWrite(pcm, out, period * HW_CHANNELS * sizeof(int32_t)) < 0) {
+            aCtx->xruns++;
+            HDF_LOGW("Warn: mixer AudioPcmWrite() failed: %{public}s", AudioPcmGetError(pcm));
+        }
+        pthread_mutex_lock(&aCtx->mixerLock);
+    }
+    pthread_mutex_unlock(&aCtx->mixerLock);
+
+    free(out);
+
+    return NULL;
+}
+
+static int MixerStart(struct AlsaCtx *aCtx)
+{
+    if (aCtx->mixerActive) {
+        return 0;
+    }
+
+    aCtx->mixerQuit = false;
+    if (pthread_create(&aCtx->mixerThread, NULL, MixerThread, aCtx) != 0) {
+        HDF_LOGE("Error: %{public}s() create thread failed", __func__);
+        return -1;
+    }
+    aCtx->mixerActive = true;
+
+    return 0;
+}
+
+static void MixerStop(struct AlsaCtx *aCtx)
+{
+    if (!aCtx->mixerActive) {
+        return;
+    }
+
+    pthread_mutex_lock(&aCtx->mixerLock);
+    aCtx->mixerQuit = true;
+    pthread_cond_broadcast(&aCtx->mixerCond);
+    pthread_mutex_unlock(&aCtx->mixerLock);
+
+    pthread_join(aCtx->mixerThread, NULL);
+    aCtx->mixerActive = false;
+    AlsaClose(aCtx);
+}
+
 static int CheckHwParam(struct AudioHwRenderParam *handleData)
 {
     if (handleData == NULL) {
@@ -249,7 +654,7 @@ static int CheckHwParam(struct AudioHwRenderParam *handleData)
     return 0;
 }
 
-static int AlsaConfig(struct AlsaCtx *aCtx, struct AudioHwRenderParam *handleData)
+static int AlsaConfig(struct AlsaCtx *aCtx, struct AlsaDevObject *devObject, struct AudioHwRenderParam *handleData)
 {
     struct pcm_config config;
     enum pcm_format format;
@@ -275,14 +680,6 @@ static int AlsaConfig(struct AlsaCtx *aCtx, struct AudioHwRenderParam *handleDat
     config.stop_threshold = handleData->frameRenderMode.attrs.stopThreshold;
     config.silence_threshold = handleData->frameRenderMode.attrs.silenceThreshold;
 
-#ifdef PLEASURE_HATS
-    if (config.rate == 12000) {
-        config.rate = 8000;
-    } else if (config.rate == 24000) {
-        config.rate = 22050;
-    }
-#endif
-
     HDF_LOGV("DUMP Alsa Config 1#: channels=%{public}d, rate=%{public}d, "
              "format=%{public}d, period_count=%{public}d, period_size=%{public}d",
              config.channels, config.rate, config.format, config.period_count, config.period_size);
@@ -292,16 +689,55 @@ static int AlsaConfig(struct AlsaCtx *aCtx, struct AudioHwRenderParam *handleDat
              aCtx->config.channels, aCtx->config.rate, aCtx->config.format,
              aCtx->config.period_count, aCtx->config.period_size);
 
-    if (aCtx->pcmHandler && !memcmp(&config, &aCtx->config, sizeof(config))) {
+    (void)memcpy_s(&devObject->config, sizeof(devObject->config), &config, sizeof(config));
+
+    // The stream is converted to what the pcm always runs, only the timing follows the stream
+    config.channels = HW_CHANNELS;
+    config.rate = HW_RATE;
+    config.format = HW_FORMAT;
+    config.period_size = ToHwFrames(config.period_size, devObject->config.rate);
+    config.start_threshold = ToHwFrames(config.start_threshold, devObject->config.rate);
+    config.stop_threshold = ToHwFrames(config.stop_threshold, devObject->config.rate);
+    config.silence_threshold = ToHwFrames(config.silence_threshold, devObject->config.rate);
+
+    struct AudioConverterFormat streamFormat = {
+        devObject->config.rate, devObject->config.channels, FormatBits(devObject->config.format)
+    };
+    const struct AudioConverterFormat *in = &devObject->stream->conv.in;
+
+    pthread_mutex_lock(&aCtx->mixerLock);
+    devObject->param = handleData;
+    if (in->rate != streamFormat.rate || in->channels != streamFormat.channels || in->bits != streamFormat.bits) {
+        // The converter is only swapped while the stream is stopped
+        AudioMixerStreamStop(devObject->stream);
+        if (AudioMixerStreamSetFormat(&aCtx->mixer, devObject->stream, &streamFormat) < 0) {
+            pthread_mutex_unlock(&aCtx->mixerLock);
+            HDF_LOGE("Error: in %{public}s, no converter from %{public}u Hz %{public}u ch %{public}u bits",
+                     __func__, streamFormat.rate, streamFormat.channels, streamFormat.bits);
+            return -1;
+        }
+    }
+    if (!memcmp(&config, &aCtx->config, sizeof(config))) {
+        pthread_mutex_unlock(&aCtx->mixerLock);
         HDF_LOGW("Warn: Same Audio Hw config. No need to change.");
         return 0;
     }
+    if (OtherStreamRunning(aCtx, devObject->stream)) {
+        pthread_mutex_unlock(&aCtx->mixerLock);
+        // Another stream owns the period size, the rings adapt to it
+        return 0;
+    }
+    AudioMixerStreamStop(devObject->stream);
+    pthread_mutex_unlock(&aCtx->mixerLock);
 
+    // Nothing is playing, the mixer reopens the pcm with the new config on the next start
+    MixerStop(aCtx);
+    pthread_mutex_lock(&aCtx->mixerLock);
     (void)memcpy_s(&aCtx->config, sizeof(aCtx->config), &config, sizeof(config));
-
-    AlsaClose(aCtx);
-    if (AlsaOpen(aCtx) < 0) {
-        HDF_LOGE("Error: in %{public}s, AlsaOpen() failed.", __func__);
+    int ret = AudioMixerSetPeriod(&aCtx->mixer, config.period_size);
+    pthread_mutex_unlock(&aCtx->mixerLock);
+    if (ret < 0) {
+        HDF_LOGE("Error: in %{public}s, AudioMixerSetPeriod() failed.", __func__);
         return -1;
     }
 
@@ -327,7 +763,15 @@ static int32_t DoCtlRenderSetVolume(const struct DevHandle *handle, int cmdId,
 
     aCtx->volume = volume;
 
-    return AlsaVolumeUpdate(aCtx);
+    pthread_mutex_lock(&aCtx->mixerLock);
+    struct AlsaDevObject *render = RenderFind(aCtx, handle, handleData);
+    if (render) {
+        render->volume = volume;
+        RenderUpdateGain(render);
+    }
+    pthread_mutex_unlock(&aCtx->mixerLock);
+
+    return render ? HDF_SUCCESS : HDF_FAILURE;
 }
 
 static int32_t DoCtlRenderGetVolume(const struct DevHandle *handle, int cmdId,
@@ -335,7 +779,10 @@ static int32_t DoCtlRenderGetVolume(const struct DevHandle *handle, int cmdId,
 {
     struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
 
-    handleData->renderMode.ctlParam.volume = aCtx->volume;
+    pthread_mutex_lock(&aCtx->mixerLock);
+    struct AlsaDevObject *render = RenderFind(aCtx, handle, handleData);
+    handleData->renderMode.ctlParam.volume = render ? render->volume : aCtx->volume;
+    pthread_mutex_unlock(&aCtx->mixerLock);
 
     return HDF_SUCCESS;
 }
@@ -345,15 +792,26 @@ static int32_t DoCtlRenderSetPauseStu(const struct DevHandle *handle, int cmdId,
 {
     struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
 
+    if (!aCtx->mmap.active) {
+        // Only this stream pauses, the others keep playing
+        pthread_mutex_lock(&aCtx->mixerLock);
+        struct AlsaDevObject *render = RenderFind(aCtx, handle, handleData);
+        if (render) {
+            AudioMixerStreamSetPaused(render->stream, handleData->renderMode.ctlParam.pause);
+            pthread_cond_broadcast(&aCtx->spaceCond);
+        }
+        pthread_mutex_unlock(&aCtx->mixerLock);
+        return render ? HDF_SUCCESS : HDF_FAILURE;
+    }
+
     if (!((struct AlsaCtx *)aCtx)->pcmHandler) {
         HDF_LOGE("Error: in %{public}s, Pcm is not opened!", __func__);
         return HDF_FAILURE;
     }
 
-    if (pcm_ioctl(aCtx->pcmHandler, SNDRV_PCM_IOCTL_PAUSE,
-                  handleData->renderMode.ctlParam.pause ? 1 : 0) < 0) {
-        HDF_LOGE("Error: pcm_ioctl(SNDRV_PCM_IOCTL_PAUSE) failed: %{public}s\n",
-                 pcm_get_error(aCtx->pcmHandler));
+    if (AudioPcmPause(aCtx->pcmHandler, handleData->renderMode.ctlParam.pause) < 0) {
+        HDF_LOGE("Error: AudioPcmPause() failed: %{public}s\n",
+                 AudioPcmGetError(aCtx->pcmHandler));
         return HDF_FAILURE;
     }
 
@@ -367,7 +825,15 @@ static int32_t DoCtlRenderSetMuteStu(const struct DevHandle *handle, int cmdId,
 
     aCtx->mute = handleData->renderMode.ctlParam.mute;
 
-    return AlsaVolumeUpdate(aCtx);
+    pthread_mutex_lock(&aCtx->mixerLock);
+    struct AlsaDevObject *render = RenderFind(aCtx, handle, handleData);
+    if (render) {
+        render->mute = aCtx->mute;
+        RenderUpdateGain(render);
+    }
+    pthread_mutex_unlock(&aCtx->mixerLock);
+
+    return render ? HDF_SUCCESS : HDF_FAILURE;
 }
 
 static int32_t DoCtlRenderGetMuteStu(const struct DevHandle *handle, int cmdId,
@@ -375,7 +841,10 @@ static int32_t DoCtlRenderGetMuteStu(const struct DevHandle *handle, int cmdId,
 {
     struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
 
-    handleData->renderMode.ctlParam.mute = aCtx->mute;
+    pthread_mutex_lock(&aCtx->mixerLock);
+    struct AlsaDevObject *render = RenderFind(aCtx, handle, handleData);
+    handleData->renderMode.ctlParam.mute = render ? render->mute : aCtx->mute;
+    pthread_mutex_unlock(&aCtx->mixerLock);
 
     return HDF_SUCCESS;
 }
@@ -510,14 +979,217 @@ static int32_t HandleCtlRenderCmd(const struct DevHandle *handle, int cmdId,
     return HDF_FAILURE;
 }
 
+// Converts frames of the framework ring into the DMA ring, wrapping around the end of the former
+static void MmapFillDma(struct AlsaCtx *aCtx, uint8_t *dma, uint32_t frames)
+{
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    uint32_t dmaFrameBytes = AudioConverterFrameBytes(&mCtx->conv.out);
+    uint32_t need = AudioConverterInFrames(&mCtx->conv, frames);
+    uint32_t done = 0;
+
+    // Whatever the converter still holds goes out first, even when no input is needed
+    do {
+        uint32_t pos = (uint32_t)(mCtx->framesCommitted % mCtx->ringFrames);
+        uint32_t chunk = mCtx->ringFrames - pos;
+        if (chunk > need) {
+            chunk = need;
+        }
+        done += AudioConverterProcess(&mCtx->conv, mCtx->ring + pos * mCtx->frameBytes, chunk,
+                                      dma + done * dmaFrameBytes, frames - done);
+        mCtx->framesCommitted += chunk;
+        need -= chunk;
+    } while (need > 0);
+
+    (void)AudioSoftGainApply(&mCtx->gain, dma, done, HW_CHANNELS, HW_BITS);
+}
+
+// Must be called with mmap.lock held
+static int MmapTransfer(struct AlsaCtx *aCtx)
+{
+    int avail = AudioPcmMmapAvail(aCtx->pcmHandler);
+    if (avail < 0) {
+        return avail;
+    }
+
+    while (avail > 0) {
+        void *area = NULL;
+        unsigned int offset = 0;
+        unsigned int frames = (unsigned int)avail;
+        if (AudioPcmMmapBegin(aCtx->pcmHandler, &area, &offset, &frames) < 0 || frames == 0) {
+            return -1;
+        }
+        MmapFillDma(aCtx, (uint8_t *)area + AudioPcmFramesToBytes(aCtx->pcmHandler, offset), frames);
+        if (AudioPcmMmapCommit(aCtx->pcmHandler, offset, frames) < 0) {
+            return -1;
+        }
+        avail -= (int)frames;
+    }
+
+    return 0;
+}
+
+// Must be called with mmap.lock held
+static int MmapStartDma(struct AlsaCtx *aCtx)
+{
+    if (AudioPcmPrepare(aCtx->pcmHandler) < 0 || MmapTransfer(aCtx) < 0) {
+        return -1;
+    }
+
+    return AudioPcmStart(aCtx->pcmHandler);
+}
+
+static void *MmapRenderThread(void *arg)
+{
+    struct AlsaCtx *aCtx = (struct AlsaCtx *)arg;
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    struct sched_param param = {.sched_priority = MMAP_THREAD_PRIORITY};
+
+    prctl(PR_SET_NAME, "alsa_mmap_out");
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        HDF_LOGW("Warn: %{public}s no SCHED_FIFO, keep the default policy", __func__);
+    }
+
+    while (mCtx->running) {
+        int ret = AudioPcmWait(aCtx->pcmHandler, MMAP_WAIT_MS);
+
+        pthread_mutex_lock(&mCtx->lock);
+        if (ret >= 0) {
+            ret = MmapTransfer(aCtx);
+        }
+        if (ret < 0 && mCtx->running) {
+            // Underrun: the hardware stopped, refill from where the framework ring is and restart
+            mCtx->xruns++;
+            AudioPcmStop(aCtx->pcmHandler);
+            ret = MmapStartDma(aCtx);
+        }
+        pthread_mutex_unlock(&mCtx->lock);
+
+        if (ret < 0) {
+            // The device is gone or wedged, do not spin on it
+            usleep(MMAP_WAIT_MS * 1000);
+        }
+    }
+
+    return NULL;
+}
+
+static void MmapStop(struct AlsaCtx *aCtx)
+{
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+
+    if (!mCtx->active) {
+        return;
+    }
+
+    mCtx->running = false;
+    pthread_join(mCtx->thread, NULL);
+
+    // The position query reads the pcm and the converter under mmap.lock
+    pthread_mutex_lock(&mCtx->lock);
+    mCtx->active = false;
+    mCtx->owner = NULL;
+    AudioConverterDeinit(&mCtx->conv);
+
+    // The mmap pcm is of no use to the mixer, which opens its own on the next start
+    AlsaClose(aCtx);
+    pthread_mutex_unlock(&mCtx->lock);
+
+    HDF_LOGI("MMAP render stopped: %{public}llu frames, %{public}u xruns",
+             (unsigned long long)mCtx->framesCommitted, mCtx->xruns);
+}
+
+static int MmapOpen(struct AlsaCtx *aCtx, const struct pcm_config *streamConfig,
+                    const struct AudioMmapBufferDescripter *desc, float volume)
+{
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    struct pcm_config config;
+    uint32_t periodSize = MMAP_PERIOD_SIZE;
+    struct AudioConverterFormat in = {streamConfig->rate, streamConfig->channels, FormatBits(streamConfig->format)};
+    struct AudioConverterFormat out = {HW_RATE, HW_CHANNELS, HW_BITS};
+
+    if (desc->transferFrameSize >= MMAP_PERIOD_SIZE_MIN && desc->transferFrameSize <= MMAP_PERIOD_SIZE_MAX) {
+        periodSize = ToHwFrames((uint32_t)desc->transferFrameSize, streamConfig->rate);
+    }
+
+    (void)memset_s(&config, sizeof(config), 0, sizeof(config));
+    config.channels = HW_CHANNELS;
+    config.rate = HW_RATE;
+    config.format = HW_FORMAT;
+    config.period_size = periodSize;
+    config.period_count = MMAP_PERIOD_COUNT;
+    config.start_threshold = periodSize;
+    config.stop_threshold = periodSize * MMAP_PERIOD_COUNT;
+    config.silence_threshold = 0;
+    config.avail_min = periodSize;
+
+    if (AudioConverterInit(&mCtx->conv, &in, &out) < 0) {
+        HDF_LOGE("Error: %{public}s() no converter from %{public}u Hz %{public}u ch %{public}u bits",
+                 __func__, in.rate, in.channels, in.bits);
+        return -1;
+    }
+
+    AlsaClose(aCtx);
+    struct AudioPcm *pcm = AudioPcmOpen(SOUND_CARD_ID, SOUND_DEV_ID, PCM_OUT | PCM_MMAP | PCM_MONOTONIC, &config);
+    if (!AudioPcmIsReady(pcm)) {
+        HDF_LOGE("Error: %{public}s() Cannot open mmap pcm_out: %{public}s", __func__, AudioPcmGetError(pcm));
+        AudioPcmClose(pcm);
+        AudioConverterDeinit(&mCtx->conv);
+        return -1;
+    }
+    aCtx->pcmHandler = pcm;
+
+    mCtx->ring = (uint8_t *)desc->memoryAddress;
+    mCtx->ringFrames = (uint32_t)desc->totalBufferFrames;
+    mCtx->frameBytes = AudioConverterFrameBytes(&in);
+    mCtx->framesCommitted = 0;
+    mCtx->xruns = 0;
+    AudioSoftGainInit(&mCtx->gain, volume, AudioSoftGainRampFrames(HW_RATE));
+
+    pthread_mutex_lock(&mCtx->lock);
+    int ret = MmapStartDma(aCtx);
+    pthread_mutex_unlock(&mCtx->lock);
+    if (ret < 0) {
+        HDF_LOGE("Error: %{public}s() start dma failed: %{public}s", __func__, AudioPcmGetError(pcm));
+        AlsaClose(aCtx);
+        AudioConverterDeinit(&mCtx->conv);
+        return -1;
+    }
+
+    mCtx->running = true;
+    if (pthread_create(&mCtx->thread, NULL, MmapRenderThread, aCtx) != 0) {
+        HDF_LOGE("Error: %{public}s() create thread failed", __func__);
+        mCtx->running = false;
+        AlsaClose(aCtx);
+        AudioConverterDeinit(&mCtx->conv);
+        return -1;
+    }
+    pthread_mutex_lock(&mCtx->lock);
+    mCtx->active = true;
+    pthread_mutex_unlock(&mCtx->lock);
+
+    HDF_LOGI("MMAP render started: ring %{public}u frames, dma %{public}u x %{public}u frames",
+             mCtx->ringFrames, MMAP_PERIOD_COUNT, periodSize);
+
+    return 0;
+}
+
 static int32_t DoOutputRenderHwParams(const struct DevHandle *handle, int cmdId,
                                       struct AudioHwRenderParam *handleData)
 {
-    struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
 
     HDF_LOGV("INFO: enter %{public}s()", __func__);
 
-    if (AlsaConfig(aCtx, handleData) < 0) {
+    if (!devObject->stream) {
+        HDF_LOGE("Error: in %{public}s, not a render handle!", __func__);
+        return HDF_FAILURE;
+    }
+
+    if (aCtx->mmap.owner == devObject) {
+        MmapStop(aCtx);
+    }
+    if (AlsaConfig(aCtx, devObject, handleData) < 0) {
         HDF_LOGE("Error: in %{public}s, AlsaConfig() failed.", __func__);
         return HDF_FAILURE;
     }
@@ -528,10 +1200,13 @@ static int32_t DoOutputRenderHwParams(const struct DevHandle *handle, int cmdId,
 static int32_t DoOutputRenderWrite(const struct DevHandle *handle, int cmdId,
                                    struct AudioHwRenderParam *handleData)
 {
-    struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
+    struct AudioMixerStream *stream = devObject->stream;
+    int32_t ret = HDF_SUCCESS;
 
-    if (!((struct AlsaCtx *)aCtx)->pcmHandler) {
-        HDF_LOGE("Error: in %{public}s, Pcm is not opened!", __func__);
+    if (aCtx->mmap.active) {
+        HDF_LOGE("Error: %{public}s, render is in mmap mode", __func__);
         return HDF_FAILURE;
     }
 
@@ -541,57 +1216,126 @@ static int32_t DoOutputRenderWrite(const struct DevHandle *handle, int cmdId,
         return HDF_FAILURE;
     }
 
-    if (pcm_write(aCtx->pcmHandler, handleData->frameRenderMode.buffer,
-                  handleData->frameRenderMode.bufferSize) < 0) {
-        HDF_LOGE("Error: pcm_write() failed: %{public}s\n",
-                 pcm_get_error(aCtx->pcmHandler));
+    if (!stream) {
+        HDF_LOGE("Error: in %{public}s, no mixer stream!", __func__);
         return HDF_FAILURE;
     }
 
-    return HDF_SUCCESS;
+    const uint8_t *data = (const uint8_t *)handleData->frameRenderMode.buffer;
+    uint32_t frameBytes = AudioMixerStreamFrameBytes(stream);
+    uint32_t frames = (uint32_t)(handleData->frameRenderMode.bufferSize / frameBytes);
+
+    struct timespec deadline;
+    DeadlineAfter(&deadline, (uint64_t)MIXER_WRITE_TIMEOUT_MS * NSEC_PER_MSEC);
+
+    // Blocks while the ring is full, which paces the client at the rate the mixer plays
+    pthread_mutex_lock(&aCtx->mixerLock);
+    if (!stream->running) {
+        pthread_mutex_unlock(&aCtx->mixerLock);
+        HDF_LOGE("Error: in %{public}s, Stream is not started!", __func__);
+        return HDF_FAILURE;
+    }
+    if (!stream->primed) {
+        // The mixer holds back silence until a stream has data, let it know
+        pthread_cond_broadcast(&aCtx->mixerCond);
+    }
+    while (frames > 0 && stream->running) {
+        uint32_t done = AudioMixerStreamWrite(stream, data, frames);
+        data += done * frameBytes;
+        frames -= done;
+        if (frames > 0 && pthread_cond_timedwait(&aCtx->spaceCond, &aCtx->mixerLock, &deadline) != 0) {
+            HDF_LOGE("Error: %{public}s, mixer did not take the data in time", __func__);
+            ret = HDF_FAILURE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&aCtx->mixerLock);
+
+    return ret;
 }
 
 static int32_t DoOutputRenderStartPrepare(const struct DevHandle *handle,
                                           int cmdId,
                                           struct AudioHwRenderParam *handleData)
 {
-    struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
 
     HDF_LOGV("INFO: enter %{public}s()", __func__);
 
-    AlsaOpen(aCtx);
+    if (aCtx->mmap.active) {
+        // The DMA was started when the mmap buffer was requested
+        return aCtx->mmap.owner == devObject ? HDF_SUCCESS : HDF_FAILURE;
+    }
 
-    if (!((struct AlsaCtx *)aCtx)->pcmHandler) {
-        HDF_LOGE("Error: in %{public}s, Pcm is not opened!", __func__);
+    if (!devObject->stream) {
+        HDF_LOGE("Error: in %{public}s, not a render handle!", __func__);
         return HDF_FAILURE;
     }
 
-    // NOTE: depop here
-    int bufsize = aCtx->config.period_count * aCtx->config.period_size;
-    char *buf = calloc(1, bufsize);
-    if (buf) {
-        pcm_write(aCtx->pcmHandler, buf, bufsize);
-        free(buf);
+    // START follows PREPARE, a running stream keeps what it has queued
+    uint64_t startNs = MonotonicNs();
+    pthread_mutex_lock(&aCtx->mixerLock);
+    int ret = 0;
+    bool started = false;
+    if (!devObject->stream->running) {
+        ret = AudioMixerStreamStart(&aCtx->mixer, devObject->stream);
+        RenderUpdateGain(devObject);
+        devObject->startState = aCtx->pcmState;
+        devObject->startNs = startNs;
+        devObject->firstSampleSeen = false;
+        started = true;
+        pthread_cond_broadcast(&aCtx->mixerCond);
     }
+    pthread_mutex_unlock(&aCtx->mixerLock);
 
-    usleep(10000);
+    // The mixer plays silence for a stream until its first write, which also covers depop
+    if (ret < 0 || MixerStart(aCtx) < 0) {
+        HDF_LOGE("Error: in %{public}s, start failed!", __func__);
+        return HDF_FAILURE;
+    }
+    if (started) {
+        pthread_mutex_lock(&aCtx->mixerLock);
+        devObject->startCallNs = MonotonicNs() - startNs;
+        pthread_mutex_unlock(&aCtx->mixerLock);
+    }
 
     return HDF_SUCCESS;
 }
 
+static void RenderStreamStop(struct AlsaDevObject *devObject)
+{
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
+    struct AudioMixerStream *stream = devObject->stream;
+
+    pthread_mutex_lock(&aCtx->mixerLock);
+    if (stream->running) {
+        HDF_LOGI("Render stream %{public}d stopped: %{public}u underruns, %{public}u device xruns",
+                 (int)(stream - aCtx->mixer.streams), stream->underruns, aCtx->xruns);
+    }
+    AudioMixerStreamStop(stream);
+    pthread_cond_broadcast(&aCtx->spaceCond);
+    pthread_mutex_unlock(&aCtx->mixerLock);
+}
+
 static int32_t DoOutputRenderStop(const struct DevHandle *handle, int cmdId,
                                   struct AudioHwRenderParam *handleData)
 {
-    struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
 
     HDF_LOGV("INFO: enter %{public}s()", __func__);
 
-    if (!((struct AlsaCtx *)aCtx)->pcmHandler) {
-        HDF_LOGE("Error: in %{public}s, Pcm is not opened!", __func__);
+    if (!devObject->stream) {
+        HDF_LOGE("Error: in %{public}s, not a render handle!", __func__);
         return HDF_FAILURE;
     }
 
-    AlsaClose(aCtx);
+    // Once no stream is left running the mixer keeps the pcm in standby, then closes it
+    if (aCtx->mmap.owner == devObject) {
+        MmapStop(aCtx);
+    }
+    RenderStreamStop(devObject);
 
     return HDF_SUCCESS;
 }
@@ -599,12 +1343,86 @@ static int32_t DoOutputRenderStop(const struct DevHandle *handle, int cmdId,
 static int32_t DoOutputRenderReqMmapBuffer(const struct DevHandle *handle, int cmdId,
                                            struct AudioHwRenderParam *handleData)
 {
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
+    const struct AudioMmapBufferDescripter *desc = &handleData->frameRenderMode.mmapBufDesc;
+
+    HDF_LOGV("INFO: enter %{public}s()", __func__);
+
+    if (!devObject->stream) {
+        HDF_LOGE("Error: in %{public}s, not a render handle!", __func__);
+        return HDF_FAILURE;
+    }
+
+    if (desc->memoryAddress == NULL || desc->totalBufferFrames <= 0) {
+        HDF_LOGE("Error: %{public}s invalid mmap buffer", __func__);
+        return HDF_FAILURE;
+    }
+
+    if (devObject->config.rate == 0) {
+        HDF_LOGE("Error: %{public}s hw params are not set", __func__);
+        return HDF_FAILURE;
+    }
+
+    // The DMA ring belongs to a single stream, the mixer has to be idle to hand it over
+    pthread_mutex_lock(&aCtx->mixerLock);
+    bool busy = OtherStreamRunning(aCtx, devObject->stream) ||
+                (aCtx->mmap.active && aCtx->mmap.owner != devObject);
+    if (!busy) {
+        AudioMixerStreamStop(devObject->stream);
+    }
+    pthread_mutex_unlock(&aCtx->mixerLock);
+    if (busy) {
+        HDF_LOGE("Error: %{public}s other streams are playing", __func__);
+        return HDF_FAILURE;
+    }
+
+    MmapStop(aCtx);
+    MixerStop(aCtx);
+    if (MmapOpen(aCtx, &devObject->config, desc, devObject->stream->volume) < 0) {
+        return HDF_FAILURE;
+    }
+    aCtx->mmap.owner = devObject;
+
     return HDF_SUCCESS;
 }
 
 static int32_t DoOutputRenderGetMmapPosition(const struct DevHandle *handle, int cmdId,
                                              struct AudioHwRenderParam *handleData)
 {
+    struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
+    struct AlsaMmapCtx *mCtx = &aCtx->mmap;
+    unsigned int avail = 0;
+    struct timespec tstamp = {0};
+    uint64_t played = 0;
+
+    if (!mCtx->active || !aCtx->pcmHandler) {
+        HDF_LOGE("Error: in %{public}s, mmap is not started!", __func__);
+        return HDF_FAILURE;
+    }
+
+    // Frames still queued in the DMA ring are committed but not played yet, counted at the stream's rate
+    pthread_mutex_lock(&mCtx->lock);
+    if (!mCtx->active || !aCtx->pcmHandler) {
+        // Stopped since the check above
+        pthread_mutex_unlock(&mCtx->lock);
+        return HDF_FAILURE;
+    }
+    int ret = AudioPcmGetHtimestamp(aCtx->pcmHandler, &avail, &tstamp);
+    if (ret == 0) {
+        uint64_t queued = (uint64_t)(AudioPcmGetBufferSize(aCtx->pcmHandler) - avail) * mCtx->conv.in.rate / HW_RATE;
+        played = mCtx->framesCommitted > queued ? mCtx->framesCommitted - queued : 0;
+    }
+    pthread_mutex_unlock(&mCtx->lock);
+
+    if (ret < 0) {
+        return HDF_FAILURE;
+    }
+
+    handleData->frameRenderMode.frames = played;
+    handleData->frameRenderMode.time.tvSec = tstamp.tv_sec;
+    handleData->frameRenderMode.time.tvNSec = tstamp.tv_nsec;
+
     return HDF_SUCCESS;
 }
 
@@ -617,11 +1435,17 @@ static int32_t DoOutputRenderOpen(const struct DevHandle *handle, int cmdId,
 static int32_t DoOutputRenderClose(const struct DevHandle *handle, int cmdId,
                                    struct AudioHwRenderParam *handleData)
 {
-    struct AlsaCtx *aCtx = ((struct AlsaDevObject *)handle->object)->pAlsaCtx;
+    struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
 
     HDF_LOGV("INFO: enter %{public}s()", __func__);
 
-    AlsaClose(aCtx);
+    if (aCtx->mmap.owner == devObject) {
+        MmapStop(aCtx);
+    }
+    if (devObject->stream) {
+        RenderStreamStop(devObject);
+    }
 
     return HDF_SUCCESS;
 }
@@ -667,29 +1491,64 @@ static int32_t HandleOutputRenderCmd(const struct DevHandle *handle, int cmdId,
     return ret;
 }
 
+static int RenderAttach(struct AlsaDevObject *devObject)
+{
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
+    int ret = -1;
+
+    pthread_mutex_lock(&aCtx->mixerLock);
+    devObject->stream = AudioMixerStreamAlloc(&aCtx->mixer);
+    for (int i = 0; devObject->stream && i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        if (!aCtx->renders[i]) {
+            aCtx->renders[i] = devObject;
+            devObject->volume = aCtx->volume;
+            devObject->mute = aCtx->mute;
+            RenderUpdateGain(devObject);
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&aCtx->mixerLock);
+
+    return ret;
+}
+
+static void RenderDetach(struct AlsaDevObject *devObject)
+{
+    struct AlsaCtx *aCtx = devObject->pAlsaCtx;
+
+    if (aCtx->mmap.owner == devObject) {
+        MmapStop(aCtx);
+    }
+
+    pthread_mutex_lock(&aCtx->mixerLock);
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        if (aCtx->renders[i] == devObject) {
+            aCtx->renders[i] = NULL;
+        }
+    }
+    AudioMixerStreamFree(devObject->stream);
+    devObject->stream = NULL;
+    pthread_cond_broadcast(&aCtx->spaceCond);
+    pthread_mutex_unlock(&aCtx->mixerLock);
+}
+
 /************************************************************************************
     Exported Interface
 *************************************************************************************/
 
-/* CreatRender for Bind handle */
-struct DevHandle *AudioBindServiceRender(const char *name)
+static struct DevHandle *AudioBindServiceRenderLocked(const char *name)
 {
     struct DevHandle *handle = NULL;
-    if (!name) {
-        HDF_LOGE("Error: service name NULL!");
-        return NULL;
-    }
-
-    HDF_LOGD("AudioBindServiceRender() name=%{public}s", name);
 
     if (!strcmp(name, "render")) {
-        if (AlsaCtxInstanceGet()->renderRefCount > 0) {
-            HDF_LOGE("Error: Audio Render can only be bound to 1 handle.");
+        if (AlsaCtxInstanceGet()->renderRefCount >= AUDIO_MIXER_MAX_STREAMS) {
+            HDF_LOGE("Error: Audio Render can only be bound to %{public}d handles.", AUDIO_MIXER_MAX_STREAMS);
             return NULL;
         }
     } else if (!strcmp(name, "control")) {
-        if (AlsaCtxInstanceGet()->ctlRefCount > 0) {
-            HDF_LOGE("Error: Audio Controler can only be bound to 1 handle.");
+        if (AlsaCtxInstanceGet()->ctlRefCount >= AUDIO_MIXER_MAX_STREAMS) {
+            HDF_LOGE("Error: Audio Controler can only be bound to %{public}d handles.", AUDIO_MIXER_MAX_STREAMS);
             return NULL;
         }
     } else {
@@ -714,6 +1573,12 @@ struct DevHandle *AudioBindServiceRender(const char *name)
                     "%s", name);
     devObject->pAlsaCtx = AlsaCtxInstanceGet();
     if (!strcmp(devObject->serviceName, "render")) {
+        if (RenderAttach(devObject) < 0) {
+            HDF_LOGE("Error: no free mixer stream.");
+            free(devObject);
+            free(handle);
+            return NULL;
+        }
         devObject->pAlsaCtx->renderRefCount++;
     } else {
         devObject->pAlsaCtx->ctlRefCount++;
@@ -726,6 +1591,24 @@ struct DevHandle *AudioBindServiceRender(const char *name)
     return handle;
 }
 
+/* CreatRender for Bind handle */
+struct DevHandle *AudioBindServiceRender(const char *name)
+{
+    struct DevHandle *handle = NULL;
+    if (!name) {
+        HDF_LOGE("Error: service name NULL!");
+        return NULL;
+    }
+
+    HDF_LOGD("AudioBindServiceRender() name=%{public}s", name);
+
+    pthread_mutex_lock(&s_ctlLock);
+    handle = AudioBindServiceRenderLocked(name);
+    pthread_mutex_unlock(&s_ctlLock);
+
+    return handle;
+}
+
 void AudioCloseServiceRender(const struct DevHandle *handle)
 {
     if (!handle || !handle->object) {
@@ -734,7 +1617,9 @@ void AudioCloseServiceRender(const struct DevHandle *handle)
     }
 
     struct AlsaDevObject *devObject = (struct AlsaDevObject *)handle->object;
+    pthread_mutex_lock(&s_ctlLock);
     if (!strcmp(devObject->serviceName, "render")) {
+        RenderDetach(devObject);
         if (--devObject->pAlsaCtx->renderRefCount <= 0) {
             // Do somthing here.
             devObject->pAlsaCtx->renderRefCount = 0;
@@ -745,6 +1630,7 @@ void AudioCloseServiceRender(const struct DevHandle *handle)
             devObject->pAlsaCtx->ctlRefCount = 0;
         }
     }
+    pthread_mutex_unlock(&s_ctlLock);
 
     HDF_LOGD("AudioCloseServiceRender(), name=%{public}s",
              devObject->serviceName);
@@ -757,28 +1643,16 @@ void AudioCloseServiceRender(const struct DevHandle *handle)
     return;
 }
 
-int32_t AudioInterfaceLibModeRender(const struct DevHandle *handle,
-                                    struct AudioHwRenderParam *handleData,
-                                    int cmdId)
+static int32_t AudioInterfaceLibModeRenderLocked(const struct DevHandle *handle,
+                                                 struct AudioHwRenderParam *handleData, int cmdId)
 {
-    if (!handle || !handle->object || !handleData) {
-        HDF_LOGE("Error: paras is NULL!");
-        return HDF_FAILURE;
-    }
-
-    if (AUDIO_DRV_PCM_IOCTL_WRITE != cmdId) {
-        HDF_LOGE("AudioInterfaceLibModeRender(cmdid=%{public}d)", cmdId);
-    }
-
     switch (cmdId) {
         case AUDIO_DRV_PCM_IOCTL_HW_PARAMS:
-        case AUDIO_DRV_PCM_IOCTL_WRITE:
         case AUDIO_DRV_PCM_IOCTRL_STOP:
         case AUDIO_DRV_PCM_IOCTRL_START:
         case AUDIO_DRV_PCM_IOCTL_PREPARE:
         case AUDIODRV_CTL_IOCTL_PAUSE_WRITE:
         case AUDIO_DRV_PCM_IOCTL_MMAP_BUFFER:
-        case AUDIO_DRV_PCM_IOCTL_MMAP_POSITION:
         case AUDIO_DRV_PCM_IOCTRL_RENDER_OPEN:
         case AUDIO_DRV_PCM_IOCTRL_RENDER_CLOSE:
             return HandleOutputRenderCmd(handle, cmdId, handleData);
@@ -803,3 +1677,28 @@ int32_t AudioInterfaceLibModeRender(const struct DevHandle *handle,
 
     return HDF_ERR_NOT_SUPPORT;
 }
+
+int32_t AudioInterfaceLibModeRender(const struct DevHandle *handle,
+                                    struct AudioHwRenderParam *handleData,
+                                    int cmdId)
+{
+    if (!handle || !handle->object || !handleData) {
+        HDF_LOGE("Error: paras is NULL!");
+        return HDF_FAILURE;
+    }
+
+    if (AUDIO_DRV_PCM_IOCTL_WRITE != cmdId && AUDIO_DRV_PCM_IOCTL_MMAP_POSITION != cmdId) {
+        HDF_LOGE("AudioInterfaceLibModeRender(cmdid=%{public}d)", cmdId);
+    }
+
+    // A blocked writer must not hold up the other streams, the data path only takes mixerLock
+    if (AUDIO_DRV_PCM_IOCTL_WRITE == cmdId || AUDIO_DRV_PCM_IOCTL_MMAP_POSITION == cmdId) {
+        return HandleOutputRenderCmd(handle, cmdId, handleData);
+    }
+
+    pthread_mutex_lock(&s_ctlLock);
+    int32_t ret = AudioInterfaceLibModeRenderLocked(handle, handleData, cmdId);
+    pthread_mutex_unlock(&s_ctlLock);
+
+    return ret;
+}
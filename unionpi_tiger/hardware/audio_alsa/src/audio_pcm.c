@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_pcm.h"
+
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include "sound/asound.h"
+
+struct AudioPcmTinyalsa {
+    struct AudioPcm base;
+    struct pcm *pcm;
+};
+
+static struct pcm *TinyalsaPcm(struct AudioPcm *pcm)
+{
+    return ((struct AudioPcmTinyalsa *)pcm)->pcm;
+}
+
+static int TinyalsaClose(struct AudioPcm *pcm)
+{
+    int ret = pcm_close(TinyalsaPcm(pcm));
+
+    free(pcm);
+
+    return ret;
+}
+
+static int TinyalsaIsReady(struct AudioPcm *pcm)
+{
+    return pcm_is_ready(TinyalsaPcm(pcm));
+}
+
+static const char *TinyalsaGetError(struct AudioPcm *pcm)
+{
+    return pcm_get_error(TinyalsaPcm(pcm));
+}
+
+static unsigned int TinyalsaGetBufferSize(struct AudioPcm *pcm)
+{
+    return pcm_get_buffer_size(TinyalsaPcm(pcm));
+}
+
+static unsigned int TinyalsaFramesToBytes(struct AudioPcm *pcm, unsigned int frames)
+{
+    return pcm_frames_to_bytes(TinyalsaPcm(pcm), frames);
+}
+
+static int TinyalsaGetHtimestamp(struct AudioPcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    return pcm_get_htimestamp(TinyalsaPcm(pcm), avail, tstamp);
+}
+
+static int TinyalsaWrite(struct AudioPcm *pcm, const void *data, unsigned int count)
+{
+    return pcm_write(TinyalsaPcm(pcm), data, count);
+}
+
+static int TinyalsaRead(struct AudioPcm *pcm, void *data, unsigned int count)
+{
+    return pcm_read(TinyalsaPcm(pcm), data, count);
+}
+
+static int TinyalsaPrepare(struct AudioPcm *pcm)
+{
+    return pcm_prepare(TinyalsaPcm(pcm));
+}
+
+static int TinyalsaStart(struct AudioPcm *pcm)
+{
+    return pcm_start(TinyalsaPcm(pcm));
+}
+
+static int TinyalsaStop(struct AudioPcm *pcm)
+{
+    return pcm_stop(TinyalsaPcm(pcm));
+}
+
+static int TinyalsaPause(struct AudioPcm *pcm, bool enable)
+{
+    return pcm_ioctl(TinyalsaPcm(pcm), SNDRV_PCM_IOCTL_PAUSE, enable ? 1 : 0);
+}
+
+static int TinyalsaWait(struct AudioPcm *pcm, int timeout)
+{
+    return pcm_wait(TinyalsaPcm(pcm), timeout);
+}
+
+static int TinyalsaMmapAvail(struct AudioPcm *pcm)
+{
+    return pcm_mmap_avail(TinyalsaPcm(pcm));
+}
+
+static int TinyalsaMmapBegin(struct AudioPcm *pcm, void **areas, unsigned int *offset, unsigned int *frames)
+{
+    return pcm_mmap_begin(TinyalsaPcm(pcm), areas, offset, frames);
+}
+
+static int TinyalsaMmapCommit(struct AudioPcm *pcm, unsigned int offset, unsigned int frames)
+{
+    return pcm_mmap_commit(TinyalsaPcm(pcm), offset, frames);
+}
+
+static const struct AudioPcmOps g_tinyalsaOps = {
+    .Close = TinyalsaClose,
+    .IsReady = TinyalsaIsReady,
+    .GetError = TinyalsaGetError,
+    .GetBufferSize = TinyalsaGetBufferSize,
+    .FramesToBytes = TinyalsaFramesToBytes,
+    .GetHtimestamp = TinyalsaGetHtimestamp,
+    .Write = TinyalsaWrite,
+    .Read = TinyalsaRead,
+    .Prepare = TinyalsaPrepare,
+    .Start = TinyalsaStart,
+    .Stop = TinyalsaStop,
+    .Pause = TinyalsaPause,
+    .Wait = TinyalsaWait,
+    .MmapAvail = TinyalsaMmapAvail,
+    .MmapBegin = TinyalsaMmapBegin,
+    .MmapCommit = TinyalsaMmapCommit,
+};
+
+static struct AudioPcm *TinyalsaOpen(unsigned int card, unsigned int device, unsigned int flags,
+                                     struct pcm_config *config)
+{
+    struct AudioPcmTinyalsa *tinyalsa = malloc(sizeof(*tinyalsa));
+    if (!tinyalsa) {
+        return NULL;
+    }
+
+    tinyalsa->base.ops = &g_tinyalsaOps;
+    tinyalsa->pcm = pcm_open(card, device, flags, config);
+
+    return &tinyalsa->base;
+}
+
+const struct AudioPcmBackend g_audioPcmTinyalsa = {
+    .name = "tinyalsa",
+    .Open = TinyalsaOpen,
+};
+
+static const struct AudioPcmBackend *g_backend = &g_audioPcmTinyalsa;
+
+void AudioPcmSetBackend(const struct AudioPcmBackend *backend)
+{
+    g_backend = backend ? backend : &g_audioPcmTinyalsa;
+}
+
+const struct AudioPcmBackend *AudioPcmGetBackend(void)
+{
+    return g_backend;
+}
+
+struct AudioPcm *AudioPcmOpen(unsigned int card, unsigned int device, unsigned int flags,
+                              struct pcm_config *config)
+{
+    return g_backend->Open(card, device, flags, config);
+}
+
+int AudioPcmClose(struct AudioPcm *pcm)
+{
+    return pcm ? pcm->ops->Close(pcm) : 0;
+}
+
+int AudioPcmIsReady(struct AudioPcm *pcm)
+{
+    return pcm ? pcm->ops->IsReady(pcm) : 0;
+}
+
+const char *AudioPcmGetError(struct AudioPcm *pcm)
+{
+    return pcm ? pcm->ops->GetError(pcm) : "out of memory";
+}
+
+unsigned int AudioPcmGetBufferSize(struct AudioPcm *pcm)
+{
+    return pcm->ops->GetBufferSize(pcm);
+}
+
+unsigned int AudioPcmFramesToBytes(struct AudioPcm *pcm, unsigned int frames)
+{
+    return pcm->ops->FramesToBytes(pcm, frames);
+}
+
+int AudioPcmGetHtimestamp(struct AudioPcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    return pcm->ops->GetHtimestamp(pcm, avail, tstamp);
+}
+
+int AudioPcmWrite(struct AudioPcm *pcm, const void *data, unsigned int count)
+{
+    return pcm->ops->Write(pcm, data, count);
+}
+
+int AudioPcmRead(struct AudioPcm *pcm, void *data, unsigned int count)
+{
+    return pcm->ops->Read(pcm, data, count);
+}
+
+int AudioPcmPrepare(struct AudioPcm *pcm)
+{
+    return pcm->ops->Prepare(pcm);
+}
+
+int AudioPcmStart(struct AudioPcm *pcm)
+{
+    return pcm->ops->Start(pcm);
+}
+
+int AudioPcmStop(struct AudioPcm *pcm)
+{
+    return pcm->ops->Stop(pcm);
+}
+
+int AudioPcmPause(struct AudioPcm *pcm, bool enable)
+{
+    return pcm->ops->Pause(pcm, enable);
+}
+
+int AudioPcmWait(struct AudioPcm *pcm, int timeout)
+{
+    return pcm->ops->Wait(pcm, timeout);
+}
+
+int AudioPcmMmapAvail(struct AudioPcm *pcm)
+{
+    return pcm->ops->MmapAvail(pcm);
+}
+
+int AudioPcmMmapBegin(struct AudioPcm *pcm, void **areas, unsigned int *offset, unsigned int *frames)
+{
+    return pcm->ops->MmapBegin(pcm, areas, offset, frames);
+}
+
+int AudioPcmMmapCommit(struct AudioPcm *pcm, unsigned int offset, unsigned int frames)
+{
+    return pcm->ops->MmapCommit(pcm, offset, frames);
+}
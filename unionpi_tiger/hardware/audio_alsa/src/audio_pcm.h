@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_PCM_H
+#define AUDIO_PCM_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "tinyalsa/asoundlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AudioPcm;
+
+/*
+ * Everything the HAL does with a pcm. Flags, configs, arguments and return values mean what
+ * they mean for the tinyalsa pcm_ function of the same name; Pause is the SNDRV_PCM_IOCTL_PAUSE
+ * ioctl.
+ */
+struct AudioPcmOps {
+    int (*Close)(struct AudioPcm *pcm);
+    int (*IsReady)(struct AudioPcm *pcm);
+    const char *(*GetError)(struct AudioPcm *pcm);
+    unsigned int (*GetBufferSize)(struct AudioPcm *pcm);
+    unsigned int (*FramesToBytes)(struct AudioPcm *pcm, unsigned int frames);
+    int (*GetHtimestamp)(struct AudioPcm *pcm, unsigned int *avail, struct timespec *tstamp);
+    int (*Write)(struct AudioPcm *pcm, const void *data, unsigned int count);
+    int (*Read)(struct AudioPcm *pcm, void *data, unsigned int count);
+    int (*Prepare)(struct AudioPcm *pcm);
+    int (*Start)(struct AudioPcm *pcm);
+    int (*Stop)(struct AudioPcm *pcm);
+    int (*Pause)(struct AudioPcm *pcm, bool enable);
+    int (*Wait)(struct AudioPcm *pcm, int timeout);
+    int (*MmapAvail)(struct AudioPcm *pcm);
+    int (*MmapBegin)(struct AudioPcm *pcm, void **areas, unsigned int *offset, unsigned int *frames);
+    int (*MmapCommit)(struct AudioPcm *pcm, unsigned int offset, unsigned int frames);
+};
+
+/* Backends put this first in their own pcm struct */
+struct AudioPcm {
+    const struct AudioPcmOps *ops;
+};
+
+struct AudioPcmBackend {
+    const char *name;
+    /* Like pcm_open(), a pcm that failed to open is returned all the same and tells why */
+    struct AudioPcm *(*Open)(unsigned int card, unsigned int device, unsigned int flags, struct pcm_config *config);
+};
+
+/* The sound card through tinyalsa, what the HAL uses unless told otherwise */
+extern const struct AudioPcmBackend g_audioPcmTinyalsa;
+
+/* Where pcms open from now on, NULL goes back to tinyalsa. Pcms already open keep theirs */
+void AudioPcmSetBackend(const struct AudioPcmBackend *backend);
+const struct AudioPcmBackend *AudioPcmGetBackend(void);
+
+struct AudioPcm *AudioPcmOpen(unsigned int card, unsigned int device, unsigned int flags,
+                              struct pcm_config *config);
+
+/* These three take NULL, as their pcm_ counterparts do */
+int AudioPcmClose(struct AudioPcm *pcm);
+int AudioPcmIsReady(struct AudioPcm *pcm);
+const char *AudioPcmGetError(struct AudioPcm *pcm);
+
+unsigned int AudioPcmGetBufferSize(struct AudioPcm *pcm);
+unsigned int AudioPcmFramesToBytes(struct AudioPcm *pcm, unsigned int frames);
+int AudioPcmGetHtimestamp(struct AudioPcm *pcm, unsigned int *avail, struct timespec *tstamp);
+int AudioPcmWrite(struct AudioPcm *pcm, const void *data, unsigned int count);
+int AudioPcmRead(struct AudioPcm *pcm, void *data, unsigned int count);
+int AudioPcmPrepare(struct AudioPcm *pcm);
+int AudioPcmStart(struct AudioPcm *pcm);
+int AudioPcmStop(struct AudioPcm *pcm);
+int AudioPcmPause(struct AudioPcm *pcm, bool enable);
+int AudioPcmWait(struct AudioPcm *pcm, int timeout);
+int AudioPcmMmapAvail(struct AudioPcm *pcm);
+int AudioPcmMmapBegin(struct AudioPcm *pcm, void **areas, unsigned int *offset, unsigned int *frames);
+int AudioPcmMmapCommit(struct AudioPcm *pcm, unsigned int offset, unsigned int frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_PCM_H */
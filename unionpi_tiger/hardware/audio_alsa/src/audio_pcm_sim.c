@@ -0,0 +1,746 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_pcm_sim.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NSEC_PER_SEC (1000000000LL)
+#define NSEC_PER_MSEC (1000000LL)
+#define NSEC_PER_USEC (1000LL)
+#define PI (3.14159265358979323846)
+#define SIM_ERROR_LEN (128)
+// When no period is due to end, e.g. while paused, blocked calls look again this often
+#define SIM_IDLE_WAIT_NS (10 * NSEC_PER_MSEC)
+// A 1 kHz tone at 48 kHz, a quarter of full scale
+#define SIM_TONE_FRAMES (48)
+#define SIM_TONE_AMPLITUDE (0.25)
+#define SIM_CAPTURE_SEED (0x9e3779b9U)
+
+enum SimState {
+    SIM_SETUP = 0,
+    SIM_PREPARED,
+    SIM_RUNNING,
+    SIM_PAUSED,
+    SIM_XRUN,
+};
+
+struct AudioPcmSim {
+    struct AudioPcm base;
+    struct AudioPcmSim *next; // the list of open pcms, under g_simLock
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // the state changed other than by the clock moving
+    struct pcm_config config;
+    bool capture;
+    bool ready;
+    char error[SIM_ERROR_LEN];
+
+    uint32_t frameBytes;
+    uint32_t bufferFrames;
+    uint32_t startThreshold;
+    uint32_t stopThreshold;
+    uint32_t availMin;
+    uint8_t *dma; // PCM_MMAP only
+
+    uint32_t rate; // of the clock, not necessarily the one the pcm was opened with
+    int64_t jitterNs;
+    uint32_t seed;
+
+    enum SimState state;
+    uint64_t appl;   // frames the application wrote or read
+    uint64_t hw;     // the hardware pointer while stopped, where the clock started from while running
+    int64_t startNs; // when the clock started, period k ends k periods later plus its jitter
+};
+
+static pthread_mutex_t g_simLock = PTHREAD_MUTEX_INITIALIZER;
+static struct AudioPcmSim *g_simPcms;
+static struct AudioPcmSimConfig g_simConfig;
+
+static pthread_once_t g_toneOnce = PTHREAD_ONCE_INIT;
+static int32_t g_tone[SIM_TONE_FRAMES];
+
+static struct {
+    _Atomic uint32_t opens;
+    _Atomic uint32_t underruns;
+    _Atomic uint32_t overruns;
+    _Atomic uint64_t framesWritten;
+    _Atomic uint64_t framesRead;
+} g_simStats;
+
+static int64_t NowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void ToTimespec(int64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = (time_t)(ns / NSEC_PER_SEC);
+    ts->tv_nsec = (long)(ns % NSEC_PER_SEC);
+}
+
+static int SimFail(struct AudioPcmSim *sim, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    (void)vsnprintf(sim->error, sizeof(sim->error), fmt, args);
+    va_end(args);
+
+    return -1;
+}
+
+static void SimToneInit(void)
+{
+    for (int i = 0; i < SIM_TONE_FRAMES; i++) {
+        g_tone[i] = (int32_t)(sin(2.0 * PI * i / SIM_TONE_FRAMES) * SIM_TONE_AMPLITUDE * INT32_MAX);
+    }
+}
+
+static uint32_t SimFormatBits(enum pcm_format format)
+{
+    switch (format) {
+        case PCM_FORMAT_S8:
+            return 8U;
+        case PCM_FORMAT_S16_LE:
+            return 16U;
+        case PCM_FORMAT_S24_3LE:
+            return 24U;
+        case PCM_FORMAT_S24_LE:
+        case PCM_FORMAT_S32_LE:
+            return 32U;
+        default:
+            return 0;
+    }
+}
+
+// The tone from frame 'frame' on, in the pcm's own format
+static void SimFillTone(const struct AudioPcmSim *sim, uint8_t *dst, uint64_t frame, uint32_t frames)
+{
+    uint32_t channels = sim->config.channels;
+
+    for (uint32_t f = 0; f < frames; f++) {
+        int32_t v = g_tone[(frame + f) % SIM_TONE_FRAMES];
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            switch (sim->config.format) {
+                case PCM_FORMAT_S8:
+                    *(int8_t *)dst = (int8_t)(v >> 24);
+                    break;
+                case PCM_FORMAT_S16_LE:
+                    *(int16_t *)dst = (int16_t)(v >> 16);
+                    break;
+                case PCM_FORMAT_S24_3LE:
+                    dst[0] = (uint8_t)(v >> 8);
+                    dst[1] = (uint8_t)(v >> 16);
+                    dst[2] = (uint8_t)(v >> 24);
+                    break;
+                case PCM_FORMAT_S24_LE:
+                    *(int32_t *)dst = v >> 8;
+                    break;
+                default:
+                    *(int32_t *)dst = v;
+                    break;
+            }
+            dst += sim->frameBytes / channels;
+        }
+    }
+}
+
+static uint32_t SimHash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+
+    return x;
+}
+
+// When period 'period' of the clock ends, period 0 is the moment it started
+static int64_t SimPeriodEndNs(const struct AudioPcmSim *sim, uint64_t period)
+{
+    int64_t ns = sim->startNs + (int64_t)(period * sim->config.period_size * NSEC_PER_SEC / sim->rate);
+
+    if (period > 0 && sim->jitterNs > 0) {
+        ns += (int64_t)(SimHash((uint32_t)period ^ sim->seed) % (uint64_t)(sim->jitterNs + 1));
+    }
+
+    return ns;
+}
+
+// Periods the clock completed by 'now'. The jitter is less than a period, so ends stay in order
+static uint64_t SimPeriodsDone(const struct AudioPcmSim *sim, int64_t now)
+{
+    if (now <= sim->startNs) {
+        return 0;
+    }
+
+    uint64_t period = (uint64_t)(now - sim->startNs) * sim->rate / ((uint64_t)sim->config.period_size * NSEC_PER_SEC);
+    if (period > 0 && SimPeriodEndNs(sim, period) > now) {
+        period--;
+    }
+
+    return period;
+}
+
+static uint64_t SimHw(const struct AudioPcmSim *sim, int64_t now)
+{
+    if (sim->state != SIM_RUNNING) {
+        return sim->hw;
+    }
+
+    return sim->hw + SimPeriodsDone(sim, now) * sim->config.period_size;
+}
+
+// Frames the application can write or read with the hardware pointer at 'hw'
+static int64_t SimAvail(const struct AudioPcmSim *sim, uint64_t hw)
+{
+    if (sim->capture) {
+        return (int64_t)(hw - sim->appl);
+    }
+
+    return (int64_t)sim->bufferFrames + (int64_t)(hw - sim->appl);
+}
+
+// Called with the pcm locked, whenever the application looks at the pcm
+static void SimUpdate(struct AudioPcmSim *sim, int64_t now)
+{
+    if (sim->state != SIM_RUNNING) {
+        return;
+    }
+
+    uint64_t hw = SimHw(sim, now);
+    if (SimAvail(sim, hw) < (int64_t)sim->stopThreshold) {
+        return;
+    }
+
+    sim->hw = hw;
+    sim->state = SIM_XRUN;
+    if (sim->capture) {
+        atomic_fetch_add(&g_simStats.overruns, 1U);
+    } else {
+        atomic_fetch_add(&g_simStats.underruns, 1U);
+    }
+    pthread_cond_broadcast(&sim->cond);
+}
+
+/*
+ * Waits for the next period to end, no longer than to 'limitNs'; wakes up early when the
+ * state changes. Called with the pcm locked.
+ */
+static void SimWaitPeriod(struct AudioPcmSim *sim, int64_t now, int64_t limitNs)
+{
+    int64_t until = now + SIM_IDLE_WAIT_NS;
+    struct timespec deadline;
+
+    if (sim->state == SIM_RUNNING) {
+        until = SimPeriodEndNs(sim, SimPeriodsDone(sim, now) + 1U);
+    }
+    if (until > limitNs) {
+        until = limitNs;
+    }
+    ToTimespec(until, &deadline);
+    pthread_cond_timedwait(&sim->cond, &sim->lock, &deadline);
+}
+
+// Like tinyalsa, preparing a pcm that is prepared or running already does nothing
+static void SimPrepareLocked(struct AudioPcmSim *sim)
+{
+    if (sim->state == SIM_SETUP || sim->state == SIM_XRUN) {
+        sim->appl = sim->hw;
+        sim->state = SIM_PREPARED;
+    }
+}
+
+static int SimStartLocked(struct AudioPcmSim *sim, int64_t now)
+{
+    SimPrepareLocked(sim);
+    if (sim->state != SIM_PREPARED) {
+        return SimFail(sim, "cannot start channel: %s", strerror(EBADFD));
+    }
+
+    sim->state = SIM_RUNNING;
+    sim->startNs = now;
+    pthread_cond_broadcast(&sim->cond);
+
+    return 0;
+}
+
+static void SimApplyConfig(struct AudioPcmSim *sim, const struct AudioPcmSimConfig *config)
+{
+    sim->rate = config->rate ? config->rate : sim->config.rate;
+    sim->jitterNs = (int64_t)config->jitterUs * NSEC_PER_USEC;
+    int64_t periodNs = (int64_t)((uint64_t)sim->config.period_size * NSEC_PER_SEC / sim->rate);
+    if (sim->jitterNs >= periodNs) {
+        sim->jitterNs = periodNs - 1;
+    }
+    sim->seed = config->seed ^ (sim->capture ? SIM_CAPTURE_SEED : 0);
+}
+
+static int SimClose(struct AudioPcm *pcm)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+
+    pthread_mutex_lock(&g_simLock);
+    for (struct AudioPcmSim **link = &g_simPcms; *link; link = &(*link)->next) {
+        if (*link == sim) {
+            *link = sim->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_simLock);
+
+    pthread_cond_destroy(&sim->cond);
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->dma);
+    free(sim);
+
+    return 0;
+}
+
+static int SimIsReady(struct AudioPcm *pcm)
+{
+    return ((struct AudioPcmSim *)pcm)->ready;
+}
+
+static const char *SimGetError(struct AudioPcm *pcm)
+{
+    return ((struct AudioPcmSim *)pcm)->error;
+}
+
+static unsigned int SimGetBufferSize(struct AudioPcm *pcm)
+{
+    return ((struct AudioPcmSim *)pcm)->bufferFrames;
+}
+
+static unsigned int SimFramesToBytes(struct AudioPcm *pcm, unsigned int frames)
+{
+    return frames * ((struct AudioPcmSim *)pcm)->frameBytes;
+}
+
+static int SimGetHtimestamp(struct AudioPcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+    int64_t now = NowNs();
+
+    pthread_mutex_lock(&sim->lock);
+    SimUpdate(sim, now);
+    if (sim->state != SIM_RUNNING) {
+        pthread_mutex_unlock(&sim->lock);
+        return -1;
+    }
+
+    // The pointer and the time it got there, as the last period interrupt reported them
+    uint64_t periods = SimPeriodsDone(sim, now);
+    int64_t frames = SimAvail(sim, sim->hw + periods * sim->config.period_size);
+    *avail = frames > 0 ? (unsigned int)frames : 0;
+    ToTimespec(SimPeriodEndNs(sim, periods), tstamp);
+    pthread_mutex_unlock(&sim->lock);
+
+    return 0;
+}
+
+/*
+ * Blocks while the buffer is full. The clock starts once start_threshold frames are queued,
+ * and after an underrun the pcm is prepared again and the write carries on, as tinyalsa does.
+ */
+static int SimWrite(struct AudioPcm *pcm, const void *data, unsigned int count)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+    uint32_t frames = count / sim->frameBytes;
+    uint32_t done = 0;
+    bool waited = false;
+
+    if (sim->capture) {
+        return SimFail(sim, "cannot write stream data: %s", strerror(EINVAL));
+    }
+
+    pthread_mutex_lock(&sim->lock);
+    while (done < frames) {
+        int64_t now = NowNs();
+        SimUpdate(sim, now);
+        if (sim->state == SIM_SETUP && waited) {
+            // Stopped from another thread while this one waited
+            pthread_mutex_unlock(&sim->lock);
+            return SimFail(sim, "cannot write stream data: %s", strerror(EBADFD));
+        }
+        SimPrepareLocked(sim);
+
+        int64_t space = SimAvail(sim, SimHw(sim, now));
+        if (space <= 0) {
+            if (sim->state == SIM_PREPARED) {
+                (void)SimStartLocked(sim, now);
+                continue;
+            }
+            SimWaitPeriod(sim, now, INT64_MAX);
+            waited = true;
+            continue;
+        }
+
+        uint32_t n = space < (int64_t)(frames - done) ? (uint32_t)space : frames - done;
+        sim->appl += n;
+        done += n;
+        if (sim->state == SIM_PREPARED && sim->appl - sim->hw >= sim->startThreshold) {
+            (void)SimStartLocked(sim, now);
+        }
+    }
+    pthread_mutex_unlock(&sim->lock);
+    atomic_fetch_add(&g_simStats.framesWritten, frames);
+
+    return 0;
+}
+
+/* Starts the clock if it is not running and blocks until all frames were captured */
+static int SimRead(struct AudioPcm *pcm, void *data, unsigned int count)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+    uint32_t frames = count / sim->frameBytes;
+    uint32_t done = 0;
+    bool waited = false;
+
+    if (!sim->capture) {
+        return SimFail(sim, "cannot read stream data: %s", strerror(EINVAL));
+    }
+
+    pthread_mutex_lock(&sim->lock);
+    while (done < frames) {
+        int64_t now = NowNs();
+        SimUpdate(sim, now);
+        if (sim->state == SIM_SETUP && waited) {
+            pthread_mutex_unlock(&sim->lock);
+            return SimFail(sim, "cannot read stream data: %s", strerror(EBADFD));
+        }
+        if (sim->state != SIM_RUNNING && sim->state != SIM_PAUSED) {
+            (void)SimStartLocked(sim, now);
+        }
+
+        int64_t avail = SimAvail(sim, SimHw(sim, now));
+        if (avail <= 0) {
+            SimWaitPeriod(sim, now, INT64_MAX);
+            waited = true;
+            continue;
+        }
+
+        uint32_t n = avail < (int64_t)(frames - done) ? (uint32_t)avail : frames - done;
+        SimFillTone(sim, (uint8_t *)data + (size_t)done * sim->frameBytes, sim->appl, n);
+        sim->appl += n;
+        done += n;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    atomic_fetch_add(&g_simStats.framesRead, frames);
+
+    return 0;
+}
+
+static int SimPrepare(struct AudioPcm *pcm)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+
+    pthread_mutex_lock(&sim->lock);
+    SimUpdate(sim, NowNs());
+    SimPrepareLocked(sim);
+    pthread_mutex_unlock(&sim->lock);
+
+    return 0;
+}
+
+static int SimStart(struct AudioPcm *pcm)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+    int64_t now = NowNs();
+
+    pthread_mutex_lock(&sim->lock);
+    SimUpdate(sim, now);
+    int ret = SimStartLocked(sim, now);
+    pthread_mutex_unlock(&sim->lock);
+
+    return ret;
+}
+
+static int SimStop(struct AudioPcm *pcm)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->hw = SimHw(sim, NowNs());
+    sim->state = SIM_SETUP;
+    pthread_cond_broadcast(&sim->cond);
+    pthread_mutex_unlock(&sim->lock);
+
+    return 0;
+}
+
+static int SimPause(struct AudioPcm *pcm, bool enable)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+    int64_t now = NowNs();
+    int ret = 0;
+
+    pthread_mutex_lock(&sim->lock);
+    SimUpdate(sim, now);
+    if (enable && sim->state == SIM_RUNNING) {
+        sim->hw = SimHw(sim, now);
+        sim->state = SIM_PAUSED;
+    } else if (!enable && sim->state == SIM_PAUSED) {
+        sim->state = SIM_RUNNING;
+        sim->startNs = now;
+    } else {
+        ret = SimFail(sim, "cannot %s channel: %s", enable ? "pause" : "resume", strerror(EBADFD));
+    }
+    pthread_cond_broadcast(&sim->cond);
+    pthread_mutex_unlock(&sim->lock);
+
+    return ret;
+}
+
+/* 1 once avail_min frames can be transferred, 0 on timeout, -EPIPE after an xrun */
+static int SimWait(struct AudioPcm *pcm, int timeout)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+    int64_t now = NowNs();
+    int64_t limitNs = timeout < 0 ? INT64_MAX : now + timeout * NSEC_PER_MSEC;
+    int ret;
+
+    pthread_mutex_lock(&sim->lock);
+    for (;;) {
+        SimUpdate(sim, now);
+        if (sim->state == SIM_XRUN) {
+            ret = -EPIPE;
+            break;
+        }
+        if (sim->state != SIM_SETUP && SimAvail(sim, SimHw(sim, now)) >= (int64_t)sim->availMin) {
+            ret = 1;
+            break;
+        }
+        if (now >= limitNs) {
+            ret = 0;
+            break;
+        }
+        SimWaitPeriod(sim, now, limitNs);
+        now = NowNs();
+    }
+    pthread_mutex_unlock(&sim->lock);
+
+    return ret;
+}
+
+static int SimMmapAvailLocked(struct AudioPcmSim *sim, int64_t now)
+{
+    SimUpdate(sim, now);
+    if (sim->state == SIM_XRUN) {
+        return -EPIPE;
+    }
+
+    int64_t avail = SimAvail(sim, SimHw(sim, now));
+    if (avail < 0) {
+        return 0;
+    }
+
+    return avail > (int64_t)sim->bufferFrames ? (int)sim->bufferFrames : (int)avail;
+}
+
+static int SimMmapAvail(struct AudioPcm *pcm)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+
+    pthread_mutex_lock(&sim->lock);
+    int avail = SimMmapAvailLocked(sim, NowNs());
+    pthread_mutex_unlock(&sim->lock);
+
+    return avail;
+}
+
+/* Capture fills the area handed out with what the clock has captured into it */
+static int SimMmapBegin(struct AudioPcm *pcm, void **areas, unsigned int *offset, unsigned int *frames)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+
+    if (!sim->dma) {
+        return SimFail(sim, "not opened with PCM_MMAP");
+    }
+
+    pthread_mutex_lock(&sim->lock);
+    int avail = SimMmapAvailLocked(sim, NowNs());
+    if (avail < 0) {
+        pthread_mutex_unlock(&sim->lock);
+        return SimFail(sim, "mmap begin: %s", strerror(-avail));
+    }
+
+    uint32_t start = (uint32_t)(sim->appl % sim->bufferFrames);
+    uint32_t n = sim->bufferFrames - start;
+    if (n > (uint32_t)avail) {
+        n = (uint32_t)avail;
+    }
+    if (n > *frames) {
+        n = *frames;
+    }
+    if (sim->capture) {
+        SimFillTone(sim, sim->dma + (size_t)start * sim->frameBytes, sim->appl, n);
+    }
+    *areas = sim->dma;
+    *offset = start;
+    *frames = n;
+    pthread_mutex_unlock(&sim->lock);
+
+    return 0;
+}
+
+static int SimMmapCommit(struct AudioPcm *pcm, unsigned int offset, unsigned int frames)
+{
+    struct AudioPcmSim *sim = (struct AudioPcmSim *)pcm;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->appl += frames;
+    pthread_mutex_unlock(&sim->lock);
+    atomic_fetch_add(sim->capture ? &g_simStats.framesRead : &g_simStats.framesWritten, frames);
+
+    return (int)frames;
+}
+
+static const struct AudioPcmOps g_simOps = {
+    .Close = SimClose,
+    .IsReady = SimIsReady,
+    .GetError = SimGetError,
+    .GetBufferSize = SimGetBufferSize,
+    .FramesToBytes = SimFramesToBytes,
+    .GetHtimestamp = SimGetHtimestamp,
+    .Write = SimWrite,
+    .Read = SimRead,
+    .Prepare = SimPrepare,
+    .Start = SimStart,
+    .Stop = SimStop,
+    .Pause = SimPause,
+    .Wait = SimWait,
+    .MmapAvail = SimMmapAvail,
+    .MmapBegin = SimMmapBegin,
+    .MmapCommit = SimMmapCommit,
+};
+
+// Defaults as tinyalsa's pcm_open() sets them
+static int SimSetup(struct AudioPcmSim *sim, unsigned int flags, const struct pcm_config *config)
+{
+    uint32_t bits = config ? SimFormatBits(config->format) : 0;
+
+    if (bits == 0 || config->channels == 0 || config->rate == 0 || config->period_size == 0 ||
+        config->period_count < 2U) {
+        return SimFail(sim, "cannot set hw params: %s", strerror(EINVAL));
+    }
+
+    sim->config = *config;
+    sim->capture = (flags & PCM_IN) != 0;
+    sim->frameBytes = bits / 8U * config->channels;
+    sim->bufferFrames = config->period_size * config->period_count;
+    sim->startThreshold = config->start_threshold ? config->start_threshold :
+                          (sim->capture ? 1U : sim->bufferFrames / 2U);
+    sim->stopThreshold = config->stop_threshold ? config->stop_threshold : sim->bufferFrames;
+    sim->availMin = config->avail_min > 0 ? (uint32_t)config->avail_min :
+                    ((flags & PCM_MMAP) ? config->period_size : 1U);
+
+    if (flags & PCM_MMAP) {
+        sim->dma = calloc(sim->bufferFrames, sim->frameBytes);
+        if (!sim->dma) {
+            return SimFail(sim, "failed to mmap buffer: %s", strerror(ENOMEM));
+        }
+    }
+
+    return 0;
+}
+
+static struct AudioPcm *SimOpen(unsigned int card, unsigned int device, unsigned int flags,
+                                struct pcm_config *config)
+{
+    struct AudioPcmSim *sim = calloc(1, sizeof(*sim));
+    pthread_condattr_t attr;
+
+    if (!sim) {
+        return NULL;
+    }
+
+    sim->base.ops = &g_simOps;
+    pthread_mutex_init(&sim->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_once(&g_toneOnce, SimToneInit);
+
+    if (SimSetup(sim, flags, config) < 0) {
+        return &sim->base;
+    }
+
+    pthread_mutex_lock(&g_simLock);
+    SimApplyConfig(sim, &g_simConfig);
+    sim->next = g_simPcms;
+    g_simPcms = sim;
+    pthread_mutex_unlock(&g_simLock);
+
+    sim->ready = true;
+    atomic_fetch_add(&g_simStats.opens, 1U);
+
+    return &sim->base;
+}
+
+const struct AudioPcmBackend g_audioPcmSim = {
+    .name = "sim",
+    .Open = SimOpen,
+};
+
+void AudioPcmSimSetConfig(const struct AudioPcmSimConfig *config)
+{
+    int64_t now = NowNs();
+
+    pthread_mutex_lock(&g_simLock);
+    g_simConfig = *config;
+    for (struct AudioPcmSim *sim = g_simPcms; sim; sim = sim->next) {
+        pthread_mutex_lock(&sim->lock);
+        if (sim->state == SIM_RUNNING) {
+            sim->hw = SimHw(sim, now);
+            sim->startNs = now;
+        }
+        SimApplyConfig(sim, config);
+        pthread_cond_broadcast(&sim->cond);
+        pthread_mutex_unlock(&sim->lock);
+    }
+    pthread_mutex_unlock(&g_simLock);
+}
+
+void AudioPcmSimGetStats(struct AudioPcmSimStats *stats)
+{
+    stats->opens = atomic_load(&g_simStats.opens);
+    stats->underruns = atomic_load(&g_simStats.underruns);
+    stats->overruns = atomic_load(&g_simStats.overruns);
+    stats->framesWritten = atomic_load(&g_simStats.framesWritten);
+    stats->framesRead = atomic_load(&g_simStats.framesRead);
+}
+
+void AudioPcmSimResetStats(void)
+{
+    atomic_store(&g_simStats.opens, 0);
+    atomic_store(&g_simStats.underruns, 0);
+    atomic_store(&g_simStats.overruns, 0);
+    atomic_store(&g_simStats.framesWritten, 0);
+    atomic_store(&g_simStats.framesRead, 0);
+}
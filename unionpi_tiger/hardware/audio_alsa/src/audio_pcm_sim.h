@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_PCM_SIM_H
+#define AUDIO_PCM_SIM_H
+
+#include <stdint.h>
+
+#include "audio_pcm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A pcm without hardware behind it. A clock on CLOCK_MONOTONIC moves the hardware pointer a
+ * period at a time, the way a DMA interrupt would, so writes and reads block, run dry and
+ * overflow like on the sound card. Playback data is thrown away, capture returns a tone.
+ */
+struct AudioPcmSimConfig {
+    uint32_t rate;     // frames a second the clock moves, 0 follows the rate each pcm is opened with
+    uint32_t jitterUs; // every period completes up to this much late, never more than a period
+    uint32_t seed;     // of the jitter, the same seed gives the same lateness period by period
+};
+
+struct AudioPcmSimStats {
+    uint32_t opens;
+    uint32_t underruns; // playback pcms that ran dry
+    uint32_t overruns;  // capture pcms that were not read in time
+    uint64_t framesWritten;
+    uint64_t framesRead;
+};
+
+extern const struct AudioPcmBackend g_audioPcmSim;
+
+/* Takes effect at once, pcms already running carry on from where they are at the new pace */
+void AudioPcmSimSetConfig(const struct AudioPcmSimConfig *config);
+
+/* Counted over all pcms since the last reset */
+void AudioPcmSimGetStats(struct AudioPcmSimStats *stats);
+void AudioPcmSimResetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_PCM_SIM_H */
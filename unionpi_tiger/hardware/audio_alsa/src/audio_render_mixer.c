@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_render_mixer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXER_USE_NEON
+#endif
+
+int32_t AudioMixerInit(struct AudioMixer *mixer, uint32_t rate, uint32_t periodFrames)
+{
+    if (!mixer || rate == 0 || periodFrames == 0) {
+        return -1;
+    }
+
+    memset(mixer, 0, sizeof(*mixer));
+    mixer->acc = calloc((size_t)periodFrames * AUDIO_MIXER_CHANNELS, sizeof(int64_t));
+    if (!mixer->acc) {
+        return -1;
+    }
+    mixer->rate = rate;
+    mixer->periodFrames = periodFrames;
+
+    return 0;
+}
+
+int32_t AudioMixerSetPeriod(struct AudioMixer *mixer, uint32_t periodFrames)
+{
+    if (periodFrames == 0) {
+        return -1;
+    }
+    if (periodFrames == mixer->periodFrames) {
+        return 0;
+    }
+
+    int64_t *acc = calloc((size_t)periodFrames * AUDIO_MIXER_CHANNELS, sizeof(int64_t));
+    if (!acc) {
+        return -1;
+    }
+    free(mixer->acc);
+    mixer->acc = acc;
+    mixer->periodFrames = periodFrames;
+
+    return 0;
+}
+
+void AudioMixerSetRamp(struct AudioMixer *mixer, uint32_t rampFrames)
+{
+    mixer->rampFrames = rampFrames;
+}
+
+void AudioMixerDeinit(struct AudioMixer *mixer)
+{
+    if (!mixer) {
+        return;
+    }
+
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        AudioMixerStreamFree(&mixer->streams[i]);
+    }
+    free(mixer->acc);
+    memset(mixer, 0, sizeof(*mixer));
+}
+
+// Points the stream's converter at 'format', leaves the stream as it was on failure
+static int32_t StreamConvertFrom(struct AudioMixer *mixer, struct AudioMixerStream *stream,
+                                 const struct AudioConverterFormat *format)
+{
+    struct AudioConverterFormat mixFormat = {mixer->rate, AUDIO_MIXER_CHANNELS, AUDIO_MIXER_BITS};
+    struct AudioConverter conv;
+
+    if (AudioConverterInit(&conv, format, &mixFormat) < 0) {
+        return -1;
+    }
+    if (!conv.passthrough && !stream->convBuf) {
+        stream->convBuf = malloc(AUDIO_MIXER_CONVERT_FRAMES * AUDIO_MIXER_CHANNELS * sizeof(int32_t));
+        if (!stream->convBuf) {
+            AudioConverterDeinit(&conv);
+            return -1;
+        }
+    }
+
+    AudioConverterDeinit(&stream->conv);
+    stream->conv = conv;
+
+    return 0;
+}
+
+struct AudioMixerStream *AudioMixerStreamAlloc(struct AudioMixer *mixer)
+{
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        struct AudioMixerStream *stream = &mixer->streams[i];
+        if (!stream->inUse) {
+            struct AudioConverterFormat format = {mixer->rate, AUDIO_MIXER_CHANNELS, 16U};
+            memset(stream, 0, sizeof(*stream));
+            if (StreamConvertFrom(mixer, stream, &format) < 0) {
+                AudioMixerStreamFree(stream);
+                return NULL;
+            }
+            stream->inUse = true;
+            stream->volume = 1.0f;
+            AudioSoftGainInit(&stream->gain, stream->volume, mixer->rampFrames);
+            return stream;
+        }
+    }
+
+    return NULL;
+}
+
+void AudioMixerStreamFree(struct AudioMixerStream *stream)
+{
+    if (!stream) {
+        return;
+    }
+
+    AudioConverterDeinit(&stream->conv);
+    free(stream->convBuf);
+    free(stream->ring);
+    memset(stream, 0, sizeof(*stream));
+}
+
+int32_t AudioMixerStreamSetFormat(struct AudioMixer *mixer, struct AudioMixerStream *stream,
+                                  const struct AudioConverterFormat *format)
+{
+    const struct AudioConverterFormat *in = &stream->conv.in;
+
+    if (in->rate == format->rate && in->channels == format->channels && in->bits == format->bits) {
+        return 0;
+    }
+
+    return StreamConvertFrom(mixer, stream, format);
+}
+
+int32_t AudioMixerStreamStart(struct AudioMixer *mixer, struct AudioMixerStream *stream)
+{
+    uint32_t ringFrames = mixer->periodFrames * AUDIO_MIXER_RING_PERIODS;
+
+    if (stream->ringFrames != ringFrames) {
+        int32_t *ring = realloc(stream->ring, (size_t)ringFrames * AUDIO_MIXER_CHANNELS * sizeof(int32_t));
+        if (!ring) {
+            return -1;
+        }
+        stream->ring = ring;
+        stream->ringFrames = ringFrames;
+    }
+
+    stream->writeFrames = 0;
+    stream->readFrames = 0;
+    stream->paused = false;
+    stream->pausing = false;
+    stream->primed = false;
+    stream->running = true;
+    AudioConverterReset(&stream->conv);
+    AudioSoftGainInit(&stream->gain, stream->volume, mixer->rampFrames);
+
+    return 0;
+}
+
+void AudioMixerStreamStop(struct AudioMixerStream *stream)
+{
+    stream->running = false;
+    stream->primed = false;
+    stream->writeFrames = 0;
+    stream->readFrames = 0;
+}
+
+void AudioMixerStreamSetVolume(struct AudioMixerStream *stream, float volume)
+{
+    stream->volume = volume;
+    if (!stream->paused && !stream->pausing) {
+        AudioSoftGainSetTarget(&stream->gain, volume);
+    }
+}
+
+void AudioMixerStreamSetPaused(struct AudioMixerStream *stream, bool paused)
+{
+    if (paused) {
+        if (stream->paused || stream->pausing) {
+            return;
+        }
+        // Nothing is playing yet, so there is nothing to fade
+        if (!stream->primed || stream->gain.rampFrames == 0) {
+            stream->paused = true;
+            AudioSoftGainInit(&stream->gain, 0.0f, stream->gain.rampFrames);
+            return;
+        }
+        stream->pausing = true;
+        AudioSoftGainSetTarget(&stream->gain, 0.0f);
+        return;
+    }
+
+    stream->paused = false;
+    stream->pausing = false;
+    AudioSoftGainSetTarget(&stream->gain, stream->volume);
+}
+
+uint32_t AudioMixerStreamSpace(const struct AudioMixerStream *stream)
+{
+    return stream->ringFrames - (uint32_t)(stream->writeFrames - stream->readFrames);
+}
+
+uint32_t AudioMixerStreamFrameBytes(const struct AudioMixerStream *stream)
+{
+    return AudioConverterFrameBytes(&stream->conv.in);
+}
+
+// Copies frames that are in the mixer format already into the ring, as many as fit
+static uint32_t RingPut(struct AudioMixerStream *stream, const int32_t *src, uint32_t frames)
+{
+    uint32_t space = AudioMixerStreamSpace(stream);
+
+    if (frames > space) {
+        frames = space;
+    }
+
+    uint32_t left = frames;
+    while (left > 0) {
+        uint32_t pos = (uint32_t)(stream->writeFrames % stream->ringFrames);
+        uint32_t chunk = stream->ringFrames - pos;
+        if (chunk > left) {
+            chunk = left;
+        }
+        memcpy(stream->ring + (size_t)pos * AUDIO_MIXER_CHANNELS, src,
+               (size_t)chunk * AUDIO_MIXER_CHANNELS * sizeof(int32_t));
+        src += (size_t)chunk * AUDIO_MIXER_CHANNELS;
+        stream->writeFrames += chunk;
+        left -= chunk;
+    }
+
+    return frames;
+}
+
+uint32_t AudioMixerStreamWrite(struct AudioMixerStream *stream, const void *data, uint32_t frames)
+{
+    const uint8_t *src = (const uint8_t *)data;
+    uint32_t frameBytes = AudioMixerStreamFrameBytes(stream);
+    uint64_t writeFrames = stream->writeFrames;
+    uint32_t done = 0;
+
+    if (stream->conv.passthrough) {
+        done = RingPut(stream, (const int32_t *)data, frames);
+    }
+
+    while (!stream->conv.passthrough && done < frames) {
+        uint32_t space = AudioMixerStreamSpace(stream);
+        uint32_t room = space < AUDIO_MIXER_CONVERT_FRAMES ? space : AUDIO_MIXER_CONVERT_FRAMES;
+        // As much input as converts to no more than there is room for
+        uint32_t need = AudioConverterInFrames(&stream->conv, room + 1U);
+        uint32_t n = need > 0 ? need - 1U : 0;
+        if (n > frames - done) {
+            n = frames - done;
+        }
+        if (n == 0) {
+            break;
+        }
+        uint32_t converted = AudioConverterProcess(&stream->conv, src, n, stream->convBuf, room);
+        RingPut(stream, stream->convBuf, converted);
+        src += (size_t)n * frameBytes;
+        done += n;
+    }
+
+    if (stream->writeFrames != writeFrames) {
+        stream->primed = true;
+    }
+
+    return done;
+}
+
+bool AudioMixerAnyRunning(const struct AudioMixer *mixer)
+{
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        if (mixer->streams[i].inUse && mixer->streams[i].running) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void Accumulate(int64_t *acc, const int32_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+
+#ifdef MIXER_USE_NEON
+    for (; i + 4U <= samples; i += 4U) {
+        int32x4_t s = vld1q_s32(src + i);
+        vst1q_s64(acc + i, vaddw_s32(vld1q_s64(acc + i), vget_low_s32(s)));
+        vst1q_s64(acc + i + 2U, vaddw_s32(vld1q_s64(acc + i + 2U), vget_high_s32(s)));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        acc[i] += src[i];
+    }
+}
+
+// Clipping happens once on the sum, not pairwise, so the order of the streams does not matter
+static void SaturateToS32(int32_t *out, const int64_t *acc, uint32_t samples)
+{
+    uint32_t i = 0;
+
+#ifdef MIXER_USE_NEON
+    for (; i + 4U <= samples; i += 4U) {
+        vst1q_s32(out + i, vcombine_s32(vqmovn_s64(vld1q_s64(acc + i)), vqmovn_s64(vld1q_s64(acc + i + 2U))));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        int64_t v = acc[i];
+        out[i] = (int32_t)(v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v));
+    }
+}
+
+static void MixStream(struct AudioMixer *mixer, struct AudioMixerStream *stream, uint32_t frames)
+{
+    uint32_t done = 0;
+
+    while (done < frames) {
+        uint32_t pos = (uint32_t)(stream->readFrames % stream->ringFrames);
+        uint32_t chunk = stream->ringFrames - pos;
+        if (chunk > frames - done) {
+            chunk = frames - done;
+        }
+        // The ring is consumed here, so the gain can go on it in place
+        int32_t *src = stream->ring + (size_t)pos * AUDIO_MIXER_CHANNELS;
+        AudioSoftGainApply(&stream->gain, src, chunk, AUDIO_MIXER_CHANNELS, AUDIO_MIXER_BITS);
+        Accumulate(mixer->acc + (size_t)done * AUDIO_MIXER_CHANNELS, src, chunk * AUDIO_MIXER_CHANNELS);
+        stream->readFrames += chunk;
+        done += chunk;
+    }
+}
+
+void AudioMixerMix(struct AudioMixer *mixer, int32_t *out)
+{
+    uint32_t period = mixer->periodFrames;
+
+    memset(mixer->acc, 0, (size_t)period * AUDIO_MIXER_CHANNELS * sizeof(int64_t));
+
+    for (int i = 0; i < AUDIO_MIXER_MAX_STREAMS; i++) {
+        struct AudioMixerStream *stream = &mixer->streams[i];
+        if (!stream->inUse || !stream->running || stream->paused || !stream->primed) {
+            continue;
+        }
+
+        uint32_t frames = (uint32_t)(stream->writeFrames - stream->readFrames);
+        if (frames < period) {
+            // Whatever there is gets played, the rest of the period is silence for this stream
+            stream->underruns++;
+        } else {
+            frames = period;
+        }
+        if (AudioSoftGainIsSilent(&stream->gain)) {
+            // Muted, or paused the moment the fade out ended: consume without touching the samples
+            stream->readFrames += frames;
+        } else {
+            MixStream(mixer, stream, frames);
+        }
+
+        if (stream->pausing && AudioSoftGainIsSilent(&stream->gain)) {
+            stream->pausing = false;
+            stream->paused = true;
+        }
+    }
+
+    SaturateToS32(out, mixer->acc, period * AUDIO_MIXER_CHANNELS);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_RENDER_MIXER_H
+#define AUDIO_RENDER_MIXER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio_converter.h"
+#include "audio_soft_gain.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_MIXER_MAX_STREAMS (8)
+#define AUDIO_MIXER_CHANNELS (2)
+#define AUDIO_MIXER_RING_PERIODS (4)
+// Frames a stream converts at a time on its way into the ring
+#define AUDIO_MIXER_CONVERT_FRAMES (256)
+// The ring and output format, what the pcm runs
+#define AUDIO_MIXER_BITS (32U)
+
+/*
+ * Every stream is converted to interleaved S32 stereo at the mixer rate when it is
+ * written, so the mixer only ever adds one sample format and S24/S32 content keeps
+ * its low bits. Nothing here locks, the owner of the mixer serializes writes and
+ * Mix() calls.
+ */
+struct AudioMixerStream {
+    bool inUse;
+    bool running;
+    bool paused;  // consumes nothing, the ring keeps what is queued
+    bool pausing; // fading out, becomes paused once the gain reaches 0
+    bool primed;  // has been written to since it started, an empty ring only counts as underrun after that
+
+    struct AudioConverter conv; // from the stream's own format, whatever it is
+    int32_t *convBuf;           // AUDIO_MIXER_CONVERT_FRAMES converted frames on their way to the ring
+    float volume;               // linear, what the gain goes back to after a pause
+    struct AudioSoftGain gain;
+
+    int32_t *ring;
+    uint32_t ringFrames;
+    uint64_t writeFrames;
+    uint64_t readFrames;
+
+    uint32_t underruns;
+};
+
+struct AudioMixer {
+    struct AudioMixerStream streams[AUDIO_MIXER_MAX_STREAMS];
+    uint32_t rate;
+    uint32_t periodFrames;
+    uint32_t rampFrames;
+    int64_t *acc; // wide enough for every stream at full scale, saturated once at the end
+};
+
+int32_t AudioMixerInit(struct AudioMixer *mixer, uint32_t rate, uint32_t periodFrames);
+void AudioMixerDeinit(struct AudioMixer *mixer);
+
+/* Only while no stream is running, rings follow on their next AudioMixerStreamStart() */
+int32_t AudioMixerSetPeriod(struct AudioMixer *mixer, uint32_t periodFrames);
+
+/* Length of the volume, mute and pause ramps, streams pick it up on their next start */
+void AudioMixerSetRamp(struct AudioMixer *mixer, uint32_t rampFrames);
+
+/* A new stream takes S16 stereo at the mixer rate */
+struct AudioMixerStream *AudioMixerStreamAlloc(struct AudioMixer *mixer);
+void AudioMixerStreamFree(struct AudioMixerStream *stream);
+
+/* Only while the stream is stopped. On failure the stream keeps the format it had */
+int32_t AudioMixerStreamSetFormat(struct AudioMixer *mixer, struct AudioMixerStream *stream,
+                                  const struct AudioConverterFormat *format);
+
+/* Allocates the ring for AUDIO_MIXER_RING_PERIODS periods and starts the stream empty */
+int32_t AudioMixerStreamStart(struct AudioMixer *mixer, struct AudioMixerStream *stream);
+void AudioMixerStreamStop(struct AudioMixerStream *stream);
+
+/* Linear, ramps from the current gain. Mute is a volume of 0 */
+void AudioMixerStreamSetVolume(struct AudioMixerStream *stream, float volume);
+
+/* Pausing fades out before the stream stops consuming, resuming fades back in */
+void AudioMixerStreamSetPaused(struct AudioMixerStream *stream, bool paused);
+
+uint32_t AudioMixerStreamSpace(const struct AudioMixerStream *stream);
+
+/* Bytes per frame in the stream's own format */
+uint32_t AudioMixerStreamFrameBytes(const struct AudioMixerStream *stream);
+
+/* Converts and queues up to 'frames' frames, returns how many of them were taken */
+uint32_t AudioMixerStreamWrite(struct AudioMixerStream *stream, const void *data, uint32_t frames);
+
+bool AudioMixerAnyRunning(const struct AudioMixer *mixer);
+
+/* Mixes one period of every running stream into 'out', interleaved S32 stereo */
+void AudioMixerMix(struct AudioMixer *mixer, int32_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_RENDER_MIXER_H */
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_render_mixer.h"
+
+#define BENCH_RATE (48000)
+#define BENCH_PERIOD (512)
+#define BENCH_SECONDS (60)
+#define BENCH_RAMP (64)
+// Float gain on an S32 sample is good for 24 bits, so a few hundred LSB per stream
+#define BENCH_MIX_TOLERANCE (AUDIO_MIXER_MAX_STREAMS * 256)
+
+static uint32_t g_seed = 0x12345678;
+
+static int16_t RandS16(void)
+{
+    g_seed = g_seed * 1664525U + 1013904223U;
+    return (int16_t)(g_seed >> 16);
+}
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int32_t ClampS32(double v)
+{
+    return (int32_t)(v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v));
+}
+
+// S16 content comes back in the top half of the S32 mix
+static int16_t Top(int32_t v)
+{
+    return (int16_t)(v >> 16);
+}
+
+/*
+ * One period of every stream against a plain C reference, loud enough to clip.
+ * The gain is float on S32 samples, each stream may be off by its rounding.
+ */
+static int CheckMix(void)
+{
+    struct AudioMixer mixer;
+    static int16_t in[AUDIO_MIXER_MAX_STREAMS][BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    static int32_t out[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    int failures = 0;
+
+    AudioMixerInit(&mixer, BENCH_RATE, BENCH_PERIOD);
+    for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+        struct AudioMixerStream *stream = AudioMixerStreamAlloc(&mixer);
+        AudioMixerStreamStart(&mixer, stream);
+        AudioMixerStreamSetVolume(stream, 1.0f / (float)(s + 1));
+        for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+            in[s][i] = RandS16();
+        }
+        AudioMixerStreamWrite(stream, in[s], BENCH_PERIOD);
+    }
+
+    AudioMixerMix(&mixer, out);
+    for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+        double acc = 0;
+        for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+            acc += (double)in[s][i] * 65536.0 * mixer.streams[s].volume;
+        }
+        if (llabs((long long)out[i] - ClampS32(acc)) > BENCH_MIX_TOLERANCE) {
+            failures++;
+        }
+    }
+    for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+        if (mixer.streams[s].underruns != 0) {
+            failures++;
+        }
+    }
+
+    // Nothing queued any more: every primed stream underruns once and the output is silent
+    AudioMixerMix(&mixer, out);
+    for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+        if (mixer.streams[s].underruns != 1) {
+            failures++;
+        }
+    }
+    for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+        if (out[i] != 0) {
+            failures++;
+            break;
+        }
+    }
+
+    AudioMixerDeinit(&mixer);
+    printf("mix check: %d failures\n", failures);
+    return failures;
+}
+
+// Mono S8, mono S24_LE and stereo S32 all end up as the same S32 stereo frame
+static int CheckFormats(void)
+{
+    struct AudioMixer mixer;
+    int32_t out[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    int8_t s8[BENCH_PERIOD];
+    int32_t s24[BENCH_PERIOD];
+    int32_t s32[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    int failures = 0;
+
+    for (int i = 0; i < BENCH_PERIOD; i++) {
+        int8_t v = (int8_t)(i - 128);
+        s8[i] = v;
+        s24[i] = (int32_t)v * 65536 & 0xffffff; // low 24 bits only, as the container holds them
+        s32[i * 2] = (int32_t)v * 16777216;
+        s32[i * 2 + 1] = (int32_t)v * 16777216;
+    }
+
+    const void *data[] = {s8, s24, s32};
+    uint32_t bits[] = {8U, 24U, 32U};
+    uint32_t channels[] = {1U, 1U, 2U};
+    for (int f = 0; f < 3; f++) {
+        AudioMixerInit(&mixer, BENCH_RATE, BENCH_PERIOD);
+        struct AudioMixerStream *stream = AudioMixerStreamAlloc(&mixer);
+        struct AudioConverterFormat format = {BENCH_RATE, channels[f], bits[f]};
+        if (AudioMixerStreamSetFormat(&mixer, stream, &format) < 0) {
+            failures++;
+        }
+        AudioMixerStreamStart(&mixer, stream);
+        AudioMixerStreamWrite(stream, data[f], BENCH_PERIOD);
+        AudioMixerMix(&mixer, out);
+        for (int i = 0; i < BENCH_PERIOD; i++) {
+            int32_t want = (int32_t)(int8_t)(i - 128) * 16777216;
+            if (out[i * 2] != want || out[i * 2 + 1] != want) {
+                failures++;
+                break;
+            }
+        }
+        AudioMixerDeinit(&mixer);
+    }
+
+    printf("format check: %d failures\n", failures);
+    return failures;
+}
+
+// S24 content below the S16 LSB survives the mix: two streams sum exactly into the S32 output
+static int CheckPrecision(void)
+{
+    struct AudioMixer mixer;
+    static int32_t in[2][BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    static int32_t out[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    struct AudioConverterFormat format = {BENCH_RATE, AUDIO_MIXER_CHANNELS, 24U};
+    int failures = 0;
+
+    AudioMixerInit(&mixer, BENCH_RATE, BENCH_PERIOD);
+    for (int s = 0; s < 2; s++) {
+        struct AudioMixerStream *stream = AudioMixerStreamAlloc(&mixer);
+        if (AudioMixerStreamSetFormat(&mixer, stream, &format) < 0) {
+            failures++;
+        }
+        AudioMixerStreamStart(&mixer, stream);
+        for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+            in[s][i] = (int32_t)(RandS16() % 256) * (s == 0 ? 1 : -3);
+        }
+        AudioMixerStreamWrite(stream, in[s], BENCH_PERIOD);
+    }
+
+    AudioMixerMix(&mixer, out);
+    for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+        if (out[i] != (in[0][i] + in[1][i]) * 256) {
+            failures++;
+        }
+    }
+
+    AudioMixerDeinit(&mixer);
+    printf("precision check: %d failures\n", failures);
+    return failures;
+}
+
+// Pausing fades out over the ramp and then stops consuming, resuming fades back in
+static int CheckPause(void)
+{
+    struct AudioMixer mixer;
+    int16_t in[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    int32_t mix[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    int16_t out[BENCH_PERIOD * AUDIO_MIXER_CHANNELS];
+    int failures = 0;
+
+    for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+        in[i] = 10000;
+    }
+
+    AudioMixerInit(&mixer, BENCH_RATE, BENCH_PERIOD);
+    AudioMixerSetRamp(&mixer, BENCH_RAMP);
+    struct AudioMixerStream *stream = AudioMixerStreamAlloc(&mixer);
+    AudioMixerStreamStart(&mixer, stream);
+    AudioMixerStreamWrite(stream, in, BENCH_PERIOD);
+    AudioMixerStreamWrite(stream, in, BENCH_PERIOD);
+
+    AudioMixerStreamSetPaused(stream, true);
+    AudioMixerMix(&mixer, mix);
+    for (int i = 0; i < BENCH_PERIOD * AUDIO_MIXER_CHANNELS; i++) {
+        out[i] = Top(mix[i]);
+    }
+    for (int i = 1; i < BENCH_PERIOD; i++) {
+        int16_t prev = out[(i - 1) * AUDIO_MIXER_CHANNELS];
+        int16_t cur = out[i * AUDIO_MIXER_CHANNELS];
+        if (cur > prev || (i >= BENCH_RAMP && cur != 0) || out[i * 2] != out[i * 2 + 1]) {
+            failures++;
+            break;
+        }
+    }
+    if (out[0] != 10000 || !stream->paused || stream->readFrames != BENCH_PERIOD) {
+        failures++;
+    }
+
+    // Paused: the second period stays queued and the output is silent
+    AudioMixerMix(&mixer, mix);
+    if (stream->readFrames != BENCH_PERIOD || mix[0] != 0 || stream->underruns != 0) {
+        failures++;
+    }
+
+    AudioMixerStreamSetPaused(stream, false);
+    AudioMixerMix(&mixer, mix);
+    if (mix[0] != 0 || mix[(BENCH_RAMP / 2) * 2] <= 0 || Top(mix[(BENCH_PERIOD - 1) * 2]) != 10000) {
+        failures++;
+    }
+
+    AudioMixerDeinit(&mixer);
+    printf("pause check: %d failures\n", failures);
+    return failures;
+}
+
+// Every stream at streamRate, S16 stereo; anything but BENCH_RATE goes through the resampler
+static int Bench(uint32_t streamRate)
+{
+    struct AudioMixer mixer;
+    const uint32_t chunkFrames = BENCH_PERIOD * 2;
+    const uint32_t periods = BENCH_RATE * BENCH_SECONDS / BENCH_PERIOD;
+    int16_t *in = malloc(sizeof(int16_t) * chunkFrames * AUDIO_MIXER_CHANNELS);
+    int32_t *out = malloc(sizeof(int32_t) * BENCH_PERIOD * AUDIO_MIXER_CHANNELS);
+    int failures = 0;
+
+    if (!in || !out) {
+        free(in);
+        free(out);
+        return 1;
+    }
+    for (uint32_t i = 0; i < chunkFrames * AUDIO_MIXER_CHANNELS; i++) {
+        in[i] = RandS16() / AUDIO_MIXER_MAX_STREAMS;
+    }
+
+    AudioMixerInit(&mixer, BENCH_RATE, BENCH_PERIOD);
+    for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+        struct AudioMixerStream *stream = AudioMixerStreamAlloc(&mixer);
+        struct AudioConverterFormat format = {streamRate, AUDIO_MIXER_CHANNELS, 16U};
+        failures += AudioMixerStreamSetFormat(&mixer, stream, &format) < 0;
+        AudioMixerStreamStart(&mixer, stream);
+        AudioMixerStreamSetVolume(stream, 0.75f);
+    }
+
+    // Writers refill every stream to the brim before each period, as the blocked clients would
+    double mixMs = 0;
+    double begin = NowMs();
+    for (uint32_t p = 0; p < periods; p++) {
+        for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+            AudioMixerStreamWrite(&mixer.streams[s], in, chunkFrames);
+        }
+        double t = NowMs();
+        AudioMixerMix(&mixer, out);
+        mixMs += NowMs() - t;
+    }
+    double totalMs = NowMs() - begin;
+
+    for (int s = 0; s < AUDIO_MIXER_MAX_STREAMS; s++) {
+        failures += mixer.streams[s].underruns != 0;
+    }
+
+    double audioMs = (double)periods * BENCH_PERIOD * 1e3 / BENCH_RATE;
+    printf("%d streams of %u Hz x %u periods of %d frames (%.0f s of 48 kHz stereo)\n", AUDIO_MIXER_MAX_STREAMS,
+           streamRate, periods, BENCH_PERIOD, audioMs / 1e3);
+    printf("  mix %.3f us/period, %.0fx realtime; with ring writes %.3f us/period, %.0fx realtime\n",
+           mixMs * 1e3 / periods, audioMs / mixMs, totalMs * 1e3 / periods, audioMs / totalMs);
+
+    AudioMixerDeinit(&mixer);
+    free(in);
+    free(out);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = CheckMix() + CheckFormats() + CheckPrecision() + CheckPause() + Bench(BENCH_RATE) +
+                   Bench(44100U);
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_soft_gain.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GAIN_USE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GAIN_USE_SSE2
+#endif
+
+#define S16_MIN_F (-32768.0f)
+#define S16_MAX_F (32767.0f)
+#define S24_MIN_F (-8388608.0f)
+#define S24_MAX_F (8388607.0f)
+#define S32_MIN_F (-2147483648.0f)
+#define S32_MAX_F (2147483520.0f) // the largest float below 2^31
+#define LANES (4U)
+#define MS_PER_SEC (1000U)
+
+void AudioSoftGainInit(struct AudioSoftGain *gain, float linear, uint32_t rampFrames)
+{
+    gain->current = linear;
+    gain->target = linear;
+    gain->step = 0.0f;
+    gain->rampLeft = 0;
+    gain->rampFrames = rampFrames;
+}
+
+void AudioSoftGainSetTarget(struct AudioSoftGain *gain, float linear)
+{
+    if (linear == gain->target) {
+        return;
+    }
+
+    gain->target = linear;
+    if (gain->rampFrames == 0) {
+        gain->current = linear;
+        gain->rampLeft = 0;
+        return;
+    }
+    gain->step = (linear - gain->current) / (float)gain->rampFrames;
+    gain->rampLeft = gain->rampFrames;
+}
+
+float AudioSoftGainFromDb(float db)
+{
+    return powf(10.0f, db / 20.0f);
+}
+
+uint32_t AudioSoftGainRampFrames(uint32_t rate)
+{
+    return rate * AUDIO_SOFT_GAIN_RAMP_MS / MS_PER_SEC;
+}
+
+bool AudioSoftGainIsSilent(const struct AudioSoftGain *gain)
+{
+    return gain->rampLeft == 0 && gain->current == 0.0f;
+}
+
+static inline float ClampF(float v, float lo, float hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Truncates toward zero like the vector paths, so every path gives the same samples
+static inline int32_t ScaleSample(int32_t v, float g, float lo, float hi)
+{
+    return (int32_t)ClampF((float)v * g, lo, hi);
+}
+
+#ifdef GAIN_USE_NEON
+typedef float32x4_t GainVec;
+
+static inline GainVec VecGain(float g, const float *offsets)
+{
+    return vaddq_f32(vdupq_n_f32(g), vld1q_f32(offsets));
+}
+
+static inline GainVec VecScale(int32x4_t v, GainVec g, float lo, float hi)
+{
+    return vminq_f32(vmaxq_f32(vmulq_f32(vcvtq_f32_s32(v), g), vdupq_n_f32(lo)), vdupq_n_f32(hi));
+}
+
+static inline void ScaleS16x4(int16_t *p, GainVec g)
+{
+    int32x4_t v = vmovl_s16(vld1_s16(p));
+    vst1_s16(p, vqmovn_s32(vcvtq_s32_f32(VecScale(v, g, S16_MIN_F, S16_MAX_F))));
+}
+
+static inline void ScaleS24x4(int32_t *p, GainVec g)
+{
+    // Sign extend the low 24 bits, the top byte of the container is not part of the sample
+    int32x4_t v = vshrq_n_s32(vshlq_n_s32(vld1q_s32(p), 8), 8);
+    vst1q_s32(p, vcvtq_s32_f32(VecScale(v, g, S24_MIN_F, S24_MAX_F)));
+}
+
+static inline void ScaleS32x4(int32_t *p, GainVec g)
+{
+    vst1q_s32(p, vcvtq_s32_f32(VecScale(vld1q_s32(p), g, S32_MIN_F, S32_MAX_F)));
+}
+#define GAIN_USE_SIMD
+#elif defined(GAIN_USE_SSE2)
+typedef __m128 GainVec;
+
+static inline GainVec VecGain(float g, const float *offsets)
+{
+    return _mm_add_ps(_mm_set1_ps(g), _mm_loadu_ps(offsets));
+}
+
+static inline __m128i VecScale(__m128i v, GainVec g, float lo, float hi)
+{
+    __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(v), g);
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(f, _mm_set1_ps(lo)), _mm_set1_ps(hi)));
+}
+
+static inline void ScaleS16x4(int16_t *p, GainVec g)
+{
+    __m128i v = _mm_loadl_epi64((const __m128i *)p);
+    v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    v = VecScale(v, g, S16_MIN_F, S16_MAX_F);
+    _mm_storel_epi64((__m128i *)p, _mm_packs_epi32(v, v));
+}
+
+static inline void ScaleS24x4(int32_t *p, GainVec g)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    v = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+    _mm_storeu_si128((__m128i *)p, VecScale(v, g, S24_MIN_F, S24_MAX_F));
+}
+
+static inline void ScaleS32x4(int32_t *p, GainVec g)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    _mm_storeu_si128((__m128i *)p, VecScale(v, g, S32_MIN_F, S32_MAX_F));
+}
+#define GAIN_USE_SIMD
+#endif
+
+/*
+ * Scales 'samples' interleaved samples, sample i of the block gets g + step * (i / channels).
+ * Four samples go at a time when the frames line up with the vector lanes (1, 2 or 4 channels)
+ * or the gain is constant, any other layout ramps in the scalar loop.
+ * Returns how many samples are left for the scalar tail.
+ */
+static uint32_t ScaleVector(void *data, uint32_t samples, uint32_t channels, uint32_t bits, float g, float step)
+{
+#ifdef GAIN_USE_SIMD
+    if (step != 0.0f && LANES % channels != 0) {
+        return samples;
+    }
+
+    uint32_t framesPerVec = step != 0.0f ? LANES / channels : 0;
+    float offsets[LANES];
+    for (uint32_t k = 0; k < LANES; k++) {
+        offsets[k] = step != 0.0f ? step * (float)(k / channels) : 0.0f;
+    }
+
+    uint32_t i = 0;
+    uint32_t frame = 0;
+    for (; i + LANES <= samples; i += LANES, frame += framesPerVec) {
+        // From the ramp start every time, rather than adding step up and drifting off target
+        GainVec gv = VecGain(g + step * (float)frame, offsets);
+        switch (bits) {
+            case 16U:
+                ScaleS16x4((int16_t *)data + i, gv);
+                break;
+            case 24U:
+                ScaleS24x4((int32_t *)data + i, gv);
+                break;
+            default:
+                ScaleS32x4((int32_t *)data + i, gv);
+                break;
+        }
+    }
+
+    return samples - i;
+#else
+    (void)data;
+    (void)channels;
+    (void)bits;
+    (void)g;
+    (void)step;
+    return samples;
+#endif
+}
+
+static void Scale(void *data, uint32_t frames, uint32_t channels, uint32_t bits, float g, float step)
+{
+    uint32_t samples = frames * channels;
+    uint32_t left = ScaleVector(data, samples, channels, bits, g, step);
+
+    for (uint32_t i = samples - left; i < samples; i++) {
+        float gi = g + step * (float)(i / channels);
+        switch (bits) {
+            case 16U: {
+                int16_t *p = (int16_t *)data + i;
+                *p = (int16_t)ScaleSample(*p, gi, S16_MIN_F, S16_MAX_F);
+                break;
+            }
+            case 24U: {
+                int32_t *p = (int32_t *)data + i;
+                *p = ScaleSample((int32_t)((uint32_t)*p << 8) >> 8, gi, S24_MIN_F, S24_MAX_F);
+                break;
+            }
+            default: {
+                int32_t *p = (int32_t *)data + i;
+                *p = ScaleSample(*p, gi, S32_MIN_F, S32_MAX_F);
+                break;
+            }
+        }
+    }
+}
+
+int32_t AudioSoftGainApply(struct AudioSoftGain *gain, void *data, uint32_t frames, uint32_t channels, uint32_t bits)
+{
+    if (bits != 16U && bits != 24U && bits != 32U) {
+        return -1;
+    }
+
+    uint32_t frameBytes = (bits == 16U ? sizeof(int16_t) : sizeof(int32_t)) * channels;
+    uint8_t *p = (uint8_t *)data;
+
+    if (gain->rampLeft > 0 && frames > 0) {
+        uint32_t n = frames < gain->rampLeft ? frames : gain->rampLeft;
+        Scale(p, n, channels, bits, gain->current, gain->step);
+        gain->rampLeft -= n;
+        gain->current = gain->rampLeft == 0 ? gain->target : gain->current + gain->step * (float)n;
+        p += (size_t)n * frameBytes;
+        frames -= n;
+    }
+
+    if (frames == 0 || gain->current == 1.0f) {
+        return 0;
+    }
+    if (gain->current == 0.0f) {
+        memset(p, 0, (size_t)frames * frameBytes);
+        return 0;
+    }
+    Scale(p, frames, channels, bits, gain->current, 0.0f);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_SOFT_GAIN_H
+#define AUDIO_SOFT_GAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every gain change is spread over this long, short enough to feel instant and long enough not to click
+#define AUDIO_SOFT_GAIN_RAMP_MS (10)
+
+/*
+ * A linear gain applied in place to interleaved PCM. A new target is reached with a
+ * per-frame linear ramp, so volume changes and mute do not click. Nothing here locks,
+ * the owner serializes AudioSoftGainSetTarget() and AudioSoftGainApply().
+ */
+struct AudioSoftGain {
+    float current;       // gain of the next frame
+    float target;
+    float step;          // per frame, while ramping
+    uint32_t rampLeft;   // frames until current reaches target
+    uint32_t rampFrames; // length of every ramp, 0 switches at once
+};
+
+/* Starts at 'linear' without a ramp */
+void AudioSoftGainInit(struct AudioSoftGain *gain, float linear, uint32_t rampFrames);
+
+/* Ramps from wherever the gain is now, a ramp under way is retargeted */
+void AudioSoftGainSetTarget(struct AudioSoftGain *gain, float linear);
+
+float AudioSoftGainFromDb(float db);
+
+uint32_t AudioSoftGainRampFrames(uint32_t rate);
+
+/* Settled at 0, what is left to apply is silence */
+bool AudioSoftGainIsSilent(const struct AudioSoftGain *gain);
+
+/*
+ * Scales 'frames' frames of S16, S24_LE (in 32 bit containers) or S32 samples in place,
+ * saturating to the sample range. Returns -1 on other sample sizes.
+ */
+int32_t AudioSoftGainApply(struct AudioSoftGain *gain, void *data, uint32_t frames, uint32_t channels, uint32_t bits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_SOFT_GAIN_H */
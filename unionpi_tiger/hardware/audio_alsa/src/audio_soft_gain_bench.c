@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_soft_gain.h"
+
+#define BENCH_RATE (48000)
+#define BENCH_CHANNELS (2)
+#define BENCH_SECONDS (60)
+#define BENCH_BLOCK (480)
+#define CHECK_FRAMES (1000)
+#define CHECK_RAMP (333)
+#define MAX_CHANNELS (6)
+
+static uint32_t g_seed = 0x12345678;
+
+static int32_t RandS32(void)
+{
+    g_seed = g_seed * 1664525U + 1013904223U;
+    return (int32_t)g_seed;
+}
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int64_t Clamp(double v, int64_t lo, int64_t hi)
+{
+    return v < (double)lo ? lo : (v > (double)hi ? hi : (int64_t)v);
+}
+
+static int32_t ReadSample(const void *data, uint32_t i, uint32_t bits)
+{
+    if (bits == 16U) {
+        return ((const int16_t *)data)[i];
+    }
+    int32_t v = ((const int32_t *)data)[i];
+    return bits == 24U ? (int32_t)((uint32_t)v << 8) >> 8 : v;
+}
+
+/*
+ * A fade from 1 to 0 over CHECK_RAMP frames and then a 2x boost that has to saturate,
+ * against a double precision reference. Ramped samples may be off by the rounding of the
+ * float gain, and S32 keeps only the 24 bits a float holds; S16 and S24 at a constant gain
+ * have to match exactly.
+ */
+static int CheckFormat(uint32_t bits, uint32_t channels)
+{
+    static int32_t data[CHECK_FRAMES * MAX_CHANNELS];
+    static int32_t orig[CHECK_FRAMES * MAX_CHANNELS];
+    uint32_t samples = CHECK_FRAMES * channels;
+    int64_t hi = bits == 16U ? INT16_MAX : (bits == 24U ? 8388607 : INT32_MAX);
+    int64_t lo = -hi - 1;
+    int failures = 0;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        int32_t v = RandS32();
+        if (bits == 16U) {
+            ((int16_t *)orig)[i] = (int16_t)(v >> 16);
+        } else {
+            orig[i] = bits == 24U ? (v >> 8) : v;
+        }
+    }
+
+    struct AudioSoftGain gain;
+    AudioSoftGainInit(&gain, 1.0f, CHECK_RAMP);
+    AudioSoftGainSetTarget(&gain, 0.0f);
+    memcpy(data, orig, sizeof(orig));
+    // Odd block sizes so the ramp ends in the middle of a vector
+    AudioSoftGainApply(&gain, data, 7, channels, bits);
+    uint32_t frameBytes = (bits == 16U ? 2U : 4U) * channels;
+    AudioSoftGainApply(&gain, (uint8_t *)data + 7 * frameBytes, CHECK_FRAMES / 2 - 7, channels, bits);
+    gain.rampFrames = 0;
+    AudioSoftGainSetTarget(&gain, 2.0f);
+    AudioSoftGainApply(&gain, (uint8_t *)data + (CHECK_FRAMES / 2) * frameBytes, CHECK_FRAMES / 2, channels, bits);
+
+    for (uint32_t i = 0; i < samples; i++) {
+        uint32_t frame = i / channels;
+        double g = frame < CHECK_RAMP ? 1.0 - (double)frame / CHECK_RAMP : (frame < CHECK_FRAMES / 2 ? 0.0 : 2.0);
+        int64_t want = Clamp((double)ReadSample(orig, i, bits) * g, lo, hi);
+        int64_t got = ReadSample(data, i, bits);
+        int64_t tolerance = frame < CHECK_RAMP ? (bits == 16U ? 1 : (bits == 24U ? 2 : 512)) : 0;
+        if (bits == 32U && frame >= CHECK_FRAMES / 2) {
+            tolerance = 128; // float keeps 24 bits of an S32 sample
+        }
+        if (got - want > tolerance || want - got > tolerance) {
+            if (failures++ == 0) {
+                printf("  S%u x%u sample %u: got %lld want %lld\n", bits, channels, i, (long long)got,
+                       (long long)want);
+            }
+        }
+    }
+    if (gain.current != 2.0f || AudioSoftGainIsSilent(&gain)) {
+        failures++;
+    }
+
+    return failures;
+}
+
+static int Check(void)
+{
+    const uint32_t bits[] = {16U, 24U, 32U};
+    const uint32_t channels[] = {1U, 2U, 3U, 4U, 6U};
+    int failures = 0;
+
+    for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+        for (size_t c = 0; c < sizeof(channels) / sizeof(channels[0]); c++) {
+            failures += CheckFormat(bits[b], channels[c]);
+        }
+    }
+
+    printf("gain check: %d failures\n", failures);
+    return failures;
+}
+
+static void Bench(uint32_t bits, bool ramping)
+{
+    const uint32_t blocks = BENCH_RATE * BENCH_SECONDS / BENCH_BLOCK;
+    size_t sampleBytes = bits == 16U ? sizeof(int16_t) : sizeof(int32_t);
+    uint8_t *data = malloc(BENCH_BLOCK * BENCH_CHANNELS * sampleBytes);
+    struct AudioSoftGain gain;
+
+    if (!data) {
+        return;
+    }
+    for (uint32_t i = 0; i < BENCH_BLOCK * BENCH_CHANNELS; i++) {
+        int32_t v = RandS32() >> 1;
+        if (bits == 16U) {
+            ((int16_t *)data)[i] = (int16_t)(v >> 16);
+        } else {
+            ((int32_t *)data)[i] = bits == 24U ? (v >> 8) : v;
+        }
+    }
+
+    // A ramp as long as a block, retargeted every block, never lets it settle
+    AudioSoftGainInit(&gain, 0.5f, ramping ? BENCH_BLOCK : 0);
+    double begin = NowMs();
+    for (uint32_t b = 0; b < blocks; b++) {
+        if (ramping) {
+            AudioSoftGainSetTarget(&gain, (b & 1U) ? 0.5f : 0.25f);
+        }
+        AudioSoftGainApply(&gain, data, BENCH_BLOCK, BENCH_CHANNELS, bits);
+    }
+    double ms = NowMs() - begin;
+
+    printf("  S%u stereo %s: %.3f us per 10 ms block, %.0fx realtime\n", bits, ramping ? "ramping " : "constant",
+           ms * 1e3 / blocks, BENCH_SECONDS * 1e3 / ms);
+    free(data);
+}
+
+int main(void)
+{
+    int failures = Check();
+
+    printf("%d s of %d kHz stereo in %d frame blocks\n", BENCH_SECONDS, BENCH_RATE / 1000, BENCH_BLOCK);
+    const uint32_t bits[] = {16U, 24U, 32U};
+    for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+        Bench(bits[b], false);
+        Bench(bits[b], true);
+    }
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -62,6 +62,9 @@
 
 #define RTB_QUEUE_ID_LENGTH 64
 
+/// size classes of the RTK_BUFFER pool, RtbPoolGetStats() takes one more for the heap
+#define RTB_POOL_CLASSES 4
+
 /*----------------------------------------------------------------------------------
     STRUCTURE DEFINITION
 ----------------------------------------------------------------------------------*/
@@ -107,11 +110,31 @@ typedef struct _RTK_BUFFER {
 struct BT_RTB_CONTEXT {
     uint8_t PacketType;
     uint16_t Handle;
+    uint8_t TxSeq;
+    uint8_t Retries;
 };
 
 /// definition to get rtk_buffer's control buffer context pointer
 #define BT_CONTEXT(_Rtb) ((struct BT_RTB_CONTEXT *)((_Rtb)->Context))
 
+/**
+    What a size class of the RTK_BUFFER pool has seen since the library was loaded
+    \param SlotSize      : Data bytes a buffer of the class holds, headroom included. 0 for the heap
+    \param Slots            : Buffers carved for the class, they are kept for reuse
+    \param InUse            : Buffers allocated and not freed yet
+    \param HighWater     : Most buffers in use at once
+    \param Allocs           : Buffers handed out
+    \param Misses          : Allocations the class had to leave to the heap, all its slots in use
+*/
+typedef struct _RTB_POOL_STATS {
+    uint32_t SlotSize;
+    uint32_t Slots;
+    uint32_t InUse;
+    uint32_t HighWater;
+    uint32_t Allocs;
+    uint32_t Misses;
+} RTB_POOL_STATS;
+
 /**
     Since RTBs are always used into/from list, so abstract this struct and provide APIs to easy process on RTBs
 */
@@ -122,6 +145,8 @@ typedef struct _RTB_QUEUE_HEAD RTB_QUEUE_HEAD;
 /**
     Allocate a RTK_BUFFER with specified data length and reserved headroom.
     If caller does not know actual headroom to reserve for further usage, specify it to zero to use default value.
+    The buffer comes from the smallest pool size class it fits, whatever the class holds beyond headroom and
+    Length is left as tailroom for RtbAddTail.
     \param [IN]     Length            <uint32_t>        : current data buffer length to allcated
     \param [IN]     HeadRoom     <uint32_t>         : if caller knows reserved head space, set it; otherwise set 0 to
    use default value \return pointer to RTK_BUFFER if succeed, null otherwise
@@ -271,4 +296,17 @@ EXTERN void RtbRemoveNode(IN OUT RTB_QUEUE_HEAD *RtkQueueHead, IN RTK_BUFFER *Rt
 
 EXTERN RTK_BUFFER *RtbCloneBuffer(IN RTK_BUFFER *pDataBuffer);
 
+/**
+    Get the counters of a pool size class
+    \param [IN]     Class        <uint32_t>                 : 0 to RTB_POOL_CLASSES - 1, RTB_POOL_CLASSES for the heap
+    \param [OUT]  Stats        <RTB_POOL_STATS*>    : counters of the class
+    \return    true if succeed, false for an unknown class
+*/
+EXTERN bool RtbPoolGetStats(IN uint32_t Class, OUT RTB_POOL_STATS *Stats);
+
+/**
+    Log the counters of every pool size class
+*/
+EXTERN void RtbPoolDumpStats(void);
+
 #endif /* BT_SKBUFF_H */
@@ -0,0 +1,106 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef HCI_H5_CODEC_H
+#define HCI_H5_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SLIP framing and the data integrity check of the H5 (three-wire UART) transport,
+ * working on whole buffers rather than byte by byte. Nothing here keeps global state,
+ * so the same code serves hci_h5.c and the codec bench.
+ */
+#define H5_SLIP_DELIM 0xc0
+#define H5_SLIP_ESC 0xdb
+#define H5_SLIP_ESC_DELIM 0xdc
+#define H5_SLIP_ESC_ESC 0xdd
+#define H5_SLIP_ESC_XON 0xde
+#define H5_SLIP_ESC_XOFF 0xdf
+
+/* Every byte escaped is the worst case */
+#define H5_SLIP_MAX_ENCODED(len) ((len) * 2)
+
+/* CRC-16-CCITT, reflected (poly 0x8408), seeded with all ones */
+#define H5_CRC_SEED 0xffff
+
+typedef enum H5_SLIP_STATUS {
+    H5_SLIP_NEED_MORE, /* input or output ran out */
+    H5_SLIP_AT_DELIM,  /* stopped in front of a 0xc0 */
+    H5_SLIP_BAD_ESC,   /* 0xdb followed by a byte that is no escape, the byte is taken */
+} tH5_SLIP_STATUS;
+
+typedef struct H5_SLIP_DECODER {
+    bool esc; /* the last byte taken was 0xdb */
+} tH5_SLIP_DECODER;
+
+/**
+ * Run len bytes through the CRC.
+ *
+ * @param crc CRC so far, H5_CRC_SEED for a new packet
+ * @param data bytes as they are before SLIP encoding
+ * @param len the length of data
+ * @return the new CRC
+ */
+uint16_t h5_crc_update_buf(uint16_t crc, const uint8_t *data, size_t len);
+
+/**
+ * The CRC is computed reflected but goes on the wire msb first,
+ * this gives the value whose high byte is sent first.
+ *
+ * @param crc CRC after the last payload byte
+ * @return the CRC in wire order
+ */
+uint16_t h5_crc_to_wire(uint16_t crc);
+
+/**
+ * SLIP encode len bytes, 0xc0 and 0xdb are always escaped,
+ * 0x11 and 0x13 only with out-of-frame flow control.
+ *
+ * @param out room for H5_SLIP_MAX_ENCODED(len) bytes
+ * @param in bytes to encode
+ * @param len the length of in
+ * @param oof_flow_control escape 0x11 and 0x13 as well
+ * @return the number of bytes written to out
+ */
+size_t h5_slip_encode(uint8_t *out, const uint8_t *in, size_t len, bool oof_flow_control);
+
+static inline void h5_slip_decoder_reset(tH5_SLIP_DECODER *dec)
+{
+    dec->esc = false;
+}
+
+/**
+ * SLIP decode until out is full, a 0xc0 turns up or the input runs out.
+ * A 0xc0 is left in the input for the caller, an escape split over
+ * two calls is carried in dec.
+ *
+ * @param dec decoder state of the stream
+ * @param in received bytes
+ * @param in_len the length of in
+ * @param in_used the number of bytes taken from in
+ * @param out where the decoded bytes go
+ * @param out_len room in out
+ * @param status why decoding stopped
+ * @return the number of bytes written to out
+ */
+size_t h5_slip_decode(tH5_SLIP_DECODER *dec, const uint8_t *in, size_t in_len, size_t *in_used, uint8_t *out,
+                      size_t out_len, tH5_SLIP_STATUS *status);
+
+#endif
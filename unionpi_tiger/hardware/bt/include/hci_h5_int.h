@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "bt_hci_bdroid.h"
+#include "bt_skbuff.h"
 #include "bt_vendor_lib.h"
 #include "rtk_hcidefs.h"
 #include "rtk_common.h"
@@ -54,6 +55,9 @@ typedef enum { DATA_TYPE_COMMAND = 1, DATA_TYPE_ACL = 2, DATA_TYPE_SCO = 3, DATA
 typedef struct hci_h5_callbacks_t {
     uint16_t (*h5_int_transmit_data_cb)(serial_data_type_t type, uint8_t *data, uint16_t length);
     void (*h5_data_ready_cb)(serial_data_type_t type, unsigned int total_length);
+    // optional, takes received packets as they are on the UART reader thread instead of h5_data_ready_cb;
+    // the type is in the packet context, there is headroom for a type byte and the callee frees them
+    void (*h5_recv_skbs_cb)(RTK_BUFFER **skbs, uint32_t count);
 } hci_h5_callbacks_t;
 
 typedef struct hci_h5_t {
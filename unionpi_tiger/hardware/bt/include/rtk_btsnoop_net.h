@@ -46,8 +46,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include "hci_h5_int.h"
 
+typedef struct RTK_BTSNOOP_STATS {
+    uint64_t Dropped;   /* records that found the ring full or failed to write, the drops field of the file */
+    uint64_t Records;   /* records written to the file */
+    uint64_t Bytes;     /* bytes written to the file */
+    uint64_t Writes;    /* writev() calls they took */
+    uint64_t Rotations; /* files started because the current one was full */
+    uint64_t Datagrams; /* records sent to the net dump listener */
+} RTK_BTSNOOP_STATS;
+
 void rtk_btsnoop_open(void);
 void rtk_btsnoop_close(void);
 void rtk_btsnoop_capture(const HC_BT_HDR *p_buf, bool is_rcvd);
@@ -61,6 +71,8 @@ bool get_rtk_btsnoop_dump(void);
 void set_rtk_btsnoop_net_dump(bool btsnoop_net_dump);
 bool get_rtk_btsnoop_net_dump(void);
 void set_rtk_btsnoop_save_log(bool btsnoop_save_log);
+void set_rtk_btsnoop_max_file_size(uint64_t max_file_size);
 char *get_rtk_btsnoop_path(void);
+void rtk_btsnoop_get_stats(RTK_BTSNOOP_STATS *stats);
 
 #endif
@@ -0,0 +1,109 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef RTK_TIMER_H
+#define RTK_TIMER_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Millisecond timers of the vendor library. All of them sit in one hierarchical
+ * timer wheel that a single thread drives from a timerfd, the callbacks run one
+ * after the other on that thread. Starting, stopping and restarting a timer is
+ * O(1) and makes no system call unless it becomes the earliest one.
+ */
+typedef struct RTK_TIMER RTK_TIMER;
+
+/* Same as the SIGEV_THREAD notify function the timers had before */
+typedef void (*tRTK_TIMER_CBACK)(union sigval arg);
+
+/* Longest timeout the wheel takes, a longer one is cut to it */
+#define RTK_TIMER_MAX_MS (1U << 24)
+
+typedef struct RTK_TIMER_STATS {
+    uint32_t Timers;      /* allocated */
+    uint32_t Armed;       /* started and not expired or stopped */
+    uint64_t Starts;
+    uint64_t Stops;
+    uint64_t Expiries;    /* callbacks run */
+    uint64_t Wakeups;     /* times the timer thread woke up */
+    uint64_t Coalesced;   /* expiries that shared a wakeup with an earlier one */
+    uint64_t TotalLateUs; /* sum over the expiries of callback start minus deadline */
+    uint32_t MaxLateUs;
+} RTK_TIMER_STATS;
+
+/**
+ * Allocate a stopped timer, the first one starts the timer thread.
+ *
+ * @param cback called on the timer thread when the timer expires
+ * @param arg handed to cback
+ * @return the timer, NULL when out of memory or the thread could not start
+ */
+RTK_TIMER *RtkTimerAllocate(tRTK_TIMER_CBACK cback, union sigval arg);
+
+/**
+ * Stop and free a timer, the last one stops the timer thread. A callback of the
+ * timer running on the timer thread is waited for unless that is the caller.
+ *
+ * @param timer the timer, NULL is ignored
+ * @return 0
+ */
+int RtkTimerFree(RTK_TIMER *timer);
+
+/**
+ * (Re)start a timer, a running one starts over.
+ *
+ * @param timer the timer
+ * @param msec time until it expires
+ * @param periodic expire every msec until stopped
+ * @return 0, -1 without a timer
+ */
+int RtkTimerStart(RTK_TIMER *timer, uint32_t msec, bool periodic);
+
+/**
+ * Stop a timer. A callback already running is not waited for, like timer_settime().
+ *
+ * @param timer the timer
+ * @return 0, -1 without a timer
+ */
+int RtkTimerStop(RTK_TIMER *timer);
+
+/**
+ * Let a timer expire up to slack_ms late so it lines up with others. Deadlines are
+ * rounded up to a multiple of slack_ms, timers with the same slack and period then
+ * expire on the same wakeup.
+ *
+ * @param timer the timer
+ * @param slack_ms 0 or 1 to expire on time
+ */
+void RtkTimerSetSlack(RTK_TIMER *timer, uint32_t slack_ms);
+
+/**
+ * Get the counters of the timer wheel
+ *
+ * @param stats where they go
+ */
+void RtkTimerGetStats(RTK_TIMER_STATS *stats);
+
+/**
+ * Log the counters of the timer wheel
+ */
+void RtkTimerDumpStats(void);
+
+#endif
@@ -46,6 +46,7 @@
 #include <termios.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stddef.h>
 
 #include "string.h"
 #include "hci_h5_int.h"
@@ -77,6 +78,127 @@ typedef struct _RTB_QUEUE_HEAD {
     uint8_t Id[RTB_QUEUE_ID_LENGTH];
 } *PRTB_QUEUE_HEAD;
 
+/**
+    What the pool hands out: the RTK_BUFFER with its data right behind it.
+    \param Next      : Free list link while the slot is in its class
+    \param Class     : Size class the slot goes back to, RTB_POOL_HEAP if it was malloc'ed on its own
+    \param Size       : Data bytes in Storage
+*/
+typedef struct _RTB_SLOT {
+    struct _RTB_SLOT *Next;
+    uint32_t Class;
+    uint32_t Size;
+    RTK_BUFFER Rtb;
+    uint8_t Storage[];
+} RTB_SLOT;
+
+typedef struct _RTB_POOL {
+    pthread_mutex_t Lock;
+    RTB_SLOT *FreeList;
+    RTB_POOL_STATS Stats;
+} RTB_POOL;
+
+// slots hold pointers, keep them aligned for those
+#define RTB_SLOT_ALIGN(_Length) (((_Length) + (sizeof(void *) - 1)) & ~(sizeof(void *) - 1))
+
+#define RTB_SLOT_OF(_Rtb) ((RTB_SLOT *)((uint8_t *)(_Rtb) - offsetof(RTB_SLOT, Rtb)))
+
+// ****************************************************************************
+// BUFFER POOL
+// ****************************************************************************
+/// index of the heap in RtbPools, it only counts
+#define RTB_POOL_HEAP RTB_POOL_CLASSES
+
+/// slots carved out of one malloc when a class runs dry
+#define RTB_POOL_SLAB_SLOTS 8
+
+/// slots a class keeps at most, about 400 KB over all classes, further buffers come from the heap
+static const uint32_t RtbPoolSlotLimit[RTB_POOL_CLASSES] = {256, 128, 64, 32};
+
+/// SlotSize of each class, headroom included: acks and commands, events and sco, an acl packet slip
+/// encoded for H5, and a whole H5 packet (0xFFF payload + 4 header + 2 crc) as h5_recv() takes it
+static RTB_POOL RtbPools[RTB_POOL_CLASSES + 1] = {
+    {PTHREAD_MUTEX_INITIALIZER, NULL, {128, 0, 0, 0, 0, 0}},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, {512, 0, 0, 0, 0, 0}},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, {2176, 0, 0, 0, 0, 0}},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, {4224, 0, 0, 0, 0, 0}},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, {0, 0, 0, 0, 0, 0}},
+};
+
+static inline void RtbPoolCount(RTB_POOL *Pool)
+{
+    Pool->Stats.Allocs++;
+    Pool->Stats.InUse++;
+    if (Pool->Stats.InUse > Pool->Stats.HighWater) {
+        Pool->Stats.HighWater = Pool->Stats.InUse;
+    }
+}
+
+/**
+    Carve RTB_POOL_SLAB_SLOTS slots for a class out of one malloc and put them on its free list.
+    Slabs stay with the class for the life of the library. Called with the class lock held.
+*/
+static void RtbPoolGrow(uint32_t Class)
+{
+    RTB_POOL *Pool = &RtbPools[Class];
+    size_t SlotLen = RTB_SLOT_ALIGN(sizeof(RTB_SLOT) + Pool->Stats.SlotSize);
+    uint32_t Count = RtbPoolSlotLimit[Class] - Pool->Stats.Slots;
+    uint8_t *Slab;
+    uint32_t i;
+
+    Count = Count < RTB_POOL_SLAB_SLOTS ? Count : RTB_POOL_SLAB_SLOTS;
+    if (!Count) {
+        return;
+    }
+    Slab = malloc(SlotLen * Count);
+    if (!Slab) {
+        return;
+    }
+    for (i = 0; i < Count; i++) {
+        RTB_SLOT *Slot = (RTB_SLOT *)(Slab + SlotLen * i);
+        Slot->Class = Class;
+        Slot->Size = Pool->Stats.SlotSize;
+        Slot->Next = Pool->FreeList;
+        Pool->FreeList = Slot;
+    }
+    Pool->Stats.Slots += Count;
+}
+
+static RTB_SLOT *RtbPoolGet(uint32_t Class)
+{
+    RTB_POOL *Pool = &RtbPools[Class];
+    RTB_SLOT *Slot;
+
+    pthread_mutex_lock(&Pool->Lock);
+    if (!Pool->FreeList) {
+        RtbPoolGrow(Class);
+    }
+    Slot = Pool->FreeList;
+    if (Slot) {
+        Pool->FreeList = Slot->Next;
+        RtbPoolCount(Pool);
+    } else {
+        Pool->Stats.Misses++;
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+    return Slot;
+}
+
+static RTB_SLOT *RtbHeapGet(uint32_t BufferLen)
+{
+    RTB_POOL *Pool = &RtbPools[RTB_POOL_HEAP];
+    RTB_SLOT *Slot = malloc(sizeof(RTB_SLOT) + BufferLen);
+
+    if (Slot) {
+        Slot->Class = RTB_POOL_HEAP;
+        Slot->Size = BufferLen;
+        pthread_mutex_lock(&Pool->Lock);
+        RtbPoolCount(Pool);
+        pthread_mutex_unlock(&Pool->Lock);
+    }
+    return Slot;
+}
+
 // ****************************************************************************
 // FUNCTION
 // ****************************************************************************
@@ -99,37 +221,39 @@ bool RtbQueueIsEmpty(IN RTB_QUEUE_HEAD *RtkQueueHead)
 */
 RTK_BUFFER *RtbAllocate(uint32_t Length, uint32_t HeadRoom)
 {
-    RTK_BUFFER *Rtb = NULL;
-    /// Rtb buffer length:
-    ///      RTK_BUFFER   48
-    ///      HeadRoom      HeadRomm or 12
-    ///      Length
-    /// memory size: 48 + Length + 12(default) + 8*2(header for each memory) ---> a multiple of 8
-    /// example:       (48 + 8)+ (300 + 12 + 8) = 372
-    Rtb = malloc(sizeof(RTK_BUFFER));
-    if (Rtb) {
-        uint32_t BufferLen = HeadRoom ? (Length + HeadRoom) : (Length + DEFAULT_HEADER_SIZE);
-        BufferLen = RTB_DATA_ALIGN(BufferLen);
-        Rtb->Head = malloc(BufferLen);
-        if (Rtb->Head) {
-            Rtb->HeadRoom = HeadRoom ? HeadRoom : DEFAULT_HEADER_SIZE;
-            Rtb->Data = Rtb->Head + Rtb->HeadRoom;
-            Rtb->End = Rtb->Data;
-            Rtb->Tail = Rtb->End + Length;
-            Rtb->Length = 0;
-            ListInitializeHeader(&Rtb->List);
-            Rtb->RefCount = 1;
-            return Rtb;
+    RTB_SLOT *Slot = NULL;
+    uint32_t Room = HeadRoom ? HeadRoom : DEFAULT_HEADER_SIZE;
+    uint32_t BufferLen;
+    uint32_t Class;
+
+    /// Rtb buffer: RTB_SLOT header, then HeadRoom or 12, Length and whatever the class has left as tailroom,
+    /// in one piece of memory that goes back to its class when freed
+    if (Length > UINT32_MAX - Room - RTB_ALIGN) {
+        return NULL;
+    }
+    BufferLen = RTB_DATA_ALIGN(Length + Room);
+    for (Class = 0; Class < RTB_POOL_CLASSES; Class++) {
+        if (BufferLen <= RtbPools[Class].Stats.SlotSize) {
+            Slot = RtbPoolGet(Class);
+            break;
         }
     }
-
-    if (Rtb) {
-        if (Rtb->Head) {
-            free(Rtb->Head);
+    if (!Slot) {
+        Slot = RtbHeapGet(BufferLen);
+        if (!Slot) {
+            return NULL;
         }
-        free(Rtb);
     }
-    return NULL;
+
+    Slot->Rtb.Head = Slot->Storage;
+    Slot->Rtb.HeadRoom = Room;
+    Slot->Rtb.Data = Slot->Rtb.Head + Room;
+    Slot->Rtb.End = Slot->Rtb.Data;
+    Slot->Rtb.Tail = Slot->Rtb.Head + Slot->Size;
+    Slot->Rtb.Length = 0;
+    ListInitializeHeader(&Slot->Rtb.List);
+    Slot->Rtb.RefCount = 1;
+    return &Slot->Rtb;
 }
 
 /**
@@ -138,11 +262,24 @@ RTK_BUFFER *RtbAllocate(uint32_t Length, uint32_t HeadRoom)
 */
 void RtbFree(RTK_BUFFER *RtkBuffer)
 {
-    if (RtkBuffer) {
-        free(RtkBuffer->Head);
-        free(RtkBuffer);
+    RTB_SLOT *Slot;
+    RTB_POOL *Pool;
+
+    if (!RtkBuffer) {
+        return;
     }
-    return;
+    Slot = RTB_SLOT_OF(RtkBuffer);
+    Pool = &RtbPools[Slot->Class];
+    pthread_mutex_lock(&Pool->Lock);
+    Pool->Stats.InUse--;
+    if (Slot->Class == RTB_POOL_HEAP) {
+        pthread_mutex_unlock(&Pool->Lock);
+        free(Slot);
+        return;
+    }
+    Slot->Next = Pool->FreeList;
+    Pool->FreeList = Slot;
+    pthread_mutex_unlock(&Pool->Lock);
 }
 
 /**
@@ -429,6 +566,39 @@ void RtbEmptyQueue(IN OUT RTB_QUEUE_HEAD *RtkQueueHead)
     return;
 }
 
+/**
+    Get the counters of a pool size class
+    \param [IN]     Class        <uint32_t>                 : 0 to RTB_POOL_CLASSES - 1, RTB_POOL_CLASSES for the heap
+    \param [OUT]  Stats        <RTB_POOL_STATS*>    : counters of the class
+    \return    true if succeed, false for an unknown class
+*/
+bool RtbPoolGetStats(IN uint32_t Class, OUT RTB_POOL_STATS *Stats)
+{
+    if (Class > RTB_POOL_HEAP || !Stats) {
+        return false;
+    }
+    pthread_mutex_lock(&RtbPools[Class].Lock);
+    *Stats = RtbPools[Class].Stats;
+    pthread_mutex_unlock(&RtbPools[Class].Lock);
+    return true;
+}
+
+/**
+    Log the counters of every pool size class
+*/
+void RtbPoolDumpStats(void)
+{
+    RTB_POOL_STATS Stats;
+    uint32_t Class;
+
+    for (Class = 0; Class <= RTB_POOL_HEAP; Class++) {
+        if (RtbPoolGetStats(Class, &Stats)) {
+            HILOGI("rtb pool %u: size %u slots %u in use %u high water %u allocs %u misses %u", Class,
+                   Stats.SlotSize, Stats.Slots, Stats.InUse, Stats.HighWater, Stats.Allocs, Stats.Misses);
+        }
+    }
+}
+
 /// Annie_tmp
 unsigned char RtbCheckQueueLen(IN RTB_QUEUE_HEAD *RtkQueueHead, IN uint8_t Len)
 {
@@ -0,0 +1,291 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      bt_skbuff_bench.c
+ *
+ *  Description:   Checks the RTK_BUFFER pool keeps the RtbAllocate/RtbFree
+ *                 contract, then has threads allocate and free buffers the
+ *                 way the H5 and userial paths do, from the pool and from
+ *                 the two mallocs RtbAllocate made before.
+ *
+ *                     bt_skbuff_bench [threads] [buffers per thread]
+ *
+ ******************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bt_skbuff.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define BENCH_THREADS 4
+#define BENCH_BUFFERS 2000000
+#define BENCH_IN_FLIGHT 16 /* buffers a thread holds at once, like the unack queue */
+#define DEFAULT_HEADROOM 12
+#define H5_RX_SKB_LEN 0x1005
+#define NSEC_PER_SEC 1000000000LL
+
+#define CHECK(cond, ...)                                                                                               \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("check failed at %s:%d: ", __FILE__, __LINE__);                                                   \
+            printf(__VA_ARGS__);                                                                                       \
+            printf("\n");                                                                                              \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+/* What the H5 and userial paths ask for: acks, commands, events, sco, slip encoded acl, h5_recv() */
+static const uint32_t g_sizes[] = {1, 4, 12, 64, 240, 260, 1021, 2056, H5_RX_SKB_LEN};
+
+typedef struct {
+    uint32_t count;
+    int legacy;
+    int failed;
+    long long ns;
+} bench_thread_t;
+
+/******************************************************************************
+**  RtbAllocate/RtbFree before the pool, a header and a data malloc each
+******************************************************************************/
+static RTK_BUFFER *legacy_allocate(uint32_t length, uint32_t headroom)
+{
+    RTK_BUFFER *rtb = malloc(sizeof(RTK_BUFFER));
+    uint32_t room = headroom ? headroom : DEFAULT_HEADROOM;
+
+    if (!rtb) {
+        return NULL;
+    }
+    rtb->Head = malloc((length + room + 3) & ~3U);
+    if (!rtb->Head) {
+        free(rtb);
+        return NULL;
+    }
+    rtb->HeadRoom = room;
+    rtb->Data = rtb->Head + room;
+    rtb->End = rtb->Data;
+    rtb->Tail = rtb->End + length;
+    rtb->Length = 0;
+    rtb->RefCount = 1;
+    return rtb;
+}
+
+static void legacy_free(RTK_BUFFER *rtb)
+{
+    free(rtb->Head);
+    free(rtb);
+}
+
+/******************************************************************************
+**  Checks
+******************************************************************************/
+static int check_contract(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(g_sizes) / sizeof(g_sizes[0]); i++) {
+        uint32_t headroom = (i & 1) ? 0 : 8;
+        uint32_t room = headroom ? headroom : DEFAULT_HEADROOM;
+        RTK_BUFFER *rtb = RtbAllocate(g_sizes[i], headroom);
+        uint8_t *p;
+
+        CHECK(rtb != NULL, "allocate %u", g_sizes[i]);
+        CHECK(rtb->Length == 0 && rtb->RefCount == 1 && rtb->HeadRoom == room, "fresh buffer of %u", g_sizes[i]);
+        CHECK(rtb->Data == rtb->Head + room && rtb->End == rtb->Data, "layout of %u", g_sizes[i]);
+        CHECK(((uintptr_t)rtb->Head & (sizeof(void *) - 1)) == 0, "buffer of %u not aligned", g_sizes[i]);
+
+        p = RtbAddTail(rtb, g_sizes[i]);
+        CHECK(p == rtb->Data && rtb->Length == g_sizes[i], "tail of %u", g_sizes[i]);
+        memset(p, 0xa5, g_sizes[i]);
+        CHECK(RtbAddHead(rtb, room) == rtb->Head && RtbAddHead(rtb, 1) == NULL, "headroom of %u", g_sizes[i]);
+        CHECK(RtbRemoveHead(rtb, room) && RtbRemoveTail(rtb, g_sizes[i]) && rtb->Length == 0, "trim %u",
+              g_sizes[i]);
+        RtbFree(rtb);
+    }
+    RtbFree(NULL);
+    return 0;
+}
+
+static int check_classes(void)
+{
+    RTB_POOL_STATS before[RTB_POOL_CLASSES + 1];
+    RTB_POOL_STATS after;
+    RTK_BUFFER *held[300];
+    uint32_t cls;
+    uint32_t n;
+
+    CHECK(!RtbPoolGetStats(RTB_POOL_CLASSES + 1, &after), "stats of a class that is not there");
+    for (cls = 0; cls <= RTB_POOL_CLASSES; cls++) {
+        CHECK(RtbPoolGetStats(cls, &before[cls]), "stats of class %u", cls);
+    }
+
+    // every size lands in the smallest class it fits, the headroom counted in
+    for (cls = 0; cls < RTB_POOL_CLASSES; cls++) {
+        uint32_t size = before[cls].SlotSize;
+        RTK_BUFFER *rtb = RtbAllocate(size - DEFAULT_HEADROOM, 0);
+        RTK_BUFFER *next = RtbAllocate(size - DEFAULT_HEADROOM + 1, 0);
+
+        CHECK(rtb && next, "allocate around %u", size);
+        RtbPoolGetStats(cls, &before[cls]);
+        CHECK(rtb->Tail == rtb->Head + size, "class %u slot has no tailroom left", cls);
+        CHECK(next->Tail - next->Head > (long)size, "one byte more than class %u", cls);
+        CHECK(RtbAddTail(rtb, size - DEFAULT_HEADROOM) && !RtbAddTail(rtb, 1), "tail of class %u", cls);
+        RtbPoolGetStats(cls, &after);
+        CHECK(after.InUse == before[cls].InUse && after.InUse >= 1, "class %u counts", cls);
+        RtbFree(rtb);
+        RtbPoolGetStats(cls, &after);
+        CHECK(after.InUse == before[cls].InUse - 1, "class %u in use after free", cls);
+        RtbFree(next);
+    }
+
+    // a class at its limit leaves the rest to the heap, the high water shows the peak
+    RtbPoolGetStats(0, &before[0]);
+    RtbPoolGetStats(RTB_POOL_CLASSES, &before[RTB_POOL_CLASSES]);
+    for (n = 0; n < sizeof(held) / sizeof(held[0]); n++) {
+        held[n] = RtbAllocate(1, 0);
+        CHECK(held[n] != NULL, "allocate %u small buffers", n);
+    }
+    RtbPoolGetStats(0, &after);
+    CHECK(after.Slots < sizeof(held) / sizeof(held[0]) && after.Misses > before[0].Misses,
+          "small class did not run out, %u slots", after.Slots);
+    CHECK(after.HighWater >= after.Slots, "high water %u of %u slots", after.HighWater, after.Slots);
+    for (n = 0; n < sizeof(held) / sizeof(held[0]); n++) {
+        RtbFree(held[n]);
+    }
+    RtbPoolGetStats(0, &after);
+    CHECK(after.InUse == 0, "small class in use %u", after.InUse);
+    RtbPoolGetStats(RTB_POOL_CLASSES, &after);
+    CHECK(after.InUse == 0 && after.Allocs > before[RTB_POOL_CLASSES].Allocs, "heap in use %u", after.InUse);
+    return 0;
+}
+
+/******************************************************************************
+**  Threads
+******************************************************************************/
+/* CPU time of the calling thread, so threads sharing a core do not count each other */
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Allocates, fills, checks and frees buffers, a few in flight like a queue */
+static void *bench_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+    RTK_BUFFER *ring[BENCH_IN_FLIGHT] = {NULL};
+    uint32_t seed = (uint32_t)(uintptr_t)arg | 1;
+    long long start = now_ns();
+    uint32_t i;
+
+    for (i = 0; i < t->count + BENCH_IN_FLIGHT; i++) {
+        RTK_BUFFER **slot = &ring[i % BENCH_IN_FLIGHT];
+
+        if (*slot) {
+            uint8_t tag = (*slot)->Data[0];
+            if ((*slot)->Data[(*slot)->Length - 1] != tag) {
+                t->failed = 1;
+            }
+            if (t->legacy) {
+                legacy_free(*slot);
+            } else {
+                RtbFree(*slot);
+            }
+            *slot = NULL;
+        }
+        if (i < t->count) {
+            uint32_t len;
+
+            seed = seed * 1103515245 + 12345;
+            len = g_sizes[(seed >> 16) % (sizeof(g_sizes) / sizeof(g_sizes[0]))];
+            *slot = t->legacy ? legacy_allocate(len, 0) : RtbAllocate(len, 0);
+            if (!*slot) {
+                t->failed = 1;
+                break;
+            }
+            RtbAddTail(*slot, len);
+            (*slot)->Data[0] = (uint8_t)i;
+            (*slot)->Data[len - 1] = (uint8_t)i;
+        }
+    }
+    t->ns = now_ns() - start;
+    return NULL;
+}
+
+static int run_threads(int legacy, uint32_t threads, uint32_t count, double *ns_per_buffer)
+{
+    pthread_t tid[64];
+    bench_thread_t t[64];
+    long long total_ns = 0;
+    uint32_t i;
+    int failed = 0;
+
+    for (i = 0; i < threads; i++) {
+        t[i].count = count;
+        t[i].legacy = legacy;
+        t[i].failed = 0;
+        t[i].ns = 0;
+        if (pthread_create(&tid[i], NULL, bench_thread, &t[i])) {
+            return 1;
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+        total_ns += t[i].ns;
+        failed |= t[i].failed;
+    }
+    *ns_per_buffer = (double)total_ns / ((double)threads * count);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t threads = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : BENCH_THREADS;
+    uint32_t count = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : BENCH_BUFFERS;
+    double pool_ns = 0;
+    double legacy_ns = 0;
+    RTB_POOL_STATS stats;
+    uint32_t cls;
+    int failures = 0;
+
+    threads = (threads < 1) ? 1 : (threads > 64 ? 64 : threads);
+    failures += check_contract();
+    failures += check_classes();
+    if (!failures && count) {
+        failures += run_threads(1, threads, count, &legacy_ns);
+        failures += run_threads(0, threads, count, &pool_ns);
+        printf("%u threads, %u buffers each\n", threads, count);
+        printf("two mallocs %8.1f cpu ns per buffer\n", legacy_ns);
+        printf("pool        %8.1f cpu ns per buffer, %.1fx\n", pool_ns, legacy_ns / pool_ns);
+    }
+    for (cls = 0; cls <= RTB_POOL_CLASSES; cls++) {
+        RtbPoolGetStats(cls, &stats);
+        printf("class %u: size %5u slots %4u high water %4u allocs %9u misses %u\n", cls, stats.SlotSize,
+               stats.Slots, stats.HighWater, stats.Allocs, stats.Misses);
+        failures += (stats.InUse != 0);
+    }
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
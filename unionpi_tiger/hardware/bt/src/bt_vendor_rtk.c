@@ -340,6 +340,8 @@ static void load_rtkbt_stack_conf(void)
             if (!strcmp(rtk_trim(split + 1), "true")) {
                 set_rtk_btsnoop_save_log (true);
             }
+        } else if (!strcmp(rtk_trim(line_ptr), "BtSnoopMaxFileSize")) {
+            set_rtk_btsnoop_max_file_size(strtoull(rtk_trim(split + 1), &endptr, 0) * 1024L * 1024L);
         } else if (!strcmp(rtk_trim(line_ptr), "BtCoexLogOutput")) {
             ret_coex_log_onoff = strtol(rtk_trim(split + 1), &endptr, 0);
             set_coex_log_onoff(ret_coex_log_onoff);
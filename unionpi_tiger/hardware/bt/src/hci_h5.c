@@ -52,7 +52,9 @@
 #include "bt_hci_bdroid.h"
 #include "bt_list.h"
 #include "bt_skbuff.h"
+#include "hci_h5_codec.h"
 #include "hci_h5_int.h"
+#include "rtk_timer.h"
 #include "userial.h"
 #include "userial_vendor.h"
 
@@ -75,13 +77,14 @@ unsigned int h5_log_enable = 1;
 #endif
 #define H5_LOG_MAX_SIZE (H5_LOG_BUF_SIZE - 12)
 
-#define DATA_RETRANS_COUNT 40          // 40*100 = 4000ms(4s)
-#define BT_INIT_DATA_RETRANS_COUNT 200 // 200*20 = 4000ms(4s)
+#define DATA_RETRANS_GIVE_UP_MS 4000  // oldest unacked packet sent this long ago, kill bluetooth
 #define SYNC_RETRANS_COUNT 350         // 350*10 = 3500ms(3.5s)
 #define CONF_RETRANS_COUNT 350
 
-#define DATA_RETRANS_TIMEOUT_VALUE 100        // ms
+#define DATA_RETRANS_TIMEOUT_VALUE 100        // ms, until the first round trip is measured
 #define BT_INIT_DATA_RETRANS_TIMEOUT_VALUE 20 // ms
+#define H5_RTO_MIN_MS 20
+#define H5_RTO_MAX_MS 1000
 #define SYNC_RETRANS_TIMEOUT_VALUE 10
 #define CONF_RETRANS_TIMEOUT_VALUE 20
 #define WAIT_CT_BAUDRATE_READY_TIMEOUT_VALUE 5
@@ -129,12 +132,24 @@ unsigned int h5_log_enable = 1;
 #define H5_CFG_DIC_TYPE(cfg) (((cfg) >> 4) & 0x01)
 #define H5_CFG_VER_NUM(cfg) (((cfg) >> 5) & 0x07)
 #define H5_CFG_SIZE 1
+#define H5_CFG_DIC_CRC 0x10
+
+// asked for in the config request, the controller answers with what it takes
+#define H5_MAX_SLIDING_WINDOW 7
+
+// worst case frame of a len byte payload: every byte of header, payload and crc escaped, and two delimiters
+#define H5_FRAME_MAX_ENCODED(len) (H5_SLIP_MAX_ENCODED((len) + H5_HDR_SIZE + 2) + 2)
+
+// TX frames are encoded back to back here and go out in one write, room for two whole worst case frames
+#define H5_TX_BUF_SIZE (2 * H5_FRAME_MAX_ENCODED(0xFFF))
+
+// received packets handed to h5_recv_skbs_cb in one call at most
+#define H5_RX_BATCH_MAX 16
 
 /******************************************************************************
 **  Local type definitions
 ******************************************************************************/
 /* Callback function for the returned event of internal issued command */
-typedef void (*tTIMER_HANDLE_CBACK)(union sigval sigval_value);
 
 typedef struct {
     uint16_t opcode;      /* OPCODE of outstanding internal commands */
@@ -146,8 +161,6 @@ typedef RTK_BUFFER sk_buff;
 
 typedef enum H5_RX_STATE { H5_W4_PKT_DELIMITER, H5_W4_PKT_START, H5_W4_HDR, H5_W4_DATA, H5_W4_CRC } tH5_RX_STATE;
 
-typedef enum H5_RX_ESC_STATE { H5_ESCSTATE_NOESC, H5_ESCSTATE_ESC } tH5_RX_ESC_STATE;
-
 typedef enum H5_LINK_STATE { H5_UNINITIALIZED, H5_INITIALIZED, H5_ACTIVE } tH5_LINK_STATE;
 
 #define H5_EVENT_RX 0x0001
@@ -170,7 +183,6 @@ void set_h5_log_enable(unsigned int enable)
 
 /* Control block for HCISU_H5 */
 typedef struct HCI_H5_CB {
-    HC_BT_HDR *p_rcv_msg;                      /* Buffer to hold current rx HCI message */
     uint32_t int_cmd_rsp_pending;              /* Num of internal cmds pending for ack */
     uint8_t int_cmd_rd_idx;                    /* Read index of int_cmd_opcode queue */
     uint8_t int_cmd_wrt_idx;                   /* Write index of int_cmd_opcode queue */
@@ -201,20 +213,33 @@ typedef struct HCI_H5_CB {
     uint32_t rx_count; // expected pkts to recv
 
     tH5_RX_STATE rx_state;
-    tH5_RX_ESC_STATE rx_esc_state;
+    tH5_SLIP_DECODER rx_slip;
     tH5_LINK_STATE link_estab_state;
 
     sk_buff *rx_skb;
     sk_buff *data_skb;
     sk_buff *internal_skb;
 
-    timer_t timer_data_retrans;
-    timer_t timer_sync_retrans;
-    timer_t timer_conf_retrans;
-    timer_t timer_wait_ct_baudrate_ready;
-    timer_t timer_h5_hw_init_ready;
+    RTK_TIMER *timer_data_retrans;
+    RTK_TIMER *timer_sync_retrans;
+    RTK_TIMER *timer_conf_retrans;
+    RTK_TIMER *timer_wait_ct_baudrate_ready;
+    RTK_TIMER *timer_h5_hw_init_ready;
 
     uint32_t data_retrans_count;
+
+    // retransmission of the reliable channel after RFC 6298, under h5_wakeup_mutex
+    uint64_t tx_time_us[8];      // first send of each sequence number
+    uint32_t srtt_us;            // smoothed round trip time, 0 until the first sample
+    uint32_t rttvar_us;          // round trip time variation
+    uint32_t rto_ms;             // retransmission timeout, 0 until the first sample or time out
+    uint8_t rtx_count;           // packets at the head of unack to send again
+    uint8_t rtx_sent;            // of those, sent again already
+    uint8_t rto_probe;           // the head went again on a time out, the rest waits for its ack
+    uint8_t data_retrans_timer_running;
+    uint32_t rto_fired;
+    uint32_t fast_retransmits;
+
     uint32_t sync_retrans_count;
     uint32_t conf_retrans_count;
 
@@ -226,11 +251,17 @@ typedef struct HCI_H5_CB {
     pthread_cond_t data_cond;
     pthread_t thread_data_ready_cb;
 
+    uint8_t tx_buf[H5_TX_BUF_SIZE]; // under h5_wakeup_mutex
+
+    sk_buff *rx_batch[H5_RX_BATCH_MAX]; // passed up by the current h5_recv_msg call
+    uint32_t rx_batch_len;
+
     uint8_t cleanuping;
 } tHCI_H5_CB;
 
 static tHCI_H5_CB rtk_h5;
 static pthread_mutex_t h5_wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t h5_pass_up_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /******************************************************************************
 **  Variables
@@ -252,9 +283,6 @@ struct patch_struct {
 /******************************************************************************
 **  Static function
 ******************************************************************************/
-static timer_t OsAllocateTimer(tTIMER_HANDLE_CBACK timer_callback);
-static int OsStartTimer(timer_t timerid, int msec, int mode);
-static int OsStopTimer(timer_t timerid);
 static uint16_t h5_wake_up(void);
 
 static hci_h5_callbacks_t *h5_int_hal_callbacks;
@@ -291,25 +319,6 @@ int h5_start_hw_init_ready_timer(void);
 
 int h5_enqueue(IN sk_buff *skb);
 
-// bite reverse in bytes
-// 00000001 -> 10000000
-// 00000100 -> 00100000
-const uint8_t byte_rev_table[256] = {
-    0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0, 0x08, 0x88, 0x48,
-    0xc8, 0x28, 0xa8, 0x68, 0xe8, 0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8, 0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4,
-    0x64, 0xe4, 0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4, 0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec, 0x1c,
-    0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc, 0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2, 0x12, 0x92, 0x52, 0xd2,
-    0x32, 0xb2, 0x72, 0xf2, 0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea, 0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a,
-    0xfa, 0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6, 0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6, 0x0e, 0x8e,
-    0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee, 0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe, 0x01, 0x81, 0x41, 0xc1, 0x21,
-    0xa1, 0x61, 0xe1, 0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1, 0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9,
-    0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9, 0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5, 0x15, 0x95, 0x55,
-    0xd5, 0x35, 0xb5, 0x75, 0xf5, 0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed, 0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd,
-    0x7d, 0xfd, 0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3, 0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3, 0x0b,
-    0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb, 0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb, 0x07, 0x87, 0x47, 0xc7,
-    0x27, 0xa7, 0x67, 0xe7, 0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7, 0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f,
-    0xef, 0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff,
-};
 #ifndef H5_LOG_BUF_SIZE
 #define H5_LOG_BUF_SIZE 1024
 #endif
@@ -356,25 +365,6 @@ static void rtkbt_h5_send_hw_error(void)
     userial_recv_rawdata_hook(p_buf, length);
 }
 
-// reverse bit
-static __inline uint8_t bit_rev8(uint8_t byte)
-{
-    return byte_rev_table[byte];
-}
-
-// reverse bit
-static __inline uint16_t bit_rev16(uint16_t x)
-{
-#define REV_8 8
-    return (bit_rev8(x & 0xff) << REV_8) | bit_rev8(x >> REV_8);
-}
-
-static const uint16_t crc_table[] = {0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
-                                     0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f};
-
-// Initialise the crc calculator
-#define H5_CRC_INIT(x) x = 0xffff
-
 /*******************************************************************************
 **
 ** Function        ms_delay
@@ -514,23 +504,6 @@ static uint32_t skb_queue_get_length(IN RTB_QUEUE_HEAD *skb_head)
     return RtbGetQueueLen(skb_head);
 }
 
-/**
- * Add "d" into crc scope, caculate the new crc value
- *
- * @param crc crc data
- * @param d one byte data
- */
-static void h5_crc_update(uint16_t *crc, uint8_t d)
-{
-    uint16_t reg = *crc;
-
-#define REG_4 4
-    reg = (reg >> REG_4) ^ crc_table[(reg ^ d) & 0x000f];
-    reg = (reg >> REG_4) ^ crc_table[(reg ^ (d >> REG_4)) & 0x000f];
-
-    *crc = reg;
-}
-
 struct __una_u16 {
     uint16_t x;
 };
@@ -549,149 +522,7 @@ static uint16_t h5_get_crc(tHCI_H5_CB *h5)
 }
 
 /**
- * Just add 0xc0 at the end of skb,
- * we can also use this to add 0xc0 at start while there is no data in skb
- *
- * @param skb socket buffer
- */
-static void h5_slip_msgdelim(sk_buff *skb)
-{
-    const char pkt_delim = 0xc0;
-    errno_t ret = -1;
-    if (ret == memcpy_s(skb_put(skb, 1), sizeof(char), &pkt_delim, 1)) {
-        return;
-    }
-}
-
-/**
- * Slip ecode one byte in h5 proto, as follows:
- * 0xc0 -> 0xdb, 0xdc
- * 0xdb -> 0xdb, 0xdd
- * 0x11 -> 0xdb, 0xde
- * 0x13 -> 0xdb, 0xdf
- * others will not change
- *
- * @param skb socket buffer
- * @c pure data in the one byte
- */
-static void h5_slip_one_byte(sk_buff *skb, uint8_t unencode_form)
-{
-    const signed char esc_c0[2] = {0xdb, 0xdc};
-    const signed char esc_db[2] = {0xdb, 0xdd};
-    const signed char esc_11[2] = {0xdb, 0xde};
-    const signed char esc_13[2] = {0xdb, 0xdf};
-    errno_t ret = -1;
-
-#define SKB_PUT_2 2
-    switch (unencode_form) {
-        case 0xc0:
-            if (ret == memcpy_s(skb_put(skb, SKB_PUT_2), SKB_PUT_2, &esc_c0, SKB_PUT_2)) {
-                return;
-            }
-            break;
-        case 0xdb:
-            if (ret == memcpy_s(skb_put(skb, SKB_PUT_2), SKB_PUT_2, &esc_db, SKB_PUT_2)) {
-                return;
-            }
-            break;
-
-        case 0x11: {
-            if (rtk_h5.oof_flow_control) {
-                (void)memcpy_s(skb_put(skb, SKB_PUT_2), SKB_PUT_2, &esc_11, SKB_PUT_2);
-            } else {
-                (void)memcpy_s(skb_put(skb, 1), sizeof(char), &unencode_form, 1);
-            }
-        }
-            break;
-
-        case 0x13: {
-            if (rtk_h5.oof_flow_control) {
-                (void)memcpy_s(skb_put(skb, SKB_PUT_2), SKB_PUT_2, &esc_13, SKB_PUT_2);
-            } else {
-                (void)memcpy_s(skb_put(skb, 1), sizeof(char), &unencode_form, 1);
-            }
-        }
-            break;
-
-        default:
-            (void)memcpy_s(skb_put(skb, 1), sizeof(char), &unencode_form, 1);
-    }
-}
-
-/**
- * Decode one byte in h5 proto, as follows:
- * 0xdb, 0xdc -> 0xc0
- * 0xdb, 0xdd -> 0xdb
- * 0xdb, 0xde -> 0x11
- * 0xdb, 0xdf -> 0x13
- * others will not change
- *
- * @param h5 realtek h5 struct
- * @byte pure data in the one byte
- */
-static void h5_unslip_one_byte(tHCI_H5_CB *h5, unsigned char byte)
-{
-    const uint8_t c0 = 0xc0, db = 0xdb;
-    const uint8_t oof1 = 0x11, oof2 = 0x13;
-    uint8_t *hdr = (uint8_t *)skb_get_data(h5->rx_skb);
-
-    if (H5_ESCSTATE_NOESC == h5->rx_esc_state) {
-        if (byte == 0xdb) {
-            h5->rx_esc_state = H5_ESCSTATE_ESC;
-        } else {
-            (void)memcpy_s(skb_put(h5->rx_skb, 1), sizeof(char), &byte, 1);
-            // Check Pkt Header's CRC enable bit
-            if (H5_HDR_CRC(hdr) && h5->rx_state != H5_W4_CRC) {
-                h5_crc_update(&h5->message_crc, byte);
-            }
-            h5->rx_count--;
-        }
-    } else if (H5_ESCSTATE_ESC == h5->rx_esc_state) {
-        switch (byte) {
-            case 0xdc:
-                (void)memcpy_s(skb_put(h5->rx_skb, 1), sizeof(char), &c0, 1);
-                if (H5_HDR_CRC(hdr) && h5->rx_state != H5_W4_CRC) {
-                    h5_crc_update(&h5->message_crc, 0xc0);
-                }
-                h5->rx_esc_state = H5_ESCSTATE_NOESC;
-                h5->rx_count--;
-                break;
-            case 0xdd:
-                (void)memcpy_s(skb_put(h5->rx_skb, 1), sizeof(char), &db, 1);
-                if (H5_HDR_CRC(hdr) && h5->rx_state != H5_W4_CRC) {
-                    h5_crc_update(&h5->message_crc, 0xdb);
-                }
-                h5->rx_esc_state = H5_ESCSTATE_NOESC;
-                h5->rx_count--;
-                break;
-            case 0xde:
-                (void)memcpy_s(skb_put(h5->rx_skb, 1), sizeof(char), &oof1, 1);
-                if (H5_HDR_CRC(hdr) && h5->rx_state != H5_W4_CRC) {
-                    h5_crc_update(&h5->message_crc, oof1);
-                }
-                h5->rx_esc_state = H5_ESCSTATE_NOESC;
-                h5->rx_count--;
-                break;
-            case 0xdf:
-                (void)memcpy_s(skb_put(h5->rx_skb, 1), sizeof(char), &oof2, 1);
-                if (H5_HDR_CRC(hdr) && h5->rx_state != H5_W4_CRC) {
-                    h5_crc_update(&h5->message_crc, oof2);
-                }
-                h5->rx_esc_state = H5_ESCSTATE_NOESC;
-                h5->rx_count--;
-                break;
-            default:
-                HILOGE("Error: Invalid byte %02x after esc byte", byte);
-                skb_free(&h5->rx_skb);
-                h5->rx_skb = NULL;
-                h5->rx_state = H5_W4_PKT_DELIMITER;
-                h5->rx_count = 0;
-                break;
-        }
-    }
-}
-/**
- * Prepare h5 packet, packet format as follow:
+ * Encode h5 packet, packet format as follow:
  *  | LSB 4 octets  | 0 ~4095| 2 MSB
  *  |packet header | payload | data integrity check |
  *
@@ -702,17 +533,21 @@ static void h5_unslip_one_byte(tHCI_H5_CB *h5, unsigned char byte)
  *  |packet type | payload length | header checksum
  *
  * @param h5 realtek h5 struct
+ * @param out room for H5_FRAME_MAX_ENCODED(len) bytes
  * @param data pure data
  * @param len the length of data
  * @param pkt_type packet type
- * @return socket buff after prepare in h5 proto
+ * @param seq SeqNumber of a reliable packet
+ * @return bytes of the frame written to out, 0 for an unknown packet type
  */
-static sk_buff *h5_prepare_pkt(tHCI_H5_CB *h5, uint8_t *data, signed long len, signed long pkt_type)
+static size_t h5_encode_pkt(tHCI_H5_CB *h5, uint8_t *out, uint8_t *data, signed long len, signed long pkt_type,
+                            uint8_t seq)
 {
-    sk_buff *nskb;
     uint8_t hdr[4];
-    uint16_t H5_CRC_INIT(h5_txmsg_crc);
-    int rel, i;
+    uint8_t crc[2];
+    uint16_t h5_txmsg_crc;
+    size_t pos = 0;
+    int rel;
 
     switch (pkt_type) {
         case HCI_ACLDATA_PKT:
@@ -728,38 +563,23 @@ static sk_buff *h5_prepare_pkt(tHCI_H5_CB *h5, uint8_t *data, signed long len, s
             break;
         default:
             HILOGE("Unknown packet type");
-            return NULL;
+            return 0;
     }
 
-        // Max len of packet: (original len +4(h5 hdr) +2(crc))*2
-        //   (because bytes 0xc0 and 0xdb are escaped, worst case is
-        //   when the packet is all made of 0xc0 and 0xdb :) )
-        //   + 2 (0xc0 delimiters at start and end).
-
 #define SKB_2 2
 #define SKB_3 3
 #define SKB_4 4
-#define SKB_6 6
 #define SKB_8 8
-    nskb = skb_alloc((len + SKB_6) * SKB_2 + SKB_2);
-    if (!nskb) {
-        H5LogMsg("nskb is NULL");
-        return NULL;
-    }
 
-    // Add SLIP start byte: 0xc0
-    h5_slip_msgdelim(nskb);
     // set AckNumber in SlipHeader
     hdr[0] = h5->rxseq_txack << SKB_3;
     h5->is_txack_req = 0;
 
     H5LogMsg("We request packet no(%u) to card", h5->rxseq_txack);
-    H5LogMsg("Sending packet with seqno %u and wait %u", h5->msgq_txseq, h5->rxseq_txack);
+    H5LogMsg("Sending packet with seqno %u and wait %u", seq, h5->rxseq_txack);
     if (rel == H5_RELIABLE_PKT) {
         // set reliable pkt bit and SeqNumber
-        hdr[0] |= 0x80 + h5->msgq_txseq;
-        ++(h5->msgq_txseq);
-        h5->msgq_txseq = (h5->msgq_txseq) & 0x07;
+        hdr[0] |= 0x80 + (seq & 0x07);
     }
 
     // set DicPresent bit
@@ -773,41 +593,82 @@ static sk_buff *h5_prepare_pkt(tHCI_H5_CB *h5, uint8_t *data, signed long len, s
     // set checksum
     hdr[SKB_3] = ~(hdr[0] + hdr[1] + hdr[SKB_2]);
 
-    // Put h5 header */
-    for (i = 0; i < SKB_4; i++) {
-        h5_slip_one_byte(nskb, hdr[i]);
+    // SLIP start byte, header and payload, all escaped in runs
+    out[pos++] = H5_SLIP_DELIM;
+    pos += h5_slip_encode(out + pos, hdr, sizeof(hdr), h5->oof_flow_control);
+    pos += h5_slip_encode(out + pos, data, len, h5->oof_flow_control);
 
-        if (h5->use_crc) {
-            h5_crc_update(&h5_txmsg_crc, hdr[i]);
-        }
+    // Put CRC */
+    if (h5->use_crc) {
+        h5_txmsg_crc = h5_crc_update_buf(H5_CRC_SEED, hdr, sizeof(hdr));
+        h5_txmsg_crc = h5_crc_to_wire(h5_crc_update_buf(h5_txmsg_crc, data, len));
+        crc[0] = (uint8_t)(h5_txmsg_crc >> SKB_8);
+        crc[1] = (uint8_t)(h5_txmsg_crc & 0x00ff);
+        pos += h5_slip_encode(out + pos, crc, sizeof(crc), h5->oof_flow_control);
     }
 
-    // Put payload */
-    for (i = 0; i < len; i++) {
-        h5_slip_one_byte(nskb, data[i]);
+    // Add SLIP end byte: 0xc0
+    out[pos++] = H5_SLIP_DELIM;
+    return pos;
+}
+static uint64_t h5_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
 
-        if (h5->use_crc) {
-            h5_crc_update(&h5_txmsg_crc, data[i]);
-        }
+/**
+ * The retransmission timeout, until the first round trip is measured the fixed one
+ */
+static uint32_t h5_rto_ms(void)
+{
+    if (rtk_h5.rto_ms) {
+        return rtk_h5.rto_ms;
     }
+    return h5_init_datatrans_flag ? BT_INIT_DATA_RETRANS_TIMEOUT_VALUE : DATA_RETRANS_TIMEOUT_VALUE;
+}
 
-    // Put CRC */
-    if (h5->use_crc) {
-        h5_txmsg_crc = bit_rev16(h5_txmsg_crc);
-        h5_slip_one_byte(nskb, (uint8_t)((h5_txmsg_crc >> SKB_8) & 0x00ff));
-        h5_slip_one_byte(nskb, (uint8_t)(h5_txmsg_crc & 0x00ff));
-    }
+/**
+ * Take a round trip sample into SRTT and RTTVAR and work out the timeout from them
+ * as RFC 6298 does, with the clock granularity of a millisecond
+ *
+ * @param h5 realtek h5 struct
+ * @param rtt_us time from sending a packet to the ack that took it off unack
+ */
+static void h5_update_rto(tHCI_H5_CB *h5, uint32_t rtt_us)
+{
+    uint32_t rto_us;
 
-    // Add SLIP end byte: 0xc0
-    h5_slip_msgdelim(nskb);
-    return nskb;
+    if (!h5->srtt_us) {
+        h5->srtt_us = rtt_us ? rtt_us : 1;
+        h5->rttvar_us = rtt_us / 2;
+    } else {
+        uint32_t delta = (h5->srtt_us > rtt_us) ? h5->srtt_us - rtt_us : rtt_us - h5->srtt_us;
+        h5->rttvar_us = (3 * h5->rttvar_us + delta) / 4;
+        h5->srtt_us = (7 * h5->srtt_us + rtt_us) / 8;
+        h5->srtt_us = h5->srtt_us ? h5->srtt_us : 1;
+    }
+    rto_us = h5->srtt_us + ((4 * h5->rttvar_us > 1000) ? 4 * h5->rttvar_us : 1000);
+    h5->rto_ms = (rto_us + 999) / 1000;
+    if (h5->rto_ms < H5_RTO_MIN_MS) {
+        h5->rto_ms = H5_RTO_MIN_MS;
+    } else if (h5->rto_ms > H5_RTO_MAX_MS) {
+        h5->rto_ms = H5_RTO_MAX_MS;
+    }
 }
+
 /**
- * Removed controller acked packet from Host's unacked lists
+ * Removed controller acked packet from Host's unacked lists. Packets that never went
+ * twice give a round trip sample. An empty ACK that acks nothing while the controller
+ * still waits for our oldest packet means it dropped what followed a lost one, those
+ * go again right away instead of after the timeout.
  *
  * @param h5 realtek h5 struct
+ * @param pure_ack the ack came in an empty ACK packet
  */
-static void h5_remove_acked_pkt(tHCI_H5_CB *h5)
+static void h5_remove_acked_pkt(tHCI_H5_CB *h5, bool pure_ack)
 {
     RT_LIST_HEAD *Head = NULL;
     RT_LIST_ENTRY *Iter = NULL, *Temp = NULL;
@@ -816,6 +677,7 @@ static void h5_remove_acked_pkt(tHCI_H5_CB *h5)
     int pkts_to_be_removed = 0;
     int seqno = 0;
     int i = 0;
+    uint64_t sent_us = 0;
 
     pthread_mutex_lock(&h5_wakeup_mutex);
 
@@ -845,14 +707,40 @@ static void h5_remove_acked_pkt(tHCI_H5_CB *h5)
             break;
         }
 
+        // Karn: a packet sent twice does not tell which send the ack is for
+        sent_us = BT_CONTEXT(skb)->Retries ? 0 : h5->tx_time_us[BT_CONTEXT(skb)->TxSeq];
         skb_unlink(skb, h5->unack);
         skb_free(&skb);
         i++;
     }
 
+    if (i) {
+        if (sent_us) {
+            h5_update_rto(h5, (uint32_t)(h5_now_us() - sent_us));
+        }
+        h5->rtx_count = (h5->rtx_count > i) ? h5->rtx_count - i : 0;
+        h5->rtx_sent = (h5->rtx_sent > i) ? h5->rtx_sent - i : 0;
+        if (h5->rto_probe) {
+            // the oldest packet got through, what was sent after it most likely did not
+            h5->rto_probe = 0;
+            h5->rtx_count = skb_queue_get_length(h5->unack);
+            h5->rtx_sent = 0;
+        }
+    } else if (pure_ack && !h5->rto_probe && !h5->rtx_count && (skb = RtbTopQueue(h5->unack)) != NULL &&
+               BT_CONTEXT(skb)->TxSeq == h5->rxack) {
+        H5LogMsg("duplicate ack(%u), fast retransmit of (%u) pkts", h5->rxack, skb_queue_get_length(h5->unack));
+        h5->rtx_count = skb_queue_get_length(h5->unack);
+        h5->rtx_sent = 0;
+        h5->fast_retransmits++;
+    }
+
     if (skb_queue_get_length(h5->unack) == 0) {
         h5_stop_data_retrans_timer();
         rtk_h5.data_retrans_count = 0;
+    } else if (i) {
+        // new data acked, the timer starts over for what is left
+        h5_stop_data_retrans_timer();
+        h5_start_data_retrans_timer();
     }
 
     if (i != pkts_to_be_removed) {
@@ -900,7 +788,7 @@ static void hci_h5_send_sync_resp(void)
 
 static void hci_h5_send_conf_req(void)
 {
-    unsigned char h5conf[3] = {0x03, 0xFC, 0x14};
+    unsigned char h5conf[3] = {0x03, 0xFC, H5_CFG_DIC_CRC | H5_MAX_SLIDING_WINDOW};
     sk_buff *skb = NULL;
 
     skb = skb_alloc_and_init(H5_LINK_CTL_PKT, h5conf, sizeof(h5conf));
@@ -934,6 +822,53 @@ static void hci_h5_send_conf_resp(void)
     return;
 }
 
+/**
+ * Hand the packets the current h5_recv_msg call completed to the hal in one go
+ *
+ * @param h5 realtek h5 struct
+ */
+static void h5_flush_rx_batch(tHCI_H5_CB *h5)
+{
+    if (!h5->rx_batch_len) {
+        return;
+    }
+    pthread_mutex_lock(&h5_pass_up_mutex);
+    h5_int_hal_callbacks->h5_recv_skbs_cb(h5->rx_batch, h5->rx_batch_len);
+    pthread_mutex_unlock(&h5_pass_up_mutex);
+    h5->rx_batch_len = 0;
+}
+
+/**
+ * Pass a received packet up. A hal with h5_recv_skbs_cb gets the skb itself on the
+ * calling thread, batched when it comes off the UART; otherwise it is queued for
+ * data_ready_cb_thread and copied out through h5_int_read_data.
+ *
+ * @param h5 realtek h5 struct
+ * @param skb packet with its type set, the receiver frees it
+ * @param from_uart called from h5_recv, hci_h5_receive_msg flushes the batch
+ */
+static void h5_pass_up(tHCI_H5_CB *h5, sk_buff *skb, bool from_uart)
+{
+    if (h5_int_hal_callbacks->h5_recv_skbs_cb) {
+        if (from_uart) {
+            h5->rx_batch[h5->rx_batch_len++] = skb;
+            if (h5->rx_batch_len == H5_RX_BATCH_MAX) {
+                h5_flush_rx_batch(h5);
+            }
+        } else {
+            pthread_mutex_lock(&h5_pass_up_mutex);
+            h5_int_hal_callbacks->h5_recv_skbs_cb(&skb, 1);
+            pthread_mutex_unlock(&h5_pass_up_mutex);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&h5->data_mutex);
+    skb_queue_tail(h5->recv_data, skb);
+    pthread_cond_signal(&h5->data_cond);
+    pthread_mutex_unlock(&h5->data_mutex);
+}
+
 static void rtk_notify_hw_h5_init_result(uint8_t status)
 {
     H5LogMsg("rtk_notify_hw_h5_init_result %d", status);
@@ -945,52 +880,86 @@ static void rtk_notify_hw_h5_init_result(uint8_t status)
         HILOGE("%s, rx_skb alloc fail!", __func__);
         return;
     }
-    pthread_mutex_lock(&rtk_h5.data_mutex);
-    skb_queue_tail(rtk_h5.recv_data, rx_skb);
-    pthread_cond_signal(&rtk_h5.data_cond);
-    pthread_mutex_unlock(&rtk_h5.data_mutex);
+    h5_pass_up(&rtk_h5, rx_skb, false);
 }
 
-static sk_buff *h5_dequeue(void)
+/**
+ * Encode the next packet due into the TX buffer: unreliable ones first, then reliable
+ * ones while the window has room, then an empty ACK if nothing else carried it.
+ *
+ * @param out where the frame goes
+ * @param room bytes left at out
+ * @return bytes of the frame, 0 if nothing is due or the next frame might not fit
+ */
+static size_t h5_dequeue_frame(uint8_t *out, size_t room)
 {
     sk_buff *skb = NULL;
+    size_t len;
     //   First of all, check for unreliable messages in the queue,
     //   since they have higher priority
     if ((skb = (sk_buff *)skb_dequeue_head(rtk_h5.unrel)) != NULL) {
-        sk_buff *nskb = h5_prepare_pkt(&rtk_h5, skb_get_data(skb), skb_get_data_length(skb), skb_get_pkt_type(skb));
-        if (nskb) {
-            skb_free(&skb);
-            return nskb;
-        } else {
+        if (H5_FRAME_MAX_ENCODED(skb_get_data_length(skb)) > room) {
             skb_queue_head(rtk_h5.unrel, skb);
+            return 0;
+        }
+        len = h5_encode_pkt(&rtk_h5, out, skb_get_data(skb), skb_get_data_length(skb), skb_get_pkt_type(skb), 0);
+        skb_free(&skb);
+        return len;
+    }
+    //   Unacked packets that have to go again come next, oldest first: the
+    //   controller drops whatever follows a lost packet, so nothing newer gets
+    //   through before them. They keep their SeqNumber and stay in unack.
+    if (rtk_h5.rtx_sent < rtk_h5.rtx_count) {
+        uint8_t i;
+
+        skb = RtbTopQueue(rtk_h5.unack);
+        for (i = 0; skb && i < rtk_h5.rtx_sent; i++) {
+            skb = RtbQueueNextNode(rtk_h5.unack, skb);
         }
+        if (skb) {
+            if (H5_FRAME_MAX_ENCODED(skb_get_data_length(skb)) > room) {
+                return 0;
+            }
+            len = h5_encode_pkt(&rtk_h5, out, skb_get_data(skb), skb_get_data_length(skb), skb_get_pkt_type(skb),
+                                BT_CONTEXT(skb)->TxSeq);
+            BT_CONTEXT(skb)->Retries++;
+            rtk_h5.rtx_sent++;
+            h5_start_data_retrans_timer();
+            return len;
+        }
+        rtk_h5.rtx_count = rtk_h5.rtx_sent;
     }
+
     //   Now, try to send a reliable pkt. We can only send a
     //   reliable packet if the number of packets sent but not yet ack'ed
     //   is < than the winsize
 
-    if (RtbGetQueueLen(rtk_h5.unack) < rtk_h5.sliding_window_size &&
+    if (!rtk_h5.rto_probe && RtbGetQueueLen(rtk_h5.unack) < rtk_h5.sliding_window_size &&
         (skb = (sk_buff *)skb_dequeue_head(rtk_h5.rel)) != NULL) {
-        sk_buff *nskb = h5_prepare_pkt(&rtk_h5, skb_get_data(skb), skb_get_data_length(skb), skb_get_pkt_type(skb));
-        if (nskb) {
-            skb_queue_tail(rtk_h5.unack, skb);
-            h5_start_data_retrans_timer();
-            return nskb;
-        } else {
+        if (H5_FRAME_MAX_ENCODED(skb_get_data_length(skb)) > room) {
             skb_queue_head(rtk_h5.rel, skb);
+            return 0;
         }
+        BT_CONTEXT(skb)->TxSeq = rtk_h5.msgq_txseq;
+        BT_CONTEXT(skb)->Retries = 0;
+        rtk_h5.tx_time_us[rtk_h5.msgq_txseq] = h5_now_us();
+        rtk_h5.msgq_txseq = (rtk_h5.msgq_txseq + 1) & 0x07;
+        len = h5_encode_pkt(&rtk_h5, out, skb_get_data(skb), skb_get_data_length(skb), skb_get_pkt_type(skb),
+                            BT_CONTEXT(skb)->TxSeq);
+        skb_queue_tail(rtk_h5.unack, skb);
+        h5_start_data_retrans_timer();
+        return len;
     }
     //   We could not send a reliable packet, either because there are
     //   none or because there are too many unack'ed packets. Did we receive
     //   any packets we have not acknowledged yet
-    if (rtk_h5.is_txack_req) {
+    if (rtk_h5.is_txack_req && H5_FRAME_MAX_ENCODED(0) <= room) {
         // if so, craft an empty ACK pkt and send it on BCSP unreliable
         // channel
-        sk_buff *nskb = h5_prepare_pkt(&rtk_h5, NULL, 0, H5_ACK_PKT);
-        return nskb;
+        return h5_encode_pkt(&rtk_h5, out, NULL, 0, H5_ACK_PKT, 0);
     }
     // We have nothing to send
-    return NULL;
+    return 0;
 }
 
 int h5_enqueue(IN sk_buff *skb)
@@ -1021,21 +990,36 @@ int h5_enqueue(IN sk_buff *skb)
     return 0;
 }
 
+/**
+ * Send everything that is due. Frames are encoded back to back into tx_buf and go
+ * down in one write per buffer. Each frame carries the current ack, so an empty ACK
+ * is only added when no other frame went out.
+ *
+ * @return bytes sent by the last write
+ */
 static uint16_t h5_wake_up(void)
 {
     uint16_t bytes_sent = 0;
-    sk_buff *skb = NULL;
-    uint8_t *data = NULL;
+    uint8_t *data = rtk_h5.tx_buf;
     uint32_t data_len = 0;
+    uint32_t frames = 0;
+    size_t frame_len;
 
     pthread_mutex_lock(&h5_wakeup_mutex);
-    while (NULL != (skb = h5_dequeue())) {
-        data = skb_get_data(skb);
-        data_len = skb_get_data_length(skb);
+    while (1) {
+        data_len = 0;
+        frames = 0;
+        while ((frame_len = h5_dequeue_frame(data + data_len, sizeof(rtk_h5.tx_buf) - data_len)) > 0) {
+            data_len += frame_len;
+            frames++;
+        }
+        if (!data_len) {
+            break;
+        }
         // we adopt the hci_h5 interface to send data
         bytes_sent = h5_int_hal_callbacks->h5_int_transmit_data_cb(DATA_TYPE_H5, data, data_len);
 
-        H5LogMsg("bytes_sent(%d)", bytes_sent);
+        H5LogMsg("bytes_sent(%d) frames(%u)", bytes_sent, frames);
 
 #if H5_TRACE_DATA_ENABLE
         {
@@ -1050,7 +1034,6 @@ static uint16_t h5_wake_up(void)
             }
         }
 #endif
-        skb_free(&skb);
     }
 
     pthread_mutex_unlock(&h5_wakeup_mutex);
@@ -1099,6 +1082,9 @@ void h5_process_ctl_pkts(void)
 
             (void)memcpy_s(&cfg, H5_CFG_SIZE, skb_get_data(skb) + MEM_2, H5_CFG_SIZE);
             rtk_h5.sliding_window_size = H5_CFG_SLID_WIN(cfg);
+            if (rtk_h5.sliding_window_size == 0 || rtk_h5.sliding_window_size > H5_MAX_SLIDING_WINDOW) {
+                rtk_h5.sliding_window_size = 1;
+            }
             rtk_h5.oof_flow_control = H5_CFG_OOF_CNTRL(cfg);
             rtk_h5.dic_type = H5_CFG_DIC_TYPE(cfg);
             H5LogMsg("rtk_h5.sliding_window_size(%d), oof_flow_control(%d), dic_type(%d)", rtk_h5.sliding_window_size,
@@ -1211,7 +1197,6 @@ static uint8_t hci_recv_frame(sk_buff *skb, uint8_t pkt_type)
 static uint8_t h5_complete_rx_pkt(tHCI_H5_CB *h5)
 {
     int pass_up = 1;
-    uint16_t eventtype = 0;
     uint8_t *h5_hdr = NULL;
     uint8_t pkt_type = 0;
     uint8_t status = 0;
@@ -1244,8 +1229,6 @@ static uint8_t h5_complete_rx_pkt(tHCI_H5_CB *h5)
         h5->rxseq_txack %= NUM_8;
         h5->is_txack_req = 1;
         pthread_mutex_unlock(&h5_wakeup_mutex);
-        // send down an empty ack if needed.
-        h5_wake_up();
     }
 
     h5->rxack = H5_HDR_ACK(h5_hdr);
@@ -1253,21 +1236,17 @@ static uint8_t h5_complete_rx_pkt(tHCI_H5_CB *h5)
     switch (pkt_type) {
         case HCI_ACLDATA_PKT:
             pass_up = 1;
-            eventtype = MSG_HC_TO_STACK_HCI_ACL;
             break;
 
         case HCI_EVENT_PKT:
             pass_up = 1;
-            eventtype = MSG_HC_TO_STACK_HCI_EVT;
             break;
 
         case HCI_SCODATA_PKT:
             pass_up = 1;
-            eventtype = MSG_HC_TO_STACK_HCI_SCO;
             break;
         case HCI_COMMAND_PKT:
             pass_up = 1;
-            eventtype = MSG_HC_TO_STACK_HCI_ERR;
             break;
 
         case H5_LINK_CTL_PKT:
@@ -1280,13 +1259,18 @@ static uint8_t h5_complete_rx_pkt(tHCI_H5_CB *h5)
 
         default:
             HILOGE("Unknown pkt type(%d)", H5_HDR_PKT_TYPE(h5_hdr));
-            eventtype = MSG_HC_TO_STACK_HCI_ERR;
             pass_up = 0;
             break;
     }
 
     // remove h5 header and send packet to hci
-    h5_remove_acked_pkt(h5);
+    h5_remove_acked_pkt(h5, pkt_type == H5_ACK_PKT && !H5_HDR_RELIABLE(h5_hdr));
+
+    // the ack may have opened the window: queued reliable packets go out carrying
+    // our ack, an empty ack only goes down when none can
+    if (h5->is_txack_req || skb_queue_get_length(h5->rel) || h5->rtx_sent < h5->rtx_count) {
+        h5_wake_up();
+    }
 
     if (H5_HDR_PKT_TYPE(h5_hdr) == H5_LINK_CTL_PKT) {
         skb_pull(h5->rx_skb, H5_HDR_SIZE);
@@ -1299,35 +1283,10 @@ static uint8_t h5_complete_rx_pkt(tHCI_H5_CB *h5)
         skb_set_pkt_type(h5->rx_skb, pkt_type);
 
         // send command or  acl data it to bluedroid stack
-        uint16_t len = 0;
-        sk_buff *skb_complete_pkt = h5->rx_skb;
-
-        /* Allocate a buffer for message */
-
-        len = BT_HC_HDR_SIZE + skb_get_data_length(skb_complete_pkt);
-        h5->p_rcv_msg = (HC_BT_HDR *)malloc(len);
-
-        if (h5->p_rcv_msg) {
-            /* Initialize buffer with received h5 data */
-            h5->p_rcv_msg->offset = 0;
-            h5->p_rcv_msg->layer_specific = 0;
-            h5->p_rcv_msg->event = eventtype;
-            h5->p_rcv_msg->len = skb_get_data_length(skb_complete_pkt);
-            (void)memcpy_s((uint8_t *)(h5->p_rcv_msg + 1), skb_get_data_length(skb_complete_pkt),
-                           skb_get_data(skb_complete_pkt), skb_get_data_length(skb_complete_pkt));
-        }
-
-        status = hci_recv_frame(skb_complete_pkt, pkt_type);
-
-        if (h5->p_rcv_msg) {
-            free(h5->p_rcv_msg);
-        }
+        status = hci_recv_frame(h5->rx_skb, pkt_type);
 
         if (!status) {
-            pthread_mutex_lock(&rtk_h5.data_mutex);
-            skb_queue_tail(rtk_h5.recv_data, h5->rx_skb);
-            pthread_cond_signal(&rtk_h5.data_cond);
-            pthread_mutex_unlock(&rtk_h5.data_mutex);
+            h5_pass_up(h5, h5->rx_skb, true);
         }
     } else {
         // free ctl packet
@@ -1338,6 +1297,54 @@ static uint8_t h5_complete_rx_pkt(tHCI_H5_CB *h5)
     return pkt_type;
 }
 
+/**
+ * SLIP decode received bytes straight into rx_skb, up to the rx_count bytes the
+ * current state still waits for. Everything before the CRC goes through the CRC,
+ * it is only checked when the header has the DIC bit.
+ *
+ * @param h5 realtek h5 struct
+ * @param data received bytes, moved past what was taken
+ * @param count num of received bytes, less what was taken
+ */
+static void h5_recv_span(tHCI_H5_CB *h5, uint8_t **data, int *count)
+{
+    uint8_t *tail = skb_get_data(h5->rx_skb) + skb_get_data_length(h5->rx_skb);
+    tH5_SLIP_STATUS status;
+    size_t used = 0;
+    size_t got;
+
+    got = h5_slip_decode(&h5->rx_slip, *data, *count, &used, tail, h5->rx_count, &status);
+    if (got) {
+        if (h5->rx_state != H5_W4_CRC) {
+            h5->message_crc = h5_crc_update_buf(h5->message_crc, tail, got);
+        }
+        skb_put(h5->rx_skb, got);
+        h5->rx_count -= got;
+    }
+    *data += used;
+    *count -= used;
+
+    switch (status) {
+        case H5_SLIP_AT_DELIM:
+            HILOGE("short h5 packet");
+            skb_free(&h5->rx_skb);
+            h5->rx_state = H5_W4_PKT_START;
+            h5->rx_count = 0;
+            (*data)++;
+            (*count)--;
+            break;
+        case H5_SLIP_BAD_ESC:
+            HILOGE("Error: Invalid byte %02x after esc byte", (*data)[-1]);
+            skb_free(&h5->rx_skb);
+            h5->rx_skb = NULL;
+            h5->rx_state = H5_W4_PKT_DELIMITER;
+            h5->rx_count = 0;
+            break;
+        default:
+            break;
+    }
+}
+
 /**
  * Parse the receive data in h5 proto.
  *
@@ -1357,17 +1364,7 @@ static bool h5_recv(tHCI_H5_CB *h5, uint8_t *data, int count)
     ptr = (uint8_t *)data;
     while (temp) {
         if (h5->rx_count) {
-            if (*ptr == 0xc0) {
-                HILOGE("short h5 packet");
-                skb_free(&h5->rx_skb);
-                h5->rx_state = H5_W4_PKT_START;
-                h5->rx_count = 0;
-            } else {
-                h5_unslip_one_byte(h5, *ptr);
-            }
-
-            ptr++;
-            temp--;
+            h5_recv_span(h5, &ptr, &temp);
             continue;
         }
 
@@ -1416,8 +1413,9 @@ static bool h5_recv(tHCI_H5_CB *h5, uint8_t *data, int count)
                 continue;
 
             case H5_W4_CRC:
-                if (bit_rev16(h5->message_crc) != h5_get_crc(h5)) {
-                    HILOGE("Checksum failed, computed(%04x)received(%04x)", bit_rev16(h5->message_crc), h5_get_crc(h5));
+                if (h5_crc_to_wire(h5->message_crc) != h5_get_crc(h5)) {
+                    HILOGE("Checksum failed, computed(%04x)received(%04x)", h5_crc_to_wire(h5->message_crc),
+                           h5_get_crc(h5));
                     skb_free(&h5->rx_skb);
                     h5->rx_state = H5_W4_PKT_DELIMITER;
                     h5->rx_count = 0;
@@ -1451,8 +1449,8 @@ static bool h5_recv(tHCI_H5_CB *h5, uint8_t *data, int count)
                         h5->rx_state = H5_W4_HDR;
 #define RX_COUNT_4 4
                         h5->rx_count = RX_COUNT_4;
-                        h5->rx_esc_state = H5_ESCSTATE_NOESC;
-                        H5_CRC_INIT(h5->message_crc);
+                        h5_slip_decoder_reset(&h5->rx_slip);
+                        h5->message_crc = H5_CRC_SEED;
 
                         // Do not increment ptr or decrement count
                         // Allocate packet. Max len of a H5 pkt=
@@ -1511,7 +1509,6 @@ static void data_retransfer_thread(void *arg)
 {
     RTK_UNUSED(arg);
     uint16_t events;
-    uint16_t data_retrans_counts = DATA_RETRANS_COUNT;
 
     H5LogMsg("data_retransfer_thread started");
 
@@ -1528,39 +1525,38 @@ static void data_retransfer_thread(void *arg)
 
         if (events & H5_EVENT_RX) {
             sk_buff *skb;
-            HILOGE("retransmitting (%u) pkts, retransfer count(%d)", skb_queue_get_length(rtk_h5.unack),
-                   rtk_h5.data_retrans_count);
-            if (h5_init_datatrans_flag == 0) {
-                data_retrans_counts = DATA_RETRANS_COUNT;
-            } else {
-                data_retrans_counts = BT_INIT_DATA_RETRANS_COUNT;
-            }
-
-            if (rtk_h5.data_retrans_count < data_retrans_counts) {
-                pthread_mutex_lock(&h5_wakeup_mutex);
-                while ((skb = skb_dequeue_tail(rtk_h5.unack)) != NULL) {
-#if H5_TRACE_DATA_ENABLE
-                    uint32_t data_len = skb_get_data_length(skb);
-                    uint8_t *pdata = skb_get_data(skb);
-#define DATA_LEN_16 16
-                    if (data_len > DATA_LEN_16) {
-                        data_len = DATA_LEN_16;
-                    }
-
-                    for (i = 0; i < data_len; i++) {
-                        HILOGE("0x%02X", pdata[i]);
+            bool give_up = false;
+
+            pthread_mutex_lock(&h5_wakeup_mutex);
+            rtk_h5.data_retrans_timer_running = 0;
+            skb = RtbTopQueue(rtk_h5.unack);
+            if (skb) {
+                HILOGE("retransmitting from seqno %u of (%u) pkts, retransfer count(%d), rto %u ms",
+                       BT_CONTEXT(skb)->TxSeq, skb_queue_get_length(rtk_h5.unack), rtk_h5.data_retrans_count,
+                       h5_rto_ms());
+                if (h5_now_us() - rtk_h5.tx_time_us[BT_CONTEXT(skb)->TxSeq] > DATA_RETRANS_GIVE_UP_MS * 1000ULL) {
+                    give_up = true;
+                } else {
+                    // back off, only the oldest packet goes again until the controller acks it
+                    rtk_h5.rto_ms = h5_rto_ms() * 2;
+                    if (rtk_h5.rto_ms > H5_RTO_MAX_MS) {
+                        rtk_h5.rto_ms = H5_RTO_MAX_MS;
                     }
-#endif
-                    rtk_h5.msgq_txseq = (rtk_h5.msgq_txseq - 1) & 0x07;
-                    skb_queue_head(rtk_h5.rel, skb);
+                    rtk_h5.rtx_count = 1;
+                    rtk_h5.rtx_sent = 0;
+                    rtk_h5.rto_probe = 1;
+                    rtk_h5.rto_fired++;
+                    rtk_h5.data_retrans_count++;
                 }
-                pthread_mutex_unlock(&h5_wakeup_mutex);
-                rtk_h5.data_retrans_count++;
-                h5_wake_up();
-            } else {
-                // do not put packet to rel queue, and do not send
+            }
+            pthread_mutex_unlock(&h5_wakeup_mutex);
+
+            if (give_up) {
+                // do not send again
                 // Kill bluetooth
                 rtkbt_h5_send_hw_error();
+            } else if (skb) {
+                h5_wake_up();
             }
         } else if (events & H5_EVENT_EXIT) {
             break;
@@ -1670,7 +1666,7 @@ void hci_h5_int_init(hci_h5_callbacks_t *h5_callbacks)
     rtk_h5.unrel = RtbQueueInit();
 
     rtk_h5.rx_state = H5_W4_PKT_DELIMITER;
-    rtk_h5.rx_esc_state = H5_ESCSTATE_NOESC;
+    h5_slip_decoder_reset(&rtk_h5.rx_slip);
 
     h5_init_datatrans_flag = 1;
 }
@@ -1723,6 +1719,9 @@ void hci_h5_cleanup(void)
     RtbQueueFree(rtk_h5.unack);
     RtbQueueFree(rtk_h5.rel);
     RtbQueueFree(rtk_h5.unrel);
+    RtbPoolDumpStats();
+    HILOGI("h5 srtt %u us rttvar %u us rto %u ms, %u time outs, %u fast retransmits", rtk_h5.srtt_us,
+           rtk_h5.rttvar_us, h5_rto_ms(), rtk_h5.rto_fired, rtk_h5.fast_retransmits);
 
     h5_int_hal_callbacks = NULL;
     rtk_h5.internal_skb = NULL;
@@ -1742,6 +1741,7 @@ bool hci_h5_receive_msg(uint8_t *byte, uint16_t length)
 {
     bool status = false;
     status = h5_recv(&rtk_h5, byte, length);
+    h5_flush_rx_batch(&rtk_h5);
     return status;
 }
 
@@ -1900,70 +1900,6 @@ uint8_t hci_h5_send_sync_cmd(uint16_t opcode, uint8_t *p_buf, uint16_t length)
 /***
     Timer related functions
 */
-static timer_t OsAllocateTimer(tTIMER_HANDLE_CBACK timer_callback)
-{
-    struct sigevent sigev;
-    timer_t timerid;
-
-    (void)memset_s(&sigev, sizeof(struct sigevent), 0, sizeof(struct sigevent));
-    // Create the POSIX timer to generate signo
-    sigev.sigev_notify = SIGEV_THREAD;
-    sigev.sigev_notify_function = timer_callback;
-    sigev.sigev_value.sival_ptr = &timerid;
-
-    HILOGE("OsAllocateTimer rtk_parse sigev.sigev_notify_thread_id = syscall(__NR_gettid)!");
-    // Create the Timer using timer_create signal
-
-    if (timer_create(CLOCK_REALTIME, &sigev, &timerid) == 0) {
-        return timerid;
-    } else {
-        HILOGE("timer_create error!");
-        return (timer_t)-1;
-    }
-}
-
-static int OsFreeTimer(timer_t timerid)
-{
-    int ret = 0;
-    ret = timer_delete(timerid);
-    if (ret != 0) {
-        HILOGE("timer_delete fail with errno(%d)", errno);
-    }
-
-    return ret;
-}
-
-static int OsStartTimer(timer_t timerid, int msec, int mode)
-{
-    struct itimerspec itval;
-
-#define HCI_H5_MSEC_1000 1000
-    itval.it_value.tv_sec = msec / HCI_H5_MSEC_1000;
-    itval.it_value.tv_nsec = (long)(msec % HCI_H5_MSEC_1000) * (1000000L);
-
-    if (mode == 1) {
-        itval.it_interval.tv_sec = itval.it_value.tv_sec;
-        itval.it_interval.tv_nsec = itval.it_value.tv_nsec;
-    } else {
-        itval.it_interval.tv_sec = 0;
-        itval.it_interval.tv_nsec = 0;
-    }
-
-    // Set the Timer when to expire through timer_settime
-
-    if (timer_settime(timerid, 0, &itval, NULL) != 0) {
-        HILOGE("time_settime error!");
-        return -1;
-    }
-
-    return 0;
-}
-
-static int OsStopTimer(timer_t timerid)
-{
-    return OsStartTimer(timerid, 0, 0);
-}
-
 static void h5_retransfer_timeout_handler(union sigval sigev_value)
 {
     RTK_UNUSED(sigev_value);
@@ -2027,10 +1963,7 @@ static void h5_wait_controller_baudrate_ready_timeout_handler(union sigval sigev
         return;
     }
     H5LogMsg("No Controller retransfer, baudrate of controller ready");
-    pthread_mutex_lock(&rtk_h5.data_mutex);
-    skb_queue_tail(rtk_h5.recv_data, rtk_h5.internal_skb);
-    pthread_cond_signal(&rtk_h5.data_cond);
-    pthread_mutex_unlock(&rtk_h5.data_mutex);
+    h5_pass_up(&rtk_h5, rtk_h5.internal_skb, false);
 
     rtk_h5.internal_skb = NULL;
 }
@@ -2052,28 +1985,30 @@ static void h5_hw_init_ready_timeout_handler(union sigval sigev_value)
 int h5_alloc_data_retrans_timer(void)
 {
     // Create and set the timer when to expire
-    rtk_h5.timer_data_retrans = OsAllocateTimer(h5_retransfer_timeout_handler);
+    rtk_h5.timer_data_retrans = RtkTimerAllocate(h5_retransfer_timeout_handler, (union sigval){0});
 
     return 0;
 }
 
 int h5_free_data_retrans_timer(void)
 {
-    return OsFreeTimer(rtk_h5.timer_data_retrans);
+    return RtkTimerFree(rtk_h5.timer_data_retrans);
 }
 
+// starts the timer if it is not running, under h5_wakeup_mutex
 int h5_start_data_retrans_timer(void)
 {
-    if (h5_init_datatrans_flag == 0) {
-        return OsStartTimer(rtk_h5.timer_data_retrans, DATA_RETRANS_TIMEOUT_VALUE, 0);
-    } else {
-        return OsStartTimer(rtk_h5.timer_data_retrans, BT_INIT_DATA_RETRANS_TIMEOUT_VALUE, 0);
+    if (rtk_h5.data_retrans_timer_running) {
+        return 0;
     }
+    rtk_h5.data_retrans_timer_running = 1;
+    return RtkTimerStart(rtk_h5.timer_data_retrans, h5_rto_ms(), false);
 }
 
 int h5_stop_data_retrans_timer(void)
 {
-    return OsStopTimer(rtk_h5.timer_data_retrans);
+    rtk_h5.data_retrans_timer_running = 0;
+    return RtkTimerStop(rtk_h5.timer_data_retrans);
 }
 
 /*
@@ -2082,24 +2017,24 @@ int h5_stop_data_retrans_timer(void)
 int h5_alloc_sync_retrans_timer(void)
 {
     // Create and set the timer when to expire
-    rtk_h5.timer_sync_retrans = OsAllocateTimer(h5_sync_retrans_timeout_handler);
+    rtk_h5.timer_sync_retrans = RtkTimerAllocate(h5_sync_retrans_timeout_handler, (union sigval){0});
 
     return 0;
 }
 
 int h5_free_sync_retrans_timer(void)
 {
-    return OsFreeTimer(rtk_h5.timer_sync_retrans);
+    return RtkTimerFree(rtk_h5.timer_sync_retrans);
 }
 
 int h5_start_sync_retrans_timer(void)
 {
-    return OsStartTimer(rtk_h5.timer_sync_retrans, SYNC_RETRANS_TIMEOUT_VALUE, 1);
+    return RtkTimerStart(rtk_h5.timer_sync_retrans, SYNC_RETRANS_TIMEOUT_VALUE, true);
 }
 
 int h5_stop_sync_retrans_timer(void)
 {
-    return OsStopTimer(rtk_h5.timer_sync_retrans);
+    return RtkTimerStop(rtk_h5.timer_sync_retrans);
 }
 
 /*
@@ -2108,24 +2043,24 @@ int h5_stop_sync_retrans_timer(void)
 int h5_alloc_conf_retrans_timer(void)
 {
     // Create and set the timer when to expire
-    rtk_h5.timer_conf_retrans = OsAllocateTimer(h5_conf_retrans_timeout_handler);
+    rtk_h5.timer_conf_retrans = RtkTimerAllocate(h5_conf_retrans_timeout_handler, (union sigval){0});
 
     return 0;
 }
 
 int h5_free_conf_retrans_timer(void)
 {
-    return OsFreeTimer(rtk_h5.timer_conf_retrans);
+    return RtkTimerFree(rtk_h5.timer_conf_retrans);
 }
 
 int h5_start_conf_retrans_timer(void)
 {
-    return OsStartTimer(rtk_h5.timer_conf_retrans, CONF_RETRANS_TIMEOUT_VALUE, 1);
+    return RtkTimerStart(rtk_h5.timer_conf_retrans, CONF_RETRANS_TIMEOUT_VALUE, true);
 }
 
 int h5_stop_conf_retrans_timer(void)
 {
-    return OsStopTimer(rtk_h5.timer_conf_retrans);
+    return RtkTimerStop(rtk_h5.timer_conf_retrans);
 }
 
 /*
@@ -2134,24 +2069,25 @@ int h5_stop_conf_retrans_timer(void)
 int h5_alloc_wait_controller_baudrate_ready_timer(void)
 {
     // Create and set the timer when to expire
-    rtk_h5.timer_wait_ct_baudrate_ready = OsAllocateTimer(h5_wait_controller_baudrate_ready_timeout_handler);
+    rtk_h5.timer_wait_ct_baudrate_ready =
+        RtkTimerAllocate(h5_wait_controller_baudrate_ready_timeout_handler, (union sigval){0});
 
     return 0;
 }
 
 int h5_free_wait_controller_baudrate_ready_timer(void)
 {
-    return OsFreeTimer(rtk_h5.timer_wait_ct_baudrate_ready);
+    return RtkTimerFree(rtk_h5.timer_wait_ct_baudrate_ready);
 }
 
 int h5_start_wait_controller_baudrate_ready_timer(void)
 {
-    return OsStartTimer(rtk_h5.timer_wait_ct_baudrate_ready, WAIT_CT_BAUDRATE_READY_TIMEOUT_VALUE, 0);
+    return RtkTimerStart(rtk_h5.timer_wait_ct_baudrate_ready, WAIT_CT_BAUDRATE_READY_TIMEOUT_VALUE, false);
 }
 
 int h5_stop_wait_controller_baudrate_ready_timer(void)
 {
-    return OsStopTimer(rtk_h5.timer_wait_ct_baudrate_ready);
+    return RtkTimerStop(rtk_h5.timer_wait_ct_baudrate_ready);
 }
 
 /*
@@ -2160,24 +2096,24 @@ int h5_stop_wait_controller_baudrate_ready_timer(void)
 int h5_alloc_hw_init_ready_timer(void)
 {
     // Create and set the timer when to expire
-    rtk_h5.timer_h5_hw_init_ready = OsAllocateTimer(h5_hw_init_ready_timeout_handler);
+    rtk_h5.timer_h5_hw_init_ready = RtkTimerAllocate(h5_hw_init_ready_timeout_handler, (union sigval){0});
 
     return 0;
 }
 
 int h5_free_hw_init_ready_timer(void)
 {
-    return OsFreeTimer(rtk_h5.timer_h5_hw_init_ready);
+    return RtkTimerFree(rtk_h5.timer_h5_hw_init_ready);
 }
 
 int h5_start_hw_init_ready_timer(void)
 {
-    return OsStartTimer(rtk_h5.timer_h5_hw_init_ready, H5_HW_INIT_READY_TIMEOUT_VALUE, 0);
+    return RtkTimerStart(rtk_h5.timer_h5_hw_init_ready, H5_HW_INIT_READY_TIMEOUT_VALUE, false);
 }
 
 int h5_stop_hw_init_ready_timer(void)
 {
-    return OsStopTimer(rtk_h5.timer_h5_hw_init_ready);
+    return RtkTimerStop(rtk_h5.timer_h5_hw_init_ready);
 }
 
 /******************************************************************************
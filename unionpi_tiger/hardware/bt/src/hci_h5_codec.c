@@ -0,0 +1,231 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      hci_h5_codec.c
+ *
+ *  Description:   SLIP framing and CRC of the H5 transport over whole spans.
+ *                 Runs of bytes that need no escape are found a word at a
+ *                 time and copied at once, the CRC takes a byte per lookup.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+#include "securec.h"
+#include "hci_h5_codec.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define H5_XON 0x11
+#define H5_XOFF 0x13
+
+/* Bits of h5_slip_class */
+#define H5_CLASS_FRAME 0x01 /* 0xc0 and 0xdb, escaped always */
+#define H5_CLASS_OOF 0x02   /* 0x11 and 0x13, escaped with oof flow control */
+
+#define H5_WORD_ONES 0x0101010101010101ULL
+#define H5_WORD_HIGHS 0x8080808080808080ULL
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+static const uint16_t h5_crc_table[256] = {
+    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78,
+};
+
+static const uint8_t h5_slip_class[256] = {
+    [H5_SLIP_DELIM] = H5_CLASS_FRAME,
+    [H5_SLIP_ESC] = H5_CLASS_FRAME,
+    [H5_XON] = H5_CLASS_OOF,
+    [H5_XOFF] = H5_CLASS_OOF,
+};
+
+/* The byte that follows 0xdb, zero where there is no escape */
+static const uint8_t h5_slip_escape[256] = {
+    [H5_SLIP_DELIM] = H5_SLIP_ESC_DELIM,
+    [H5_SLIP_ESC] = H5_SLIP_ESC_ESC,
+    [H5_XON] = H5_SLIP_ESC_XON,
+    [H5_XOFF] = H5_SLIP_ESC_XOFF,
+};
+
+/* What an escape decodes to, zero for a byte that is no escape */
+static const uint8_t h5_slip_unescape[256] = {
+    [H5_SLIP_ESC_DELIM] = H5_SLIP_DELIM,
+    [H5_SLIP_ESC_ESC] = H5_SLIP_ESC,
+    [H5_SLIP_ESC_XON] = H5_XON,
+    [H5_SLIP_ESC_XOFF] = H5_XOFF,
+};
+
+/******************************************************************************
+**  Static functions
+******************************************************************************/
+
+/* Non zero if any byte of word equals byte */
+static inline uint64_t h5_word_has(uint64_t word, uint8_t byte)
+{
+    uint64_t x = word ^ (H5_WORD_ONES * byte);
+
+    return (x - H5_WORD_ONES) & ~x & H5_WORD_HIGHS;
+}
+
+/**
+ * Count the bytes from the start of in that go through SLIP unchanged.
+ *
+ * @param in bytes to look at
+ * @param len the length of in
+ * @param oof_flow_control 0x11 and 0x13 end the span as well
+ * @return the length of the span
+ */
+static size_t h5_plain_span(const uint8_t *in, size_t len, bool oof_flow_control)
+{
+    uint8_t mask = oof_flow_control ? (H5_CLASS_FRAME | H5_CLASS_OOF) : H5_CLASS_FRAME;
+    size_t i = 0;
+
+    while (i + sizeof(uint64_t) <= len) {
+        uint64_t word;
+        uint64_t hit;
+
+        // a fixed size memcpy is an unaligned load
+        memcpy(&word, in + i, sizeof(word));
+        hit = h5_word_has(word, H5_SLIP_DELIM) | h5_word_has(word, H5_SLIP_ESC);
+        if (oof_flow_control) {
+            hit |= h5_word_has(word, H5_XON) | h5_word_has(word, H5_XOFF);
+        }
+        if (hit) {
+            break;
+        }
+        i += sizeof(uint64_t);
+    }
+    while (i < len && !(h5_slip_class[in[i]] & mask)) {
+        i++;
+    }
+    return i;
+}
+
+/******************************************************************************
+**  Functions
+******************************************************************************/
+uint16_t h5_crc_update_buf(uint16_t crc, const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        crc = (crc >> 8) ^ h5_crc_table[(crc ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
+uint16_t h5_crc_to_wire(uint16_t crc)
+{
+    crc = ((crc >> 1) & 0x5555) | ((crc & 0x5555) << 1);
+    crc = ((crc >> 2) & 0x3333) | ((crc & 0x3333) << 2);
+    crc = ((crc >> 4) & 0x0f0f) | ((crc & 0x0f0f) << 4);
+    return (uint16_t)((crc >> 8) | (crc << 8));
+}
+
+size_t h5_slip_encode(uint8_t *out, const uint8_t *in, size_t len, bool oof_flow_control)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < len) {
+        size_t span = h5_plain_span(in + i, len - i, oof_flow_control);
+        if (span) {
+            (void)memcpy_s(out + o, span, in + i, span);
+            i += span;
+            o += span;
+            if (i == len) {
+                break;
+            }
+        }
+        out[o++] = H5_SLIP_ESC;
+        out[o++] = h5_slip_escape[in[i++]];
+    }
+    return o;
+}
+
+size_t h5_slip_decode(tH5_SLIP_DECODER *dec, const uint8_t *in, size_t in_len, size_t *in_used, uint8_t *out,
+                      size_t out_len, tH5_SLIP_STATUS *status)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    *status = H5_SLIP_NEED_MORE;
+    while (i < in_len && o < out_len) {
+        uint8_t byte = in[i];
+        size_t span;
+
+        if (byte == H5_SLIP_DELIM) {
+            *status = H5_SLIP_AT_DELIM;
+            break;
+        }
+        if (dec->esc) {
+            i++;
+            dec->esc = false;
+            if (!h5_slip_unescape[byte]) {
+                *status = H5_SLIP_BAD_ESC;
+                break;
+            }
+            out[o++] = h5_slip_unescape[byte];
+            continue;
+        }
+        if (byte == H5_SLIP_ESC) {
+            i++;
+            dec->esc = true;
+            continue;
+        }
+        span = h5_plain_span(in + i, (in_len - i < out_len - o) ? in_len - i : out_len - o, false);
+        (void)memcpy_s(out + o, out_len - o, in + i, span);
+        i += span;
+        o += span;
+    }
+    *in_used = i;
+    return o;
+}
@@ -0,0 +1,440 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      hci_h5_codec_bench.c
+ *
+ *  Description:   Checks the H5 codec against the byte at a time SLIP and
+ *                 nibble CRC hci_h5.c used before, over a generated corpus
+ *                 of payloads cut at every kind of boundary, then compares
+ *                 the throughput of both.
+ *
+ *                     hci_h5_codec_bench [corpus cases] [bench MiB]
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "securec.h"
+#include "hci_h5_codec.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define CORPUS_CASES 20000
+#define CORPUS_MAX_LEN 4100 /* past the 0xfff byte H5 payload */
+#define BENCH_MIB 64
+#define BENCH_PKT_LEN 1021 /* a 3-DH5 ACL packet */
+#define BENCH_ROUNDS 5
+#define NSEC_PER_SEC 1000000000LL
+#define MIB (1024 * 1024)
+
+#define CRC_CHECK_VALUE 0x6f91 /* CRC of "123456789", CRC-16/MCRF4XX */
+
+#define CHECK(cond, ...)                                                                                               \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("check failed at %s:%d: ", __FILE__, __LINE__);                                                   \
+            printf(__VA_ARGS__);                                                                                       \
+            printf("\n");                                                                                              \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+/******************************************************************************
+**  The codec hci_h5.c had before, kept as the reference
+******************************************************************************/
+static const uint16_t legacy_crc_table[] = {0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+                                            0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f};
+
+static void legacy_crc_update(uint16_t *crc, uint8_t d)
+{
+    uint16_t reg = *crc;
+
+    reg = (reg >> 4) ^ legacy_crc_table[(reg ^ d) & 0x000f];
+    reg = (reg >> 4) ^ legacy_crc_table[(reg ^ (d >> 4)) & 0x000f];
+    *crc = reg;
+}
+
+static uint8_t legacy_bit_rev8(uint8_t byte)
+{
+    uint8_t rev = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        rev = (uint8_t)((rev << 1) | ((byte >> i) & 1));
+    }
+    return rev;
+}
+
+static uint16_t legacy_bit_rev16(uint16_t x)
+{
+    return (uint16_t)((legacy_bit_rev8(x & 0xff) << 8) | legacy_bit_rev8(x >> 8));
+}
+
+/* One memcpy_s per byte, as skb_put() of one or two bytes did */
+static size_t legacy_slip_one_byte(uint8_t *out, uint8_t byte, int oof)
+{
+    uint8_t esc[2] = {H5_SLIP_ESC, 0};
+
+    switch (byte) {
+        case 0xc0:
+            esc[1] = 0xdc;
+            break;
+        case 0xdb:
+            esc[1] = 0xdd;
+            break;
+        case 0x11:
+            esc[1] = oof ? 0xde : 0;
+            break;
+        case 0x13:
+            esc[1] = oof ? 0xdf : 0;
+            break;
+        default:
+            break;
+    }
+    if (esc[1]) {
+        (void)memcpy_s(out, sizeof(esc), esc, sizeof(esc));
+        return sizeof(esc);
+    }
+    (void)memcpy_s(out, 1, &byte, 1);
+    return 1;
+}
+
+static size_t legacy_slip_encode(uint8_t *out, const uint8_t *in, size_t len, int oof)
+{
+    size_t o = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        o += legacy_slip_one_byte(out + o, in[i], oof);
+    }
+    return o;
+}
+
+/* The old h5_unslip_one_byte() loop of h5_recv(), same stop rules as h5_slip_decode() */
+static size_t legacy_slip_decode(tH5_SLIP_DECODER *dec, const uint8_t *in, size_t in_len, size_t *in_used,
+                                 uint8_t *out, size_t out_len, tH5_SLIP_STATUS *status)
+{
+    size_t i = 0;
+    size_t o = 0;
+    uint8_t byte;
+
+    *status = H5_SLIP_NEED_MORE;
+    for (; i < in_len && o < out_len; i++) {
+        if (in[i] == 0xc0) {
+            *status = H5_SLIP_AT_DELIM;
+            break;
+        }
+        if (!dec->esc) {
+            if (in[i] == 0xdb) {
+                dec->esc = true;
+            } else {
+                (void)memcpy_s(out + o++, 1, &in[i], 1);
+            }
+            continue;
+        }
+        dec->esc = false;
+        switch (in[i]) {
+            case 0xdc:
+                byte = 0xc0;
+                break;
+            case 0xdd:
+                byte = 0xdb;
+                break;
+            case 0xde:
+                byte = 0x11;
+                break;
+            case 0xdf:
+                byte = 0x13;
+                break;
+            default:
+                *in_used = i + 1;
+                *status = H5_SLIP_BAD_ESC;
+                return o;
+        }
+        (void)memcpy_s(out + o++, 1, &byte, 1);
+    }
+    *in_used = i;
+    return o;
+}
+
+/******************************************************************************
+**  Corpus
+******************************************************************************/
+static uint32_t g_seed = 0x5eed1234;
+
+static uint32_t rnd(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+
+/*
+ * Payloads with the bytes SLIP cares about at every density: plain noise,
+ * only specials, long plain runs with a special on either side of a word
+ * boundary, runs of escapes, and lengths around the word size.
+ */
+static size_t corpus_payload(uint32_t n, uint8_t *buf)
+{
+    static const uint8_t specials[] = {0xc0, 0xdb, 0x11, 0x13, 0xdc, 0xdd, 0xde, 0xdf};
+    size_t len = (n % 4 == 0) ? (n / 4) % 40 : rnd() % CORPUS_MAX_LEN;
+    uint32_t kind = (n / 2) % 6;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        switch (kind) {
+            case 0:
+                buf[i] = (uint8_t)rnd();
+                break;
+            case 1:
+                buf[i] = specials[rnd() % sizeof(specials)];
+                break;
+            case 2:
+                buf[i] = (rnd() % 61 == 0) ? specials[rnd() % 4] : (uint8_t)(0x20 + rnd() % 0x40);
+                break;
+            case 3:
+                buf[i] = (i % 8 == 7 || i % 8 == 0) ? specials[rnd() % 4] : (uint8_t)i;
+                break;
+            case 4:
+                buf[i] = (rnd() & 1) ? 0xdb : 0xc0;
+                break;
+            default:
+                buf[i] = (rnd() % 3 == 0) ? specials[rnd() % sizeof(specials)] : (uint8_t)rnd();
+                break;
+        }
+    }
+    return len;
+}
+
+/* Runs both decoders over in, fed in random pieces with random room to write */
+static int check_decode(const uint8_t *in, size_t len, uint32_t n)
+{
+    static uint8_t out_new[CORPUS_MAX_LEN * 2];
+    static uint8_t out_old[CORPUS_MAX_LEN * 2];
+    tH5_SLIP_DECODER dec_new = {false};
+    tH5_SLIP_DECODER dec_old = {false};
+    size_t pos = 0;
+    size_t o = 0;
+
+    while (pos < len) {
+        size_t piece = 1 + rnd() % ((n & 1) ? 7 : 600);
+        size_t room = 1 + rnd() % ((n & 2) ? 5 : 900);
+        size_t used_new = 0;
+        size_t used_old = 0;
+        tH5_SLIP_STATUS st_new;
+        tH5_SLIP_STATUS st_old;
+        size_t got_new;
+        size_t got_old;
+
+        piece = (piece > len - pos) ? len - pos : piece;
+        got_new = h5_slip_decode(&dec_new, in + pos, piece, &used_new, out_new + o, room, &st_new);
+        got_old = legacy_slip_decode(&dec_old, in + pos, piece, &used_old, out_old + o, room, &st_old);
+        CHECK(got_new == got_old && used_new == used_old && st_new == st_old && dec_new.esc == dec_old.esc,
+              "case %u at %zu: got %zu/%zu used %zu/%zu status %d/%d", n, pos, got_new, got_old, used_new, used_old,
+              st_new, st_old);
+        CHECK(memcmp(out_new + o, out_old + o, got_new) == 0, "case %u at %zu: decoded bytes differ", n, pos);
+        o += got_new;
+        pos += used_new;
+        if (st_new == H5_SLIP_AT_DELIM) {
+            pos++;
+        }
+        if (st_new != H5_SLIP_NEED_MORE) {
+            h5_slip_decoder_reset(&dec_new);
+            h5_slip_decoder_reset(&dec_old);
+        }
+    }
+    return 0;
+}
+
+static int check_corpus(uint32_t cases)
+{
+    static uint8_t payload[CORPUS_MAX_LEN];
+    static uint8_t enc_new[H5_SLIP_MAX_ENCODED(CORPUS_MAX_LEN)];
+    static uint8_t enc_old[H5_SLIP_MAX_ENCODED(CORPUS_MAX_LEN)];
+    static uint8_t dec[CORPUS_MAX_LEN];
+    uint32_t n;
+
+    for (n = 0; n < cases; n++) {
+        size_t len = corpus_payload(n, payload);
+        int oof = (int)(n & 1);
+        uint16_t crc_old = H5_CRC_SEED;
+        uint16_t crc_new;
+        size_t cut = len ? rnd() % len : 0;
+        size_t enc_len;
+        size_t used = 0;
+        size_t got;
+        tH5_SLIP_DECODER state = {false};
+        tH5_SLIP_STATUS status;
+        size_t i;
+
+        for (i = 0; i < len; i++) {
+            legacy_crc_update(&crc_old, payload[i]);
+        }
+        crc_new = h5_crc_update_buf(h5_crc_update_buf(H5_CRC_SEED, payload, cut), payload + cut, len - cut);
+        CHECK(crc_new == crc_old, "case %u: crc %04x, expected %04x", n, crc_new, crc_old);
+
+        enc_len = h5_slip_encode(enc_new, payload, len, oof);
+        CHECK(enc_len == legacy_slip_encode(enc_old, payload, len, oof), "case %u: encoded length differs", n);
+        CHECK(memcmp(enc_new, enc_old, enc_len) == 0, "case %u: encoded bytes differ", n);
+        CHECK(memchr(enc_new, H5_SLIP_DELIM, enc_len) == NULL, "case %u: 0xc0 left in the encoding", n);
+
+        got = h5_slip_decode(&state, enc_new, enc_len, &used, dec, sizeof(dec), &status);
+        CHECK(got == len && used == enc_len && status == H5_SLIP_NEED_MORE && !state.esc,
+              "case %u: round trip gave %zu of %zu bytes", n, got, len);
+        CHECK(memcmp(dec, payload, len) == 0, "case %u: round trip bytes differ", n);
+
+        // raw payloads are garbage to the decoder: delimiters and bad escapes included
+        if (check_decode(payload, len, n) || check_decode(enc_new, enc_len, n)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_crc(void)
+{
+    const uint8_t check[] = "123456789";
+    uint32_t x;
+
+    CHECK(h5_crc_update_buf(H5_CRC_SEED, check, sizeof(check) - 1) == CRC_CHECK_VALUE, "crc check value");
+    for (x = 0; x <= 0xffff; x++) {
+        CHECK(h5_crc_to_wire((uint16_t)x) == legacy_bit_rev16((uint16_t)x), "wire order of %04x", x);
+    }
+    return 0;
+}
+
+/******************************************************************************
+**  Throughput
+******************************************************************************/
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* What a packet costs each way: CRC and SLIP encode on TX, SLIP decode and CRC on RX */
+static volatile uint32_t g_sink;
+
+static double bench_tx(bool legacy, const uint8_t *pkt, uint8_t *wire, size_t total)
+{
+    long long start = now_ns();
+    size_t done;
+
+    for (done = 0; done < total; done += BENCH_PKT_LEN) {
+        uint16_t crc = H5_CRC_SEED;
+        size_t len;
+        size_t i;
+
+        if (legacy) {
+            for (i = 0; i < BENCH_PKT_LEN; i++) {
+                legacy_crc_update(&crc, pkt[i]);
+            }
+            len = legacy_slip_encode(wire, pkt, BENCH_PKT_LEN, 0);
+            crc = legacy_bit_rev16(crc);
+        } else {
+            crc = h5_crc_to_wire(h5_crc_update_buf(crc, pkt, BENCH_PKT_LEN));
+            len = h5_slip_encode(wire, pkt, BENCH_PKT_LEN, false);
+        }
+        g_sink += crc + (uint32_t)len;
+    }
+    return (double)total / (double)(now_ns() - start);
+}
+
+static double bench_rx(bool legacy, const uint8_t *wire, size_t wire_len, uint8_t *pkt, size_t total)
+{
+    long long start = now_ns();
+    size_t done;
+
+    for (done = 0; done < total; done += BENCH_PKT_LEN) {
+        tH5_SLIP_DECODER dec = {false};
+        tH5_SLIP_STATUS status;
+        uint16_t crc = H5_CRC_SEED;
+        size_t used;
+        size_t got;
+        size_t i;
+
+        if (legacy) {
+            got = legacy_slip_decode(&dec, wire, wire_len, &used, pkt, BENCH_PKT_LEN, &status);
+            for (i = 0; i < got; i++) {
+                legacy_crc_update(&crc, pkt[i]);
+            }
+        } else {
+            got = h5_slip_decode(&dec, wire, wire_len, &used, pkt, BENCH_PKT_LEN, &status);
+            crc = h5_crc_update_buf(crc, pkt, got);
+        }
+        g_sink += crc + (uint32_t)got;
+    }
+    return (double)total / (double)(now_ns() - start);
+}
+
+static double best_of(double a, double b)
+{
+    return a > b ? a : b;
+}
+
+static void bench(size_t total)
+{
+    static uint8_t pkt[BENCH_PKT_LEN];
+    static uint8_t wire[H5_SLIP_MAX_ENCODED(BENCH_PKT_LEN)];
+    static uint8_t out[BENCH_PKT_LEN];
+    double tx[2] = {0, 0};
+    double rx[2] = {0, 0};
+    size_t wire_len;
+    size_t i;
+    int r;
+
+    // audio-like payload: about 1 in 128 bytes needs an escape
+    for (i = 0; i < BENCH_PKT_LEN; i++) {
+        pkt[i] = (uint8_t)rnd();
+    }
+    wire_len = h5_slip_encode(wire, pkt, BENCH_PKT_LEN, false);
+
+    for (r = 0; r < BENCH_ROUNDS; r++) {
+        tx[0] = best_of(tx[0], bench_tx(true, pkt, wire, total));
+        tx[1] = best_of(tx[1], bench_tx(false, pkt, wire, total));
+        rx[0] = best_of(rx[0], bench_rx(true, wire, wire_len, out, total));
+        rx[1] = best_of(rx[1], bench_rx(false, wire, wire_len, out, total));
+    }
+    printf("%-4s %14s %14s %8s\n", "", "byte/nibble", "span/table", "speedup");
+    printf("%-4s %9.3f B/ns %9.3f B/ns %7.1fx\n", "tx", tx[0], tx[1], tx[1] / tx[0]);
+    printf("%-4s %9.3f B/ns %9.3f B/ns %7.1fx\n", "rx", rx[0], rx[1], rx[1] / rx[0]);
+    printf("3 Mbaud H5 is 0.0004 B/ns each way\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t cases = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : CORPUS_CASES;
+    size_t mib = (argc > 2) ? (size_t)strtoul(argv[2], NULL, 0) : BENCH_MIB;
+    int failures = 0;
+
+    failures += check_crc();
+    failures += check_corpus(cases);
+    printf("corpus of %u payloads: %s\n", cases, failures ? "mismatch" : "codecs agree");
+    if (!failures && mib) {
+        bench(mib * MIB);
+    }
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
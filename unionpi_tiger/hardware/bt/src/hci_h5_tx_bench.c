@@ -0,0 +1,672 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      hci_h5_tx_bench.c
+ *
+ *  Description:   Runs hci_h5.c against a stand-in controller on the other
+ *                 end of a pseudo terminal. The controller answers the link
+ *                 establishment, acks the host's reliable packets and hands
+ *                 ACL credits back in Number Of Completed Packets events, the
+ *                 way a real one does. The host sends ACL packets as the
+ *                 credits allow, the bench counts the writes the transport
+ *                 makes and the empty ACKs it sends. Received packets come
+ *                 up as skbs on the reader thread like userial_vendor takes
+ *                 them, or with [skbs] 0 through data_ready_cb_thread and
+ *                 h5_int_read_data.
+ *
+ *                 Once the link is up the UART can lose and corrupt frames,
+ *                 [drop %] and [corrupt %] of them each way. The controller
+ *                 drops what fails its checks and sends its own unacked
+ *                 packets again after a while, the bench gives the goodput.
+ *
+ *                     hci_h5_tx_bench [packets] [acl length] [window] [credits] [skbs]
+ *                                     [drop %] [corrupt %]
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "hci_h5_codec.h"
+#include "hci_h5_int.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define BENCH_PACKETS 20000
+#define BENCH_ACL_LEN 1021
+#define BENCH_WINDOW 4
+#define BENCH_CREDITS 8
+#define BENCH_POLL_MS 10
+#define BENCH_TIMEOUT_S 20
+#define BENCH_CTL_RTO_MS 40 /* the controller sends its unacked packets again after this */
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000LL
+#define PPM_PER_PERCENT 10000
+
+#define H5_HDR_SIZE 4
+#define H5_MAX_PAYLOAD 0xFFF
+#define H5_FRAME_MAX (H5_SLIP_MAX_ENCODED(H5_HDR_SIZE + H5_MAX_PAYLOAD + 2) + 2)
+#define H5_ACK_PKT 0x00
+#define H5_ACL_PKT 0x02
+#define H5_EVENT_PKT 0x04
+#define H5_LINK_CTL_PKT 0x0F
+
+#define HCI_ACL_HDR_SIZE 4
+#define HCI_COMMAND_COMPLETE_EVT 0x0E
+#define HCI_NUM_OF_CMP_PKTS_EVT 0x13
+#define BENCH_ACL_HANDLE 0x0001
+
+#define CHECK(cond, ...)                                                                                               \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("check failed at %s:%d: ", __FILE__, __LINE__);                                                   \
+            printf(__VA_ARGS__);                                                                                       \
+            printf("\n");                                                                                              \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+/* One direction of the UART */
+typedef struct {
+    uint32_t drop_ppm;
+    uint32_t corrupt_ppm;
+    uint32_t seed;
+    uint32_t frames;
+    uint32_t dropped;
+    uint32_t corrupted;
+} line_t;
+
+/* A reliable packet of the controller the host has not acked yet */
+typedef struct {
+    uint8_t type;
+    uint16_t len;
+    uint8_t data[16];
+} stand_in_pkt_t;
+
+/* The controller end of the link */
+typedef struct {
+    int fd;
+    uint8_t window;
+    bool dic;
+    tH5_SLIP_DECODER dec;
+    bool in_frame;
+    size_t frame_len;
+    uint8_t frame[H5_HDR_SIZE + H5_MAX_PAYLOAD + 2];
+    uint8_t rx_seq;   /* next sequence number expected from the host */
+    uint8_t tx_seq;   /* sequence number of our next reliable packet */
+    uint8_t host_ack; /* next sequence number the host expects */
+    stand_in_pkt_t unacked[8];
+    long long ack_ns; /* the host last acked something new, or we last resent */
+    bool ack_due;
+    uint32_t completed; /* ACL packets taken but not reported yet */
+    uint32_t acl_packets;
+    uint64_t acl_bytes;
+    uint32_t rel_sent;
+    uint32_t rel_resent;
+    uint32_t pure_acks;
+    uint32_t duplicates;
+    uint32_t bad_frames;
+} stand_in_t;
+
+/******************************************************************************
+**  Host side
+******************************************************************************/
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static volatile int g_running = 1;
+static int g_host_fd = -1;
+static int g_init_status = -1;
+static uint32_t g_credits;
+static uint32_t g_delivered;
+static uint32_t g_writes;
+static uint64_t g_write_bytes;
+static uint32_t g_passed_up;
+static uint32_t g_passed_up_on_reader;
+static pthread_t g_reader;
+static const hci_h5_t *g_h5;
+static volatile int g_lossy;
+static line_t g_to_controller;
+static line_t g_to_host;
+static pthread_mutex_t g_tx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/******************************************************************************
+**  UART
+******************************************************************************/
+static uint32_t line_random(line_t *line)
+{
+    line->seed ^= line->seed << 13;
+    line->seed ^= line->seed >> 17;
+    line->seed ^= line->seed << 5;
+    return line->seed;
+}
+
+/*
+ * Decides the fate of one SLIP frame, delimiters included: 0 when it is lost,
+ * otherwise its length, with one bit flipped when it gets corrupted. The flip
+ * keeps away from delimiters and escapes so the receiver still finds the frame
+ * and fails it on the checksum or the CRC.
+ */
+static size_t line_pass(line_t *line, uint8_t *frame, size_t len)
+{
+    uint32_t roll;
+    size_t i;
+
+    if (!g_lossy) {
+        return len;
+    }
+    line->frames++;
+    roll = line_random(line) % (100 * PPM_PER_PERCENT);
+    if (roll < line->drop_ppm) {
+        line->dropped++;
+        return 0;
+    }
+    if (roll >= line->drop_ppm + line->corrupt_ppm) {
+        return len;
+    }
+    for (i = 1 + line_random(line) % (len - 2); i < len - 1; i++) {
+        uint8_t b = frame[i];
+        if (b != 0xc0 && b != 0xc1 && b != 0xda && b != 0xdb && frame[i - 1] != H5_SLIP_ESC) {
+            frame[i] ^= 0x01;
+            line->corrupted++;
+            break;
+        }
+    }
+    return len;
+}
+
+static void write_all(int fd, const uint8_t *data, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+}
+
+/* hci_h5.c reports link errors through here, the bench has no stack to tell */
+void userial_recv_rawdata_hook(unsigned char *buffer, unsigned int total_length)
+{
+    (void)buffer;
+    printf("host hook got %u bytes\n", total_length);
+}
+
+/* One write of the host makes it to the UART, less the frames the line loses */
+static uint16_t bench_transmit(serial_data_type_t type, uint8_t *data, uint16_t length)
+{
+    static uint8_t wire[UINT16_MAX];
+    size_t out = 0;
+    size_t start = 0;
+    size_t i;
+
+    (void)type;
+    pthread_mutex_lock(&g_lock);
+    g_writes++;
+    g_write_bytes += length;
+    pthread_mutex_unlock(&g_lock);
+
+    pthread_mutex_lock(&g_tx_lock);
+    for (i = 1; i < length; i++) {
+        if (data[i] != H5_SLIP_DELIM || data[start] != H5_SLIP_DELIM) {
+            continue;
+        }
+        memcpy(wire + out, data + start, i + 1 - start);
+        out += line_pass(&g_to_controller, wire + out, i + 1 - start);
+        start = ++i;
+    }
+    write_all(g_host_fd, wire, out);
+    pthread_mutex_unlock(&g_tx_lock);
+    return length;
+}
+
+/* What the stack does with the events: the init result and the credits */
+static void bench_host_packet(serial_data_type_t type, const uint8_t *buf, size_t len)
+{
+    pthread_mutex_lock(&g_lock);
+    g_passed_up++;
+    g_passed_up_on_reader += pthread_equal(pthread_self(), g_reader) ? 1 : 0;
+    if (type != DATA_TYPE_EVENT || len < 2) {
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+    if (buf[0] == HCI_COMMAND_COMPLETE_EVT && len >= 6 && buf[3] == (HCI_VSC_H5_INIT & 0xff) &&
+        buf[4] == (HCI_VSC_H5_INIT >> 8)) {
+        g_init_status = buf[5];
+    } else if (buf[0] == HCI_NUM_OF_CMP_PKTS_EVT && len >= 7) {
+        g_credits += buf[5] | (buf[6] << 8);
+    }
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void bench_data_ready(serial_data_type_t type, unsigned int total_length)
+{
+    static uint8_t buf[H5_MAX_PAYLOAD + 6];
+    size_t len;
+
+    if (total_length > sizeof(buf)) {
+        return;
+    }
+    len = g_h5->h5_int_read_data(buf, total_length);
+    bench_host_packet(type, buf, len);
+}
+
+static void bench_recv_skbs(RTK_BUFFER **skbs, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        bench_host_packet(BT_CONTEXT(skbs[i])->PacketType, skbs[i]->Data, skbs[i]->Length);
+        RtbFree(skbs[i]);
+    }
+}
+
+/* What userial_vendor's reader does: hand whatever the UART gave to h5_recv_msg */
+static void *host_reader(void *arg)
+{
+    uint8_t buf[4096];
+
+    (void)arg;
+    while (g_running) {
+        struct pollfd pfd = {.fd = g_host_fd, .events = POLLIN};
+        ssize_t n;
+
+        if (poll(&pfd, 1, BENCH_POLL_MS) <= 0) {
+            continue;
+        }
+        n = read(g_host_fd, buf, sizeof(buf));
+        if (n > 0) {
+            g_h5->h5_recv_msg(buf, (uint16_t)n);
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+**  Stand-in controller
+******************************************************************************/
+static void stand_in_write(stand_in_t *c, uint8_t type, bool reliable, uint8_t seq, const uint8_t *data,
+                           uint16_t len)
+{
+    uint8_t pkt[H5_HDR_SIZE + H5_MAX_PAYLOAD + 2];
+    uint8_t wire[H5_FRAME_MAX];
+    size_t pos = 0;
+    size_t plen = H5_HDR_SIZE + len;
+
+    pkt[0] = (uint8_t)((c->rx_seq << 3) | (c->dic << 6) | (reliable << 7));
+    if (reliable) {
+        pkt[0] |= seq;
+    }
+    pkt[1] = (uint8_t)(type | ((len & 0x0f) << 4));
+    pkt[2] = (uint8_t)(len >> 4);
+    pkt[3] = (uint8_t)~(pkt[0] + pkt[1] + pkt[2]);
+    memcpy(pkt + H5_HDR_SIZE, data, len);
+    if (c->dic) {
+        uint16_t crc = h5_crc_to_wire(h5_crc_update_buf(H5_CRC_SEED, pkt, plen));
+        pkt[plen++] = (uint8_t)(crc >> 8);
+        pkt[plen++] = (uint8_t)crc;
+    }
+    wire[pos++] = H5_SLIP_DELIM;
+    pos += h5_slip_encode(wire + pos, pkt, plen, false);
+    wire[pos++] = H5_SLIP_DELIM;
+    c->ack_due = false;
+    write_all(c->fd, wire, line_pass(&g_to_host, wire, pos));
+}
+
+static void stand_in_send(stand_in_t *c, uint8_t type, bool reliable, const uint8_t *data, uint16_t len)
+{
+    uint8_t seq = c->tx_seq;
+
+    if (reliable) {
+        stand_in_pkt_t *pkt = &c->unacked[seq];
+
+        if (((c->tx_seq - c->host_ack) & 0x07) == 0) {
+            c->ack_ns = now_ns();
+        }
+        pkt->type = type;
+        pkt->len = (len > sizeof(pkt->data)) ? sizeof(pkt->data) : len;
+        memcpy(pkt->data, data, pkt->len);
+        c->tx_seq = (c->tx_seq + 1) & 0x07;
+        c->rel_sent++;
+    }
+    stand_in_write(c, type, reliable, seq, data, len);
+}
+
+/* Go back N: nothing came in order since the oldest unacked packet, all of them go again */
+static void stand_in_resend(stand_in_t *c)
+{
+    uint8_t seq;
+
+    if (((c->tx_seq - c->host_ack) & 0x07) == 0 || now_ns() - c->ack_ns < BENCH_CTL_RTO_MS * NSEC_PER_MSEC) {
+        return;
+    }
+    for (seq = c->host_ack; seq != c->tx_seq; seq = (seq + 1) & 0x07) {
+        stand_in_write(c, c->unacked[seq].type, true, seq, c->unacked[seq].data, c->unacked[seq].len);
+        c->rel_resent++;
+    }
+    c->ack_ns = now_ns();
+}
+
+static void stand_in_link_ctl(stand_in_t *c, const uint8_t *data, uint16_t len)
+{
+    static const uint8_t sync_resp[] = {0x02, 0x7D};
+    uint8_t conf_resp[] = {0x04, 0x7B, 0x00};
+
+    if (len >= 2 && data[0] == 0x01 && data[1] == 0x7E) {
+        stand_in_send(c, H5_LINK_CTL_PKT, false, sync_resp, sizeof(sync_resp));
+    } else if (len >= 2 && data[0] == 0x03 && data[1] == 0xFC) {
+        conf_resp[2] = (uint8_t)((c->window & 0x07) | (c->dic << 4));
+        stand_in_send(c, H5_LINK_CTL_PKT, false, conf_resp, sizeof(conf_resp));
+    }
+}
+
+static void stand_in_frame(stand_in_t *c)
+{
+    uint8_t *hdr = c->frame;
+    uint16_t len;
+    bool crc;
+
+    if (c->frame_len < H5_HDR_SIZE || (uint8_t)(hdr[0] + hdr[1] + hdr[2] + hdr[3]) != 0xff) {
+        c->bad_frames++;
+        return;
+    }
+    len = (uint16_t)((hdr[1] >> 4) | (hdr[2] << 4));
+    crc = (hdr[0] >> 6) & 0x01;
+    if (c->frame_len != H5_HDR_SIZE + len + (crc ? 2 : 0)) {
+        c->bad_frames++;
+        return;
+    }
+    if (crc) {
+        uint16_t want = h5_crc_to_wire(h5_crc_update_buf(H5_CRC_SEED, c->frame, H5_HDR_SIZE + len));
+        if (want != ((c->frame[H5_HDR_SIZE + len] << 8) | c->frame[H5_HDR_SIZE + len + 1])) {
+            c->bad_frames++;
+            return;
+        }
+    }
+
+    if (c->host_ack != ((hdr[0] >> 3) & 0x07)) {
+        c->host_ack = (hdr[0] >> 3) & 0x07;
+        c->ack_ns = now_ns();
+    }
+    if ((hdr[0] >> 7) & 0x01) {
+        c->ack_due = true;
+        if ((hdr[0] & 0x07) != c->rx_seq) {
+            c->duplicates++;
+            return;
+        }
+        c->rx_seq = (c->rx_seq + 1) & 0x07;
+    } else if ((hdr[1] & 0x0f) == H5_ACK_PKT && len == 0) {
+        c->pure_acks++;
+    }
+
+    switch (hdr[1] & 0x0f) {
+        case H5_LINK_CTL_PKT:
+            stand_in_link_ctl(c, hdr + H5_HDR_SIZE, len);
+            break;
+        case H5_ACL_PKT: {
+            const uint8_t *acl = hdr + H5_HDR_SIZE;
+            uint32_t index = 0;
+
+            if (len >= HCI_ACL_HDR_SIZE + sizeof(index)) {
+                memcpy(&index, acl + HCI_ACL_HDR_SIZE, sizeof(index));
+            }
+            if (index != c->acl_packets) {
+                c->bad_frames++;
+            }
+            c->acl_packets++;
+            c->acl_bytes += len;
+            c->completed++;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/* Takes a chunk off the UART, then acks it: on a credits event if our window is open, empty otherwise */
+static void stand_in_input(stand_in_t *c, const uint8_t *in, size_t in_len)
+{
+    size_t pos = 0;
+
+    while (pos < in_len) {
+        tH5_SLIP_STATUS status;
+        size_t used = 0;
+
+        if (!c->in_frame) {
+            if (in[pos++] == H5_SLIP_DELIM) {
+                c->in_frame = true;
+                c->frame_len = 0;
+                h5_slip_decoder_reset(&c->dec);
+            }
+            continue;
+        }
+        c->frame_len += h5_slip_decode(&c->dec, in + pos, in_len - pos, &used, c->frame + c->frame_len,
+                                       sizeof(c->frame) - c->frame_len, &status);
+        pos += used;
+        if (status == H5_SLIP_AT_DELIM) {
+            pos++;
+            if (c->frame_len) {
+                stand_in_frame(c);
+            }
+            c->frame_len = 0;
+            h5_slip_decoder_reset(&c->dec);
+        } else if (status == H5_SLIP_BAD_ESC || c->frame_len == sizeof(c->frame)) {
+            c->bad_frames++;
+            c->in_frame = false;
+        }
+    }
+
+    if (c->completed && ((c->tx_seq - c->host_ack) & 0x07) < c->window) {
+        uint8_t nocp[7] = {HCI_NUM_OF_CMP_PKTS_EVT, 5, 1, BENCH_ACL_HANDLE & 0xff, BENCH_ACL_HANDLE >> 8};
+
+        nocp[5] = (uint8_t)c->completed;
+        nocp[6] = (uint8_t)(c->completed >> 8);
+        c->completed = 0;
+        stand_in_send(c, H5_EVENT_PKT, true, nocp, sizeof(nocp));
+    } else if (c->ack_due) {
+        stand_in_send(c, H5_ACK_PKT, false, NULL, 0);
+    }
+
+    pthread_mutex_lock(&g_lock);
+    g_delivered = c->acl_packets;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void *stand_in_thread(void *arg)
+{
+    stand_in_t *c = arg;
+    uint8_t buf[4096];
+
+    while (g_running) {
+        struct pollfd pfd = {.fd = c->fd, .events = POLLIN};
+        ssize_t n;
+
+        if (poll(&pfd, 1, BENCH_POLL_MS) > 0) {
+            n = read(c->fd, buf, sizeof(buf));
+            if (n > 0) {
+                stand_in_input(c, buf, (size_t)n);
+            }
+        }
+        stand_in_resend(c);
+    }
+    return NULL;
+}
+
+/******************************************************************************
+**  Run
+******************************************************************************/
+/* Waits until *value reaches want, 0 on time out */
+static int wait_for(volatile uint32_t *value, uint32_t want)
+{
+    struct timespec deadline;
+    int ok = 1;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += BENCH_TIMEOUT_S;
+    pthread_mutex_lock(&g_lock);
+    while (*value < want && ok) {
+        ok = pthread_cond_timedwait(&g_cond, &g_lock, &deadline) == 0;
+    }
+    ok = *value >= want;
+    pthread_mutex_unlock(&g_lock);
+    return ok;
+}
+
+static int run(stand_in_t *c, uint32_t packets, uint16_t acl_len, uint32_t credits, bool skbs)
+{
+    static uint8_t acl[HCI_ACL_HDR_SIZE + H5_MAX_PAYLOAD];
+    hci_h5_callbacks_t callbacks = {bench_transmit, bench_data_ready, skbs ? bench_recv_skbs : NULL};
+    struct termios tio;
+    pthread_t controller;
+    long long start;
+    long long ns;
+    uint32_t writes;
+    uint64_t write_bytes;
+    uint32_t i;
+    int started;
+
+    cfmakeraw(&tio);
+    CHECK(openpty(&c->fd, &g_host_fd, NULL, &tio, NULL) == 0, "openpty: %s", strerror(errno));
+    g_h5 = hci_get_h5_int_interface();
+    set_h5_log_enable(0);
+    g_h5->h5_int_init(&callbacks);
+    CHECK(pthread_create(&g_reader, NULL, host_reader, NULL) == 0, "host reader");
+    CHECK(pthread_create(&controller, NULL, stand_in_thread, c) == 0, "controller");
+
+    // link establishment, then steady state retransmission as after the firmware download
+    g_h5->h5_send_sync_cmd(HCI_VSC_H5_INIT, NULL, 0);
+    pthread_mutex_lock(&g_lock);
+    while (g_init_status < 0) {
+        pthread_cond_wait(&g_cond, &g_lock);
+    }
+    started = g_init_status == 0;
+    g_writes = 0;
+    g_write_bytes = 0;
+    g_credits = credits;
+    pthread_mutex_unlock(&g_lock);
+    set_h5_init_datatrans_flag(0);
+    g_lossy = 1;
+
+    if (started) {
+        acl[0] = BENCH_ACL_HANDLE & 0xff;
+        acl[1] = (BENCH_ACL_HANDLE >> 8) | 0x20;
+        acl[2] = (uint8_t)acl_len;
+        acl[3] = (uint8_t)(acl_len >> 8);
+        for (i = HCI_ACL_HDR_SIZE; i < HCI_ACL_HDR_SIZE + acl_len; i++) {
+            acl[i] = (uint8_t)(i * 7);
+        }
+        start = now_ns();
+        for (i = 0; i < packets; i++) {
+            pthread_mutex_lock(&g_lock);
+            while (g_credits == 0) {
+                pthread_cond_wait(&g_cond, &g_lock);
+            }
+            g_credits--;
+            pthread_mutex_unlock(&g_lock);
+            memcpy(acl + HCI_ACL_HDR_SIZE, &i, sizeof(i));
+            g_h5->h5_send_acl_data(DATA_TYPE_ACL, acl, HCI_ACL_HDR_SIZE + acl_len);
+        }
+        started = wait_for(&g_delivered, packets);
+        ns = now_ns() - start;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    writes = g_writes;
+    write_bytes = g_write_bytes;
+    pthread_mutex_unlock(&g_lock);
+    g_running = 0;
+    pthread_join(g_reader, NULL);
+    pthread_join(controller, NULL);
+    g_h5->h5_int_cleanup();
+    close(g_host_fd);
+    close(c->fd);
+
+    CHECK(g_init_status == 0, "link establishment gave status %d", g_init_status);
+    CHECK(started, "controller took %u of %u packets", c->acl_packets, packets);
+    CHECK(c->bad_frames == g_to_controller.corrupted, "%u bad frames, %u corrupted", c->bad_frames,
+          g_to_controller.corrupted);
+    CHECK(!skbs || g_passed_up_on_reader == g_passed_up, "%u of %u skbs passed up off the reader thread",
+          g_passed_up - g_passed_up_on_reader, g_passed_up);
+
+    printf("%u acl packets of %u bytes, window %u, %u credits\n", packets, acl_len, c->window, credits);
+    printf("writes      %8u, %.3f per acl packet, %.0f bytes each\n", writes, (double)writes / packets,
+           (double)write_bytes / writes);
+    printf("empty acks  %8u for %u controller packets\n", c->pure_acks, c->rel_sent);
+    printf("line        %8u frames to the controller, %u lost %u corrupted\n", g_to_controller.frames,
+           g_to_controller.dropped, g_to_controller.corrupted);
+    printf("            %8u frames to the host, %u lost %u corrupted\n", g_to_host.frames, g_to_host.dropped,
+           g_to_host.corrupted);
+    printf("resent      %8u seen by the controller, %u by the host\n", c->duplicates, c->rel_resent);
+    printf("passed up   %8u, %u of them on the reader thread\n", g_passed_up, g_passed_up_on_reader);
+    printf("goodput     %8.1f MB/s\n", (double)c->acl_bytes * NSEC_PER_SEC / ns / (1024 * 1024));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static stand_in_t controller;
+    uint32_t packets = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : BENCH_PACKETS;
+    uint32_t acl_len = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : BENCH_ACL_LEN;
+    uint32_t window = (argc > 3) ? (uint32_t)strtoul(argv[3], NULL, 0) : BENCH_WINDOW;
+    uint32_t credits = (argc > 4) ? (uint32_t)strtoul(argv[4], NULL, 0) : BENCH_CREDITS;
+    bool skbs = (argc > 5) ? strtoul(argv[5], NULL, 0) != 0 : true;
+    double drop = (argc > 6) ? strtod(argv[6], NULL) : 0;
+    double corrupt = (argc > 7) ? strtod(argv[7], NULL) : 0;
+    int failures;
+
+    packets = packets ? packets : 1;
+    acl_len = (acl_len < sizeof(uint32_t)) ? sizeof(uint32_t) : acl_len;
+    acl_len = (acl_len > H5_MAX_PAYLOAD - HCI_ACL_HDR_SIZE) ? H5_MAX_PAYLOAD - HCI_ACL_HDR_SIZE : acl_len;
+    controller.window = (window < 1 || window > 7) ? BENCH_WINDOW : (uint8_t)window;
+    controller.dic = true;
+    credits = credits ? credits : 1;
+    drop = (drop < 0) ? 0 : (drop > 50 ? 50 : drop);
+    corrupt = (corrupt < 0) ? 0 : (corrupt > 50 ? 50 : corrupt);
+    g_to_controller.drop_ppm = g_to_host.drop_ppm = (uint32_t)(drop * PPM_PER_PERCENT);
+    g_to_controller.corrupt_ppm = g_to_host.corrupt_ppm = (uint32_t)(corrupt * PPM_PER_PERCENT);
+    g_to_controller.seed = 0x12345678;
+    g_to_host.seed = 0x9abcdef1;
+
+    failures = run(&controller, packets, (uint16_t)acl_len, credits, skbs);
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
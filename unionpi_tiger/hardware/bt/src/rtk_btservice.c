@@ -55,6 +55,7 @@
 #include "upio.h"
 #include "rtk_parse.h"
 #include "rtk_btservice.h"
+#include "rtk_timer.h"
 
 #include "bt_vendor_lib.h"
 
@@ -74,8 +75,6 @@
 
 #define HCICMD_REPLY_TIMEOUT_VALUE 8000 // ms
 
-typedef void (*tTIMER_HANDLE_CBACK)(union sigval sigval_value);
-
 typedef struct Rtk_Btservice_Info {
     int socketfd;
     int sig_fd[2];
@@ -86,7 +85,7 @@ typedef struct Rtk_Btservice_Info {
     int autopair_fd;
     sem_t cmdqueue_sem;
     sem_t cmdsend_sem;
-    timer_t timer_hcicmd_reply;
+    RTK_TIMER *timer_hcicmd_reply;
     RT_LIST_HEAD cmdqueue_list;
     pthread_mutex_t cmdqueue_mutex;
     volatile uint8_t cmdqueue_thread_running;
@@ -105,70 +104,6 @@ typedef struct Rtk_Queue_Data {
 typedef void (*tINT_CMD_CBACK)(void *p_mem);
 static Rtk_Btservice_Info *rtk_btservice = NULL;
 static void Rtk_Service_Send_Hwerror_Event(void);
-static timer_t OsAllocateTimer(tTIMER_HANDLE_CBACK timer_callback)
-{
-    struct sigevent sigev;
-    timer_t timerid;
-
-    (void)memset_s(&sigev, sizeof(struct sigevent), 0, sizeof(struct sigevent));
-    // Create the POSIX timer to generate signo
-    sigev.sigev_notify = SIGEV_THREAD;
-    sigev.sigev_notify_function = timer_callback;
-    sigev.sigev_value.sival_ptr = &timerid;
-
-    HILOGD("OsAllocateTimer bt_service sigev.sigev_notify_thread_id = syscall(__NR_gettid)!");
-    // Create the Timer using timer_create signal
-
-    if (timer_create(CLOCK_REALTIME, &sigev, &timerid) == 0) {
-        return timerid;
-    } else {
-        HILOGE("timer_create error!");
-        return (timer_t)-1;
-    }
-}
-
-static int OsFreeTimer(timer_t timerid)
-{
-    int ret = 0;
-    ret = timer_delete(timerid);
-    if (ret != 0) {
-        HILOGE("timer_delete fail with errno(%d)", errno);
-    }
-
-    return ret;
-}
-
-static int OsStartTimer(timer_t timerid, int msec, int mode)
-{
-    struct itimerspec itval;
-
-#define TIMER_MEC_1000 1000
-    itval.it_value.tv_sec = msec / TIMER_MEC_1000;
-    itval.it_value.tv_nsec = (long)(msec % TIMER_MEC_1000) * (1000000L);
-
-    if (mode == 1) {
-        itval.it_interval.tv_sec = itval.it_value.tv_sec;
-        itval.it_interval.tv_nsec = itval.it_value.tv_nsec;
-    } else {
-        itval.it_interval.tv_sec = 0;
-        itval.it_interval.tv_nsec = 0;
-    }
-
-    // Set the Timer when to expire through timer_settime
-
-    if (timer_settime(timerid, 0, &itval, NULL) != 0) {
-        HILOGE("time_settime error!");
-        return -1;
-    }
-
-    return 0;
-}
-
-static int OsStopTimer(timer_t timerid)
-{
-    return OsStartTimer(timerid, 0, 0);
-}
-
 static void init_cmdqueue_hash(Rtk_Btservice_Info *rtk_info)
 {
     RT_LIST_HEAD *head = &rtk_info->cmdqueue_list;
@@ -200,32 +135,33 @@ static void flush_cmdqueue_hash(Rtk_Btservice_Info *rtk_info)
     pthread_mutex_unlock(&rtk_info->cmdqueue_mutex);
 }
 
-static void hcicmd_reply_timeout_handler(void) // (union sigval sigev_value)
+static void hcicmd_reply_timeout_handler(union sigval sigev_value)
 {
+    RTK_UNUSED(sigev_value);
     Rtk_Service_Send_Hwerror_Event();
 }
 
 static int hcicmd_alloc_reply_timer(void)
 {
     // Create and set the timer when to expire
-    rtk_btservice->timer_hcicmd_reply = OsAllocateTimer(hcicmd_reply_timeout_handler);
+    rtk_btservice->timer_hcicmd_reply = RtkTimerAllocate(hcicmd_reply_timeout_handler, (union sigval){0});
 
     return 0;
 }
 
 static int hcicmd_free_reply_timer(void)
 {
-    return OsFreeTimer(rtk_btservice->timer_hcicmd_reply);
+    return RtkTimerFree(rtk_btservice->timer_hcicmd_reply);
 }
 
 static int hcicmd_start_reply_timer(void)
 {
-    return OsStartTimer(rtk_btservice->timer_hcicmd_reply, HCICMD_REPLY_TIMEOUT_VALUE, 1);
+    return RtkTimerStart(rtk_btservice->timer_hcicmd_reply, HCICMD_REPLY_TIMEOUT_VALUE, true);
 }
 
 static int hcicmd_stop_reply_timer(void)
 {
-    return OsStopTimer(rtk_btservice->timer_hcicmd_reply);
+    return RtkTimerStop(rtk_btservice->timer_hcicmd_reply);
 }
 
 static void Rtk_Client_Cmd_Cback(HC_BT_HDR *p_mem)
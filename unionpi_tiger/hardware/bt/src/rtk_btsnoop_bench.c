@@ -0,0 +1,425 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      rtk_btsnoop_bench.c
+ *
+ *  Description:   Has threads capture ACL packets the way userial_vendor does
+ *                 into rotating btsnoop files in [dir], as fast as they can
+ *                 and then at a steady rate that must drop nothing. The files
+ *                 are read back and checked: every record whole and in order,
+ *                 none over the size limit, records plus drops the packets
+ *                 captured. Then each mode runs flat out for [seconds]:
+ *                 logging off, the eight write() calls per packet capture
+ *                 made before, and the capture ring.
+ *
+ *                     rtk_btsnoop_bench [dir] [seconds] [threads]
+ *
+ ******************************************************************************/
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bt_hci_bdroid.h"
+#include "rtk_btsnoop_net.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define BENCH_DIR "/data/local/tmp"
+#define BENCH_FILE "btsnoop_bench.cfa"
+#define BENCH_SECONDS 2
+#define BENCH_THREADS 2
+#define BENCH_CHECK_PACKETS 50000 /* per thread */
+#define BENCH_PACED_RATE 10000    /* packets/s per thread, ten times the UART at 1.5 Mbit/s */
+#define BENCH_PACE_EVERY 16
+#define BENCH_CHECK_FILE_SIZE (4 * 1024 * 1024)
+#define BENCH_RUN_FILE_SIZE (64 * 1024 * 1024)
+#define BENCH_ACL_LEN 1021
+#define BENCH_PKT_LEN (4 + BENCH_ACL_LEN)
+#define BENCH_RECORD_LEN (24 + 1 + BENCH_PKT_LEN)
+#define BTSNOOP_EPOCH_DELTA 0x00dcddb30f2f8000ULL
+#define NSEC_PER_SEC 1000000000LL
+
+#define CHECK(cond, ...)                                                                                               \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("check failed at %s:%d: ", __FILE__, __LINE__);                                                   \
+            printf(__VA_ARGS__);                                                                                       \
+            printf("\n");                                                                                              \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+enum {
+    MODE_OFF,
+    MODE_INLINE,
+    MODE_RING,
+};
+
+static const char *g_mode_names[] = {"logging off", "inline writes", "capture ring"};
+
+typedef struct {
+    int id;
+    int mode;
+    uint32_t count; /* 0 runs until g_stop */
+    uint32_t rate;  /* packets per second, 0 as fast as it can */
+    uint64_t sent;
+} bench_thread_t;
+
+static _Atomic int g_stop;
+static char g_dir[256] = BENCH_DIR;
+
+/******************************************************************************
+**  rtk_btsnoop_write_packet() before the ring, eight writes under a lock
+******************************************************************************/
+static pthread_mutex_t g_inline_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_inline_fd = -1;
+
+static void inline_write(const void *data, size_t length)
+{
+    if (g_inline_fd != -1) {
+        write(g_inline_fd, data, length);
+    }
+}
+
+static void inline_capture(const HC_BT_HDR *p_buf, bool is_rcvd)
+{
+    const uint8_t *packet = (const uint8_t *)(p_buf + 1) + p_buf->offset;
+    uint8_t type = 2;
+    int length_he = (packet[3] << 8) + packet[2] + 5;
+    int length, flags, drops = 0;
+    struct timeval tv;
+
+    pthread_mutex_lock(&g_inline_lock);
+    gettimeofday(&tv, NULL);
+    uint64_t timestamp = tv.tv_sec * 1000000LL + tv.tv_usec + BTSNOOP_EPOCH_DELTA;
+    uint32_t time_hi = htonl(timestamp >> 32);
+    uint32_t time_lo = htonl(timestamp & 0xFFFFFFFF);
+
+    length = htonl(length_he);
+    flags = htonl(is_rcvd);
+    drops = htonl(drops);
+    inline_write(&length, 4);
+    inline_write(&length, 4);
+    inline_write(&flags, 4);
+    inline_write(&drops, 4);
+    inline_write(&time_hi, 4);
+    inline_write(&time_lo, 4);
+    inline_write(&type, 1);
+    inline_write(packet, length_he - 1);
+    pthread_mutex_unlock(&g_inline_lock);
+}
+
+/******************************************************************************
+**  Capturing threads
+******************************************************************************/
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* ACL packet 'seq' of thread 'id', the payload a pattern the check can recompute */
+static void make_packet(HC_BT_HDR *p_buf, const uint8_t *pattern, int id, uint32_t seq)
+{
+    uint8_t *p = (uint8_t *)(p_buf + 1);
+
+    p_buf->event = (seq & 1) ? MSG_HC_TO_STACK_HCI_ACL : MSG_STACK_TO_HC_HCI_ACL;
+    p_buf->offset = 0;
+    p_buf->len = BENCH_PKT_LEN;
+    p_buf->layer_specific = 0;
+    p[0] = 0x01;
+    p[1] = (uint8_t)id;
+    p[2] = BENCH_ACL_LEN & 0xFF;
+    p[3] = BENCH_ACL_LEN >> 8;
+    memcpy(p + 4, pattern + (seq & 0xFF), BENCH_ACL_LEN);
+    memcpy(p + 4, &seq, sizeof(seq));
+}
+
+static void *bench_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+    uint8_t buf[sizeof(HC_BT_HDR) + BENCH_PKT_LEN];
+    uint8_t pattern[BENCH_ACL_LEN + 256];
+    HC_BT_HDR *p_buf = (HC_BT_HDR *)buf;
+    long long start = now_ns();
+    uint32_t seq;
+
+    for (seq = 0; seq < sizeof(pattern); seq++) {
+        pattern[seq] = (uint8_t)(seq * 7 + t->id);
+    }
+    for (seq = 0; t->count ? seq < t->count : !g_stop; seq++) {
+        if (t->rate && seq % BENCH_PACE_EVERY == 0) {
+            long long wait = start + seq * NSEC_PER_SEC / t->rate - now_ns();
+            if (wait > 0) {
+                struct timespec ts = {wait / NSEC_PER_SEC, wait % NSEC_PER_SEC};
+                nanosleep(&ts, NULL);
+            }
+        }
+        make_packet(p_buf, pattern, t->id, seq);
+        if (t->mode == MODE_INLINE) {
+            inline_capture(p_buf, seq & 1);
+        } else {
+            rtk_btsnoop_capture(p_buf, seq & 1);
+        }
+    }
+    t->sent = seq;
+    return NULL;
+}
+
+static uint64_t run_threads(int mode, uint32_t threads, uint32_t count, uint32_t rate, uint32_t seconds)
+{
+    pthread_t tid[64];
+    bench_thread_t t[64];
+    uint64_t sent = 0;
+    uint32_t i;
+
+    g_stop = 0;
+    for (i = 0; i < threads; i++) {
+        t[i].id = (int)i;
+        t[i].mode = mode;
+        t[i].count = count;
+        t[i].rate = rate;
+        t[i].sent = 0;
+        pthread_create(&tid[i], NULL, bench_thread, &t[i]);
+    }
+    if (!count) {
+        sleep(seconds);
+        g_stop = 1;
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+        sent += t[i].sent;
+    }
+    return sent;
+}
+
+/******************************************************************************
+**  Reading the files back
+******************************************************************************/
+static void file_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", g_dir, name);
+}
+
+static int is_bench_file(const char *name)
+{
+    return strncmp(name, BENCH_FILE, strlen(BENCH_FILE)) == 0;
+}
+
+static void remove_files(void)
+{
+    DIR *dir = opendir(g_dir);
+    struct dirent *de;
+    char path[512];
+
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if (is_bench_file(de->d_name)) {
+            file_path(path, sizeof(path), de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+}
+
+/* Checks one file, adds its records per thread to 'records', the largest drops field to 'drops' */
+static int check_file(const char *path, uint32_t threads, uint64_t *records, uint32_t *drops)
+{
+    static uint8_t data[BENCH_CHECK_FILE_SIZE];
+    int64_t last_seq[64];
+    uint8_t pattern[BENCH_ACL_LEN + 256];
+    uint32_t last_drops = 0;
+    size_t size, pos;
+    uint32_t i;
+    FILE *fp = fopen(path, "rb");
+
+    CHECK(fp != NULL, "cannot open %s", path);
+    size = fread(data, 1, sizeof(data), fp);
+    CHECK(fgetc(fp) == EOF, "%s is larger than %d bytes", path, BENCH_CHECK_FILE_SIZE);
+    fclose(fp);
+    CHECK(size >= 16 && memcmp(data, "btsnoop\0\0\0\0\1\0\0\x3\xea", 16) == 0, "%s has no btsnoop header", path);
+    for (i = 0; i < threads; i++) {
+        last_seq[i] = -1;
+    }
+
+    for (pos = 16; pos < size; pos += BENCH_RECORD_LEN) {
+        uint32_t hdr[6];
+        const uint8_t *p = data + pos + 24;
+        uint32_t seq;
+        int id;
+
+        CHECK(size - pos >= BENCH_RECORD_LEN, "%s ends in a partial record", path);
+        memcpy(hdr, data + pos, sizeof(hdr));
+        CHECK(ntohl(hdr[0]) == BENCH_PKT_LEN + 1 && ntohl(hdr[1]) == BENCH_PKT_LEN + 1, "bad record length");
+        CHECK(p[0] == 2 && p[1] == 0x01, "not an ACL record");
+        CHECK(ntohl(hdr[3]) >= last_drops, "drops went down");
+        last_drops = ntohl(hdr[3]);
+        id = p[2];
+        CHECK(id < (int)threads, "bad thread %d", id);
+        memcpy(&seq, p + 5, sizeof(seq));
+        CHECK((int64_t)seq > last_seq[id], "thread %d record %u after %lld", id, seq, (long long)last_seq[id]);
+        CHECK(ntohl(hdr[2]) == (seq & 1), "bad direction");
+        last_seq[id] = seq;
+        for (i = 0; i < sizeof(pattern); i++) {
+            pattern[i] = (uint8_t)(i * 7 + id);
+        }
+        CHECK(memcmp(p + 5 + 4, pattern + (seq & 0xFF) + 4, BENCH_ACL_LEN - 4) == 0, "bad payload");
+        records[id]++;
+    }
+    *drops = last_drops > *drops ? last_drops : *drops;
+    return 0;
+}
+
+/* Capture with rotation into small files and read everything back */
+static int check_files(uint32_t threads, uint32_t rate)
+{
+    uint64_t records[64] = {0};
+    uint64_t total = 0;
+    uint32_t drops = 0;
+    uint32_t files = 0;
+    RTK_BTSNOOP_STATS stats;
+    DIR *dir;
+    struct dirent *de;
+    char path[512];
+    uint32_t i;
+
+    remove_files();
+    set_rtk_btsnoop_save_log(true);
+    set_rtk_btsnoop_max_file_size(BENCH_CHECK_FILE_SIZE);
+    rtk_btsnoop_open();
+    run_threads(MODE_RING, threads, BENCH_CHECK_PACKETS, rate, 0);
+    rtk_btsnoop_close();
+    rtk_btsnoop_get_stats(&stats);
+
+    dir = opendir(g_dir);
+    CHECK(dir != NULL, "cannot open %s", g_dir);
+    while ((de = readdir(dir)) != NULL) {
+        if (is_bench_file(de->d_name)) {
+            file_path(path, sizeof(path), de->d_name);
+            if (check_file(path, threads, records, &drops)) {
+                closedir(dir);
+                return 1;
+            }
+            files++;
+        }
+    }
+    closedir(dir);
+    remove_files();
+
+    for (i = 0; i < threads; i++) {
+        total += records[i];
+    }
+    printf("%s: %u threads x %u packets, %u files, %llu records, %llu dropped, %llu writes, %llu rotations\n",
+           rate ? "paced" : "flat out", threads, BENCH_CHECK_PACKETS, files, (unsigned long long)total, (unsigned long long)stats.Dropped,
+           (unsigned long long)stats.Writes, (unsigned long long)stats.Rotations);
+    CHECK(total == stats.Records, "%llu records in the files, %llu written", (unsigned long long)total,
+          (unsigned long long)stats.Records);
+    CHECK(total + stats.Dropped == (uint64_t)threads * BENCH_CHECK_PACKETS, "records and drops do not add up");
+    CHECK(drops <= stats.Dropped, "drops field %u over %llu dropped", drops, (unsigned long long)stats.Dropped);
+    CHECK(files == stats.Rotations + 1, "%u files for %llu rotations", files, (unsigned long long)stats.Rotations);
+    CHECK(stats.Writes < total, "a write per record");
+    CHECK(!rate || stats.Dropped == 0, "dropped at %u packets/s", rate * threads);
+    return 0;
+}
+
+/******************************************************************************
+**  Packets per second
+******************************************************************************/
+static int run_mode(int mode, uint32_t threads, uint32_t seconds, double *pps)
+{
+    RTK_BTSNOOP_STATS stats = {0};
+    char path[512];
+    long long start;
+    uint64_t sent;
+
+    remove_files();
+    file_path(path, sizeof(path), BENCH_FILE);
+    if (mode == MODE_INLINE) {
+        g_inline_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        CHECK(g_inline_fd != -1, "cannot open %s", path);
+    } else if (mode == MODE_RING) {
+        set_rtk_btsnoop_save_log(false);
+        set_rtk_btsnoop_max_file_size(BENCH_RUN_FILE_SIZE);
+        rtk_btsnoop_open();
+    }
+
+    start = now_ns();
+    sent = run_threads(mode, threads, 0, 0, seconds);
+    *pps = sent * (double)NSEC_PER_SEC / (now_ns() - start);
+
+    if (mode == MODE_INLINE) {
+        close(g_inline_fd);
+        g_inline_fd = -1;
+    } else if (mode == MODE_RING) {
+        rtk_btsnoop_close();
+        rtk_btsnoop_get_stats(&stats);
+    }
+    remove_files();
+
+    printf("%-14s %10.0f packets/s", g_mode_names[mode], *pps);
+    if (mode == MODE_RING) {
+        printf(", %llu written in %llu writes, %llu dropped (%.1f%%)", (unsigned long long)stats.Records,
+               (unsigned long long)stats.Writes, (unsigned long long)stats.Dropped,
+               100.0 * stats.Dropped / (sent ? sent : 1));
+        CHECK(stats.Records + stats.Dropped == sent, "records and drops do not add up");
+    }
+    printf("\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : BENCH_SECONDS;
+    uint32_t threads = (argc > 3) ? (uint32_t)strtoul(argv[3], NULL, 0) : BENCH_THREADS;
+    double pps[3] = {0};
+    int failures = 0;
+    int mode;
+
+    if (argc > 1) {
+        snprintf(g_dir, sizeof(g_dir), "%s", argv[1]);
+    }
+    threads = (threads < 1) ? 1 : (threads > 64 ? 64 : threads);
+    snprintf(get_rtk_btsnoop_path(), 1024, "%s/%s", g_dir, BENCH_FILE);
+
+    failures += check_files(threads, 0);
+    failures += check_files(threads, BENCH_PACED_RATE);
+    if (!failures && seconds) {
+        printf("%u threads, %u seconds, %d byte ACL packets\n", threads, seconds, BENCH_ACL_LEN);
+        for (mode = MODE_OFF; mode <= MODE_RING && !failures; mode++) {
+            failures += run_mode(mode, threads, seconds, &pps[mode]);
+        }
+        if (!failures) {
+            printf("inline writes %.1f%% of logging off, capture ring %.1f%%\n", 100.0 * pps[MODE_INLINE] / pps[0],
+                   100.0 * pps[MODE_RING] / pps[0]);
+        }
+    }
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
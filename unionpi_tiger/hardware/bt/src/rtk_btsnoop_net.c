@@ -16,6 +16,8 @@
  *
  ******************************************************************************/
 #define LOG_TAG "rtk_btsnoop_net"
+#include <stdatomic.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "bt_vendor_rtk.h"
 #include "rtk_btsnoop_net.h"
@@ -38,17 +40,44 @@
 #define HCI_SCODATA_PKT 0x03
 #define HCI_EVENT_PKT 0x04
 
+/*
+ * Records are copied into a ring as they are captured and a writer thread
+ * takes them to the file and the net dump listener. The ring is shared by
+ * all capturing threads, a full ring drops the record and counts it in the
+ * drops field of the next one.
+ */
+#define BTSNOOP_RING_SIZE (1U << 20)
+#define BTSNOOP_RING_MASK (BTSNOOP_RING_SIZE - 1)
+#define BTSNOOP_SLOT_MAX (BTSNOOP_RING_SIZE / 4)
+#define BTSNOOP_WAKE_LEVEL (BTSNOOP_RING_SIZE / 4) // wake the writer before the flush interval is up
+#define BTSNOOP_FLUSH_MS 100
+#define BTSNOOP_BATCH_RECORDS 256
+#define BTSNOOP_FILE_HDR_LEN 16
+#define BTSNOOP_RECORD_HDR_LEN 24
+#define BTSNOOP_SLOT_ALIGN(n) (((n) + 7U) & ~7U)
+
+#define BTSNOOP_SINK_FILE 0x01
+#define BTSNOOP_SINK_NET 0x02
+
+typedef struct {
+    _Atomic uint32_t Size; // of the slot, 0 until the record in it is complete
+    uint32_t Sinks;        // 0 for the padding up to the end of the ring
+    // btsnoop record: length, length, flags, drops, time, type and packet
+} BTSNOOP_SLOT;
+
 unsigned int rtkbt_h5logfilter = 0x01;
 bool rtk_btsnoop_dump = false;
 bool rtk_btsnoop_net_dump = false;
 bool rtk_btsnoop_save_log = false;
 char rtk_btsnoop_path[1024] = {'\0'};
-static pthread_mutex_t btsnoop_log_lock;
+static pthread_mutex_t btsnoop_log_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void rtk_safe_close_(int *fd);
 static void *rtk_listen_fn_(void *context);
+static void *rtk_writer_fn_(void *context);
 
 static const char *RTK_LISTEN_THREAD_NAME_ = "rtk_btsnoop_net";
+static const char *RTK_WRITER_THREAD_NAME_ = "rtk_btsnoop_wr";
 static const int RTK_LOCALHOST_ = 0xC0A80AE2; // 192.168.10.226
 static const int RTK_LISTEN_PORT_ = 8872;
 
@@ -60,8 +89,31 @@ static bool rtk_listen_thread_valid_ = false;
 static pthread_mutex_t rtk_client_socket_lock_ = PTHREAD_MUTEX_INITIALIZER;
 static int rtk_listen_socket_ = -1;
 
-// File descriptor for btsnoop file.
+// File descriptor for btsnoop file, the size and counters under btsnoop_log_lock.
 static int hci_btsnoop_fd = -1;
+static uint64_t hci_btsnoop_file_size = 0;
+static uint64_t rtk_btsnoop_max_file_size = 0;
+static RTK_BTSNOOP_STATS rtk_btsnoop_stats;
+
+static struct {
+    uint8_t *Buf;
+    _Atomic bool Running;
+    _Atomic uint32_t Busy;   // capturing threads that may still write to Buf
+    _Atomic uint64_t Head;   // bytes reserved since the ring started
+    _Atomic uint64_t Tail;   // bytes the writer is done with
+    _Atomic uint64_t Dropped;
+    uint32_t LastDrops;      // writer only, the drops field never goes down
+    pthread_mutex_t Lock;
+    pthread_cond_t Wake;     // writer: records waiting or stop
+    pthread_cond_t Drained;  // writer went through the ring
+    pthread_t Thread;
+    int Users;               // the file and the net dump
+    bool Flush;
+    bool Stop;
+} btsnoop_ring = {
+    .Lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 // Epoch in microseconds since 01/01/0000.
 static const uint64_t BTSNOOP_EPOCH_DELTA = 0x00dcddb30f2f8000ULL;
 
@@ -76,9 +128,14 @@ void set_rtk_btsnoop_save_log(bool btsnoop_save_log)
     rtk_btsnoop_save_log = btsnoop_save_log;
 }
 
+void set_rtk_btsnoop_max_file_size(uint64_t max_file_size)
+{
+    rtk_btsnoop_max_file_size = max_file_size;
+}
+
 void set_rtk_btsnoop_net_dump(bool btsnoop_net_dump)
 {
-    rtk_btsnoop_dump = btsnoop_net_dump;
+    rtk_btsnoop_net_dump = btsnoop_net_dump;
 }
 
 bool get_rtk_btsnoop_net_dump(void)
@@ -114,19 +171,101 @@ static uint64_t rtk_btsnoop_timestamp(void)
     return timestamp;
 }
 
-void rtk_btsnoop_open(void)
+static inline BTSNOOP_SLOT *rtk_btsnoop_slot(uint64_t pos)
+{
+    return (BTSNOOP_SLOT *)(btsnoop_ring.Buf + (pos & BTSNOOP_RING_MASK));
+}
+
+static int rtk_btsnoop_ring_start(void)
+{
+    pthread_mutex_lock(&btsnoop_ring.Lock);
+    if (btsnoop_ring.Users++ > 0) {
+        pthread_mutex_unlock(&btsnoop_ring.Lock);
+        return 0;
+    }
+
+    btsnoop_ring.Buf = calloc(1, BTSNOOP_RING_SIZE);
+    if (btsnoop_ring.Buf == NULL) {
+        HILOGE("%s unable to allocate the capture ring", __func__);
+        btsnoop_ring.Users = 0;
+        pthread_mutex_unlock(&btsnoop_ring.Lock);
+        return -1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&btsnoop_ring.Wake, &attr);
+    pthread_cond_init(&btsnoop_ring.Drained, NULL);
+    pthread_condattr_destroy(&attr);
+
+    atomic_store(&btsnoop_ring.Head, 0);
+    atomic_store(&btsnoop_ring.Tail, 0);
+    atomic_store(&btsnoop_ring.Dropped, 0);
+    btsnoop_ring.LastDrops = 0;
+    btsnoop_ring.Flush = false;
+    btsnoop_ring.Stop = false;
+    if (pthread_create(&btsnoop_ring.Thread, NULL, rtk_writer_fn_, NULL) != 0) {
+        HILOGE("%s pthread_create failed: %s", __func__, strerror(errno));
+        pthread_cond_destroy(&btsnoop_ring.Wake);
+        pthread_cond_destroy(&btsnoop_ring.Drained);
+        free(btsnoop_ring.Buf);
+        btsnoop_ring.Buf = NULL;
+        btsnoop_ring.Users = 0;
+        pthread_mutex_unlock(&btsnoop_ring.Lock);
+        return -1;
+    }
+    atomic_store(&btsnoop_ring.Running, true);
+    pthread_mutex_unlock(&btsnoop_ring.Lock);
+    return 0;
+}
+
+// Takes what was captured so far to the sinks still open, the last user stops the writer
+static void rtk_btsnoop_ring_stop(void)
+{
+    pthread_mutex_lock(&btsnoop_ring.Lock);
+    if (btsnoop_ring.Users == 0) {
+        pthread_mutex_unlock(&btsnoop_ring.Lock);
+        return;
+    }
+
+    if (--btsnoop_ring.Users > 0) {
+        uint64_t head = atomic_load(&btsnoop_ring.Head);
+        btsnoop_ring.Flush = true;
+        pthread_cond_signal(&btsnoop_ring.Wake);
+        while (atomic_load(&btsnoop_ring.Tail) < head) {
+            pthread_cond_wait(&btsnoop_ring.Drained, &btsnoop_ring.Lock);
+        }
+        pthread_mutex_unlock(&btsnoop_ring.Lock);
+        return;
+    }
+
+    atomic_store(&btsnoop_ring.Running, false);
+    while (atomic_load(&btsnoop_ring.Busy) != 0) {
+        sched_yield();
+    }
+    btsnoop_ring.Stop = true;
+    pthread_cond_signal(&btsnoop_ring.Wake);
+    pthread_mutex_unlock(&btsnoop_ring.Lock);
+
+    pthread_join(btsnoop_ring.Thread, NULL);
+
+    pthread_mutex_lock(&btsnoop_ring.Lock);
+    pthread_cond_destroy(&btsnoop_ring.Wake);
+    pthread_cond_destroy(&btsnoop_ring.Drained);
+    free(btsnoop_ring.Buf);
+    btsnoop_ring.Buf = NULL;
+    pthread_mutex_unlock(&btsnoop_ring.Lock);
+}
+
+// With btsnoop_log_lock held
+static void rtk_btsnoop_open_file(void)
 {
-    pthread_mutex_init(&btsnoop_log_lock, NULL);
     char last_log_path[PATH_MAX];
     uint64_t timestamp;
     uint32_t usec;
     uint8_t sec, hour, minus, day;
 
-    if (hci_btsnoop_fd != -1) {
-        HILOGE("%s btsnoop log file is already open.", __func__);
-        return;
-    }
-
     if (rtk_btsnoop_save_log) {
         timestamp = rtk_btsnoop_timestamp() - BTSNOOP_EPOCH_DELTA;
         usec = (uint32_t)(timestamp % 1000000LL);
@@ -141,14 +280,11 @@ void rtk_btsnoop_open(void)
         timestamp /= 30LL;
         (void)snprintf_s(last_log_path, PATH_MAX, PATH_MAX, "%s.%uY-%dD-%dH-%dM-%dS-%dUS",
             rtk_btsnoop_path, (uint32_t)timestamp, day, hour, minus, sec, usec);
-        if (!rename(rtk_btsnoop_path, last_log_path) && errno != ENOENT) {
-            HILOGE("%s unable to rename '%s' to '%s': %s", __func__, rtk_btsnoop_path, last_log_path, strerror(errno));
-        }
     } else {
         (void)snprintf_s(last_log_path, PATH_MAX, PATH_MAX, "%s.last", rtk_btsnoop_path);
-        if (!rename(rtk_btsnoop_path, last_log_path) && errno != ENOENT) {
-            HILOGE("%s unable to rename '%s' to '%s': %s", __func__, rtk_btsnoop_path, last_log_path, strerror(errno));
-        }
+    }
+    if (rename(rtk_btsnoop_path, last_log_path) != 0 && errno != ENOENT) {
+        HILOGE("%s unable to rename '%s' to '%s': %s", __func__, rtk_btsnoop_path, last_log_path, strerror(errno));
     }
 
     hci_btsnoop_fd =
@@ -158,79 +294,146 @@ void rtk_btsnoop_open(void)
         return;
     }
 
-    write(hci_btsnoop_fd, "btsnoop\0\0\0\0\1\0\0\x3\xea", 16L);
+    write(hci_btsnoop_fd, "btsnoop\0\0\0\0\1\0\0\x3\xea", BTSNOOP_FILE_HDR_LEN);
+    hci_btsnoop_file_size = BTSNOOP_FILE_HDR_LEN;
 }
 
-void rtk_btsnoop_close(void)
+void rtk_btsnoop_open(void)
 {
-    pthread_mutex_destroy(&btsnoop_log_lock);
+    pthread_mutex_lock(&btsnoop_log_lock);
     if (hci_btsnoop_fd != -1) {
-        close(hci_btsnoop_fd);
+        pthread_mutex_unlock(&btsnoop_log_lock);
+        HILOGE("%s btsnoop log file is already open.", __func__);
+        return;
+    }
+
+    (void)memset_s(&rtk_btsnoop_stats, sizeof(rtk_btsnoop_stats), 0, sizeof(rtk_btsnoop_stats));
+    rtk_btsnoop_open_file();
+    pthread_mutex_unlock(&btsnoop_log_lock);
+
+    if (hci_btsnoop_fd != -1 && rtk_btsnoop_ring_start() != 0) {
+        rtk_btsnoop_close();
     }
-    hci_btsnoop_fd = -1;
 }
 
-static void rtk_btsnoop_write(const void *data, size_t length)
+void rtk_btsnoop_close(void)
 {
-    if (hci_btsnoop_fd != -1) {
-        write(hci_btsnoop_fd, data, length);
+    if (hci_btsnoop_fd == -1) {
+        return;
     }
+
+    rtk_btsnoop_ring_stop();
+    pthread_mutex_lock(&btsnoop_log_lock);
+    HILOGI("%s %llu records in %llu writes, %llu dropped, %llu rotations", __func__,
+        (unsigned long long)rtk_btsnoop_stats.Records, (unsigned long long)rtk_btsnoop_stats.Writes,
+        (unsigned long long)atomic_load(&btsnoop_ring.Dropped), (unsigned long long)rtk_btsnoop_stats.Rotations);
+    close(hci_btsnoop_fd);
+    hci_btsnoop_fd = -1;
+    pthread_mutex_unlock(&btsnoop_log_lock);
 }
 
-static void rtk_btsnoop_write_packet(serial_data_type_t type, const uint8_t *packet, bool is_received)
+void rtk_btsnoop_get_stats(RTK_BTSNOOP_STATS *stats)
 {
-    int length_he = 0;
-    int length;
-    int flags;
-    int drops = 0;
     pthread_mutex_lock(&btsnoop_log_lock);
+    *stats = rtk_btsnoop_stats;
+    stats->Dropped = atomic_load(&btsnoop_ring.Dropped);
+    pthread_mutex_unlock(&btsnoop_log_lock);
+}
+
+// Length of the btsnoop record from the packet type on, 0 for a type it does not log
+static uint32_t rtk_btsnoop_record_len(serial_data_type_t type, const uint8_t *packet, bool is_received,
+                                       uint32_t *flags)
+{
     switch (type) {
         case HCI_COMMAND_PKT:
-            length_he = packet[2L] + 4L;
-            flags = 2L;
-            break;
+            *flags = 2L;
+            return packet[2L] + 4L;
         case HCI_ACLDATA_PKT:
-            length_he = (packet[3L] << 8L) + packet[2L] + 5L;
-            flags = is_received;
-            break;
+            *flags = is_received;
+            return (packet[3L] << 8L) + packet[2L] + 5L;
         case HCI_SCODATA_PKT:
-            length_he = packet[2L] + 4L;
-            flags = is_received;
-            break;
+            *flags = is_received;
+            return packet[2L] + 4L;
         case HCI_EVENT_PKT:
-            length_he = packet[1] + 3L;
-            flags = 3L;
-            break;
+            *flags = 3L;
+            return packet[1] + 3L;
         default:
-            break;
+            return 0;
+    }
+}
+
+/*
+ * Copies the packet into the ring as a complete btsnoop record. Capturing threads
+ * reserve their slots with a compare and swap on the head and mark them complete
+ * when filled, the writer takes the records in order up to the first one that is
+ * not. Makes no system call unless the writer is to be woken up early.
+ */
+static void rtk_btsnoop_write_packet(serial_data_type_t type, const uint8_t *packet, bool is_received,
+                                     uint32_t sinks)
+{
+    uint32_t flags = 0;
+    uint32_t length_he = rtk_btsnoop_record_len(type, packet, is_received, &flags);
+    uint32_t size = BTSNOOP_SLOT_ALIGN(sizeof(BTSNOOP_SLOT) + BTSNOOP_RECORD_HDR_LEN + length_he);
+    uint64_t head, tail;
+    uint32_t pad;
+
+    if (length_he == 0) {
+        return;
+    }
+
+    atomic_fetch_add(&btsnoop_ring.Busy, 1);
+    if (!atomic_load(&btsnoop_ring.Running)) {
+        atomic_fetch_sub(&btsnoop_ring.Busy, 1);
+        return;
+    }
+
+    head = atomic_load_explicit(&btsnoop_ring.Head, memory_order_relaxed);
+    do {
+        uint32_t room = BTSNOOP_RING_SIZE - (uint32_t)(head & BTSNOOP_RING_MASK);
+        pad = room < size ? room : 0;
+        tail = atomic_load_explicit(&btsnoop_ring.Tail, memory_order_acquire);
+        if (size > BTSNOOP_SLOT_MAX || head + pad + size - tail > BTSNOOP_RING_SIZE) {
+            atomic_fetch_add_explicit(&btsnoop_ring.Dropped, 1, memory_order_relaxed);
+            atomic_fetch_sub(&btsnoop_ring.Busy, 1);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&btsnoop_ring.Head, &head, head + pad + size,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    if (pad != 0) {
+        BTSNOOP_SLOT *fill = rtk_btsnoop_slot(head);
+        fill->Sinks = 0;
+        atomic_store_explicit(&fill->Size, pad, memory_order_release);
     }
 
+    BTSNOOP_SLOT *slot = rtk_btsnoop_slot(head + pad);
+    uint32_t *hdr = (uint32_t *)(slot + 1);
+    uint8_t *record = (uint8_t *)hdr + BTSNOOP_RECORD_HDR_LEN;
     uint64_t timestamp = rtk_btsnoop_timestamp();
-    uint32_t time_hi = timestamp >> 32L;
-    uint32_t time_lo = timestamp & 0xFFFFFFFF;
-
-    length = htonl(length_he);
-    flags = htonl(flags);
-    drops = htonl(drops);
-    time_hi = htonl(time_hi);
-    time_lo = htonl(time_lo);
-
-    rtk_btsnoop_write(&length, 4L);
-    rtk_btsnoop_write(&length, 4L);
-    rtk_btsnoop_write(&flags, 4L);
-    rtk_btsnoop_write(&drops, 4L);
-    rtk_btsnoop_write(&time_hi, 4L);
-    rtk_btsnoop_write(&time_lo, 4L);
-    rtk_btsnoop_write(&type, 1);
-    rtk_btsnoop_write(packet, length_he - 1);
-    pthread_mutex_unlock(&btsnoop_log_lock);
+
+    slot->Sinks = sinks;
+    hdr[0] = htonl(length_he);
+    hdr[1] = htonl(length_he);
+    hdr[2L] = htonl(flags);
+    hdr[3L] = htonl((uint32_t)atomic_load_explicit(&btsnoop_ring.Dropped, memory_order_relaxed));
+    hdr[4L] = htonl((uint32_t)(timestamp >> 32L));
+    hdr[5L] = htonl((uint32_t)(timestamp & 0xFFFFFFFF));
+    record[0] = type;
+    (void)memcpy_s(record + 1, length_he - 1, packet, length_he - 1);
+    atomic_store_explicit(&slot->Size, size, memory_order_release);
+
+    if (head - tail < BTSNOOP_WAKE_LEVEL && head + pad + size - tail >= BTSNOOP_WAKE_LEVEL) {
+        pthread_cond_signal(&btsnoop_ring.Wake);
+    }
+    atomic_fetch_sub(&btsnoop_ring.Busy, 1);
 }
 
 void rtk_btsnoop_capture(const HC_BT_HDR *p_buf, bool is_rcvd)
 {
     const uint8_t *p = (const uint8_t *)(p_buf + 1) + p_buf->offset;
+    const uint32_t sinks = BTSNOOP_SINK_FILE | BTSNOOP_SINK_NET;
 
-    if (hci_btsnoop_fd == -1) {
+    if (!atomic_load_explicit(&btsnoop_ring.Running, memory_order_relaxed)) {
         return;
     }
 
@@ -238,20 +441,20 @@ void rtk_btsnoop_capture(const HC_BT_HDR *p_buf, bool is_rcvd)
         case MSG_HC_TO_STACK_HCI_EVT:
             if ((*(p + 3L) == 0x94) && (*(p + 4L) == 0xfc) && (*(p + 5L) == 0x00) && (rtkbt_h5logfilter & 1)) {
             } else {
-                rtk_btsnoop_write_packet(HCI_EVENT_PKT, p, false);
+                rtk_btsnoop_write_packet(HCI_EVENT_PKT, p, false, sinks);
             }
             break;
         case MSG_HC_TO_STACK_HCI_ACL:
         case MSG_STACK_TO_HC_HCI_ACL:
-            rtk_btsnoop_write_packet(HCI_ACLDATA_PKT, p, is_rcvd);
+            rtk_btsnoop_write_packet(HCI_ACLDATA_PKT, p, is_rcvd, sinks);
             break;
         case MSG_HC_TO_STACK_HCI_SCO:
         case MSG_STACK_TO_HC_HCI_SCO:
-            rtk_btsnoop_write_packet(HCI_SCODATA_PKT, p, is_rcvd);
+            rtk_btsnoop_write_packet(HCI_SCODATA_PKT, p, is_rcvd, sinks);
             break;
         case MSG_STACK_TO_HC_HCI_CMD:
             if (((rtkbt_h5logfilter & 1) == 0) || (*p != 0x94) || (*(p + 1) != 0xfc)) {
-                rtk_btsnoop_write_packet(HCI_COMMAND_PKT, p, true);
+                rtk_btsnoop_write_packet(HCI_COMMAND_PKT, p, true, sinks);
             }
             break;
     }
@@ -259,19 +462,33 @@ void rtk_btsnoop_capture(const HC_BT_HDR *p_buf, bool is_rcvd)
 
 void rtk_btsnoop_net_open(void)
 {
+    if (rtk_listen_thread_valid_) {
+        return;
+    }
+
     rtk_listen_thread_valid_ = (pthread_create(&rtk_listen_thread_, NULL, rtk_listen_fn_, NULL) == 0);
     if (!rtk_listen_thread_valid_) {
         HILOGE("%s pthread_create failed: %s", __func__, strerror(errno));
-    } else {
-        HILOGD("initialized");
+        return;
     }
+    if (rtk_btsnoop_ring_start() != 0) {
+        rtk_btsnoop_net_close();
+        return;
+    }
+    HILOGD("initialized");
 }
 
 void rtk_btsnoop_net_close(void)
 {
     if (rtk_listen_thread_valid_) {
-        shutdown(rtk_listen_socket_, SHUT_RDWR);
+        rtk_btsnoop_ring_stop();
         pthread_join(rtk_listen_thread_, NULL);
+        pthread_mutex_lock(&rtk_client_socket_lock_);
+        if (rtk_listen_socket_ != -1) {
+            shutdown(rtk_listen_socket_, SHUT_RDWR);
+        }
+        rtk_safe_close_(&rtk_listen_socket_);
+        pthread_mutex_unlock(&rtk_client_socket_lock_);
         rtk_listen_thread_valid_ = false;
     }
 }
@@ -281,51 +498,52 @@ void rtk_btsnoop_net_write(serial_data_type_t type, uint8_t *data, bool is_recei
     if (rtk_listen_socket_ == -1) {
         return;
     }
-    int length = 0;
     uint8_t *p = data;
 
     switch (type) {
         case HCI_COMMAND_PKT:
-            if (((rtkbt_h5logfilter & 1) == 0) || (*p != 0x94) || (*(p + 1) != 0xfc)) {
-                length = data[2L] + 3L;
-            } else {
+            if (((rtkbt_h5logfilter & 1) != 0) && (*p == 0x94) && (*(p + 1) == 0xfc)) {
                 return;
             }
             break;
-        case HCI_ACLDATA_PKT:
-            length = (data[3L] << 8L) + data[2L] + 4L;
-            break;
-        case HCI_SCODATA_PKT:
-            length = data[2L] + 3L;
-            break;
         case HCI_EVENT_PKT:
             if ((*(p + 3L) == 0x94) && (*(p + 4L) == 0xfc) && (*(p + 5L) == 0x00) && (rtkbt_h5logfilter & 1)) {
                 return;
-            } else {
-                length = data[1] + 2L;
             }
             break;
         default:
             break;
     }
 
+    rtk_btsnoop_write_packet(type, data, is_received, BTSNOOP_SINK_NET);
+}
+
+// Sends a btsnoop record from the ring to the net dump listener, on the writer thread
+static void rtk_btsnoop_net_send(const uint8_t *record)
+{
+    const uint32_t *hdr = (const uint32_t *)record;
+    serial_data_type_t type = record[BTSNOOP_RECORD_HDR_LEN];
+    const uint8_t *data = record + BTSNOOP_RECORD_HDR_LEN + 1;
+    int length = (int)ntohl(hdr[0]) - 1;
+    bool is_received = (ntohl(hdr[2L]) & 1) != 0;
+    uint64_t timestamp = (((uint64_t)ntohl(hdr[4L]) << 32L) | ntohl(hdr[5L])) - BTSNOOP_EPOCH_DELTA;
+
     uint8_t buffer[4126] = {0};
     struct sockaddr_in client_addr;
     int i = 0;
 
 #if DATA_DIRECT_2_ELLISY
     uint8_t bit_rate[4] = {0x00, 0x1b, 0x37, 0x4b};
+    struct tm tm_buf;
     struct tm *t;
-    time_t tt;
-    time_t t_ret;
-    t_ret = time(&tt);
-    t = localtime(&tt);
-
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
+    time_t tt = (time_t)(timestamp / 1000000LL);
+    t = localtime_r(&tt, &tm_buf);
+    if (t == NULL) {
+        return;
+    }
 
-    uint64_t nano_time =
-        (t->tm_hour * 3600LL + t->tm_min * 60LL + t->tm_sec) * 1000LL * 1000LL * 1000LL + tv.tv_usec * 1000LL;
+    uint64_t nano_time = (t->tm_hour * 3600LL + t->tm_min * 60LL + t->tm_sec) * 1000LL * 1000LL * 1000LL +
+                         (timestamp % 1000000LL) * 1000LL;
     uint16_t year = (t->tm_year + 1900) & 0xFFFF;
     uint8_t month = (t->tm_mon + 1) & 0xFF;
     uint8_t day = buffer[0] = 0x02;
@@ -382,7 +600,9 @@ void rtk_btsnoop_net_write(serial_data_type_t type, uint8_t *data, bool is_recei
 #else
     i = 5L;
 #endif
-    (void)memcpy_s(&buffer[i], sizeof(buffer), data, length);
+    if (memcpy_s(&buffer[i], sizeof(buffer) - i, data, length) != EOK) {
+        return;
+    }
     (void)memset_s(&client_addr, sizeof(client_addr), 0, sizeof(client_addr));
     client_addr.sin_family = AF_INET;
     client_addr.sin_addr.s_addr = htonl(RTK_REMOTEHOST_);
@@ -392,6 +612,163 @@ void rtk_btsnoop_net_write(serial_data_type_t type, uint8_t *data, bool is_recei
     RTK_NO_INTR(ret = sendto(rtk_listen_socket_, buffer, (length + i), 0, (struct sockaddr *)&client_addr,
                              sizeof(struct sockaddr_in)));
     pthread_mutex_unlock(&rtk_client_socket_lock_);
+    if (ret != -1) {
+        rtk_btsnoop_stats.Datagrams++;
+    }
+}
+
+/*
+ * Writes out the whole batch, a short write continues where it stopped.
+ * Returns how many records did not make it out whole, 'written' is what did go out.
+ */
+static int rtk_btsnoop_writev(int fd, struct iovec *iov, int count, size_t *written)
+{
+    *written = 0;
+    while (count > 0) {
+        ssize_t ret;
+        RTK_NO_INTR(ret = writev(fd, iov, count));
+        if (ret < 0) {
+            return count;
+        }
+        rtk_btsnoop_stats.Writes++;
+        *written += (size_t)ret;
+        while (count > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+// Starts a new file when the current one is full, the full one is kept like at open
+static void rtk_btsnoop_rotate(void)
+{
+    close(hci_btsnoop_fd);
+    hci_btsnoop_fd = -1;
+    rtk_btsnoop_open_file();
+    rtk_btsnoop_stats.Rotations++;
+}
+
+/*
+ * Takes the complete records from the tail of the ring, up to BTSNOOP_BATCH_RECORDS
+ * of them to the file in one writev() and each to the net dump listener. The slots
+ * are cleared before the tail moves past them, the next record in the same place
+ * must find its size 0 until it is complete.
+ */
+static void rtk_btsnoop_drain(void)
+{
+    uint64_t tail = atomic_load_explicit(&btsnoop_ring.Tail, memory_order_relaxed);
+
+    for (;;) {
+        struct iovec iov[BTSNOOP_BATCH_RECORDS];
+        int count = 0;
+        size_t bytes = 0;
+        uint64_t pos = tail;
+
+        pthread_mutex_lock(&btsnoop_log_lock);
+        bool to_net = rtk_listen_socket_ != -1;
+        while (count < BTSNOOP_BATCH_RECORDS) {
+            BTSNOOP_SLOT *slot = rtk_btsnoop_slot(pos);
+            uint32_t size = atomic_load_explicit(&slot->Size, memory_order_acquire);
+            if (size == 0) {
+                break;
+            }
+
+            uint8_t *record = (uint8_t *)(slot + 1);
+            if (slot->Sinks != 0) {
+                // a record filled in later than the next one can carry a higher count
+                uint32_t *drops = (uint32_t *)record + 3L;
+                if (ntohl(*drops) < btsnoop_ring.LastDrops) {
+                    *drops = htonl(btsnoop_ring.LastDrops);
+                }
+                btsnoop_ring.LastDrops = ntohl(*drops);
+            }
+            if ((slot->Sinks & BTSNOOP_SINK_FILE) && hci_btsnoop_fd != -1) {
+                size_t len = BTSNOOP_RECORD_HDR_LEN + ntohl(*(uint32_t *)record);
+                if (rtk_btsnoop_max_file_size != 0 && hci_btsnoop_file_size + bytes > BTSNOOP_FILE_HDR_LEN &&
+                    hci_btsnoop_file_size + bytes + len > rtk_btsnoop_max_file_size) {
+                    if (count > 0) {
+                        break;
+                    }
+                    rtk_btsnoop_rotate();
+                }
+                if (hci_btsnoop_fd != -1) {
+                    iov[count].iov_base = record;
+                    iov[count].iov_len = len;
+                    count++;
+                    bytes += len;
+                }
+            }
+            if ((slot->Sinks & BTSNOOP_SINK_NET) && to_net) {
+                rtk_btsnoop_net_send(record);
+            }
+            pos += size;
+        }
+        if (count > 0) {
+            size_t written = 0;
+            int failed = rtk_btsnoop_writev(hci_btsnoop_fd, iov, count, &written);
+            if (failed > 0) {
+                HILOGE("%s unable to write '%s': %s", __func__, rtk_btsnoop_path, strerror(errno));
+                atomic_fetch_add_explicit(&btsnoop_ring.Dropped, (uint64_t)failed, memory_order_relaxed);
+            }
+            hci_btsnoop_file_size += written;
+            rtk_btsnoop_stats.Records += (uint64_t)(count - failed);
+            rtk_btsnoop_stats.Bytes += written;
+        }
+        pthread_mutex_unlock(&btsnoop_log_lock);
+
+        if (pos == tail) {
+            break;
+        }
+        uint32_t from = (uint32_t)(tail & BTSNOOP_RING_MASK);
+        uint32_t len = (uint32_t)(pos - tail);
+        uint32_t first = len < BTSNOOP_RING_SIZE - from ? len : BTSNOOP_RING_SIZE - from;
+        (void)memset_s(btsnoop_ring.Buf + from, first, 0, first);
+        if (len > first) {
+            (void)memset_s(btsnoop_ring.Buf, len - first, 0, len - first);
+        }
+        atomic_store_explicit(&btsnoop_ring.Tail, pos, memory_order_release);
+        tail = pos;
+    }
+}
+
+static void *rtk_writer_fn_(void *context)
+{
+    RTK_UNUSED(context);
+    prctl(PR_SET_NAME, (unsigned long)RTK_WRITER_THREAD_NAME_, 0, 0, 0);
+
+    pthread_mutex_lock(&btsnoop_ring.Lock);
+    for (;;) {
+        bool stop = btsnoop_ring.Stop;
+        btsnoop_ring.Flush = false;
+        pthread_mutex_unlock(&btsnoop_ring.Lock);
+
+        rtk_btsnoop_drain();
+
+        pthread_mutex_lock(&btsnoop_ring.Lock);
+        pthread_cond_broadcast(&btsnoop_ring.Drained);
+        if (stop) {
+            break;
+        }
+        uint64_t used = atomic_load(&btsnoop_ring.Head) - atomic_load(&btsnoop_ring.Tail);
+        if (!btsnoop_ring.Stop && !btsnoop_ring.Flush && used < BTSNOOP_WAKE_LEVEL) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += BTSNOOP_FLUSH_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&btsnoop_ring.Wake, &btsnoop_ring.Lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&btsnoop_ring.Lock);
+    return NULL;
 }
 
 static void *rtk_listen_fn_(void *context)
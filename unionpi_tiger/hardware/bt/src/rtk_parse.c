@@ -63,6 +63,7 @@
 #include "bt_list.h"
 #include "hardware_uart.h"
 #include "rtk_parse.h"
+#include "rtk_timer.h"
 
 #define RTK_COEX_VERSION "3.0"
 #define HCI_EVT_CMD_CMPL_OPCODE 3
@@ -93,6 +94,7 @@ char bt_leave[] = "BT_LEAVE";
 
 #define PAN_PACKET_COUNT 5
 #define PACKET_COUNT_TIOMEOUT_VALUE 1000 // ms
+#define PROFILE_TIMER_SLACK 200           // ms
 
 // vendor cmd to fw
 #define HCI_VENDOR_ENABLE_PROFILE_REPORT_COMMAND (0x0018 | HCI_GRP_VENDOR_SPECIFIC)
@@ -228,10 +230,10 @@ typedef struct RTK_PROF {
     pthread_mutex_t btwifi_mutex;
     pthread_t thread_monitor;
     pthread_t thread_data;
-    timer_t timer_a2dp_packet_count;
-    timer_t timer_pan_packet_count;
-    timer_t timer_hogp_packet_count;
-    timer_t timer_polling;
+    RTK_TIMER *timer_a2dp_packet_count;
+    RTK_TIMER *timer_pan_packet_count;
+    RTK_TIMER *timer_hogp_packet_count;
+    RTK_TIMER *timer_polling;
     // struct sockaddr_nl src_addr;    //for netlink
     struct sockaddr_in server_addr; // server addr for kernel socket
     struct sockaddr_in client_addr; // client addr  for kernel socket
@@ -335,68 +337,14 @@ void print_sbc_header(struct sbc_frame_hdr *hdr)
     RtkLogMsg("subbands %u", subbands[hdr->subbands]);
 }
 
-static timer_t OsAllocateTimer(int signo)
+static RTK_TIMER *OsAllocateTimer(int signo)
 {
-    struct sigevent sigev;
-    timer_t timerid = (timer_t)-1;
-    errno_t ret = -1;
-
-    // Create the POSIX timer to generate signo
-    ret = memset_s(&sigev, sizeof(sigev), 0, sizeof(sigev));
-    if (ret != 0) {
-    }
-    sigev.sigev_notify = SIGEV_THREAD;
-    sigev.sigev_notify_function = notify_func;
-    sigev.sigev_value.sival_int = signo;
-
-    // Create the Timer using timer_create signal
-    if (timer_create(CLOCK_REALTIME, &sigev, &timerid) == 0) {
-        return timerid;
-    } else {
-        HILOGE("timer_create error!");
-        return (timer_t)-1;
-    }
-}
-
-static int OsFreeTimer(timer_t timerid)
-{
-    int ret = 0;
-    ret = timer_delete(timerid);
-    if (ret != 0) {
-        HILOGE("timer_delete fail with errno(%d)", errno);
-    }
-
-    return ret;
-}
-
-static int OsStartTimer(timer_t timerid, int msec, int mode)
-{
-    struct itimerspec itval;
-
-#define PARSE_MSEC_1000 1000
-    itval.it_value.tv_sec = msec / PARSE_MSEC_1000;
-    itval.it_value.tv_nsec = (long)(msec % PARSE_MSEC_1000) * (1000000L);
-
-    if (mode == 1) {
-        itval.it_interval.tv_sec = itval.it_value.tv_sec;
-        itval.it_interval.tv_nsec = itval.it_value.tv_nsec;
-    } else {
-        itval.it_interval.tv_sec = 0;
-        itval.it_interval.tv_nsec = 0;
-    }
+    union sigval arg = {.sival_int = signo};
+    RTK_TIMER *timer = RtkTimerAllocate(notify_func, arg);
 
-    // Set the Timer when to expire through timer_settime
-    if (timer_settime(timerid, 0, &itval, NULL) != 0) {
-        HILOGE("time_settime error!");
-        return -1;
-    }
-
-    return 0;
-}
-
-static int OsStopTimer(timer_t timerid)
-{
-    return OsStartTimer(timerid, 0, 0);
+    // the profile timers only sample counters, they may as well run on one wakeup
+    RtkTimerSetSlack(timer, PROFILE_TIMER_SLACK);
+    return timer;
 }
 
 int alloc_polling_timer(void)
@@ -410,19 +358,19 @@ int alloc_polling_timer(void)
 
 int free_polling_timer(void)
 {
-    return OsFreeTimer(rtk_prof.timer_polling);
+    return RtkTimerFree(rtk_prof.timer_polling);
 }
 
 int stop_polling_timer(void)
 {
     RtkLogMsg("stop polling timer");
-    return OsStopTimer(rtk_prof.timer_polling);
+    return RtkTimerStop(rtk_prof.timer_polling);
 }
 
 int start_polling_timer(int value)
 {
     RtkLogMsg("start polling timer");
-    return OsStartTimer(rtk_prof.timer_polling, value, 1);
+    return RtkTimerStart(rtk_prof.timer_polling, value, true);
 }
 
 int alloc_hogp_packet_count_timer(void)
@@ -436,19 +384,19 @@ int alloc_hogp_packet_count_timer(void)
 
 int free_hogp_packet_count_timer(void)
 {
-    return OsFreeTimer(rtk_prof.timer_hogp_packet_count);
+    return RtkTimerFree(rtk_prof.timer_hogp_packet_count);
 }
 
 int stop_hogp_packet_count_timer(void)
 {
     RtkLogMsg("stop hogp packet");
-    return OsStopTimer(rtk_prof.timer_hogp_packet_count);
+    return RtkTimerStop(rtk_prof.timer_hogp_packet_count);
 }
 
 int start_hogp_packet_count_timer(void)
 {
     RtkLogMsg("start hogp packet");
-    return OsStartTimer(rtk_prof.timer_hogp_packet_count, PACKET_COUNT_TIOMEOUT_VALUE, 1);
+    return RtkTimerStart(rtk_prof.timer_hogp_packet_count, PACKET_COUNT_TIOMEOUT_VALUE, true);
 }
 
 int alloc_a2dp_packet_count_timer(void)
@@ -462,19 +410,19 @@ int alloc_a2dp_packet_count_timer(void)
 
 int free_a2dp_packet_count_timer(void)
 {
-    return OsFreeTimer(rtk_prof.timer_a2dp_packet_count);
+    return RtkTimerFree(rtk_prof.timer_a2dp_packet_count);
 }
 
 int stop_a2dp_packet_count_timer(void)
 {
     RtkLogMsg("stop a2dp packet");
-    return OsStopTimer(rtk_prof.timer_a2dp_packet_count);
+    return RtkTimerStop(rtk_prof.timer_a2dp_packet_count);
 }
 
 int start_a2dp_packet_count_timer(void)
 {
     RtkLogMsg("start a2dp packet");
-    return OsStartTimer(rtk_prof.timer_a2dp_packet_count, PACKET_COUNT_TIOMEOUT_VALUE, 1);
+    return RtkTimerStart(rtk_prof.timer_a2dp_packet_count, PACKET_COUNT_TIOMEOUT_VALUE, true);
 }
 
 int alloc_pan_packet_count_timer(void)
@@ -488,19 +436,19 @@ int alloc_pan_packet_count_timer(void)
 
 int free_pan_packet_count_timer(void)
 {
-    return OsFreeTimer(rtk_prof.timer_pan_packet_count);
+    return RtkTimerFree(rtk_prof.timer_pan_packet_count);
 }
 
 int stop_pan_packet_count_timer(void)
 {
     RtkLogMsg("stop pan packet");
-    return OsStopTimer(rtk_prof.timer_pan_packet_count);
+    return RtkTimerStop(rtk_prof.timer_pan_packet_count);
 }
 
 int start_pan_packet_count_timer(void)
 {
     RtkLogMsg("start pan packet");
-    return OsStartTimer(rtk_prof.timer_pan_packet_count, PACKET_COUNT_TIOMEOUT_VALUE, 1);
+    return RtkTimerStart(rtk_prof.timer_pan_packet_count, PACKET_COUNT_TIOMEOUT_VALUE, true);
 }
 
 static int8_t psm_to_profile_index(uint16_t psm)
@@ -31,6 +31,7 @@
 #include <time.h>
 #include "bt_hci_bdroid.h"
 #include "rtk_poll.h"
+#include "rtk_timer.h"
 
 /******************************************************************************
 **  Constants & Macros
@@ -81,7 +82,7 @@ enum {
 typedef struct {
     uint8_t state; /* poll state */
     uint8_t timer_created;
-    timer_t timer_id;
+    RTK_TIMER *timer_id;
     uint32_t timeout_ms;
 } bt_poll_cb_t;
 
@@ -106,21 +107,10 @@ static bt_poll_cb_t bt_poll_cb;
 *******************************************************************************/
 static void poll_timer_stop(void)
 {
-    int status;
-    struct itimerspec ts;
-
     HILOGI("poll_timer_stop: timer_created %d", bt_poll_cb.timer_created);
 
     if (bt_poll_cb.timer_created == true) {
-        ts.it_value.tv_sec = 0;
-        ts.it_value.tv_nsec = 0;
-        ts.it_interval.tv_sec = 0;
-        ts.it_interval.tv_nsec = 0;
-
-        status = timer_settime(bt_poll_cb.timer_id, 0, &ts, 0);
-        if (status == -1) {
-            HILOGE("[STOP] Failed to set poll idle timeout");
-        }
+        RtkTimerStop(bt_poll_cb.timer_id);
     }
 }
 
@@ -161,7 +151,8 @@ void poll_cleanup(void)
     HILOGI("poll_cleanup: timer_created %d", bt_poll_cb.timer_created);
 
     if (bt_poll_cb.timer_created == true) {
-        timer_delete(bt_poll_cb.timer_id);
+        RtkTimerFree(bt_poll_cb.timer_id);
+        bt_poll_cb.timer_created = false;
     }
 }
 
@@ -208,11 +199,8 @@ void poll_enable(uint8_t turn_on)
 *******************************************************************************/
 void poll_timer_flush(void)
 {
-    int status;
-    struct itimerspec ts;
-    struct sigevent se;
+    union sigval arg;
 
-    (void)memset_s(&se, sizeof(struct sigevent), 0, sizeof(struct sigevent));
     BTPOLLDBG("poll_timer_flush: state %d", bt_poll_cb.state);
 
     if (bt_poll_cb.state != POLL_ENABLED) {
@@ -220,25 +208,15 @@ void poll_timer_flush(void)
     }
 
     if (bt_poll_cb.timer_created == false) {
-        se.sigev_notify = SIGEV_THREAD;
-        se.sigev_value.sival_ptr = &bt_poll_cb.timer_id;
-        se.sigev_notify_function = poll_idle_timeout;
-        se.sigev_notify_attributes = NULL;
-
-        status = timer_create(CLOCK_MONOTONIC, &se, &bt_poll_cb.timer_id);
-        if (status == 0) {
+        arg.sival_ptr = &bt_poll_cb.timer_id;
+        bt_poll_cb.timer_id = RtkTimerAllocate(poll_idle_timeout, arg);
+        if (bt_poll_cb.timer_id != NULL) {
             bt_poll_cb.timer_created = true;
         }
     }
 #if (defined(ENABLE_BT_POLL_IN_ACTIVE_MODE) && (ENABLE_BT_POLL_IN_ACTIVE_MODE == false))
     if (bt_poll_cb.timer_created == true) {
-        ts.it_value.tv_sec = bt_poll_cb.timeout_ms / 1000L;
-        ts.it_value.tv_nsec = 1000L * 1000L * (bt_poll_cb.timeout_ms % 1000L);
-        ts.it_interval.tv_sec = 0;
-        ts.it_interval.tv_nsec = 0;
-
-        status = timer_settime(bt_poll_cb.timer_id, 0, &ts, 0);
-        if (status == -1) {
+        if (RtkTimerStart(bt_poll_cb.timer_id, bt_poll_cb.timeout_ms, false) != 0) {
             HILOGE("[Flush] Failed to set poll idle timeout");
         }
     }
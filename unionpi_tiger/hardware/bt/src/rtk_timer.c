@@ -0,0 +1,479 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      rtk_timer.c
+ *
+ *  Description:   Timer wheel behind the H5, profile, heartbeat and service
+ *                 timers. Four levels of 64 slots, one millisecond a slot on
+ *                 the lowest, 64 times that on each level above. A timer goes
+ *                 into the level its timeout falls in and moves down as the
+ *                 wheel turns. The wheel thread sleeps on a timerfd set for
+ *                 the next slot that has timers and runs their callbacks.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_timer"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "securec.h"
+#include "bt_list.h"
+#include "rtk_timer.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_NONE UINT64_MAX
+
+#define USEC_PER_MSEC 1000ULL
+#define NSEC_PER_USEC 1000ULL
+#define USEC_PER_SEC 1000000ULL
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+struct RTK_TIMER {
+    RT_LIST_ENTRY List;
+    tRTK_TIMER_CBACK Cback;
+    union sigval Arg;
+    uint64_t Expires; // tick
+    uint32_t Period;  // ms, 0 for a one shot timer
+    uint32_t Slack;
+    uint8_t Level;
+    uint8_t Slot;
+    bool Armed;
+};
+
+typedef struct {
+    pthread_mutex_t Lock;
+    pthread_cond_t Idle; // a callback returned
+    pthread_t Thread;
+    int Fd;
+    bool Running;
+    uint64_t EpochUs;
+    uint64_t Tick;    // every slot up to this millisecond has run
+    uint64_t ArmedAt; // tick the timerfd is set for
+    RTK_TIMER *Current;
+    uint64_t Occupied[TW_LEVELS];
+    RT_LIST_HEAD Slots[TW_LEVELS][TW_SLOTS];
+    RTK_TIMER_STATS Stats;
+} tRTK_TIMER_WHEEL;
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+static tRTK_TIMER_WHEEL wheel = {
+    .Lock = PTHREAD_MUTEX_INITIALIZER,
+    .Idle = PTHREAD_COND_INITIALIZER,
+    .Fd = -1,
+};
+
+/******************************************************************************
+**  Wheel, under wheel.Lock
+******************************************************************************/
+static uint64_t tw_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * USEC_PER_SEC + (uint64_t)ts.tv_nsec / NSEC_PER_USEC;
+}
+
+static uint64_t tw_now_tick(void)
+{
+    return (tw_now_us() - wheel.EpochUs) / USEC_PER_MSEC;
+}
+
+static void tw_init_slots(void)
+{
+    uint32_t level;
+    uint32_t slot;
+
+    for (level = 0; level < TW_LEVELS; level++) {
+        for (slot = 0; slot < TW_SLOTS; slot++) {
+            ListInitializeHeader(&wheel.Slots[level][slot]);
+        }
+    }
+}
+
+/* Puts a timer into the level its expiry falls in as seen from wheel.Tick */
+static void tw_insert(RTK_TIMER *timer)
+{
+    uint64_t delta = (timer->Expires > wheel.Tick) ? timer->Expires - wheel.Tick : 0;
+    uint32_t level = 0;
+
+    while (level < TW_LEVELS - 1 && delta >= (1ULL << (TW_BITS * (level + 1)))) {
+        level++;
+    }
+    timer->Level = (uint8_t)level;
+    timer->Slot = (uint8_t)((timer->Expires >> (TW_BITS * level)) & TW_MASK);
+    ListAddToTail(&timer->List, &wheel.Slots[level][timer->Slot]);
+    wheel.Occupied[level] |= 1ULL << timer->Slot;
+    timer->Armed = true;
+    wheel.Stats.Armed++;
+}
+
+static void tw_remove(RTK_TIMER *timer)
+{
+    RT_LIST_HEAD *slot = &wheel.Slots[timer->Level][timer->Slot];
+
+    ListDeleteNode(&timer->List);
+    if (ListIsEmpty(slot)) {
+        wheel.Occupied[timer->Level] &= ~(1ULL << timer->Slot);
+    }
+    timer->Armed = false;
+    wheel.Stats.Armed--;
+}
+
+/* Moves the timers of a higher level slot down now that the wheel reached it */
+static void tw_cascade(uint32_t level, uint32_t slot)
+{
+    RT_LIST_HEAD *head = &wheel.Slots[level][slot];
+
+    while (!ListIsEmpty(head)) {
+        RTK_TIMER *timer = LIST_ENTRY(head->Next, RTK_TIMER, List);
+        tw_remove(timer);
+        tw_insert(timer);
+    }
+}
+
+/* The first tick the wheel has to look at again: a lowest level slot with timers or a cascade */
+static uint64_t tw_next_tick(void)
+{
+    uint64_t next = TW_NONE;
+    uint32_t level;
+
+    for (level = 0; level < TW_LEVELS; level++) {
+        uint32_t shift = TW_BITS * level;
+        uint64_t bits = wheel.Occupied[level];
+        uint32_t now = (uint32_t)((wheel.Tick >> shift) & TW_MASK);
+        uint64_t ahead;
+        uint64_t at;
+
+        if (!bits) {
+            continue;
+        }
+        // rotate so bit 0 is the slot the wheel is in, the slots after it follow
+        ahead = now ? ((bits >> now) | (bits << (TW_SLOTS - now))) : bits;
+        ahead &= ~1ULL;
+        at = ((wheel.Tick >> shift) + (ahead ? (uint64_t)__builtin_ctzll(ahead) : TW_SLOTS)) << shift;
+        if (at < next) {
+            next = at;
+        }
+    }
+    return next;
+}
+
+static void tw_arm(uint64_t tick)
+{
+    struct itimerspec its;
+    uint64_t us = wheel.EpochUs + tick * USEC_PER_MSEC;
+
+    if (tick == wheel.ArmedAt) {
+        return;
+    }
+    (void)memset_s(&its, sizeof(its), 0, sizeof(its));
+    if (tick != TW_NONE) {
+        its.it_value.tv_sec = (time_t)(us / USEC_PER_SEC);
+        its.it_value.tv_nsec = (long)((us % USEC_PER_SEC) * NSEC_PER_USEC);
+    }
+    if (timerfd_settime(wheel.Fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        HILOGE("timerfd_settime error(%d)", errno);
+        return;
+    }
+    wheel.ArmedAt = tick;
+}
+
+/* Ticks to expire msec from now, rounded up to the slack */
+static uint64_t tw_expires(const RTK_TIMER *timer, uint64_t from_us, uint32_t msec)
+{
+    uint64_t expires = (from_us - wheel.EpochUs + msec * USEC_PER_MSEC + USEC_PER_MSEC - 1) / USEC_PER_MSEC;
+
+    if (timer->Slack > 1) {
+        expires = (expires + timer->Slack - 1) / timer->Slack * timer->Slack;
+    }
+    return (expires > wheel.Tick) ? expires : wheel.Tick + 1;
+}
+
+/* Runs the callbacks of one tick, the lock is dropped around each */
+static uint32_t tw_run_tick(uint64_t now)
+{
+    RT_LIST_HEAD *head = &wheel.Slots[0][wheel.Tick & TW_MASK];
+    uint32_t fired = 0;
+
+    while (!ListIsEmpty(head)) {
+        RTK_TIMER *timer = LIST_ENTRY(head->Next, RTK_TIMER, List);
+        uint64_t deadline_us = wheel.EpochUs + timer->Expires * USEC_PER_MSEC;
+        uint64_t late_us;
+
+        tw_remove(timer);
+        if (timer->Period) {
+            // keep the phase, periods missed while the wheel was late are skipped
+            timer->Expires += timer->Period;
+            while (timer->Expires <= now) {
+                timer->Expires += timer->Period;
+            }
+            tw_insert(timer);
+        }
+
+        late_us = tw_now_us();
+        late_us = (late_us > deadline_us) ? late_us - deadline_us : 0;
+        wheel.Stats.Expiries++;
+        wheel.Stats.TotalLateUs += late_us;
+        if (late_us > wheel.Stats.MaxLateUs) {
+            wheel.Stats.MaxLateUs = (uint32_t)((late_us > UINT32_MAX) ? UINT32_MAX : late_us);
+        }
+
+        wheel.Current = timer;
+        pthread_mutex_unlock(&wheel.Lock);
+        timer->Cback(timer->Arg);
+        pthread_mutex_lock(&wheel.Lock);
+        wheel.Current = NULL;
+        pthread_cond_broadcast(&wheel.Idle);
+        fired++;
+    }
+    return fired;
+}
+
+static void *tw_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+
+    prctl(PR_SET_NAME, (unsigned long)"bt_timer", 0, 0, 0);
+
+    pthread_mutex_lock(&wheel.Lock);
+    while (wheel.Fd == fd) {
+        uint64_t expirations;
+        uint64_t now;
+        uint32_t fired = 0;
+        ssize_t n;
+
+        pthread_mutex_unlock(&wheel.Lock);
+        n = read(fd, &expirations, sizeof(expirations));
+        pthread_mutex_lock(&wheel.Lock);
+        if (wheel.Fd != fd) {
+            break;
+        }
+        if (n != sizeof(expirations)) {
+            if (n < 0 && errno != EINTR && errno != EAGAIN) {
+                HILOGE("timerfd read error(%d)", errno);
+            }
+            continue;
+        }
+
+        wheel.Stats.Wakeups++;
+        wheel.ArmedAt = TW_NONE;
+        now = tw_now_tick();
+        while (wheel.Tick < now) {
+            uint32_t level;
+
+            wheel.Tick++;
+            for (level = 1; level < TW_LEVELS && !(wheel.Tick & ((1ULL << (TW_BITS * level)) - 1)); level++) {
+                tw_cascade(level, (uint32_t)((wheel.Tick >> (TW_BITS * level)) & TW_MASK));
+            }
+            if (wheel.Occupied[0] & (1ULL << (wheel.Tick & TW_MASK))) {
+                fired += tw_run_tick(now);
+            }
+        }
+        wheel.Stats.Coalesced += fired ? fired - 1 : 0;
+        tw_arm(tw_next_tick());
+    }
+    pthread_mutex_unlock(&wheel.Lock);
+
+    close(fd);
+    return NULL;
+}
+
+static void tw_dump_stats(const RTK_TIMER_STATS *s)
+{
+    HILOGI("rtk timer: %u timers %u armed, starts %llu stops %llu expiries %llu wakeups %llu coalesced %llu, "
+           "late avg %llu us max %u us",
+           s->Timers, s->Armed, (unsigned long long)s->Starts, (unsigned long long)s->Stops,
+           (unsigned long long)s->Expiries, (unsigned long long)s->Wakeups, (unsigned long long)s->Coalesced,
+           (unsigned long long)(s->Expiries ? s->TotalLateUs / s->Expiries : 0), s->MaxLateUs);
+}
+
+/******************************************************************************
+**  Interface
+******************************************************************************/
+RTK_TIMER *RtkTimerAllocate(tRTK_TIMER_CBACK cback, union sigval arg)
+{
+    RTK_TIMER *timer = calloc(1, sizeof(*timer));
+
+    if (!timer) {
+        HILOGE("RtkTimerAllocate: out of memory");
+        return NULL;
+    }
+    timer->Cback = cback;
+    timer->Arg = arg;
+
+    pthread_mutex_lock(&wheel.Lock);
+    if (!wheel.Running) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+        if (fd < 0) {
+            HILOGE("timerfd_create error(%d)", errno);
+            pthread_mutex_unlock(&wheel.Lock);
+            free(timer);
+            return NULL;
+        }
+        if (!wheel.EpochUs) {
+            wheel.EpochUs = tw_now_us();
+            tw_init_slots();
+        }
+        wheel.Fd = fd;
+        wheel.Tick = tw_now_tick();
+        wheel.ArmedAt = TW_NONE;
+        wheel.Running = true;
+        if (pthread_create(&wheel.Thread, NULL, tw_thread, (void *)(intptr_t)fd) != 0) {
+            HILOGE("RtkTimerAllocate: pthread_create failed");
+            wheel.Running = false;
+            wheel.Fd = -1;
+            close(fd);
+            pthread_mutex_unlock(&wheel.Lock);
+            free(timer);
+            return NULL;
+        }
+    }
+    wheel.Stats.Timers++;
+    pthread_mutex_unlock(&wheel.Lock);
+    return timer;
+}
+
+int RtkTimerFree(RTK_TIMER *timer)
+{
+    RTK_TIMER_STATS stats;
+    bool on_thread;
+    pthread_t thread;
+
+    if (!timer) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&wheel.Lock);
+    on_thread = pthread_equal(pthread_self(), wheel.Thread);
+    if (timer->Armed) {
+        tw_remove(timer);
+    }
+    while (!on_thread && wheel.Current == timer) {
+        pthread_cond_wait(&wheel.Idle, &wheel.Lock);
+    }
+    free(timer);
+
+    if (--wheel.Stats.Timers > 0) {
+        pthread_mutex_unlock(&wheel.Lock);
+        return 0;
+    }
+    // the last one, no thread left running when the library is unloaded
+    stats = wheel.Stats;
+    wheel.Running = false;
+    thread = wheel.Thread;
+    wheel.ArmedAt = TW_NONE;
+    tw_arm(0);
+    wheel.Fd = -1;
+    pthread_mutex_unlock(&wheel.Lock);
+
+    tw_dump_stats(&stats);
+    if (on_thread) {
+        pthread_detach(thread);
+    } else {
+        pthread_join(thread, NULL);
+    }
+    return 0;
+}
+
+int RtkTimerStart(RTK_TIMER *timer, uint32_t msec, bool periodic)
+{
+    uint64_t now_us = tw_now_us();
+
+    if (!timer) {
+        return -1;
+    }
+    msec = (msec > RTK_TIMER_MAX_MS) ? RTK_TIMER_MAX_MS : msec;
+
+    pthread_mutex_lock(&wheel.Lock);
+    if (timer->Armed) {
+        tw_remove(timer);
+    }
+    if (!wheel.Stats.Armed && !wheel.Current) {
+        // nothing to run on the way, the wheel can skip to now
+        uint64_t now = (now_us - wheel.EpochUs) / USEC_PER_MSEC;
+        wheel.Tick = (now > wheel.Tick) ? now : wheel.Tick;
+    }
+    timer->Period = periodic ? (msec ? msec : 1) : 0;
+    timer->Expires = tw_expires(timer, now_us, msec);
+    tw_insert(timer);
+    wheel.Stats.Starts++;
+    if (timer->Expires < wheel.ArmedAt) {
+        tw_arm(timer->Expires);
+    }
+    pthread_mutex_unlock(&wheel.Lock);
+    return 0;
+}
+
+int RtkTimerStop(RTK_TIMER *timer)
+{
+    if (!timer) {
+        return -1;
+    }
+
+    // the timerfd stays set, the wheel thread finds nothing and sets it for what is left
+    pthread_mutex_lock(&wheel.Lock);
+    if (timer->Armed) {
+        tw_remove(timer);
+        wheel.Stats.Stops++;
+    }
+    pthread_mutex_unlock(&wheel.Lock);
+    return 0;
+}
+
+void RtkTimerSetSlack(RTK_TIMER *timer, uint32_t slack_ms)
+{
+    if (timer) {
+        pthread_mutex_lock(&wheel.Lock);
+        timer->Slack = slack_ms;
+        pthread_mutex_unlock(&wheel.Lock);
+    }
+}
+
+void RtkTimerGetStats(RTK_TIMER_STATS *stats)
+{
+    pthread_mutex_lock(&wheel.Lock);
+    *stats = wheel.Stats;
+    pthread_mutex_unlock(&wheel.Lock);
+}
+
+void RtkTimerDumpStats(void)
+{
+    RTK_TIMER_STATS stats;
+
+    RtkTimerGetStats(&stats);
+    tw_dump_stats(&stats);
+}
@@ -0,0 +1,532 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2018 Realtek Corporation.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+/******************************************************************************
+ *
+ *  Filename:      rtk_timer_bench.c
+ *
+ *  Description:   Checks the timer wheel keeps its deadlines over all levels,
+ *                 then runs the timers of an A2DP stream with a HID device
+ *                 connected on it and on the SIGEV_THREAD POSIX timers the
+ *                 library had before: the H5 retransmission timer restarted
+ *                 for every ACL packet, one in a hundred lost, the A2DP,
+ *                 HOGP and polling profile timers and the heartbeat. Gives
+ *                 the threads the callbacks ran on, how late they ran and
+ *                 what starting and stopping a timer costs.
+ *
+ *                     rtk_timer_bench [seconds] [a2dp packet interval us]
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtk_timer.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+#define BENCH_SECONDS 10
+#define BENCH_A2DP_INTERVAL_US 3000 /* SBC at 328 kbit/s in 2-DH5 packets */
+#define BENCH_HID_INTERVAL_US 11250
+#define BENCH_LOSS 100              /* one packet in this many is lost, only the retransmission gets acked */
+#define BENCH_ACK_US 500
+#define BENCH_RTO_MS 20
+#define BENCH_PROFILE_MS 1000       /* PACKET_COUNT_TIOMEOUT_VALUE and a 1 s polling_time */
+#define BENCH_PROFILE_SLACK_MS 200  /* PROFILE_TIMER_SLACK */
+#define BENCH_HEARTBEAT_MS 1000
+#define BENCH_MAX_SAMPLES 65536
+#define BENCH_MAX_THREADS 4096
+#define CHECK_TIMERS 200
+#define CHECK_MAX_MS 5000           /* across the first three levels */
+#define CHECK_LATE_US 20000
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_USEC 1000LL
+#define NSEC_PER_MSEC 1000000LL
+
+#define CHECK(cond, ...)                                                                                               \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("check failed at %s:%d: ", __FILE__, __LINE__);                                                   \
+            printf(__VA_ARGS__);                                                                                       \
+            printf("\n");                                                                                              \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+typedef enum { KIND_RTO, KIND_PROFILE, KIND_HEARTBEAT, KIND_COUNT } bench_kind_t;
+
+/* A timer of the workload on either implementation */
+typedef struct {
+    bench_kind_t kind;
+    uint32_t ms;
+    bool periodic;
+    bool armed;
+    long long deadline_ns;
+    long long last_ns;
+    timer_t posix;
+    RTK_TIMER *wheel;
+} bench_timer_t;
+
+typedef struct {
+    uint32_t count;
+    long long late_ns[BENCH_MAX_SAMPLES];
+} bench_samples_t;
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool g_posix;
+static bench_samples_t g_samples[KIND_COUNT];
+static uint32_t g_expiries;
+static uint32_t g_stale;
+static bool g_lost;
+static pid_t g_tids[BENCH_MAX_THREADS];
+static uint32_t g_tid_count;
+static const char *g_kind_names[KIND_COUNT] = {"h5 retransmission", "profile counters", "heartbeat"};
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(long long ns)
+{
+    struct timespec ts = {.tv_sec = ns / NSEC_PER_SEC, .tv_nsec = ns % NSEC_PER_SEC};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/******************************************************************************
+**  The POSIX timers the library had before, OsAllocateTimer() and friends
+******************************************************************************/
+static timer_t posix_allocate(void (*cback)(union sigval), union sigval arg)
+{
+    struct sigevent sigev;
+    timer_t timerid = (timer_t)-1;
+
+    (void)memset(&sigev, 0, sizeof(sigev));
+    sigev.sigev_notify = SIGEV_THREAD;
+    sigev.sigev_notify_function = cback;
+    sigev.sigev_value = arg;
+    if (timer_create(CLOCK_REALTIME, &sigev, &timerid) != 0) {
+        return (timer_t)-1;
+    }
+    return timerid;
+}
+
+static int posix_start(timer_t timerid, int msec, int mode)
+{
+    struct itimerspec itval;
+
+    itval.it_value.tv_sec = msec / 1000;
+    itval.it_value.tv_nsec = (long)(msec % 1000) * NSEC_PER_MSEC;
+    itval.it_interval = mode ? itval.it_value : (struct timespec){0};
+    return timer_settime(timerid, 0, &itval, NULL);
+}
+
+/******************************************************************************
+**  Workload timers
+******************************************************************************/
+static void note_thread(void)
+{
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    uint32_t i;
+
+    for (i = 0; i < g_tid_count; i++) {
+        if (g_tids[i] == tid) {
+            return;
+        }
+    }
+    if (g_tid_count < BENCH_MAX_THREADS) {
+        g_tids[g_tid_count++] = tid;
+    }
+}
+
+static void bench_sample(bench_kind_t kind, long long late_ns)
+{
+    bench_samples_t *s = &g_samples[kind];
+
+    if (s->count < BENCH_MAX_SAMPLES) {
+        s->late_ns[s->count++] = late_ns;
+    }
+}
+
+static void bench_start(bench_timer_t *t)
+{
+    t->deadline_ns = now_ns() + t->ms * NSEC_PER_MSEC;
+    t->last_ns = 0;
+    t->armed = true;
+    if (g_posix) {
+        posix_start(t->posix, (int)t->ms, t->periodic);
+    } else {
+        RtkTimerStart(t->wheel, t->ms, t->periodic);
+    }
+}
+
+static void bench_stop(bench_timer_t *t)
+{
+    t->armed = false;
+    if (g_posix) {
+        posix_start(t->posix, 0, 0);
+    } else {
+        RtkTimerStop(t->wheel);
+    }
+}
+
+/*
+ * One shot timers count how late they ran, the coalesced periodic ones how far
+ * an interval was off the period
+ */
+static void bench_expired(union sigval arg)
+{
+    bench_timer_t *t = arg.sival_ptr;
+    long long now = now_ns();
+
+    pthread_mutex_lock(&g_lock);
+    note_thread();
+    if (!t->armed) {
+        // stopped while it was firing
+        g_stale++;
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+    g_expiries++;
+    if (t->periodic) {
+        if (t->last_ns) {
+            long long off = now - t->last_ns - t->ms * NSEC_PER_MSEC;
+            bench_sample(t->kind, off < 0 ? -off : off);
+        }
+        t->last_ns = now;
+    } else {
+        bench_sample(t->kind, now - t->deadline_ns);
+        t->armed = false;
+    }
+    // the retransmission gets through, acks come again
+    if (t->kind == KIND_RTO) {
+        g_lost = false;
+    }
+    // the heartbeat goes again from its own timeout, as heartbeat_timed_out() does
+    if (t->kind == KIND_HEARTBEAT) {
+        bench_start(t);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report_samples(bench_kind_t kind)
+{
+    bench_samples_t *s = &g_samples[kind];
+    long long sum = 0;
+    uint32_t i;
+
+    if (!s->count) {
+        printf("  %-18s no expiries\n", g_kind_names[kind]);
+        return;
+    }
+    qsort(s->late_ns, s->count, sizeof(s->late_ns[0]), cmp_ll);
+    for (i = 0; i < s->count; i++) {
+        sum += s->late_ns[i];
+    }
+    printf("  %-18s %6u expiries, %s avg %6lld us p99 %6lld us max %6lld us\n", g_kind_names[kind], s->count,
+           kind == KIND_PROFILE ? "period off" : "late      ", sum / s->count / NSEC_PER_USEC,
+           s->late_ns[s->count * 99 / 100] / NSEC_PER_USEC, s->late_ns[s->count - 1] / NSEC_PER_USEC);
+}
+
+/* A2DP out, HID in, on the timers of the library. Returns the ns a start plus stop took */
+static double run_workload(bool posix, uint32_t seconds, uint32_t a2dp_us, double *cpu_ms)
+{
+    bench_timer_t timers[5] = {
+        {.kind = KIND_RTO, .ms = BENCH_RTO_MS},
+        {.kind = KIND_PROFILE, .ms = BENCH_PROFILE_MS, .periodic = true}, // a2dp packet count
+        {.kind = KIND_PROFILE, .ms = BENCH_PROFILE_MS, .periodic = true}, // hogp packet count
+        {.kind = KIND_PROFILE, .ms = BENCH_PROFILE_MS, .periodic = true}, // polling
+        {.kind = KIND_HEARTBEAT, .ms = BENCH_HEARTBEAT_MS},
+    };
+    bench_timer_t *rto = &timers[0];
+    struct rusage before;
+    struct rusage after;
+    long long op_ns = 0;
+    uint32_t ops = 0;
+    long long start;
+    long long end;
+    long long next_a2dp;
+    long long next_hid;
+    uint32_t packet = 0;
+    uint32_t i;
+
+    g_posix = posix;
+    for (i = 0; i < sizeof(timers) / sizeof(timers[0]); i++) {
+        union sigval arg = {.sival_ptr = &timers[i]};
+        if (posix) {
+            timers[i].posix = posix_allocate(bench_expired, arg);
+        } else {
+            timers[i].wheel = RtkTimerAllocate(bench_expired, arg);
+            if (timers[i].kind == KIND_PROFILE) {
+                RtkTimerSetSlack(timers[i].wheel, BENCH_PROFILE_SLACK_MS);
+            }
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &before);
+    pthread_mutex_lock(&g_lock);
+    for (i = 1; i < sizeof(timers) / sizeof(timers[0]); i++) {
+        bench_start(&timers[i]);
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    start = now_ns();
+    end = start + seconds * NSEC_PER_SEC;
+    next_a2dp = start;
+    next_hid = start;
+    while (next_a2dp < end) {
+        long long t0;
+
+        if (next_hid <= next_a2dp) {
+            // a HID report comes in, the stack only counts it
+            sleep_until(next_hid);
+            next_hid += BENCH_HID_INTERVAL_US * NSEC_PER_USEC;
+            continue;
+        }
+        sleep_until(next_a2dp);
+        next_a2dp += a2dp_us * NSEC_PER_USEC;
+        packet++;
+
+        // an ACL packet goes out with the retransmission timer running, the ack stops it
+        pthread_mutex_lock(&g_lock);
+        t0 = now_ns();
+        if (!rto->armed) {
+            bench_start(rto);
+        }
+        op_ns += now_ns() - t0;
+        pthread_mutex_unlock(&g_lock);
+
+        if (packet % BENCH_LOSS == 0) {
+            g_lost = true;
+        }
+        sleep_until(now_ns() + BENCH_ACK_US * NSEC_PER_USEC);
+        pthread_mutex_lock(&g_lock);
+        t0 = now_ns();
+        if (rto->armed && !g_lost) {
+            bench_stop(rto);
+        }
+        op_ns += now_ns() - t0;
+        ops++;
+        pthread_mutex_unlock(&g_lock);
+    }
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < sizeof(timers) / sizeof(timers[0]); i++) {
+        bench_stop(&timers[i]);
+    }
+    pthread_mutex_unlock(&g_lock);
+    getrusage(RUSAGE_SELF, &after);
+    *cpu_ms = (after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_stime.tv_sec) *
+                  1000.0 +
+              (after.ru_utime.tv_usec - before.ru_utime.tv_usec + after.ru_stime.tv_usec - before.ru_stime.tv_usec) /
+                  1000.0;
+
+    // let callbacks that were on their way finish before the timers go
+    usleep(BENCH_RTO_MS * 1000 * 2);
+    for (i = 0; i < sizeof(timers) / sizeof(timers[0]); i++) {
+        if (posix) {
+            timer_delete(timers[i].posix);
+        } else {
+            RtkTimerFree(timers[i].wheel);
+        }
+    }
+    return ops ? (double)op_ns / ops : 0;
+}
+
+/******************************************************************************
+**  Checks of the wheel
+******************************************************************************/
+typedef struct {
+    long long deadline_ns;
+    long long fired_ns;
+    uint32_t fired;
+} check_timer_t;
+
+static void check_expired(union sigval arg)
+{
+    check_timer_t *c = arg.sival_ptr;
+
+    pthread_mutex_lock(&g_lock);
+    c->fired_ns = now_ns();
+    c->fired++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void check_free_self(union sigval arg)
+{
+    RTK_TIMER **timer = arg.sival_ptr;
+
+    RtkTimerFree(*timer);
+    *timer = NULL;
+}
+
+static int check_wheel(void)
+{
+    static check_timer_t checks[CHECK_TIMERS];
+    static RTK_TIMER *timers[CHECK_TIMERS];
+    RTK_TIMER *self = NULL;
+    RTK_TIMER_STATS stats;
+    uint32_t seed = 12345;
+    long long start;
+    long long max_late = 0;
+    uint32_t i;
+
+    // timers over the lowest three levels, every fourth stopped and every fourth restarted
+    start = now_ns();
+    for (i = 0; i < CHECK_TIMERS; i++) {
+        union sigval arg = {.sival_ptr = &checks[i]};
+        uint32_t ms;
+
+        seed = seed * 1103515245 + 12345;
+        ms = 1 + (seed >> 8) % CHECK_MAX_MS;
+        timers[i] = RtkTimerAllocate(check_expired, arg);
+        CHECK(timers[i] != NULL, "allocate timer %u", i);
+        pthread_mutex_lock(&g_lock);
+        checks[i].deadline_ns = now_ns() + ms * NSEC_PER_MSEC;
+        pthread_mutex_unlock(&g_lock);
+        RtkTimerStart(timers[i], ms, false);
+    }
+    for (i = 0; i < CHECK_TIMERS; i += 4) {
+        RtkTimerStop(timers[i]);
+    }
+    for (i = 1; i < CHECK_TIMERS; i += 4) {
+        pthread_mutex_lock(&g_lock);
+        checks[i].deadline_ns = now_ns() + (i % CHECK_MAX_MS) * NSEC_PER_MSEC;
+        pthread_mutex_unlock(&g_lock);
+        RtkTimerStart(timers[i], i % CHECK_MAX_MS, false);
+    }
+    sleep_until(start + (CHECK_MAX_MS + 100) * NSEC_PER_MSEC);
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < CHECK_TIMERS; i++) {
+        long long late = checks[i].fired_ns - checks[i].deadline_ns;
+
+        if (i % 4 == 0) {
+            CHECK(checks[i].fired == 0, "stopped timer %u fired", i);
+            continue;
+        }
+        CHECK(checks[i].fired == 1, "timer %u fired %u times", i, checks[i].fired);
+        CHECK(late >= 0, "timer %u fired %lld us early", i, -late / NSEC_PER_USEC);
+        max_late = (late > max_late) ? late : max_late;
+    }
+    pthread_mutex_unlock(&g_lock);
+    CHECK(max_late < CHECK_LATE_US * NSEC_PER_USEC, "a timer was %lld us late", max_late / NSEC_PER_USEC);
+
+    // periodic: ten expiries in ten periods
+    (void)memset(&checks[0], 0, sizeof(checks[0]));
+    RtkTimerStart(timers[0], 10, true);
+    usleep(105 * 1000);
+    RtkTimerStop(timers[0]);
+    pthread_mutex_lock(&g_lock);
+    CHECK(checks[0].fired == 10, "periodic timer fired %u times in 105 ms", checks[0].fired);
+    pthread_mutex_unlock(&g_lock);
+
+    // a callback can free its own timer
+    {
+        union sigval arg = {.sival_ptr = &self};
+        self = RtkTimerAllocate(check_free_self, arg);
+        RtkTimerStart(self, 1, false);
+        usleep(20 * 1000);
+        CHECK(self == NULL, "timer did not free itself");
+    }
+
+    for (i = 0; i < CHECK_TIMERS; i++) {
+        RtkTimerFree(timers[i]);
+    }
+    RtkTimerGetStats(&stats);
+    CHECK(stats.Timers == 0 && stats.Armed == 0, "%u timers %u armed left", stats.Timers, stats.Armed);
+    printf("wheel checks: %u timers up to %u ms, latest %lld us late, %llu wakeups for %llu expiries\n",
+           CHECK_TIMERS, CHECK_MAX_MS, max_late / NSEC_PER_USEC, (unsigned long long)stats.Wakeups,
+           (unsigned long long)stats.Expiries);
+    return 0;
+}
+
+/******************************************************************************
+**  Run
+******************************************************************************/
+static int run(bool posix, uint32_t seconds, uint32_t a2dp_us)
+{
+    double cpu_ms = 0;
+    double op_ns;
+    uint32_t k;
+
+    (void)memset(g_samples, 0, sizeof(g_samples));
+    g_expiries = 0;
+    g_stale = 0;
+    g_tid_count = 0;
+    g_lost = false;
+    op_ns = run_workload(posix, seconds, a2dp_us, &cpu_ms);
+
+    printf("%s:\n", posix ? "posix timers, SIGEV_THREAD" : "timer wheel");
+    printf("  callback threads %6u, %.1f per second\n", g_tid_count, (double)g_tid_count / seconds);
+    printf("  expiries         %6u, %u after a stop\n", g_expiries, g_stale);
+    printf("  start + stop     %6.0f ns\n", op_ns);
+    printf("  cpu              %6.1f ms per second\n", cpu_ms / seconds);
+    for (k = 0; k < KIND_COUNT; k++) {
+        report_samples((bench_kind_t)k);
+    }
+    if (!posix) {
+        CHECK(g_tid_count == 1, "wheel callbacks ran on %u threads", g_tid_count);
+        CHECK(g_samples[KIND_PROFILE].count >= 3 * (seconds - 2), "%u profile timer expiries",
+              g_samples[KIND_PROFILE].count);
+        CHECK(g_samples[KIND_HEARTBEAT].count >= seconds - 2, "%u heartbeats", g_samples[KIND_HEARTBEAT].count);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : BENCH_SECONDS;
+    uint32_t a2dp_us = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : BENCH_A2DP_INTERVAL_US;
+    int failures = 0;
+
+    seconds = (seconds < 3) ? 3 : seconds;
+    a2dp_us = (a2dp_us < 1000) ? 1000 : a2dp_us;
+
+    failures += check_wheel();
+    if (!failures) {
+        printf("a2dp packet every %u us, hid report every %u us, %u s\n", a2dp_us, BENCH_HID_INTERVAL_US, seconds);
+        failures += run(true, seconds, a2dp_us);
+        failures += run(false, seconds, a2dp_us);
+        RtkTimerDumpStats();
+    }
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
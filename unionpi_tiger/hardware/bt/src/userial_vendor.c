@@ -32,6 +32,7 @@
 #include <sys/eventfd.h>
 #include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <utils/Log.h>
 
@@ -142,6 +143,7 @@ typedef struct {
 **  Static functions
 ******************************************************************************/
 static void h5_data_ready_cb(serial_data_type_t type, unsigned int total_length);
+static void h5_recv_skbs_cb(RTK_BUFFER **skbs, uint32_t count);
 static uint16_t h5_int_transmit_data_cb(serial_data_type_t type, uint8_t *data, uint16_t length);
 /******************************************************************************
 **  Static variables
@@ -180,6 +182,7 @@ static rtk_parse_manager_t *rtk_parse_manager = NULL;
 static hci_h5_callbacks_t h5_int_callbacks = {
     .h5_int_transmit_data_cb = h5_int_transmit_data_cb,
     .h5_data_ready_cb = h5_data_ready_cb,
+    .h5_recv_skbs_cb = h5_recv_skbs_cb,
 };
 
 static const uint8_t hci_preamble_sizes[] = {COMMAND_PREAMBLE_SIZE, ACL_PREAMBLE_SIZE, SCO_PREAMBLE_SIZE,
@@ -718,12 +721,10 @@ static uint16_t h4_int_transmit_data(uint8_t *data, uint16_t total_length)
     return transmitted_length;
 }
 
-static void userial_enqueue_coex_rawdata(unsigned char *buffer, int length, bool is_recved)
+// the coex thread frees skb_data once it has parsed it
+static void userial_enqueue_coex_skb(RTK_BUFFER *skb_data, bool is_recved)
 {
-    RTK_BUFFER *skb_data = RtbAllocate(length, 0);
     RTK_BUFFER *skb_type = RtbAllocate(1, 0);
-    (void)memcpy_s(skb_data->Data, length, buffer, length);
-    skb_data->Length = length;
     if (is_recved) {
         *skb_type->Data = RTK_DATA_RECEIVED;
         skb_type->Length = 1;
@@ -741,6 +742,14 @@ static void userial_enqueue_coex_rawdata(unsigned char *buffer, int length, bool
     }
 }
 
+static void userial_enqueue_coex_rawdata(unsigned char *buffer, int length, bool is_recved)
+{
+    RTK_BUFFER *skb_data = RtbAllocate(length, 0);
+    (void)memcpy_s(skb_data->Data, length, buffer, length);
+    skb_data->Length = length;
+    userial_enqueue_coex_skb(skb_data, is_recved);
+}
+
 static void userial_send_cmd_to_controller(unsigned char *recv_buffer, int total_length)
 {
     char rtkbt_transtype_send_cmd = get_rtkbt_transtype();
@@ -2106,6 +2115,85 @@ static void h5_data_ready_cb(serial_data_type_t type, unsigned int total_length)
     return;
 }
 
+// A packet with no headroom left is copied into one that has some, as before batching
+static RTK_BUFFER *h5_recv_copy_skb(RTK_BUFFER *skb)
+{
+    RTK_BUFFER *copy = RtbAllocate(skb->Length, 0);
+    if (!copy) {
+        return NULL;
+    }
+    (void)memcpy_s(RtbAddTail(copy, skb->Length), skb->Length, skb->Data, skb->Length);
+    BT_CONTEXT(copy)->PacketType = BT_CONTEXT(skb)->PacketType;
+    RtbFree(skb);
+    return copy;
+}
+
+// H5 packets straight from the uart thread: the type byte goes into the headroom in front of
+// each one, the batch goes to the stack in one writev and the same buffers then go to coex
+static void h5_recv_skbs_cb(RTK_BUFFER **skbs, uint32_t count)
+{
+    struct iovec iov[count];
+    struct iovec *pending = iov;
+    int iovcnt = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        uint8_t type = BT_CONTEXT(skbs[i])->PacketType;
+        uint8_t *p_type = RtbAddHead(skbs[i], 1);
+        if (!p_type) {
+            RTK_BUFFER *copy = h5_recv_copy_skb(skbs[i]);
+            p_type = copy ? RtbAddHead(copy, 1) : NULL;
+            if (!p_type) {
+                // Without its type byte neither the stack nor the coex parser can read it
+                HILOGE("%s, no headroom for the packet type, packet dropped", __func__);
+                RtbFree(copy ? copy : skbs[i]);
+                skbs[i] = NULL;
+                continue;
+            }
+            skbs[i] = copy;
+        }
+        *p_type = type;
+#ifdef RTK_HANDLE_EVENT
+        // only events and sco are looked at, acl would just be copied through the parser
+        if (type != DATA_TYPE_ACL) {
+            unsigned int read_length = 0;
+            do {
+                read_length += userial_handle_recv_data(skbs[i]->Data + read_length, skbs[i]->Length - read_length);
+            } while (vnd_userial.thread_running && read_length < skbs[i]->Length);
+        }
+#endif
+        iov[iovcnt].iov_base = skbs[i]->Data;
+        iov[iovcnt].iov_len = skbs[i]->Length;
+        iovcnt++;
+    }
+
+    while (iovcnt > 0) {
+        ssize_t ret;
+        RTK_NO_INTR(ret = writev(vnd_userial.uart_fd[1], pending, iovcnt));
+        if (ret <= 0) {
+            // If we wrote nothing, don't loop more because we
+            // can't go to infinity or beyond
+            HILOGE("In %s, error writing to the stack socket: %s", __func__, ret ? strerror(errno) : "nothing written");
+            break;
+        }
+        while (iovcnt > 0 && (size_t)ret >= pending->iov_len) {
+            ret -= pending->iov_len;
+            pending++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            pending->iov_base = (uint8_t *)pending->iov_base + ret;
+            pending->iov_len -= ret;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (skbs[i]) {
+            userial_enqueue_coex_skb(skbs[i], true);
+        }
+    }
+}
+
 // This recv data from driver which is sent or recv by the controller. The data type have ACL/SCO/EVENT
 //  direction CONTROLLER -----> BT HOST
 static void userial_recv_uart_rawdata(unsigned char *buffer, unsigned int total_length)
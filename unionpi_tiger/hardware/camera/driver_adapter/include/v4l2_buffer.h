@@ -16,8 +16,10 @@
 #ifndef HOS_CAMERA_V4L2_BUFFER_H
 #define HOS_CAMERA_V4L2_BUFFER_H
 
+#include <array>
+#include <condition_variable>
 #include <mutex>
-#include <map>
+#include <vector>
 #include <cstring>
 #include <sys/ioctl.h>
 #include <linux/videodev2.h>
@@ -47,18 +49,66 @@ public:
 
     RetCode Flush(int fd);
 
+    RetCode GetBlitStats(int fd, V4l2BlitStats& stats);
+
 private:
+    using ExportInfo = struct _ExportInfo {
+        int dmaFd;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t pixelFormat;
+        // Only mapped when the GE2D blitter is unavailable and the CPU does the conversion
+        void* vaddr;
+        size_t length;
+    };
+
+    using StreamInfo = struct _StreamInfo {
+        enum v4l2_memory memory;
+        uint32_t width;
+        uint32_t height;
+        uint32_t pixelFormat;
+        uint32_t count;
+    };
+
+    // Per device fd bookkeeping, slots and exports are addressed by the V4L2 buffer index
+    using FrameQueue = struct _FrameQueue {
+        int fd = -1;
+        StreamInfo info = {};
+        std::vector<std::shared_ptr<FrameSpec>> slots;
+        std::vector<ExportInfo> exports;
+        V4l2BlitStats stats = {};
+        uint32_t blitting = 0; // dequeued frames still reading an export, ReleaseQueue waits for them
+    };
+
+    FrameQueue* FindQueue(int fd);
+    RetCode RequestBuffers(int fd, unsigned int buffCont, enum v4l2_memory memType);
+    RetCode V4L2QueryBuffer(int fd, enum v4l2_memory memType, const std::shared_ptr<FrameSpec>& frameSpec);
+    RetCode GetStreamInfo(int fd, StreamInfo& info);
+    enum v4l2_memory GetMemoryType(int fd);
+    bool CanImportBuffer(int fd, const std::shared_ptr<FrameSpec>& frameSpec);
+    RetCode ImportFallback(int fd);
+    RetCode SetupQueue(int fd, const StreamInfo& info);
+    void ReleaseQueue(int fd);
+    void MapExport(ExportInfo& info);
+    void CloseExports(std::vector<ExportInfo>& exports);
+    RetCode CreateExportCache(int fd, unsigned int buffCont, const StreamInfo& stream,
+        std::vector<ExportInfo>& exports);
+    RetCode ConvertForMMAP(const ExportInfo& src, const std::shared_ptr<IBuffer>& toBuffer, uint64_t& useUs);
+    RetCode BlitForMMAP(const ExportInfo& src, const std::shared_ptr<IBuffer>& toBuffer, uint64_t& useUs);
+    void UpdateBlitStats(int fd, uint64_t useUs, bool failed);
+
     BufCallback dequeueBuffer_;
 
-    using FrameMap = std::map<unsigned int, std::shared_ptr<FrameSpec>>;
-    std::map<int, FrameMap> queueBuffers_;
+    std::array<FrameQueue, MAXSTREAMCOUNT> frameQueues_;
 
+    // Only guards slot publication, never held across ioctl, blit or the upper layer callback
     std::mutex bufferLock_;
+    std::condition_variable blitDone_;
 
     enum v4l2_memory memoryType_;
     enum v4l2_buf_type bufferType_;
 
-    RetCode BlitForMMAP(int fd, uint32_t fromIndex, std::shared_ptr<IBuffer> toBuffer);
     void *ge2d_;
 };
 } // namespace OHOS::Camera
@@ -89,6 +89,24 @@ using DeviceControl = struct _V4l2Control {
     std::vector<V4l2Menu> menu;
 };
 
+using V4l2BlitStats = struct _V4l2BlitStats {
+    uint64_t frameCount;
+    uint64_t failCount;
+    uint64_t lastUs;
+    uint64_t maxUs;
+    uint64_t totalUs;
+};
+
+enum V4l2ThreadMode : uint32_t {
+    V4L2_THREAD_SHARED,
+    V4L2_THREAD_PER_STREAM,
+};
+
+using V4l2WorkerConfig = struct _V4l2WorkerConfig {
+    int32_t cpu;
+    int32_t priority;
+};
+
 enum V4l2FmtCmd : uint32_t {
     CMD_V4L2_GET_FORMAT,
     CMD_V4L2_SET_FORMAT,
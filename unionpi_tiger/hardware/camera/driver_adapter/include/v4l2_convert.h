@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOS_CAMERA_V4L2_CONVERT_H
+#define HOS_CAMERA_V4L2_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/videodev2.h>
+#include "v4l2_common.h"
+#if defined(V4L2_UTEST) || defined (V4L2_MAIN_TEST)
+#include "v4l2_temp.h"
+#else
+#include <camera.h>
+#endif
+
+namespace OHOS::Camera {
+// CPU replacement for the GE2D stretch blit, used when the blitter is not available.
+// Formats are V4L2 fourccs with the byte order documented in videodev2.h, planes packed
+// without padding. Scaling is nearest neighbour, colour conversion is BT.601 limited range.
+enum V4l2ConvertIsa : uint32_t {
+    V4L2_ISA_AUTO,
+    V4L2_ISA_SCALAR,
+    V4L2_ISA_SSE2,
+    V4L2_ISA_AVX2,
+    V4L2_ISA_NEON,
+};
+
+using V4l2Image = struct _V4l2Image {
+    uint8_t* data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelFormat;
+    size_t size;
+};
+
+bool V4l2ConvertSupported(uint32_t srcFormat, uint32_t dstFormat);
+size_t V4l2ImageSize(uint32_t pixelFormat, uint32_t width, uint32_t height);
+RetCode V4l2ConvertImage(const V4l2Image& src, const V4l2Image& dst);
+
+// V4L2_ISA_AUTO picks the best kernels the CPU supports, anything else fails if unsupported
+RetCode V4l2ConvertSetIsa(V4l2ConvertIsa isa);
+V4l2ConvertIsa V4l2ConvertGetIsa();
+const char* V4l2ConvertIsaName(V4l2ConvertIsa isa);
+
+// Threads used for large frames, including the caller. 0 restores the default.
+void V4l2ConvertSetThreads(uint32_t count);
+} // namespace OHOS::Camera
+#endif // HOS_CAMERA_V4L2_CONVERT_H
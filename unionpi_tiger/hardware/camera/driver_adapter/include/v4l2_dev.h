@@ -15,6 +15,7 @@
 #ifndef HOS_CAMERA_V4L2_DEV_H
 #define HOS_CAMERA_V4L2_DEV_H
 
+#include <atomic>
 #include <map>
 #include <mutex>
 #include <thread>
@@ -77,6 +78,12 @@ public:
 
     RetCode Flush(const std::string& cameraID);
 
+    RetCode GetBlitStats(const std::string& cameraID, V4l2BlitStats& stats);
+
+    RetCode SetThreadMode(V4l2ThreadMode mode);
+
+    RetCode SetWorkerConfig(const std::string& cameraID, const V4l2WorkerConfig& config);
+
     static RetCode Init(std::vector<std::string>& cameraIDs);
 
     static std::map<std::string, std::string> deviceMatch;
@@ -98,7 +105,20 @@ public:
     }
 
 private:
+    // Used in V4L2_THREAD_PER_STREAM mode, one dequeue thread and one HosV4L2Buffers per device fd
+    using StreamWorker = struct _StreamWorker {
+        int fd = -1;
+        int epollFd = -1;
+        int eventFd = -1;
+        std::thread* thread = nullptr;
+        std::shared_ptr<HosV4L2Buffers> buffers = nullptr;
+    };
+
     int GetCurrentFd(const std::string& cameraID);
+    std::shared_ptr<HosV4L2Buffers> GetBuffers(int fd);
+    RetCode StartWorker(const std::string& cameraID, int fd);
+    RetCode StopWorker(int fd);
+    void workerLoop(std::shared_ptr<StreamWorker> worker, V4l2WorkerConfig config);
     void loopBuffers();
     RetCode CreateEpoll(int fd, const unsigned int streamNumber);
     void EraseEpoll(int fd);
@@ -115,6 +135,12 @@ private:
     std::mutex epollLock_;
 
     std::shared_ptr<HosV4L2Buffers> myBuffers_ = nullptr;
+    BufCallback bufCallback_ = nullptr;
+
+    std::atomic<V4l2ThreadMode> threadMode_ {V4L2_THREAD_SHARED}; // written under workerLock_, read without it
+    std::map<int, std::shared_ptr<StreamWorker>> workers_;
+    std::map<std::string, V4l2WorkerConfig> workerConfigs_;
+    std::mutex workerLock_;
     std::shared_ptr<HosV4L2Streams> myStreams_ = nullptr;
     std::shared_ptr<HosFileFormat> myFileFormat_ = nullptr;
     std::shared_ptr<HosV4L2Control> myControl_ = nullptr;
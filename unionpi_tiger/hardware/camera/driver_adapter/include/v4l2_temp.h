@@ -108,6 +108,11 @@ public:
         return 0;
     }
 
+    int32_t GetStreamId()
+    {
+        return 0;
+    }
+
     void SetBufferStatus(const CameraBufferStatus flag)
     {
     }
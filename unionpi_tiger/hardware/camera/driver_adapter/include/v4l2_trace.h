@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOS_CAMERA_V4L2_TRACE_H
+#define HOS_CAMERA_V4L2_TRACE_H
+
+#include <cstdint>
+#include <vector>
+#if defined(V4L2_UTEST) || defined (V4L2_MAIN_TEST)
+#include "v4l2_temp.h"
+#else
+#include <camera.h>
+#endif
+
+namespace OHOS::Camera {
+// Per-frame pipeline trace. Every stage a frame passes is written as one record into a ring
+// that lives in a shared file, so a separate process (v4l2_trace_dump) can read it while the
+// camera host runs. Recording is lock free and does nothing until a reader enables the ring.
+// The host only creates and maps the ring once V4L2_TRACE_ENABLE_PATH exists.
+#ifndef V4L2_TRACE_PATH
+#define V4L2_TRACE_PATH "/data/local/tmp/camera_v4l2_trace"
+#endif
+#ifndef V4L2_TRACE_ENABLE_PATH
+#define V4L2_TRACE_ENABLE_PATH V4L2_TRACE_PATH ".enable"
+#endif
+
+enum V4l2TraceStage : uint32_t {
+    V4L2_TRACE_DQBUF,
+    V4L2_TRACE_BLIT_BEGIN,
+    V4L2_TRACE_BLIT_END,
+    V4L2_TRACE_DELIVER,
+    V4L2_TRACE_ENCODE_BEGIN,
+    V4L2_TRACE_ENCODE_END,
+    V4L2_TRACE_PORT_OUT,
+    V4L2_TRACE_DROP,
+    V4L2_TRACE_STAGE_COUNT,
+};
+
+using V4l2TraceEvent = struct _V4l2TraceEvent {
+    uint64_t seq;
+    uint64_t tsNs;
+    int32_t streamId;
+    int32_t bufferIndex;
+    V4l2TraceStage stage;
+};
+
+// Recorders map V4L2_TRACE_PATH once tracing is enabled, V4l2TraceInit() maps a ring right away
+RetCode V4l2TraceInit(const char* path);
+void V4l2TraceRecord(V4l2TraceStage stage, int32_t streamId, int32_t bufferIndex);
+const char* V4l2TraceStageName(V4l2TraceStage stage);
+uint64_t V4l2TraceNowNs();
+
+class V4l2TraceReader {
+public:
+    V4l2TraceReader() = default;
+    ~V4l2TraceReader();
+
+    RetCode Open(const char* path);
+    void Close();
+    void SetEnabled(bool enabled);
+
+    // Appends the records written since the last call. Records overwritten before they
+    // could be read are counted in lost.
+    void Read(std::vector<V4l2TraceEvent>& events, uint64_t& lost);
+
+private:
+    void* ring_ = nullptr;
+    uint64_t next_ = 0;
+};
+} // namespace OHOS::Camera
+#endif // HOS_CAMERA_V4L2_TRACE_H
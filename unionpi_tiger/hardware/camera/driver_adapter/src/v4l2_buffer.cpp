@@ -14,8 +14,11 @@
  */
 
 #include <unistd.h>
+#include <sys/mman.h>
 #include "aml_ge2d.h"
 #include "v4l2_buffer.h"
+#include "v4l2_convert.h"
+#include "v4l2_trace.h"
 namespace OHOS::Camera {
 #define OUTPUT_V4L2_PIX_FMT V4L2_PIX_FMT_NV21
 using Ge2dCanvasInfo = struct _Ge2dCanvasInfo {
@@ -137,11 +140,11 @@ static int doBlit(aml_ge2d_t *ge2d, Ge2dCanvasInfo & srcInfo, Ge2dCanvasInfo & d
     return ret;
 }
 
-static inline uint64_t getTickMs()
+static inline uint64_t getTickUs()
 {
     struct timespec ts = {};
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_nsec / 1000000ULL + ts.tv_sec * 1000ULL;
+    return ts.tv_nsec / 1000ULL + ts.tv_sec * 1000000ULL;
 }
 
 HosV4L2Buffers::HosV4L2Buffers(enum v4l2_memory memType, enum v4l2_buf_type bufferType)
@@ -168,6 +171,10 @@ HosV4L2Buffers::HosV4L2Buffers(enum v4l2_memory memType, enum v4l2_buf_type buff
 
 HosV4L2Buffers::~HosV4L2Buffers()
 {
+    for (auto &queue : frameQueues_) {
+        CloseExports(queue.exports);
+    }
+
     if (ge2d_) {
         aml_ge2d_exit((aml_ge2d_t*)ge2d_);
         CAMERA_LOGD("aml_ge2d_exit()");
@@ -175,18 +182,28 @@ HosV4L2Buffers::~HosV4L2Buffers()
     }
 }
 
-RetCode HosV4L2Buffers::V4L2ReqBuffers(int fd, int unsigned buffCont)
+// Must be called with bufferLock_ held
+HosV4L2Buffers::FrameQueue* HosV4L2Buffers::FindQueue(int fd)
 {
-    struct v4l2_requestbuffers req = {};
+    for (auto &queue : frameQueues_) {
+        if (queue.fd == fd) {
+            return &queue;
+        }
+    }
 
-    CAMERA_LOGD("V4L2ReqBuffers buffCont %d\n", buffCont);
+    return nullptr;
+}
+
+RetCode HosV4L2Buffers::RequestBuffers(int fd, unsigned int buffCont, enum v4l2_memory memType)
+{
+    struct v4l2_requestbuffers req = {};
 
     req.count = buffCont;
     req.type = bufferType_;
-    req.memory = memoryType_;
+    req.memory = memType;
 
     if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
-        CAMERA_LOGE("does not support memory mapping %s\n", strerror(errno));
+        CAMERA_LOGE("does not support memory type %{public}d %{public}s\n", memType, strerror(errno));
         return RC_ERROR;
     }
 
@@ -195,7 +212,7 @@ RetCode HosV4L2Buffers::V4L2ReqBuffers(int fd, int unsigned buffCont)
 
         req.count = 0;
         req.type = bufferType_;
-        req.memory = memoryType_;
+        req.memory = memType;
         if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
             CAMERA_LOGE("V4L2ReqBuffers does not release buffer	%s\n", strerror(errno));
             return RC_ERROR;
@@ -207,6 +224,197 @@ RetCode HosV4L2Buffers::V4L2ReqBuffers(int fd, int unsigned buffCont)
     return RC_OK;
 }
 
+RetCode HosV4L2Buffers::GetStreamInfo(int fd, StreamInfo& info)
+{
+    struct v4l2_format fmt = {};
+
+    fmt.type = bufferType_;
+    if (ioctl(fd, VIDIOC_G_FMT, &fmt) < 0) {
+        CAMERA_LOGE("error: ioctl VIDIOC_G_FMT failed: %s\n", strerror(errno));
+        return RC_ERROR;
+    }
+
+    if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        info.width = fmt.fmt.pix_mp.width;
+        info.height = fmt.fmt.pix_mp.height;
+        info.pixelFormat = fmt.fmt.pix_mp.pixelformat;
+    } else {
+        info.width = fmt.fmt.pix.width;
+        info.height = fmt.fmt.pix.height;
+        info.pixelFormat = fmt.fmt.pix.pixelformat;
+    }
+
+    return RC_OK;
+}
+
+enum v4l2_memory HosV4L2Buffers::GetMemoryType(int fd)
+{
+    std::lock_guard<std::mutex> l(bufferLock_);
+
+    FrameQueue* queue = FindQueue(fd);
+    if (queue == nullptr) {
+        return memoryType_;
+    }
+
+    return queue->info.memory;
+}
+
+RetCode HosV4L2Buffers::V4L2ReqBuffers(int fd, int unsigned buffCont)
+{
+    StreamInfo info = {};
+    RetCode rc;
+
+    CAMERA_LOGD("V4L2ReqBuffers buffCont %d\n", buffCont);
+
+    if (buffCont == 0) {
+        enum v4l2_memory memType = GetMemoryType(fd);
+        // Exported dmabufs pin the MMAP buffers, drop them before the queue is freed
+        ReleaseQueue(fd);
+        return RequestBuffers(fd, 0, memType);
+    }
+    ReleaseQueue(fd);
+
+    if (GetStreamInfo(fd, info) == RC_ERROR) {
+        return RC_ERROR;
+    }
+    info.count = buffCont;
+
+    // The sensor already outputs the pipeline format, let it write straight into the pipeline buffers
+    info.memory = memoryType_;
+    if (memoryType_ == V4L2_MEMORY_MMAP && info.pixelFormat == OUTPUT_V4L2_PIX_FMT) {
+        info.memory = V4L2_MEMORY_DMABUF;
+    }
+
+    rc = RequestBuffers(fd, buffCont, info.memory);
+    if (rc == RC_ERROR && info.memory != memoryType_) {
+        CAMERA_LOGD("V4L2ReqBuffers dmabuf import unsupported, fall back to memory type %{public}d\n", memoryType_);
+        info.memory = memoryType_;
+        rc = RequestBuffers(fd, buffCont, info.memory);
+    }
+    if (rc == RC_ERROR) {
+        return RC_ERROR;
+    }
+
+    return SetupQueue(fd, info);
+}
+
+RetCode HosV4L2Buffers::SetupQueue(int fd, const StreamInfo& info)
+{
+    std::vector<ExportInfo> exports;
+
+    if (info.memory == V4L2_MEMORY_MMAP && CreateExportCache(fd, info.count, info, exports) == RC_ERROR) {
+        return RC_ERROR;
+    }
+
+    std::lock_guard<std::mutex> l(bufferLock_);
+    FrameQueue* queue = FindQueue(fd);
+    if (queue == nullptr) {
+        queue = FindQueue(-1);
+    }
+    if (queue == nullptr) {
+        CAMERA_LOGE("SetupQueue no free queue for fd %{public}d, max %{public}d streams\n", fd, MAXSTREAMCOUNT);
+        for (auto &it : exports) {
+            close(it.dmaFd);
+        }
+        return RC_ERROR;
+    }
+
+    queue->fd = fd;
+    queue->info = info;
+    queue->slots.assign(info.count, nullptr);
+    queue->exports = std::move(exports);
+    queue->stats = {};
+
+    return RC_OK;
+}
+
+void HosV4L2Buffers::ReleaseQueue(int fd)
+{
+    std::vector<ExportInfo> exports;
+
+    {
+        std::unique_lock<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue == nullptr) {
+            return;
+        }
+
+        // The loop thread may still be blitting a frame of this queue it dequeued before StreamOff
+        blitDone_.wait(l, [queue] { return queue->blitting == 0; });
+        exports.swap(queue->exports);
+        queue->slots.clear();
+        queue->fd = -1;
+    }
+
+    CloseExports(exports);
+}
+
+void HosV4L2Buffers::CloseExports(std::vector<ExportInfo>& exports)
+{
+    for (auto &info : exports) {
+        if (info.vaddr != nullptr) {
+            munmap(info.vaddr, info.length);
+        }
+        if (info.dmaFd >= 0) {
+            close(info.dmaFd);
+        }
+    }
+    exports.clear();
+}
+
+// A failed map only costs the CPU fallback for that buffer, BlitForMMAP reports it per frame
+void HosV4L2Buffers::MapExport(ExportInfo& info)
+{
+    off_t length = lseek(info.dmaFd, 0, SEEK_END);
+    if (length <= 0) {
+        CAMERA_LOGE("MapExport: lseek dmaFd %{public}d failed: %{public}s\n", info.dmaFd, strerror(errno));
+        return;
+    }
+
+    void* vaddr = mmap(nullptr, length, PROT_READ, MAP_SHARED, info.dmaFd, 0);
+    if (vaddr == MAP_FAILED) {
+        CAMERA_LOGE("MapExport: mmap dmaFd %{public}d failed: %{public}s\n", info.dmaFd, strerror(errno));
+        return;
+    }
+    info.vaddr = vaddr;
+    info.length = static_cast<size_t>(length);
+}
+
+RetCode HosV4L2Buffers::CreateExportCache(int fd, unsigned int buffCont, const StreamInfo& stream,
+    std::vector<ExportInfo>& exports)
+{
+    ExportInfo info = {};
+
+    info.width = stream.width;
+    info.height = stream.height;
+    info.format = pixelFormatV4l2ToGe2d(stream.pixelFormat);
+    info.pixelFormat = stream.pixelFormat;
+
+    for (unsigned int i = 0; i < buffCont; ++i) {
+        struct v4l2_exportbuffer expbuf = {};
+
+        expbuf.type = bufferType_;
+        expbuf.index = i;
+        if (ioctl(fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+            CAMERA_LOGE("error: ioctl VIDIOC_EXPBUF index %{public}u failed: %{public}s\n", i, strerror(errno));
+            CloseExports(exports);
+            return RC_ERROR;
+        }
+        info.dmaFd = expbuf.fd;
+        info.vaddr = nullptr;
+        info.length = 0;
+        if (ge2d_ == nullptr) {
+            MapExport(info);
+        }
+        exports.push_back(info);
+    }
+
+    CAMERA_LOGD("CreateExportCache fd = %{public}d count = %{public}u size = %{public}ux%{public}u fmt = %{public}u\n",
+        fd, buffCont, info.width, info.height, info.format);
+
+    return RC_OK;
+}
+
 RetCode HosV4L2Buffers::V4L2QueueBuffer(int fd, const std::shared_ptr<FrameSpec>& frameSpec)
 {
     struct v4l2_buffer buf = {};
@@ -219,12 +427,16 @@ RetCode HosV4L2Buffers::V4L2QueueBuffer(int fd, const std::shared_ptr<FrameSpec>
 
     buf.index = (uint32_t)frameSpec->buffer_->GetIndex();
     buf.type = bufferType_;
-    buf.memory = memoryType_;
+    buf.memory = GetMemoryType(fd);
 
     if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
         buf.m.planes = planes;
         buf.m.planes[0].length = frameSpec->buffer_->GetSize();
-        buf.m.planes[0].m.userptr = (unsigned long)frameSpec->buffer_->GetVirAddress();
+        if (buf.memory == V4L2_MEMORY_DMABUF) {
+            buf.m.planes[0].m.fd = frameSpec->buffer_->GetFileDescriptor();
+        } else {
+            buf.m.planes[0].m.userptr = (unsigned long)frameSpec->buffer_->GetVirAddress();
+        }
         buf.length = 1;
 
         CAMERA_LOGD("++++++++++++ V4L2QueueBuffer buf.index = %{public}d, buf.length = \
@@ -232,31 +444,39 @@ RetCode HosV4L2Buffers::V4L2QueueBuffer(int fd, const std::shared_ptr<FrameSpec>
             buf.index, buf.m.planes[0].length, (void*)buf.m.planes[0].m.userptr);
     } else if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
         buf.length = frameSpec->buffer_->GetSize();
-        buf.m.userptr = (unsigned long)frameSpec->buffer_->GetVirAddress();
+        if (buf.memory == V4L2_MEMORY_DMABUF) {
+            buf.m.fd = frameSpec->buffer_->GetFileDescriptor();
+        } else {
+            buf.m.userptr = (unsigned long)frameSpec->buffer_->GetVirAddress();
+        }
 
         CAMERA_LOGD("++++++++++++ V4L2QueueBuffer buf.index = %{public}d, buf.length = \
             %{public}d, buf.m.userptr = %{public}p\n", \
             buf.index, buf.length, (void*)buf.m.userptr);
     }
 
-    std::lock_guard<std::mutex> l(bufferLock_);
+    {
+        // Publish before QBUF, the buffer may complete before the ioctl even returns
+        std::lock_guard<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue == nullptr || buf.index >= queue->slots.size()) {
+            CAMERA_LOGE("V4L2QueueBuffer fd = %{public}d buf.index = %{public}d has no slot\n", fd, buf.index);
+            return RC_ERROR;
+        }
+        queue->slots[buf.index] = frameSpec;
+    }
+
     int rc = ioctl(fd, VIDIOC_QBUF, &buf);
     if (rc < 0) {
         CAMERA_LOGE("ioctl VIDIOC_QBUF failed: %s\n", strerror(errno));
+        std::lock_guard<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue != nullptr && buf.index < queue->slots.size()) {
+            queue->slots[buf.index] = nullptr;
+        }
         return RC_ERROR;
     }
 
-    auto itr = queueBuffers_.find(fd);
-    if (itr != queueBuffers_.end()) {
-        itr->second[buf.index] = frameSpec;
-        CAMERA_LOGD("insert frameMap fd = %{public}d buf.index = %{public}d\n", fd, buf.index);
-    } else {
-        FrameMap frameMap;
-        frameMap.insert(std::make_pair(buf.index, frameSpec));
-        queueBuffers_.insert(std::make_pair(fd, frameMap));
-        CAMERA_LOGD("insert fd = %{public}d buf.index = %{public}d\n", fd, buf.index);
-    }
-
     return RC_OK;
 }
 
@@ -264,9 +484,13 @@ RetCode HosV4L2Buffers::V4L2DequeueBuffer(int fd)
 {
     struct v4l2_buffer buf = {};
     struct v4l2_plane planes[1] = {};
+    std::shared_ptr<FrameSpec> frameSpec = nullptr;
+    ExportInfo src = {};
+    FrameQueue* pinned = nullptr;
+    uint64_t useUs = 0;
 
     buf.type = bufferType_;
-    buf.memory = memoryType_;
+    buf.memory = GetMemoryType(fd);
 
     if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
         buf.m.planes = planes;
@@ -286,85 +510,179 @@ RetCode HosV4L2Buffers::V4L2DequeueBuffer(int fd)
             buf.index, (void*)buf.m.userptr, buf.length);
     }
 
-    std::lock_guard<std::mutex> l(bufferLock_);
-
-    auto IterMap = queueBuffers_.find(fd);
-    if (IterMap == queueBuffers_.end()) {
-        CAMERA_LOGE("std::map queueBuffers_ no fd\n");
-        return RC_ERROR;
-    }
-    auto& bufferMap = IterMap->second;
+    {
+        std::lock_guard<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue == nullptr) {
+            CAMERA_LOGE("V4L2DequeueBuffer no queue for fd %{public}d\n", fd);
+            return RC_ERROR;
+        }
+        if (buf.index >= queue->slots.size() || queue->slots[buf.index] == nullptr) {
+            CAMERA_LOGE("V4L2DequeueBuffer buf.index == %{public}d is not queued\n", buf.index);
+            return RC_ERROR;
+        }
+        frameSpec = std::move(queue->slots[buf.index]);
+        queue->slots[buf.index] = nullptr;
 
-    auto Iter = bufferMap.find(buf.index);
-    if (Iter == bufferMap.end()) {
-        CAMERA_LOGE("V4L2DequeueBuffer buf.index == %{public}d is not find in FrameMap\n", buf.index);
-        return RC_ERROR;
+        if (buf.memory == V4L2_MEMORY_MMAP && buf.index < queue->exports.size()) {
+            src = queue->exports[buf.index];
+            pinned = queue;
+            pinned->blitting++;
+        }
     }
 
     if (dequeueBuffer_ == nullptr) {
         CAMERA_LOGE("V4L2DequeueBuffer buf.index == %{public}d no callback\n", buf.index);
-        bufferMap.erase(Iter);
+        if (pinned != nullptr) {
+            std::lock_guard<std::mutex> l(bufferLock_);
+            pinned->blitting--;
+            blitDone_.notify_all();
+        }
         return RC_ERROR;
     }
 
-    if (memoryType_ == V4L2_MEMORY_MMAP) {
-        BlitForMMAP(fd, buf.index, Iter->second->buffer_);
+    int32_t streamId = frameSpec->buffer_->GetStreamId();
+    V4l2TraceRecord(V4L2_TRACE_DQBUF, streamId, buf.index);
+    if (buf.memory == V4L2_MEMORY_MMAP) {
+        V4l2TraceRecord(V4L2_TRACE_BLIT_BEGIN, streamId, buf.index);
+        rc = BlitForMMAP(src, frameSpec->buffer_, useUs);
+        V4l2TraceRecord(V4L2_TRACE_BLIT_END, streamId, buf.index);
+        UpdateBlitStats(fd, useUs, rc != RC_OK);
+    }
+    if (pinned != nullptr) {
+        std::lock_guard<std::mutex> l(bufferLock_);
+        pinned->blitting--;
+        blitDone_.notify_all();
     }
 
     // callback to up
-    dequeueBuffer_(Iter->second);
-
-    bufferMap.erase(Iter);
+    dequeueBuffer_(frameSpec);
 
     return RC_OK;
 }
 
-RetCode HosV4L2Buffers::V4L2AllocBuffer(int fd, const std::shared_ptr<FrameSpec>& frameSpec)
+RetCode HosV4L2Buffers::V4L2QueryBuffer(int fd, enum v4l2_memory memType, const std::shared_ptr<FrameSpec>& frameSpec)
 {
     struct v4l2_buffer buf = {};
     struct v4l2_plane planes[1] = {};
-    CAMERA_LOGD("V4L2AllocBuffer\n");
+    uint32_t length;
 
-    if (frameSpec == nullptr) {
-        CAMERA_LOGE("V4L2AllocBuffer frameSpec is NULL\n");
+    buf.type = bufferType_;
+    buf.memory = memType;
+    buf.index = (uint32_t)frameSpec->buffer_->GetIndex();
+
+    if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        buf.m.planes = planes;
+        buf.length = 1;
+    }
+    CAMERA_LOGD("V4L2QueryBuffer memory %{public}d Print the cnt: %{public}d\n", memType, buf.index);
+
+    if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+        CAMERA_LOGE("error: ioctl VIDIOC_QUERYBUF failed: %{public}s\n", strerror(errno));
         return RC_ERROR;
     }
 
-    switch (memoryType_) {
-        case V4L2_MEMORY_MMAP:
-            break;
-        case V4L2_MEMORY_USERPTR:
-            buf.type = bufferType_;
-            buf.memory = memoryType_;
-            buf.index = (uint32_t)frameSpec->buffer_->GetIndex();
+    length = (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ? buf.m.planes[0].length : buf.length;
+    CAMERA_LOGD("buf.length = %{public}d frameSpec->buffer_->GetSize() = %{public}d\n", length,
+                frameSpec->buffer_->GetSize());
 
-            if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
-                buf.m.planes = planes;
-                buf.length = 1;
-            }
-            CAMERA_LOGD("V4L2_MEMORY_USERPTR Print the cnt: %{public}d\n", buf.index);
+    if (length > frameSpec->buffer_->GetSize()) {
+        CAMERA_LOGE("ERROR:user buff < V4L2 buf.length\n");
+        return RC_ERROR;
+    }
+
+    return RC_OK;
+}
+
+bool HosV4L2Buffers::CanImportBuffer(int fd, const std::shared_ptr<FrameSpec>& frameSpec)
+{
+    StreamInfo info = {};
 
-            if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
-                CAMERA_LOGE("error: ioctl VIDIOC_QUERYBUF failed: %{public}s\n", strerror(errno));
+    {
+        std::lock_guard<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue == nullptr) {
+            return false;
+        }
+        info = queue->info;
+    }
+
+    if (frameSpec->buffer_->GetFileDescriptor() < 0) {
+        CAMERA_LOGD("CanImportBuffer index %{public}d has no dmabuf fd\n", frameSpec->buffer_->GetIndex());
+        return false;
+    }
+
+    // No GE2D stage behind an imported buffer, so nothing can rescale a geometry mismatch
+    if (frameSpec->buffer_->GetWidth() != info.width || frameSpec->buffer_->GetHeight() != info.height) {
+        CAMERA_LOGD("CanImportBuffer buffer %{public}ux%{public}u does not match sensor %{public}ux%{public}u\n",
+            frameSpec->buffer_->GetWidth(), frameSpec->buffer_->GetHeight(), info.width, info.height);
+        return false;
+    }
+
+    return true;
+}
+
+RetCode HosV4L2Buffers::ImportFallback(int fd)
+{
+    StreamInfo info = {};
+
+    {
+        std::lock_guard<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue == nullptr) {
+            return RC_ERROR;
+        }
+        for (auto &slot : queue->slots) {
+            if (slot != nullptr) {
+                CAMERA_LOGE("ImportFallback fd %{public}d already has imported buffers queued\n", fd);
                 return RC_ERROR;
             }
+        }
+        info = queue->info;
+    }
 
-            CAMERA_LOGD("buf.length = %{public}d frameSpec->buffer_->GetSize() = %{public}d\n", buf.length,
-                        frameSpec->buffer_->GetSize());
+    CAMERA_LOGD("ImportFallback fd %{public}d reallocate %{public}u buffers as memory type %{public}d\n",
+        fd, info.count, memoryType_);
+
+    if (RequestBuffers(fd, 0, info.memory) == RC_ERROR) {
+        return RC_ERROR;
+    }
+
+    info.memory = memoryType_;
+    if (RequestBuffers(fd, info.count, info.memory) == RC_ERROR) {
+        return RC_ERROR;
+    }
+
+    return SetupQueue(fd, info);
+}
+
+RetCode HosV4L2Buffers::V4L2AllocBuffer(int fd, const std::shared_ptr<FrameSpec>& frameSpec)
+{
+    enum v4l2_memory memType = GetMemoryType(fd);
+    CAMERA_LOGD("V4L2AllocBuffer\n");
+
+    if (frameSpec == nullptr) {
+        CAMERA_LOGE("V4L2AllocBuffer frameSpec is NULL\n");
+        return RC_ERROR;
+    }
 
-            if (buf.length > frameSpec->buffer_->GetSize()) {
-                CAMERA_LOGE("ERROR:user buff < V4L2 buf.length\n");
+    switch (memType) {
+        case V4L2_MEMORY_MMAP:
+            break;
+        case V4L2_MEMORY_USERPTR:
+            if (V4L2QueryBuffer(fd, memType, frameSpec) == RC_ERROR) {
                 return RC_ERROR;
             }
-
             break;
         case V4L2_MEMORY_OVERLAY:
             // to do something
             break;
 
         case V4L2_MEMORY_DMABUF:
-            // to do something
-            break;
+            if (CanImportBuffer(fd, frameSpec)) {
+                return V4L2QueryBuffer(fd, memType, frameSpec);
+            }
+            return ImportFallback(fd);
 
         default:
             CAMERA_LOGE("It can not be happening - incorrect memory type\n");
@@ -378,9 +696,6 @@ RetCode HosV4L2Buffers::V4L2ReleaseBuffers(int fd)
 {
     CAMERA_LOGE("HosV4L2Buffers::V4L2ReleaseBuffers\n");
 
-    std::lock_guard<std::mutex> l(bufferLock_);
-    queueBuffers_.erase(fd);
-
     return V4L2ReqBuffers(fd, 0);
 }
 
@@ -392,23 +707,32 @@ void HosV4L2Buffers::SetCallback(BufCallback cb)
 
 RetCode HosV4L2Buffers::Flush(int fd)
 {
+    std::vector<std::shared_ptr<FrameSpec>> frames;
+
     CAMERA_LOGD("HosV4L2Buffers::Flush enter\n");
-    std::lock_guard<std::mutex> l(bufferLock_);
 
     if (dequeueBuffer_ == nullptr) {
         CAMERA_LOGE("HosV4L2Buffers::Flush  dequeueBuffer_ == nullptr");
         return RC_ERROR;
     }
 
-    auto IterMap = queueBuffers_.find(fd);
-    if (IterMap == queueBuffers_.end()) {
-        CAMERA_LOGE("HosV4L2Buffers::Flush std::map queueBuffers_ no fd");
-        return RC_ERROR;
+    {
+        std::lock_guard<std::mutex> l(bufferLock_);
+        FrameQueue* queue = FindQueue(fd);
+        if (queue == nullptr) {
+            CAMERA_LOGE("HosV4L2Buffers::Flush no queue for fd");
+            return RC_ERROR;
+        }
+
+        for (auto &slot : queue->slots) {
+            if (slot != nullptr) {
+                frames.push_back(std::move(slot));
+                slot = nullptr;
+            }
+        }
     }
-    auto &bufferMap = IterMap->second;
 
-    for (auto &it : bufferMap) {
-        std::shared_ptr<FrameSpec> frameSpec = it.second;
+    for (auto &frameSpec : frames) {
         CAMERA_LOGD("HosV4L2Buffers::Flush throw up buffer begin, buffpool=%{public}d",
                     (int32_t)frameSpec->bufferPoolId_);
         frameSpec->buffer_->SetBufferStatus(CAMERA_BUFFER_STATUS_INVALID);
@@ -416,79 +740,102 @@ RetCode HosV4L2Buffers::Flush(int fd)
         CAMERA_LOGD("HosV4L2Buffers::Flush throw up buffer end");
     }
 
-    bufferMap.clear();
-
     CAMERA_LOGD("HosV4L2Buffers::Flush exit\n");
 
     return RC_OK;
 }
 
-RetCode HosV4L2Buffers::BlitForMMAP(int fd, uint32_t fromIndex, std::shared_ptr<IBuffer> toBuffer)
+RetCode HosV4L2Buffers::GetBlitStats(int fd, V4l2BlitStats& stats)
 {
-    int ret;
-    struct v4l2_format fmt = {};
-    struct v4l2_exportbuffer expbuf = {};
-    int32_t dstDma = toBuffer->GetFileDescriptor();
-    uint32_t dstWidth = toBuffer->GetWidth();
-    uint32_t dstHeight = toBuffer->GetHeight();
-    int32_t srcDma = -1;
-    uint32_t srcWidth = 0;
-    uint32_t srcHeight = 0;
-    uint32_t srcFmt;
-    uint32_t dstFmt;
-    uint64_t tickBegin = getTickMs();
-    Ge2dCanvasInfo srcInfo;
-    Ge2dCanvasInfo dstInfo;
+    std::lock_guard<std::mutex> l(bufferLock_);
 
-    // Get src format
-    fmt.type = bufferType_;
-    ret = ioctl(fd, VIDIOC_G_FMT, &fmt);
-    if (ret < 0) {
-        CAMERA_LOGE("error: ioctl VIDIOC_G_FMT failed: %s\n", strerror(errno));
+    FrameQueue* queue = FindQueue(fd);
+    if (queue == nullptr) {
+        CAMERA_LOGE("HosV4L2Buffers::GetBlitStats no stats for fd %{public}d", fd);
         return RC_ERROR;
     }
+    stats = queue->stats;
 
-    if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
-        srcWidth = fmt.fmt.pix_mp.width;
-        srcHeight = fmt.fmt.pix_mp.height;
-        srcFmt = pixelFormatV4l2ToGe2d(fmt.fmt.pix_mp.pixelformat);
-    } else if (bufferType_ == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
-        srcWidth = fmt.fmt.pix.width;
-        srcHeight = fmt.fmt.pix.height;
-        srcFmt = pixelFormatV4l2ToGe2d(fmt.fmt.pix.pixelformat);
+    return RC_OK;
+}
+
+void HosV4L2Buffers::UpdateBlitStats(int fd, uint64_t useUs, bool failed)
+{
+    std::lock_guard<std::mutex> l(bufferLock_);
+
+    FrameQueue* queue = FindQueue(fd);
+    if (queue == nullptr) {
+        return;
+    }
+    V4l2BlitStats& stats = queue->stats;
+
+    if (failed) {
+        stats.failCount++;
+        return;
     }
 
-    dstFmt = pixelFormatV4l2ToGe2d(OUTPUT_V4L2_PIX_FMT);
-    if (!srcFmt || !dstFmt) {
-        CAMERA_LOGE("Error: Invalid srcFmt or dstFmt: %{public}d, %{public}d", srcFmt, dstFmt);
+    stats.frameCount++;
+    stats.lastUs = useUs;
+    stats.totalUs += useUs;
+    if (useUs > stats.maxUs) {
+        stats.maxUs = useUs;
+    }
+}
+
+RetCode HosV4L2Buffers::ConvertForMMAP(const ExportInfo& src, const std::shared_ptr<IBuffer>& toBuffer,
+    uint64_t& useUs)
+{
+    uint64_t tickBegin = getTickUs();
+
+    if (src.vaddr == nullptr || toBuffer->GetVirAddress() == nullptr) {
         return RC_ERROR;
     }
 
-    // Export dma fd
-    expbuf.type = bufferType_;
-    expbuf.index = fromIndex;
-    ret = ioctl(fd, VIDIOC_EXPBUF, &expbuf);
-    if (ret < 0) {
-        CAMERA_LOGE("error: ioctl VIDIOC_EXPBUF failed: ret = %{public}d, %{public}s\n", ret, strerror(errno));
+    V4l2Image srcImage = {static_cast<uint8_t*>(src.vaddr), src.width, src.height, src.pixelFormat, src.length};
+    V4l2Image dstImage = {static_cast<uint8_t*>(toBuffer->GetVirAddress()), toBuffer->GetWidth(),
+        toBuffer->GetHeight(), OUTPUT_V4L2_PIX_FMT, toBuffer->GetSize()};
+    RetCode rc = V4l2ConvertImage(srcImage, dstImage);
+
+    useUs = getTickUs() - tickBegin;
+
+    CAMERA_LOGD("cpu convert ret=%{public}d, use_time=%{public}lluus", rc, useUs);
+
+    return rc;
+}
+
+// The source side comes from the export cache built at V4L2ReqBuffers time
+RetCode HosV4L2Buffers::BlitForMMAP(const ExportInfo& src, const std::shared_ptr<IBuffer>& toBuffer, uint64_t& useUs)
+{
+    int ret;
+    uint32_t dstFmt = pixelFormatV4l2ToGe2d(OUTPUT_V4L2_PIX_FMT);
+    uint64_t tickBegin = getTickUs();
+    Ge2dCanvasInfo srcInfo;
+    Ge2dCanvasInfo dstInfo;
+
+    if (ge2d_ == nullptr) {
+        // aml_ge2d_init() already reported the failure, convert on the CPU instead
+        return ConvertForMMAP(src, toBuffer, useUs);
+    }
+
+    if (!src.format || !dstFmt) {
+        CAMERA_LOGE("Error: Invalid srcFmt or dstFmt: %{public}d, %{public}d", src.format, dstFmt);
         return RC_ERROR;
     }
-    srcDma = expbuf.fd;
 
     // DO blit
-    srcInfo.width = srcWidth;
-    srcInfo.height = srcHeight;
-    srcInfo.format = srcFmt;
-    srcInfo.dmaFd = srcDma;
-    dstInfo.width = dstWidth;
-    dstInfo.height = dstHeight;
+    srcInfo.width = src.width;
+    srcInfo.height = src.height;
+    srcInfo.format = src.format;
+    srcInfo.dmaFd = src.dmaFd;
+    dstInfo.width = toBuffer->GetWidth();
+    dstInfo.height = toBuffer->GetHeight();
     dstInfo.format = dstFmt;
-    dstInfo.dmaFd = dstDma;
+    dstInfo.dmaFd = toBuffer->GetFileDescriptor();
     ret = doBlit((aml_ge2d_t*)ge2d_, srcInfo, dstInfo);
 
-    close(srcDma);
+    useUs = getTickUs() - tickBegin;
 
-    CAMERA_LOGD("fromIndex=%{public}d, blit ret=%{public}d, use_time=%{public}llums", \
-                fromIndex, ret, getTickMs()-tickBegin);
+    CAMERA_LOGD("blit ret=%{public}d, use_time=%{public}lluus", ret, useUs);
 
     CAMERA_LOGD("Format=%{public}d, Size=%{public}d, EncodeType=%{public}d", \
                 toBuffer->GetFormat(), toBuffer->GetSize(), toBuffer->GetEncodeType());
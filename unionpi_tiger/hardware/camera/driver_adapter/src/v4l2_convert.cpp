@@ -0,0 +1,944 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <linux/videodev2.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define V4L2_CONVERT_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define V4L2_CONVERT_NEON
+#endif
+#include "v4l2_convert.h"
+
+namespace OHOS::Camera {
+enum FormatLayout : uint32_t {
+    LAYOUT_SEMI_420,
+    LAYOUT_SEMI_422,
+    LAYOUT_PLANAR_420,
+    LAYOUT_UYVY,
+    LAYOUT_GREY,
+    LAYOUT_RGB,
+};
+
+using RgbLayout = struct _RgbLayout {
+    uint32_t bpp;
+    uint32_t r;
+    uint32_t g;
+    uint32_t b;
+    uint32_t a;  // == bpp when there is no alpha/padding byte
+};
+
+using FormatDesc = struct _FormatDesc {
+    uint32_t fourcc;
+    FormatLayout layout;
+    bool vFirst;
+    RgbLayout rgb;
+};
+
+static const FormatDesc FORMAT_TABLE[] = {
+    {V4L2_PIX_FMT_NV21, LAYOUT_SEMI_420, true, {}},
+    {V4L2_PIX_FMT_NV12, LAYOUT_SEMI_420, false, {}},
+    {V4L2_PIX_FMT_NV16, LAYOUT_SEMI_422, false, {}},
+    {V4L2_PIX_FMT_YVU420, LAYOUT_PLANAR_420, true, {}},
+    {V4L2_PIX_FMT_UYVY, LAYOUT_UYVY, false, {}},
+    {V4L2_PIX_FMT_GREY, LAYOUT_GREY, false, {}},
+    {V4L2_PIX_FMT_RGB24, LAYOUT_RGB, false, {3, 0, 1, 2, 3}},
+    {V4L2_PIX_FMT_BGR24, LAYOUT_RGB, false, {3, 2, 1, 0, 3}},
+    {V4L2_PIX_FMT_RGBA32, LAYOUT_RGB, false, {4, 0, 1, 2, 3}},
+    {V4L2_PIX_FMT_RGBX32, LAYOUT_RGB, false, {4, 0, 1, 2, 3}},
+    {V4L2_PIX_FMT_ABGR32, LAYOUT_RGB, false, {4, 2, 1, 0, 3}},
+    {V4L2_PIX_FMT_BGRA32, LAYOUT_RGB, false, {4, 3, 2, 1, 0}},
+};
+
+// Frames below this many pixels are not worth waking the stripe workers for
+static constexpr uint32_t STRIPE_MIN_PIXELS = 320 * 240;
+static constexpr uint32_t STRIPE_MIN_ROWS = 16;
+static constexpr uint32_t DEFAULT_MAX_THREADS = 4;
+
+static const FormatDesc* FindFormat(uint32_t fourcc)
+{
+    for (auto &it : FORMAT_TABLE) {
+        if (it.fourcc == fourcc) {
+            return &it;
+        }
+    }
+    return nullptr;
+}
+
+static inline uint8_t Clamp8(int32_t value)
+{
+    return (uint8_t)std::min(std::max(value, 0), 255);
+}
+
+/*
+ * Kernels. Every variant computes the same fixed point BT.601 formula, so SIMD output is
+ * bit exact with the scalar code and the benchmark can verify one against the other.
+ *   R = (74 * (Y - 16) + 32 + 102 * (V - 128)) >> 6
+ *   G = (74 * (Y - 16) + 32 - 25 * (U - 128) - 52 * (V - 128)) >> 6
+ *   B = (74 * (Y - 16) + 32 + 129 * (U - 128)) >> 6
+ */
+static void YuvToRgbScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+    uint32_t width, const RgbLayout& layout)
+{
+    for (uint32_t x = 0; x < width; x++) {
+        int32_t yc = 74 * (y[x] - 16) + 32;
+        int32_t d = u[x / 2] - 128;
+        int32_t e = v[x / 2] - 128;
+        uint8_t* px = dst + x * layout.bpp;
+
+        px[layout.r] = Clamp8((yc + 102 * e) >> 6);
+        px[layout.g] = Clamp8((yc - 25 * d - 52 * e) >> 6);
+        px[layout.b] = Clamp8((yc + 129 * d) >> 6);
+        if (layout.a < layout.bpp) {
+            px[layout.a] = 0xff;
+        }
+    }
+}
+
+static void SplitUVScalar(const uint8_t* src, uint8_t* a, uint8_t* b, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        a[i] = src[i * 2];
+        b[i] = src[i * 2 + 1];
+    }
+}
+
+static void MergeUVScalar(const uint8_t* a, const uint8_t* b, uint8_t* dst, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i * 2] = a[i];
+        dst[i * 2 + 1] = b[i];
+    }
+}
+
+#if defined(V4L2_CONVERT_X86)
+static inline void YuvToRgb8Sse2(__m128i y16, __m128i u16, __m128i v16, __m128i& r, __m128i& g, __m128i& b)
+{
+    __m128i yc = _mm_mullo_epi16(_mm_sub_epi16(y16, _mm_set1_epi16(16)), _mm_set1_epi16(74));
+    __m128i d = _mm_sub_epi16(u16, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(v16, _mm_set1_epi16(128));
+
+    yc = _mm_adds_epi16(yc, _mm_set1_epi16(32));
+    r = _mm_srai_epi16(_mm_adds_epi16(yc, _mm_mullo_epi16(e, _mm_set1_epi16(102))), 6);
+    g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yc, _mm_mullo_epi16(d, _mm_set1_epi16(25))),
+        _mm_mullo_epi16(e, _mm_set1_epi16(52))), 6);
+    b = _mm_srai_epi16(_mm_adds_epi16(yc, _mm_mullo_epi16(d, _mm_set1_epi16(129))), 6);
+}
+
+static inline void StoreQuadSse2(uint8_t* dst, const __m128i* ch)
+{
+    __m128i lo01 = _mm_unpacklo_epi8(ch[0], ch[1]);
+    __m128i hi01 = _mm_unpackhi_epi8(ch[0], ch[1]);
+    __m128i lo23 = _mm_unpacklo_epi8(ch[2], ch[3]);
+    __m128i hi23 = _mm_unpackhi_epi8(ch[2], ch[3]);
+
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(lo01, lo23));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(lo01, lo23));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(hi01, hi23));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(hi01, hi23));
+}
+
+static void YuvToRgbSse2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+    uint32_t width, const RgbLayout& layout)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x = 0;
+
+    if (layout.bpp == 4) {
+        for (; x + 16 <= width; x += 16) {
+            __m128i ys = _mm_loadu_si128((const __m128i *)(y + x));
+            __m128i us = _mm_loadl_epi64((const __m128i *)(u + x / 2));
+            __m128i vs = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+            __m128i uu = _mm_unpacklo_epi8(us, us);
+            __m128i vv = _mm_unpacklo_epi8(vs, vs);
+            __m128i rl, gl, bl, rh, gh, bh;
+            __m128i ch[4];
+
+            YuvToRgb8Sse2(_mm_unpacklo_epi8(ys, zero), _mm_unpacklo_epi8(uu, zero), _mm_unpacklo_epi8(vv, zero),
+                rl, gl, bl);
+            YuvToRgb8Sse2(_mm_unpackhi_epi8(ys, zero), _mm_unpackhi_epi8(uu, zero), _mm_unpackhi_epi8(vv, zero),
+                rh, gh, bh);
+            ch[layout.r] = _mm_packus_epi16(rl, rh);
+            ch[layout.g] = _mm_packus_epi16(gl, gh);
+            ch[layout.b] = _mm_packus_epi16(bl, bh);
+            ch[layout.a] = _mm_set1_epi8((char)0xff);
+            StoreQuadSse2(dst + x * 4, ch);
+        }
+    }
+
+    YuvToRgbScalar(y + x, u + x / 2, v + x / 2, dst + x * layout.bpp, width - x, layout);
+}
+
+static void SplitUVSse2(const uint8_t* src, uint8_t* a, uint8_t* b, uint32_t count)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    uint32_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(src + i * 2 + 16));
+        _mm_storeu_si128((__m128i *)(a + i), _mm_packus_epi16(_mm_and_si128(x0, mask), _mm_and_si128(x1, mask)));
+        _mm_storeu_si128((__m128i *)(b + i), _mm_packus_epi16(_mm_srli_epi16(x0, 8), _mm_srli_epi16(x1, 8)));
+    }
+
+    SplitUVScalar(src + i * 2, a + i, b + i, count - i);
+}
+
+static void MergeUVSse2(const uint8_t* a, const uint8_t* b, uint8_t* dst, uint32_t count)
+{
+    uint32_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi8(x0, x1));
+        _mm_storeu_si128((__m128i *)(dst + i * 2 + 16), _mm_unpackhi_epi8(x0, x1));
+    }
+
+    MergeUVScalar(a + i, b + i, dst + i * 2, count - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i DupChromaAvx2(const uint8_t* c)
+{
+    __m128i c16 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)c));
+    return _mm256_set_m128i(_mm_unpackhi_epi16(c16, c16), _mm_unpacklo_epi16(c16, c16));
+}
+
+__attribute__((target("avx2"))) static inline __m128i Pack8Avx2(__m256i x)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+}
+
+__attribute__((target("avx2"))) static void YuvToRgbAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+    uint8_t* dst, uint32_t width, const RgbLayout& layout)
+{
+    uint32_t x = 0;
+
+    if (layout.bpp == 4) {
+        const __m256i c16 = _mm256_set1_epi16(16);
+        const __m256i c128 = _mm256_set1_epi16(128);
+        const __m256i round = _mm256_set1_epi16(32);
+
+        for (; x + 16 <= width; x += 16) {
+            __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x)));
+            __m256i d = _mm256_sub_epi16(DupChromaAvx2(u + x / 2), c128);
+            __m256i e = _mm256_sub_epi16(DupChromaAvx2(v + x / 2), c128);
+            __m256i yc = _mm256_mullo_epi16(_mm256_sub_epi16(y16, c16), _mm256_set1_epi16(74));
+            __m128i ch[4];
+
+            yc = _mm256_adds_epi16(yc, round);
+            __m256i r = _mm256_srai_epi16(_mm256_adds_epi16(yc, _mm256_mullo_epi16(e, _mm256_set1_epi16(102))), 6);
+            __m256i g = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(yc,
+                _mm256_mullo_epi16(d, _mm256_set1_epi16(25))), _mm256_mullo_epi16(e, _mm256_set1_epi16(52))), 6);
+            __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(yc, _mm256_mullo_epi16(d, _mm256_set1_epi16(129))), 6);
+
+            ch[layout.r] = Pack8Avx2(r);
+            ch[layout.g] = Pack8Avx2(g);
+            ch[layout.b] = Pack8Avx2(b);
+            ch[layout.a] = _mm_set1_epi8((char)0xff);
+            StoreQuadSse2(dst + x * 4, ch);
+        }
+    }
+
+    YuvToRgbScalar(y + x, u + x / 2, v + x / 2, dst + x * layout.bpp, width - x, layout);
+}
+
+__attribute__((target("avx2"))) static void SplitUVAvx2(const uint8_t* src, uint8_t* a, uint8_t* b, uint32_t count)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+    uint32_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(src + i * 2 + 32));
+        __m256i ea = _mm256_packus_epi16(_mm256_and_si256(x0, mask), _mm256_and_si256(x1, mask));
+        __m256i eb = _mm256_packus_epi16(_mm256_srli_epi16(x0, 8), _mm256_srli_epi16(x1, 8));
+        _mm256_storeu_si256((__m256i *)(a + i), _mm256_permute4x64_epi64(ea, 0xd8));
+        _mm256_storeu_si256((__m256i *)(b + i), _mm256_permute4x64_epi64(eb, 0xd8));
+    }
+
+    SplitUVSse2(src + i * 2, a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void MergeUVAvx2(const uint8_t* a, const uint8_t* b, uint8_t* dst,
+    uint32_t count)
+{
+    uint32_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i lo = _mm256_unpacklo_epi8(x0, x1);
+        __m256i hi = _mm256_unpackhi_epi8(x0, x1);
+        _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    MergeUVSse2(a + i, b + i, dst + i * 2, count - i);
+}
+#endif
+
+#if defined(V4L2_CONVERT_NEON)
+static inline uint8x8_t YuvToRgbChannelNeon(int16x8_t yc, int16x8_t d, int16_t kd, int16x8_t e, int16_t ke)
+{
+    int16x8_t x = vqaddq_s16(yc, vmulq_n_s16(d, kd));
+    return vqshrun_n_s16(vqaddq_s16(x, vmulq_n_s16(e, ke)), 6);
+}
+
+static void YuvToRgbNeon(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+    uint32_t width, const RgbLayout& layout)
+{
+    const int16x8_t c16 = vdupq_n_s16(16);
+    const int16x8_t c128 = vdupq_n_s16(128);
+    const int16x8_t round = vdupq_n_s16(32);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t ys = vld1q_u8(y + x);
+        uint8x8_t us = vld1_u8(u + x / 2);
+        uint8x8_t vs = vld1_u8(v + x / 2);
+        uint8x8x2_t uu = vzip_u8(us, us);
+        uint8x8x2_t vv = vzip_u8(vs, vs);
+        uint8x8_t rgb[2][3];
+
+        for (int half = 0; half < 2; half++) {
+            uint8x8_t yh = half ? vget_high_u8(ys) : vget_low_u8(ys);
+            int16x8_t yc = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(yh)), c16);
+            int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uu.val[half])), c128);
+            int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vv.val[half])), c128);
+
+            yc = vqaddq_s16(vmulq_n_s16(yc, 74), round);
+            rgb[half][0] = YuvToRgbChannelNeon(yc, d, 0, e, 102);
+            rgb[half][1] = YuvToRgbChannelNeon(yc, d, -25, e, -52);
+            rgb[half][2] = YuvToRgbChannelNeon(yc, d, 129, e, 0);
+        }
+
+        uint8x16_t r = vcombine_u8(rgb[0][0], rgb[1][0]);
+        uint8x16_t g = vcombine_u8(rgb[0][1], rgb[1][1]);
+        uint8x16_t b = vcombine_u8(rgb[0][2], rgb[1][2]);
+        if (layout.bpp == 4) {
+            uint8x16x4_t px;
+            px.val[layout.r] = r;
+            px.val[layout.g] = g;
+            px.val[layout.b] = b;
+            px.val[layout.a] = vdupq_n_u8(0xff);
+            vst4q_u8(dst + x * 4, px);
+        } else {
+            uint8x16x3_t px;
+            px.val[layout.r] = r;
+            px.val[layout.g] = g;
+            px.val[layout.b] = b;
+            vst3q_u8(dst + x * 3, px);
+        }
+    }
+
+    YuvToRgbScalar(y + x, u + x / 2, v + x / 2, dst + x * layout.bpp, width - x, layout);
+}
+
+static void SplitUVNeon(const uint8_t* src, uint8_t* a, uint8_t* b, uint32_t count)
+{
+    uint32_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t uv = vld2q_u8(src + i * 2);
+        vst1q_u8(a + i, uv.val[0]);
+        vst1q_u8(b + i, uv.val[1]);
+    }
+
+    SplitUVScalar(src + i * 2, a + i, b + i, count - i);
+}
+
+static void MergeUVNeon(const uint8_t* a, const uint8_t* b, uint8_t* dst, uint32_t count)
+{
+    uint32_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t uv;
+        uv.val[0] = vld1q_u8(a + i);
+        uv.val[1] = vld1q_u8(b + i);
+        vst2q_u8(dst + i * 2, uv);
+    }
+
+    MergeUVScalar(a + i, b + i, dst + i * 2, count - i);
+}
+#endif
+
+using ConvertKernels = struct _ConvertKernels {
+    V4l2ConvertIsa isa;
+    void (*yuvToRgb)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+        uint32_t width, const RgbLayout& layout);
+    void (*splitUV)(const uint8_t* src, uint8_t* a, uint8_t* b, uint32_t count);
+    void (*mergeUV)(const uint8_t* a, const uint8_t* b, uint8_t* dst, uint32_t count);
+};
+
+static const ConvertKernels KERNEL_TABLE[] = {
+    {V4L2_ISA_SCALAR, YuvToRgbScalar, SplitUVScalar, MergeUVScalar},
+#if defined(V4L2_CONVERT_X86)
+    {V4L2_ISA_SSE2, YuvToRgbSse2, SplitUVSse2, MergeUVSse2},
+    {V4L2_ISA_AVX2, YuvToRgbAvx2, SplitUVAvx2, MergeUVAvx2},
+#endif
+#if defined(V4L2_CONVERT_NEON)
+    {V4L2_ISA_NEON, YuvToRgbNeon, SplitUVNeon, MergeUVNeon},
+#endif
+};
+
+static bool IsaSupported(V4l2ConvertIsa isa)
+{
+    switch (isa) {
+        case V4L2_ISA_SCALAR:
+            return true;
+#if defined(V4L2_CONVERT_X86)
+        case V4L2_ISA_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case V4L2_ISA_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+#if defined(V4L2_CONVERT_NEON)
+        case V4L2_ISA_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+static V4l2ConvertIsa DetectIsa()
+{
+    static const V4l2ConvertIsa preferred[] = {V4L2_ISA_AVX2, V4L2_ISA_NEON, V4L2_ISA_SSE2};
+
+    for (auto isa : preferred) {
+        if (IsaSupported(isa)) {
+            return isa;
+        }
+    }
+    return V4L2_ISA_SCALAR;
+}
+
+static const ConvertKernels* FindKernels(V4l2ConvertIsa isa)
+{
+    for (auto &it : KERNEL_TABLE) {
+        if (it.isa == isa) {
+            return &it;
+        }
+    }
+    return &KERNEL_TABLE[0];
+}
+
+static std::atomic<const ConvertKernels*> g_kernels(nullptr);
+static std::atomic<uint32_t> g_threadLimit(0);
+
+static const ConvertKernels* GetKernels()
+{
+    const ConvertKernels* kernels = g_kernels.load(std::memory_order_acquire);
+    if (kernels == nullptr) {
+        kernels = FindKernels(DetectIsa());
+        g_kernels.store(kernels, std::memory_order_release);
+    }
+    return kernels;
+}
+
+// A small persistent pool, so stripe processing doesn't pay a thread spawn per frame
+class ConvertWorkers {
+public:
+    static ConvertWorkers& Instance()
+    {
+        static ConvertWorkers workers;
+        return workers;
+    }
+
+    // Runs job(0) .. job(count - 1) on the workers and the caller, returns when all are done
+    void Run(uint32_t count, const std::function<void(uint32_t)>& job)
+    {
+        std::unique_lock<std::mutex> runLock(runLock_, std::try_to_lock);
+        if (!runLock.owns_lock()) {
+            // Another stream owns the workers, convert on this thread instead of waiting
+            for (uint32_t i = 0; i < count; i++) {
+                job(i);
+            }
+            return;
+        }
+
+        while (threads_.size() < count - 1) {
+            threads_.emplace_back([this] { Loop(); });
+        }
+
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            job_ = &job;
+            jobCount_ = count;
+            nextJob_ = 0;
+            pending_ = count;
+            generation_++;
+        }
+        cv_.notify_all();
+
+        Work();
+
+        std::unique_lock<std::mutex> l(lock_);
+        doneCv_.wait(l, [this] { return pending_ == 0; });
+        job_ = nullptr;
+    }
+
+    ~ConvertWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &it : threads_) {
+            it.join();
+        }
+    }
+
+private:
+    ConvertWorkers() = default;
+
+    void Work()
+    {
+        while (true) {
+            uint32_t index;
+            const std::function<void(uint32_t)>* job = nullptr;
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                if (job_ == nullptr || nextJob_ >= jobCount_) {
+                    return;
+                }
+                index = nextJob_++;
+                job = job_;
+            }
+
+            (*job)(index);
+
+            std::lock_guard<std::mutex> l(lock_);
+            if (--pending_ == 0) {
+                doneCv_.notify_all();
+            }
+        }
+    }
+
+    void Loop()
+    {
+        uint64_t seen = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> l(lock_);
+                cv_.wait(l, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+            Work();
+        }
+    }
+
+    std::mutex runLock_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::condition_variable doneCv_;
+    std::vector<std::thread> threads_;
+    const std::function<void(uint32_t)>* job_ = nullptr;
+    uint32_t jobCount_ = 0;
+    uint32_t nextJob_ = 0;
+    uint32_t pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+// One output row pair in the intermediate 4:2:0 form: two luma rows and one chroma row
+using RowPair = struct _RowPair {
+    const uint8_t* y[2];
+    const uint8_t* u;
+    const uint8_t* v;
+};
+
+using Scratch = struct _Scratch {
+    std::vector<uint8_t> y[2];
+    std::vector<uint8_t> u;
+    std::vector<uint8_t> v;
+    std::vector<uint8_t> sy[2];
+    std::vector<uint8_t> su;
+    std::vector<uint8_t> sv;
+};
+
+using ConvertJob = struct _ConvertJob {
+    const V4l2Image* src;
+    const V4l2Image* dst;
+    const FormatDesc* srcDesc;
+    const FormatDesc* dstDesc;
+    const ConvertKernels* kernels;
+    const std::vector<uint32_t>* xMap;
+};
+
+static void ReadRgbRows(const ConvertJob& job, const uint8_t* row0, const uint8_t* row1, uint8_t* y0, uint8_t* y1,
+    uint8_t* u, uint8_t* v)
+{
+    const RgbLayout& layout = job.srcDesc->rgb;
+    const uint32_t width = job.src->width;
+
+    for (uint32_t x = 0; x < width; x += 2) {
+        int32_t sumR = 0;
+        int32_t sumG = 0;
+        int32_t sumB = 0;
+        const uint8_t* rows[2] = {row0, row1};
+        uint8_t* outs[2] = {y0, y1};
+
+        for (int j = 0; j < 2; j++) {
+            for (uint32_t k = 0; k < 2; k++) {
+                const uint8_t* px = rows[j] + (x + k) * layout.bpp;
+                int32_t r = px[layout.r];
+                int32_t g = px[layout.g];
+                int32_t b = px[layout.b];
+                outs[j][x + k] = Clamp8(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                sumR += r;
+                sumG += g;
+                sumB += b;
+            }
+        }
+
+        sumR = (sumR + 2) / 4;
+        sumG = (sumG + 2) / 4;
+        sumB = (sumB + 2) / 4;
+        u[x / 2] = Clamp8(((-38 * sumR - 74 * sumG + 112 * sumB + 128) >> 8) + 128);
+        v[x / 2] = Clamp8(((112 * sumR - 94 * sumG - 18 * sumB + 128) >> 8) + 128);
+    }
+}
+
+// Fills rp with source rows sy0/sy1 at source width, pointing into the source where possible
+static void ReadRows(const ConvertJob& job, uint32_t sy0, uint32_t sy1, RowPair& rp, Scratch& s)
+{
+    const V4l2Image& src = *job.src;
+    const FormatDesc& desc = *job.srcDesc;
+    const uint32_t w = src.width;
+    const uint32_t h = src.height;
+    const uint32_t cw = w / 2;
+    uint8_t* a = s.su.data();
+    uint8_t* b = s.sv.data();
+
+    switch (desc.layout) {
+        case LAYOUT_SEMI_420:
+        case LAYOUT_SEMI_422: {
+            uint32_t cy = (desc.layout == LAYOUT_SEMI_420) ? sy0 / 2 : sy0;
+            rp.y[0] = src.data + sy0 * w;
+            rp.y[1] = src.data + sy1 * w;
+            job.kernels->splitUV(src.data + w * h + cy * w, a, b, cw);
+            rp.u = desc.vFirst ? b : a;
+            rp.v = desc.vFirst ? a : b;
+            break;
+        }
+        case LAYOUT_PLANAR_420: {
+            const uint8_t* first = src.data + w * h + (sy0 / 2) * cw;
+            const uint8_t* second = first + cw * (h / 2);
+            rp.y[0] = src.data + sy0 * w;
+            rp.y[1] = src.data + sy1 * w;
+            rp.u = desc.vFirst ? second : first;
+            rp.v = desc.vFirst ? first : second;
+            break;
+        }
+        case LAYOUT_UYVY: {
+            const uint8_t* row0 = src.data + sy0 * w * 2;
+            const uint8_t* row1 = src.data + sy1 * w * 2;
+            for (uint32_t i = 0; i < cw; i++) {
+                a[i] = row0[i * 4];
+                s.sy[0][i * 2] = row0[i * 4 + 1];
+                b[i] = row0[i * 4 + 2];
+                s.sy[0][i * 2 + 1] = row0[i * 4 + 3];
+                s.sy[1][i * 2] = row1[i * 4 + 1];
+                s.sy[1][i * 2 + 1] = row1[i * 4 + 3];
+            }
+            rp.y[0] = s.sy[0].data();
+            rp.y[1] = s.sy[1].data();
+            rp.u = a;
+            rp.v = b;
+            break;
+        }
+        case LAYOUT_GREY:
+            std::fill(s.su.begin(), s.su.end(), 128);
+            rp.y[0] = src.data + sy0 * w;
+            rp.y[1] = src.data + sy1 * w;
+            rp.u = a;
+            rp.v = a;
+            break;
+        case LAYOUT_RGB:
+            ReadRgbRows(job, src.data + sy0 * w * desc.rgb.bpp, src.data + sy1 * w * desc.rgb.bpp,
+                s.sy[0].data(), s.sy[1].data(), a, b);
+            rp.y[0] = s.sy[0].data();
+            rp.y[1] = s.sy[1].data();
+            rp.u = a;
+            rp.v = b;
+            break;
+    }
+}
+
+static void ResampleRows(const ConvertJob& job, RowPair& rp, Scratch& s)
+{
+    const std::vector<uint32_t>& xMap = *job.xMap;
+    const uint32_t dw = job.dst->width;
+
+    for (int j = 0; j < 2; j++) {
+        for (uint32_t x = 0; x < dw; x++) {
+            s.y[j][x] = rp.y[j][xMap[x]];
+        }
+        rp.y[j] = s.y[j].data();
+    }
+    for (uint32_t x = 0; x < dw / 2; x++) {
+        s.u[x] = rp.u[xMap[x * 2] / 2];
+        s.v[x] = rp.v[xMap[x * 2] / 2];
+    }
+    rp.u = s.u.data();
+    rp.v = s.v.data();
+}
+
+static void PackUyvy(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, uint32_t cw)
+{
+    for (uint32_t i = 0; i < cw; i++) {
+        dst[i * 4] = u[i];
+        dst[i * 4 + 1] = y[i * 2];
+        dst[i * 4 + 2] = v[i];
+        dst[i * 4 + 3] = y[i * 2 + 1];
+    }
+}
+
+// Writes destination rows dy (and dy + 1 when rows == 2) from rp at destination width
+static void WriteRows(const ConvertJob& job, uint32_t dy, uint32_t rows, const RowPair& rp)
+{
+    const V4l2Image& dst = *job.dst;
+    const FormatDesc& desc = *job.dstDesc;
+    const uint32_t w = dst.width;
+    const uint32_t h = dst.height;
+    const uint32_t cw = w / 2;
+
+    switch (desc.layout) {
+        case LAYOUT_SEMI_420:
+        case LAYOUT_SEMI_422:
+            for (uint32_t j = 0; j < rows; j++) {
+                std::copy(rp.y[j], rp.y[j] + w, dst.data + (dy + j) * w);
+                if (desc.layout == LAYOUT_SEMI_422 || j == 0) {
+                    uint32_t cy = (desc.layout == LAYOUT_SEMI_420) ? dy / 2 : dy + j;
+                    job.kernels->mergeUV(desc.vFirst ? rp.v : rp.u, desc.vFirst ? rp.u : rp.v,
+                        dst.data + w * h + cy * w, cw);
+                }
+            }
+            break;
+        case LAYOUT_PLANAR_420: {
+            uint8_t* first = dst.data + w * h + (dy / 2) * cw;
+            uint8_t* second = first + cw * (h / 2);
+            for (uint32_t j = 0; j < rows; j++) {
+                std::copy(rp.y[j], rp.y[j] + w, dst.data + (dy + j) * w);
+            }
+            std::copy(desc.vFirst ? rp.v : rp.u, (desc.vFirst ? rp.v : rp.u) + cw, first);
+            std::copy(desc.vFirst ? rp.u : rp.v, (desc.vFirst ? rp.u : rp.v) + cw, second);
+            break;
+        }
+        case LAYOUT_UYVY:
+            for (uint32_t j = 0; j < rows; j++) {
+                PackUyvy(rp.y[j], rp.u, rp.v, dst.data + (dy + j) * w * 2, cw);
+            }
+            break;
+        case LAYOUT_GREY:
+            for (uint32_t j = 0; j < rows; j++) {
+                std::copy(rp.y[j], rp.y[j] + w, dst.data + (dy + j) * w);
+            }
+            break;
+        case LAYOUT_RGB:
+            for (uint32_t j = 0; j < rows; j++) {
+                job.kernels->yuvToRgb(rp.y[j], rp.u, rp.v, dst.data + (dy + j) * w * desc.rgb.bpp, w, desc.rgb);
+            }
+            break;
+    }
+}
+
+static void ConvertStripe(const ConvertJob& job, uint32_t rowBegin, uint32_t rowEnd)
+{
+    thread_local Scratch s;
+    const uint32_t sw = job.src->width;
+    const uint32_t dw = job.dst->width;
+    const uint32_t sh = job.src->height;
+    const uint32_t dh = job.dst->height;
+    const bool scaleX = (sw != dw);
+
+    for (int j = 0; j < 2; j++) {
+        s.sy[j].resize(sw);
+        s.y[j].resize(dw);
+    }
+    s.su.resize(sw / 2);
+    s.sv.resize(sw / 2);
+    s.u.resize(dw / 2);
+    s.v.resize(dw / 2);
+
+    for (uint32_t dy = rowBegin; dy < rowEnd; dy += 2) {
+        uint32_t rows = std::min(2U, dh - dy);
+        // Keep both source rows inside the same chroma row pair, like the 4:2:0 output
+        uint32_t sy0 = (uint32_t)((uint64_t)dy * sh / dh) & ~1U;
+        uint32_t sy1 = std::min(sy0 + 1, sh - 1);
+        if (sh != dh) {
+            sy1 = std::min((uint32_t)((uint64_t)(dy + 1) * sh / dh), sh - 1);
+            sy1 = std::max(sy1, sy0);
+        }
+        RowPair rp = {};
+
+        ReadRows(job, sy0, sy1, rp, s);
+        if (scaleX) {
+            ResampleRows(job, rp, s);
+        }
+        WriteRows(job, dy, rows, rp);
+    }
+}
+
+size_t V4l2ImageSize(uint32_t pixelFormat, uint32_t width, uint32_t height)
+{
+    const FormatDesc* desc = FindFormat(pixelFormat);
+    size_t pixels = (size_t)width * height;
+
+    if (desc == nullptr) {
+        return 0;
+    }
+
+    switch (desc->layout) {
+        case LAYOUT_SEMI_420:
+        case LAYOUT_PLANAR_420:
+            return pixels * 3 / 2;
+        case LAYOUT_SEMI_422:
+        case LAYOUT_UYVY:
+            return pixels * 2;
+        case LAYOUT_GREY:
+            return pixels;
+        case LAYOUT_RGB:
+            return pixels * desc->rgb.bpp;
+    }
+    return 0;
+}
+
+bool V4l2ConvertSupported(uint32_t srcFormat, uint32_t dstFormat)
+{
+    return FindFormat(srcFormat) != nullptr && FindFormat(dstFormat) != nullptr;
+}
+
+RetCode V4l2ConvertImage(const V4l2Image& src, const V4l2Image& dst)
+{
+    ConvertJob job = {&src, &dst, FindFormat(src.pixelFormat), FindFormat(dst.pixelFormat), GetKernels(), nullptr};
+    std::vector<uint32_t> xMap;
+
+    if (job.srcDesc == nullptr || job.dstDesc == nullptr) {
+        CAMERA_LOGE("V4l2ConvertImage: unsupported format %{public}x -> %{public}x", src.pixelFormat, dst.pixelFormat);
+        return RC_ERROR;
+    }
+
+    // Every layout works on pixel pairs, odd sizes only show up on broken configurations
+    if (src.data == nullptr || dst.data == nullptr || src.width < 2 || src.height < 2 || dst.width < 2 ||
+        dst.height < 2 || ((src.width | src.height | dst.width | dst.height) & 1)) {
+        CAMERA_LOGE("V4l2ConvertImage: bad geometry %{public}ux%{public}u -> %{public}ux%{public}u",
+            src.width, src.height, dst.width, dst.height);
+        return RC_ERROR;
+    }
+
+    if (src.size < V4l2ImageSize(src.pixelFormat, src.width, src.height) ||
+        dst.size < V4l2ImageSize(dst.pixelFormat, dst.width, dst.height)) {
+        CAMERA_LOGE("V4l2ConvertImage: buffer too small for %{public}ux%{public}u", dst.width, dst.height);
+        return RC_ERROR;
+    }
+
+    if (src.pixelFormat == dst.pixelFormat && src.width == dst.width && src.height == dst.height) {
+        std::copy(src.data, src.data + V4l2ImageSize(src.pixelFormat, src.width, src.height), dst.data);
+        return RC_OK;
+    }
+
+    if (src.width != dst.width) {
+        xMap.resize(dst.width);
+        for (uint32_t x = 0; x < dst.width; x++) {
+            xMap[x] = (uint32_t)((uint64_t)x * src.width / dst.width);
+        }
+        job.xMap = &xMap;
+    }
+
+    uint32_t threads = g_threadLimit.load();
+    if (threads == 0) {
+        threads = std::min(std::max(std::thread::hardware_concurrency(), 1U), DEFAULT_MAX_THREADS);
+    }
+    if ((uint64_t)dst.width * dst.height < STRIPE_MIN_PIXELS) {
+        threads = 1;
+    }
+
+    uint32_t rowPairs = dst.height / 2;
+    uint32_t stripes = std::max(1U, std::min(threads, dst.height / STRIPE_MIN_ROWS));
+    if (stripes == 1) {
+        ConvertStripe(job, 0, dst.height);
+        return RC_OK;
+    }
+
+    ConvertWorkers::Instance().Run(stripes, [&job, rowPairs, stripes](uint32_t index) {
+        uint32_t begin = rowPairs * index / stripes * 2;
+        uint32_t end = rowPairs * (index + 1) / stripes * 2;
+        ConvertStripe(job, begin, end);
+    });
+
+    return RC_OK;
+}
+
+RetCode V4l2ConvertSetIsa(V4l2ConvertIsa isa)
+{
+    if (isa == V4L2_ISA_AUTO) {
+        g_kernels.store(FindKernels(DetectIsa()));
+        return RC_OK;
+    }
+
+    const ConvertKernels* kernels = FindKernels(isa);
+    if (kernels->isa != isa || !IsaSupported(isa)) {
+        return RC_ERROR;
+    }
+
+    g_kernels.store(kernels);
+    return RC_OK;
+}
+
+V4l2ConvertIsa V4l2ConvertGetIsa()
+{
+    return GetKernels()->isa;
+}
+
+const char* V4l2ConvertIsaName(V4l2ConvertIsa isa)
+{
+    switch (isa) {
+        case V4L2_ISA_AUTO:
+            return "auto";
+        case V4L2_ISA_SCALAR:
+            return "scalar";
+        case V4L2_ISA_SSE2:
+            return "sse2";
+        case V4L2_ISA_AVX2:
+            return "avx2";
+        case V4L2_ISA_NEON:
+            return "neon";
+    }
+    return "unknown";
+}
+
+void V4l2ConvertSetThreads(uint32_t count)
+{
+    g_threadLimit.store(count);
+}
+} // namespace OHOS::Camera
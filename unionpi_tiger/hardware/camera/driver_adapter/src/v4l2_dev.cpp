@@ -14,6 +14,8 @@
  */
 
 #include "v4l2_dev.h"
+#include <pthread.h>
+#include <sched.h>
 #include <sys/prctl.h>
 
 namespace OHOS::Camera {
@@ -224,9 +226,25 @@ RetCode HosV4L2Dev::Init(std::vector<std::string>& cameraIDs)
     return RC_OK;
 }
 
+std::shared_ptr<HosV4L2Buffers> HosV4L2Dev::GetBuffers(int fd)
+{
+    if (threadMode_ == V4L2_THREAD_SHARED) {
+        return myBuffers_;
+    }
+
+    std::lock_guard<std::mutex> l(workerLock_);
+    auto itr = workers_.find(fd);
+    if (itr == workers_.end()) {
+        return nullptr;
+    }
+
+    return itr->second->buffers;
+}
+
 RetCode HosV4L2Dev::ReqBuffers(const std::string& cameraID, unsigned int buffCont)
 {
     int rc, fd;
+    std::shared_ptr<HosV4L2Buffers> buffers = nullptr;
 
     fd = GetCurrentFd(cameraID);
     if (fd < 0) {
@@ -234,15 +252,32 @@ RetCode HosV4L2Dev::ReqBuffers(const std::string& cameraID, unsigned int buffCon
         return RC_ERROR;
     }
 
-    if (myBuffers_ == nullptr) {
-        myBuffers_ = std::make_shared<HosV4L2Buffers>(memoryType_, bufferType_);
+    if (threadMode_ == V4L2_THREAD_PER_STREAM) {
+        buffers = GetBuffers(fd);
+        if (buffers == nullptr) {
+            auto worker = std::make_shared<StreamWorker>();
+            worker->fd = fd;
+            worker->buffers = std::make_shared<HosV4L2Buffers>(memoryType_, bufferType_);
+            if (bufCallback_ != nullptr) {
+                worker->buffers->SetCallback(bufCallback_);
+            }
+
+            std::lock_guard<std::mutex> l(workerLock_);
+            workers_[fd] = worker;
+            buffers = worker->buffers;
+        }
+    } else {
         if (myBuffers_ == nullptr) {
-            CAMERA_LOGE("error: Creatbuffer: myBuffers_ make_shared is NULL\n");
-            return RC_ERROR;
+            myBuffers_ = std::make_shared<HosV4L2Buffers>(memoryType_, bufferType_);
+            if (myBuffers_ == nullptr) {
+                CAMERA_LOGE("error: Creatbuffer: myBuffers_ make_shared is NULL\n");
+                return RC_ERROR;
+            }
         }
+        buffers = myBuffers_;
     }
 
-    rc = myBuffers_->V4L2ReqBuffers(fd, buffCont);
+    rc = buffers->V4L2ReqBuffers(fd, buffCont);
     if (rc == RC_ERROR) {
         CAMERA_LOGE("error: Creatbuffer: V4L2ReqBuffers error\n");
         return RC_ERROR;
@@ -261,20 +296,21 @@ RetCode HosV4L2Dev::CreatBuffer(const std::string& cameraID, const std::shared_p
         return RC_ERROR;
     }
 
-    if (frameSpec == nullptr || myBuffers_ == nullptr) {
+    auto buffers = GetBuffers(fd);
+    if (frameSpec == nullptr || buffers == nullptr) {
         CAMERA_LOGE("error: Creatbuffer frameSpec or myBuffers_ is NULL\n");
         return RC_ERROR;
     }
 
     CAMERA_LOGD("Creatbuffer frameSpec->buffer index == %d\n", frameSpec->buffer_->GetIndex());
 
-    rc = myBuffers_->V4L2AllocBuffer(fd, frameSpec);
+    rc = buffers->V4L2AllocBuffer(fd, frameSpec);
     if (rc == RC_ERROR) {
         CAMERA_LOGE("error: Creatbuffer: V4L2AllocBuffer error\n");
         return RC_ERROR;
     }
 
-    rc = myBuffers_->V4L2QueueBuffer(fd, frameSpec);
+    rc = buffers->V4L2QueueBuffer(fd, frameSpec);
     if (rc == RC_ERROR) {
         CAMERA_LOGE("error: Creatbuffer: V4L2QueueBuffer error\n");
         return RC_ERROR;
@@ -293,12 +329,13 @@ RetCode HosV4L2Dev::QueueBuffer(const std::string& cameraID, const std::shared_p
         return RC_ERROR;
     }
 
-    if (frameSpec == nullptr || myBuffers_ == nullptr) {
+    auto buffers = GetBuffers(fd);
+    if (frameSpec == nullptr || buffers == nullptr) {
         CAMERA_LOGE(" QueueBuffer frameSpec or myBuffers_ is NULL\n");
         return RC_ERROR;
     }
 
-    rc = myBuffers_->V4L2QueueBuffer(fd, frameSpec);
+    rc = buffers->V4L2QueueBuffer(fd, frameSpec);
     if (rc == RC_ERROR) {
         CAMERA_LOGE("QueueBuffer: V4L2QueueBuffer error\n");
         return RC_ERROR;
@@ -312,18 +349,28 @@ RetCode HosV4L2Dev::ReleaseBuffers(const std::string& cameraID)
     int fd;
     int rc = 0;
 
-    if (myBuffers_ == nullptr) {
-        CAMERA_LOGE("ReleaseBuffers myBuffers_ is NULL\n");
-        return RC_ERROR;
-    }
-
     fd = GetCurrentFd(cameraID);
     if (fd < 0) {
         CAMERA_LOGE("ReleaseBuffers: GetCurrentFd error\n");
         return RC_ERROR;
     }
 
-    rc = myBuffers_->V4L2ReleaseBuffers(fd);
+    auto buffers = GetBuffers(fd);
+    if (buffers == nullptr) {
+        CAMERA_LOGE("ReleaseBuffers myBuffers_ is NULL\n");
+        return RC_ERROR;
+    }
+
+    rc = buffers->V4L2ReleaseBuffers(fd);
+
+    if (threadMode_ == V4L2_THREAD_PER_STREAM) {
+        std::lock_guard<std::mutex> l(workerLock_);
+        auto itr = workers_.find(fd);
+        if (itr != workers_.end() && itr->second->thread == nullptr) {
+            workers_.erase(itr);
+        }
+    }
+
     if (rc == RC_ERROR) {
         CAMERA_LOGE("ReleaseBuffers: V4L2ReleaseBuffers error\n");
         return RC_ERROR;
@@ -441,6 +488,10 @@ RetCode HosV4L2Dev::StartStream(const std::string& cameraID)
         return RC_ERROR;
     }
 
+    if (threadMode_ == V4L2_THREAD_PER_STREAM) {
+        return StartWorker(cameraID, fd);
+    }
+
     rc = CreateEpoll(fd, streamNumber_);
     if (rc == RC_ERROR) {
         CAMERA_LOGE("StartStream: CreateEpoll error\n");
@@ -469,6 +520,18 @@ RetCode HosV4L2Dev::StopStream(const std::string& cameraID)
         return RC_ERROR;
     }
 
+    if (threadMode_ == V4L2_THREAD_PER_STREAM) {
+        fd = GetCurrentFd(cameraID);
+        if (fd < 0) {
+            CAMERA_LOGE("error: StopStream: GetCurrentFd error\n");
+            return RC_ERROR;
+        }
+
+        StopWorker(fd);
+
+        return myStreams_->V4L2StreamOff(fd);
+    }
+
     if (streamThread_ == nullptr) {
         CAMERA_LOGE("StopStream thread is stopped\n");
         return RC_ERROR;
@@ -793,6 +856,16 @@ RetCode HosV4L2Dev::SetCallback(BufCallback cb)
         CAMERA_LOGE("HosV4L2Dev::SetCallback is null");
         return RC_ERROR;
     }
+    bufCallback_ = cb;
+
+    if (threadMode_ == V4L2_THREAD_PER_STREAM) {
+        std::lock_guard<std::mutex> l(workerLock_);
+        for (auto &it : workers_) {
+            it.second->buffers->SetCallback(cb);
+        }
+        return RC_OK;
+    }
+
     if (myBuffers_ == nullptr) {
         CAMERA_LOGE("SetCallback myBuffers_ is NULL\n");
         return RC_ERROR;
@@ -812,12 +885,13 @@ RetCode HosV4L2Dev::Flush(const std::string& cameraID)
         return RC_ERROR;
     }
 
-    if (myBuffers_ == nullptr) {
+    auto buffers = GetBuffers(fd);
+    if (buffers == nullptr) {
         CAMERA_LOGE(" HosV4L2Dev::Flush myBuffers_ is NULL\n");
         return RC_ERROR;
     }
 
-    rc = myBuffers_->Flush(fd);
+    rc = buffers->Flush(fd);
     if (rc == RC_ERROR) {
         CAMERA_LOGE("HosV4L2Dev::Flush: error\n");
         return RC_ERROR;
@@ -825,4 +899,175 @@ RetCode HosV4L2Dev::Flush(const std::string& cameraID)
 
     return RC_OK;
 }
+
+RetCode HosV4L2Dev::GetBlitStats(const std::string& cameraID, V4l2BlitStats& stats)
+{
+    int fd;
+
+    fd = GetCurrentFd(cameraID);
+    if (fd < 0) {
+        CAMERA_LOGE("HosV4L2Dev::GetBlitStats: GetCurrentFd error\n");
+        return RC_ERROR;
+    }
+
+    auto buffers = GetBuffers(fd);
+    if (buffers == nullptr) {
+        CAMERA_LOGE("HosV4L2Dev::GetBlitStats myBuffers_ is NULL\n");
+        return RC_ERROR;
+    }
+
+    return buffers->GetBlitStats(fd, stats);
+}
+
+RetCode HosV4L2Dev::SetThreadMode(V4l2ThreadMode mode)
+{
+    std::lock_guard<std::mutex> l(workerLock_);
+
+    if (streamNumber_ > 0 || !workers_.empty() || (myBuffers_ != nullptr && mode != threadMode_.load())) {
+        CAMERA_LOGE("HosV4L2Dev::SetThreadMode must be called before any buffer is requested\n");
+        return RC_ERROR;
+    }
+
+    threadMode_.store(mode);
+
+    return RC_OK;
+}
+
+RetCode HosV4L2Dev::SetWorkerConfig(const std::string& cameraID, const V4l2WorkerConfig& config)
+{
+    std::lock_guard<std::mutex> l(workerLock_);
+    workerConfigs_[cameraID] = config;
+
+    return RC_OK;
+}
+
+RetCode HosV4L2Dev::StartWorker(const std::string& cameraID, int fd)
+{
+    struct epoll_event epollevent = {};
+    V4l2WorkerConfig config = {-1, 0};
+
+    std::lock_guard<std::mutex> l(workerLock_);
+    auto itr = workers_.find(fd);
+    if (itr == workers_.end()) {
+        CAMERA_LOGE("StartWorker: no buffers requested for fd %{public}d\n", fd);
+        return RC_ERROR;
+    }
+    auto worker = itr->second;
+    if (worker->thread != nullptr) {
+        return RC_OK;
+    }
+
+    auto cfg = workerConfigs_.find(cameraID);
+    if (cfg != workerConfigs_.end()) {
+        config = cfg->second;
+    }
+
+    worker->epollFd = epoll_create(1);
+    worker->eventFd = eventfd(0, 0);
+    if (worker->epollFd < 0 || worker->eventFd < 0) {
+        CAMERA_LOGE("StartWorker: create epoll or eventfd failed\n");
+        close(worker->epollFd);
+        close(worker->eventFd);
+        return RC_ERROR;
+    }
+
+    epollevent.events = EPOLLIN;
+    epollevent.data.fd = fd;
+    epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, fd, &epollevent);
+    epollevent.data.fd = worker->eventFd;
+    epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->eventFd, &epollevent);
+
+    worker->thread = new (std::nothrow) std::thread(&HosV4L2Dev::workerLoop, this, worker, config);
+    if (worker->thread == nullptr) {
+        CAMERA_LOGE("StartWorker: start thread failed\n");
+        close(worker->epollFd);
+        close(worker->eventFd);
+        return RC_ERROR;
+    }
+
+    return RC_OK;
+}
+
+RetCode HosV4L2Dev::StopWorker(int fd)
+{
+    std::thread* thread = nullptr;
+    std::shared_ptr<StreamWorker> worker = nullptr;
+
+    {
+        std::lock_guard<std::mutex> l(workerLock_);
+        auto itr = workers_.find(fd);
+        if (itr == workers_.end() || itr->second->thread == nullptr) {
+            CAMERA_LOGE("StopWorker: no thread running for fd %{public}d\n", fd);
+            return RC_ERROR;
+        }
+        worker = itr->second;
+        thread = worker->thread;
+    }
+
+    // The upper layer may call QueueBuffer from the callback, so join without holding workerLock_
+    uint64_t one = 1;
+    write(worker->eventFd, &one, sizeof(one));
+    thread->join();
+    delete thread;
+
+    close(worker->eventFd);
+    close(worker->epollFd);
+
+    std::lock_guard<std::mutex> l(workerLock_);
+    worker->thread = nullptr;
+    worker->eventFd = -1;
+    worker->epollFd = -1;
+
+    return RC_OK;
+}
+
+void HosV4L2Dev::workerLoop(std::shared_ptr<StreamWorker> worker, V4l2WorkerConfig config)
+{
+    struct epoll_event event = {};
+    std::string name = "v4l2_dq_" + std::to_string(worker->fd);
+    int nfds, rc;
+
+    CAMERA_LOGD("!!! workerLoop enter fd = %{public}d cpu = %{public}d prio = %{public}d\n",
+        worker->fd, config.cpu, config.priority);
+    prctl(PR_SET_NAME, name.c_str());
+
+    if (config.cpu >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(config.cpu, &cpuSet);
+        if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) != 0) {
+            CAMERA_LOGE("workerLoop: set affinity to cpu %{public}d failed: %{public}s\n", config.cpu, strerror(errno));
+        }
+    }
+
+    if (config.priority > 0) {
+        struct sched_param param = {};
+        param.sched_priority = config.priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            CAMERA_LOGE("workerLoop: set SCHED_FIFO %{public}d failed\n", config.priority);
+        }
+    }
+
+    while (true) {
+        nfds = epoll_wait(worker->epollFd, &event, 1, -1);
+        if (nfds <= 0) {
+            continue;
+        }
+
+        if (event.data.fd == worker->eventFd) {
+            break;
+        }
+
+        if (event.events & EPOLLIN) {
+            rc = worker->buffers->V4L2DequeueBuffer(worker->fd);
+            if (rc == RC_ERROR) {
+                CAMERA_LOGE("workerLoop: V4L2DequeueBuffer return error == %d\n", rc);
+            }
+        } else {
+            CAMERA_LOGD("workerLoop: epoll invalid events = 0x%x\n", event.events);
+            usleep(WATING_TIME);
+        }
+    }
+    CAMERA_LOGD("!!! workerLoop exit fd = %{public}d\n", worker->fd);
+}
 } // namespace OHOS::Camera
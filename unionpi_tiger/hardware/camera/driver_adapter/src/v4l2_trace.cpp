@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "v4l2_trace.h"
+
+namespace OHOS::Camera {
+static constexpr uint32_t TRACE_MAGIC = 0x56345452; // "V4TR"
+static constexpr uint32_t TRACE_VERSION = 1;
+static constexpr uint64_t TRACE_CAPACITY = 16384;   // power of two, 512KB of records
+
+// Shared between processes, so only lock free atomics and no pointers. A slot is a seqlock:
+// seq is 0 while the writer fills it and the record number + 1 once it is complete.
+struct TraceSlot {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> tsNs;
+    std::atomic<uint64_t> key;
+    std::atomic<uint64_t> stage;
+};
+
+struct TraceRing {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t capacity;
+    std::atomic<uint32_t> enabled;
+    std::atomic<uint64_t> head;
+    TraceSlot slots[TRACE_CAPACITY];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "trace ring needs lock free 64 bit atomics");
+
+static std::atomic<TraceRing*> g_traceRing {nullptr};
+
+// The ring sits in a world writable directory. Only the camera host creates it, it never follows
+// a link there and never writes to a file somebody else planted. The reader only attaches to a
+// ring that is already there and never resizes or clears it.
+static TraceRing* MapRing(const char* path, bool create)
+{
+    int fd = create ? open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0660) :
+        open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        CAMERA_LOGE("V4l2Trace: open %{public}s failed: %{public}s\n", path, strerror(errno));
+        return nullptr;
+    }
+
+    struct stat st = {};
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1 ||
+        (create && st.st_uid != geteuid()) || (!create && st.st_size != static_cast<off_t>(sizeof(TraceRing)))) {
+        CAMERA_LOGE("V4l2Trace: %{public}s is not a trace ring, ignored\n", path);
+        close(fd);
+        return nullptr;
+    }
+
+    flock(fd, LOCK_EX);
+    if (create && ftruncate(fd, sizeof(TraceRing)) < 0) {
+        CAMERA_LOGE("V4l2Trace: ftruncate %{public}s failed: %{public}s\n", path, strerror(errno));
+        flock(fd, LOCK_UN);
+        close(fd);
+        return nullptr;
+    }
+
+    void* addr = mmap(nullptr, sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        CAMERA_LOGE("V4l2Trace: mmap %{public}s failed: %{public}s\n", path, strerror(errno));
+        flock(fd, LOCK_UN);
+        close(fd);
+        return nullptr;
+    }
+
+    // A fresh file is all zeroes, which is a valid empty ring apart from the header
+    TraceRing* ring = static_cast<TraceRing*>(addr);
+    if (ring->magic.load(std::memory_order_acquire) != TRACE_MAGIC || ring->version != TRACE_VERSION ||
+        ring->capacity != TRACE_CAPACITY) {
+        if (!create) {
+            CAMERA_LOGE("V4l2Trace: %{public}s has no valid ring header\n", path);
+            munmap(addr, sizeof(TraceRing));
+            flock(fd, LOCK_UN);
+            close(fd);
+            return nullptr;
+        }
+        memset(addr, 0, sizeof(TraceRing));
+        ring->version = TRACE_VERSION;
+        ring->capacity = TRACE_CAPACITY;
+        ring->magic.store(TRACE_MAGIC, std::memory_order_release);
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ring;
+}
+
+// Nothing is mapped until v4l2_trace_dump asks for it through V4L2_TRACE_ENABLE_PATH. Until then
+// the recorders only look for that file once a second.
+static TraceRing* GetRing()
+{
+    static std::mutex probeLock;
+    static std::atomic<uint64_t> nextProbeNs {0};
+    constexpr uint64_t probeIntervalNs = 1000000000ULL;
+
+    TraceRing* ring = g_traceRing.load(std::memory_order_acquire);
+    if (ring != nullptr) {
+        return ring;
+    }
+
+    uint64_t now = V4l2TraceNowNs();
+    if (now < nextProbeNs.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    std::unique_lock<std::mutex> l(probeLock, std::try_to_lock);
+    if (!l.owns_lock()) {
+        return nullptr;
+    }
+    nextProbeNs.store(now + probeIntervalNs, std::memory_order_relaxed);
+
+    struct stat st = {};
+    if (g_traceRing.load(std::memory_order_acquire) == nullptr && lstat(V4L2_TRACE_ENABLE_PATH, &st) == 0) {
+        TraceRing* mapped = MapRing(V4L2_TRACE_PATH, true);
+        if (mapped != nullptr) {
+            mapped->enabled.store(1, std::memory_order_relaxed);
+            g_traceRing.store(mapped, std::memory_order_release);
+        }
+    }
+    return g_traceRing.load(std::memory_order_acquire);
+}
+
+RetCode V4l2TraceInit(const char* path)
+{
+    TraceRing* ring = MapRing(path, true);
+    if (ring == nullptr) {
+        return RC_ERROR;
+    }
+
+    TraceRing* old = g_traceRing.exchange(ring, std::memory_order_acq_rel);
+    if (old != nullptr) {
+        // Recorders may still hold the old ring, leave it mapped
+        CAMERA_LOGD("V4l2TraceInit: replaced the ring mapped before\n");
+    }
+    return RC_OK;
+}
+
+uint64_t V4l2TraceNowNs()
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void V4l2TraceRecord(V4l2TraceStage stage, int32_t streamId, int32_t bufferIndex)
+{
+    TraceRing* ring = GetRing();
+    if (ring == nullptr || ring->enabled.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    uint64_t n = ring->head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot& slot = ring->slots[n & (TRACE_CAPACITY - 1)];
+
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.tsNs.store(V4l2TraceNowNs(), std::memory_order_relaxed);
+    slot.key.store((static_cast<uint64_t>(static_cast<uint32_t>(streamId)) << 32) |
+        static_cast<uint32_t>(bufferIndex), std::memory_order_relaxed);
+    slot.stage.store(stage, std::memory_order_relaxed);
+    slot.seq.store(n + 1, std::memory_order_release);
+}
+
+const char* V4l2TraceStageName(V4l2TraceStage stage)
+{
+    static const char* names[V4L2_TRACE_STAGE_COUNT] = {
+        "dqbuf", "blit_begin", "blit_end", "deliver", "encode_begin", "encode_end", "port_out", "drop",
+    };
+
+    return stage < V4L2_TRACE_STAGE_COUNT ? names[stage] : "unknown";
+}
+
+V4l2TraceReader::~V4l2TraceReader()
+{
+    Close();
+}
+
+RetCode V4l2TraceReader::Open(const char* path)
+{
+    Close();
+    TraceRing* ring = MapRing(path, false);
+    if (ring == nullptr) {
+        return RC_ERROR;
+    }
+
+    ring_ = ring;
+    next_ = ring->head.load(std::memory_order_acquire);
+    return RC_OK;
+}
+
+void V4l2TraceReader::Close()
+{
+    if (ring_ != nullptr) {
+        munmap(ring_, sizeof(TraceRing));
+        ring_ = nullptr;
+    }
+}
+
+void V4l2TraceReader::SetEnabled(bool enabled)
+{
+    if (ring_ != nullptr) {
+        static_cast<TraceRing*>(ring_)->enabled.store(enabled ? 1 : 0, std::memory_order_relaxed);
+    }
+}
+
+void V4l2TraceReader::Read(std::vector<V4l2TraceEvent>& events, uint64_t& lost)
+{
+    TraceRing* ring = static_cast<TraceRing*>(ring_);
+    if (ring == nullptr) {
+        return;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (head - next_ > TRACE_CAPACITY) {
+        lost += head - next_ - TRACE_CAPACITY;
+        next_ = head - TRACE_CAPACITY;
+    }
+
+    for (; next_ < head; next_++) {
+        TraceSlot& slot = ring->slots[next_ & (TRACE_CAPACITY - 1)];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq < next_ + 1) {
+            // Claimed but not filled in yet, pick it up on the next call. A writer that never
+            // finishes (the host died mid record) must not stall the reader for good though.
+            if (head - next_ < TRACE_CAPACITY / 2) {
+                break;
+            }
+            lost++;
+            continue;
+        }
+
+        V4l2TraceEvent event = {};
+        event.seq = next_;
+        event.tsNs = slot.tsNs.load(std::memory_order_relaxed);
+        uint64_t key = slot.key.load(std::memory_order_relaxed);
+        event.stage = static_cast<V4l2TraceStage>(slot.stage.load(std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq != next_ + 1 || slot.seq.load(std::memory_order_relaxed) != seq) {
+            // Lapped by the writers while copying
+            lost++;
+            continue;
+        }
+        event.streamId = static_cast<int32_t>(key >> 32);
+        event.bufferIndex = static_cast<int32_t>(key & 0xffffffff);
+        events.push_back(event);
+    }
+}
+} // namespace OHOS::Camera
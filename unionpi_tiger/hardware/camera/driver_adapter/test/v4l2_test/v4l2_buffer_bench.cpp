@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <getopt.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "v4l2_buffer.h"
+#include "v4l2_mock_dev.h"
+
+namespace OHOS::Camera {
+namespace {
+constexpr uint32_t BENCH_WIDTH = 1920;
+constexpr uint32_t BENCH_HEIGHT = 1080;
+
+struct BenchOptions {
+    uint32_t fps = 240;
+    uint32_t seconds = 5;
+    uint32_t buffers = 4;
+};
+
+struct Samples {
+    std::mutex lock;
+    std::vector<uint64_t> values;
+
+    void Add(uint64_t ns)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        values.push_back(ns);
+    }
+
+    void Print(const char* name)
+    {
+        constexpr uint32_t p50 = 50;
+        constexpr uint32_t p99 = 99;
+        constexpr uint32_t hundred = 100;
+
+        std::lock_guard<std::mutex> l(lock);
+        if (values.empty()) {
+            printf("%-16s no samples\n", name);
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        printf("%-16s n=%-7zu p50=%7.2fus p99=%7.2fus max=%7.2fus\n", name, values.size(),
+            values[values.size() * p50 / hundred] / 1000.0, values[values.size() * p99 / hundred] / 1000.0,
+            values.back() / 1000.0);
+    }
+};
+
+Samples g_qbufNs;
+Samples g_dqbufNs;
+Samples g_readyToCallbackNs;
+Samples g_callbackToQbufNs;
+
+std::mutex g_consumerLock;
+std::condition_variable g_consumerCv;
+std::deque<std::pair<std::shared_ptr<FrameSpec>, uint64_t>> g_consumerQueue;
+std::atomic<bool> g_running {true};
+std::atomic<uint64_t> g_frames {0};
+int g_fd = -1;
+
+void ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+    int c;
+    while ((c = getopt(argc, argv, "f:s:n:")) != -1) {
+        switch (c) {
+            case 'f':
+                options.fps = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 's':
+                options.seconds = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'n':
+                options.buffers = static_cast<uint32_t>(atoi(optarg));
+                break;
+            default:
+                printf("usage: v4l2_buffer_bench [-f fps] [-s seconds] [-n buffers]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void OnFrame(std::shared_ptr<FrameSpec> frameSpec)
+{
+    uint64_t now = MockV4L2NowNs();
+    g_readyToCallbackNs.Add(now - MockV4L2ReadyTime(g_fd, frameSpec->buffer_->GetIndex()));
+    g_frames++;
+
+    std::lock_guard<std::mutex> l(g_consumerLock);
+    g_consumerQueue.emplace_back(frameSpec, now);
+    g_consumerCv.notify_one();
+}
+
+// Plays the pipeline side, handing buffers back from another thread like the stream operator does
+void ConsumerLoop(HosV4L2Buffers* buffers)
+{
+    while (true) {
+        std::unique_lock<std::mutex> l(g_consumerLock);
+        g_consumerCv.wait(l, [] { return !g_consumerQueue.empty() || !g_running.load(); });
+        if (g_consumerQueue.empty()) {
+            return;
+        }
+        auto item = g_consumerQueue.front();
+        g_consumerQueue.pop_front();
+        l.unlock();
+
+        uint64_t begin = MockV4L2NowNs();
+        g_callbackToQbufNs.Add(begin - item.second);
+        buffers->V4L2QueueBuffer(g_fd, item.first);
+        g_qbufNs.Add(MockV4L2NowNs() - begin);
+    }
+}
+
+// Same shape as HosV4L2Dev::loopBuffers
+void DequeueLoop(HosV4L2Buffers* buffers)
+{
+    struct epoll_event event = {};
+    int epollFd = epoll_create(1);
+
+    event.events = EPOLLIN;
+    event.data.fd = g_fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, g_fd, &event);
+
+    constexpr int waitMs = 100;
+    while (g_running.load()) {
+        if (epoll_wait(epollFd, &event, 1, waitMs) <= 0) {
+            continue;
+        }
+        uint64_t begin = MockV4L2NowNs();
+        buffers->V4L2DequeueBuffer(g_fd);
+        g_dqbufNs.Add(MockV4L2NowNs() - begin);
+    }
+    close(epollFd);
+}
+} // namespace
+
+int BenchMain(int argc, char** argv)
+{
+    BenchOptions options;
+    ParseOptions(argc, argv, options);
+
+    g_fd = MockV4L2Open(options.fps, BENCH_WIDTH, BENCH_HEIGHT, V4L2_PIX_FMT_YUYV);
+    if (g_fd < 0) {
+        printf("MockV4L2Open failed\n");
+        return -1;
+    }
+
+    HosV4L2Buffers buffers(V4L2_MEMORY_USERPTR, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    buffers.SetCallback(OnFrame);
+    if (buffers.V4L2ReqBuffers(g_fd, options.buffers) != RC_OK) {
+        printf("V4L2ReqBuffers failed\n");
+        return -1;
+    }
+
+    // Frame content is never touched, the bench only measures bookkeeping and hand-off
+    static uint8_t dummy;
+    std::vector<std::shared_ptr<FrameSpec>> frameSpecs;
+    for (uint32_t i = 0; i < options.buffers; i++) {
+        auto frameSpec = std::make_shared<FrameSpec>();
+        frameSpec->buffer_ = std::make_shared<IBuffer>();
+        frameSpec->buffer_->SetIndex(i);
+        frameSpec->buffer_->SetSize(BENCH_WIDTH * BENCH_HEIGHT * 2);
+        frameSpec->buffer_->SetVirAddress(&dummy);
+        frameSpec->bufferPoolId_ = 0;
+        buffers.V4L2AllocBuffer(g_fd, frameSpec);
+        buffers.V4L2QueueBuffer(g_fd, frameSpec);
+        frameSpecs.push_back(frameSpec);
+    }
+
+    ioctl(g_fd, VIDIOC_STREAMON, nullptr);
+    uint64_t begin = MockV4L2NowNs();
+    std::thread consumer(ConsumerLoop, &buffers);
+    std::thread dequeuer(DequeueLoop, &buffers);
+
+    std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+    uint64_t frames = g_frames.load();
+    double elapsed = (MockV4L2NowNs() - begin) / 1e9;
+
+    ioctl(g_fd, VIDIOC_STREAMOFF, nullptr);
+    g_running = false;
+    dequeuer.join();
+    g_consumerCv.notify_all();
+    consumer.join();
+
+    printf("target %u fps, %u buffers, %u s\n", options.fps, options.buffers, options.seconds);
+    printf("delivered %llu frames, %.1f fps, starved periods %llu\n", (unsigned long long)frames,
+        frames / elapsed, (unsigned long long)MockV4L2Starved(g_fd));
+    g_dqbufNs.Print("DQBUF+callback");
+    g_qbufNs.Print("QBUF");
+    g_readyToCallbackNs.Print("ready->callback");
+    g_callbackToQbufNs.Print("callback->QBUF");
+
+    buffers.V4L2ReleaseBuffers(g_fd);
+    MockV4L2Close(g_fd);
+
+    return 0;
+}
+} // namespace OHOS::Camera
+
+int main(int argc, char** argv)
+{
+    return OHOS::Camera::BenchMain(argc, argv);
+}
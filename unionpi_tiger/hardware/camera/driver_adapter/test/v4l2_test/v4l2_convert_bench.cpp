@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <vector>
+#include <linux/videodev2.h>
+#include "v4l2_convert.h"
+
+namespace OHOS::Camera {
+namespace {
+struct BenchOptions {
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    uint32_t iterations = 50;
+    uint32_t threads = 0;
+    bool verifyOnly = false;
+};
+
+struct NamedFormat {
+    uint32_t fourcc;
+    const char* name;
+};
+
+const NamedFormat FORMATS[] = {
+    {V4L2_PIX_FMT_NV21, "NV21"},
+    {V4L2_PIX_FMT_NV12, "NV12"},
+    {V4L2_PIX_FMT_NV16, "NV16"},
+    {V4L2_PIX_FMT_YVU420, "YV12"},
+    {V4L2_PIX_FMT_UYVY, "UYVY"},
+    {V4L2_PIX_FMT_GREY, "GREY"},
+    {V4L2_PIX_FMT_RGB24, "RGB24"},
+    {V4L2_PIX_FMT_BGR24, "BGR24"},
+    {V4L2_PIX_FMT_RGBA32, "RGBA32"},
+    {V4L2_PIX_FMT_RGBX32, "RGBX32"},
+    {V4L2_PIX_FMT_ABGR32, "ABGR32"},
+    {V4L2_PIX_FMT_BGRA32, "BGRA32"},
+};
+
+const V4l2ConvertIsa ISAS[] = {V4L2_ISA_SCALAR, V4L2_ISA_SSE2, V4L2_ISA_AVX2, V4L2_ISA_NEON};
+
+void ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+    int c;
+    while ((c = getopt(argc, argv, "w:h:n:t:v")) != -1) {
+        switch (c) {
+            case 'w':
+                options.width = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'h':
+                options.height = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'n':
+                options.iterations = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 't':
+                options.threads = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'v':
+                options.verifyOnly = true;
+                break;
+            default:
+                printf("usage: v4l2_convert_bench [-w width] [-h height] [-n iterations] [-t threads] [-v]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+std::vector<uint8_t> MakeImage(uint32_t fourcc, uint32_t width, uint32_t height)
+{
+    std::vector<uint8_t> data(V4l2ImageSize(fourcc, width, height));
+    uint32_t seed = 0x12345678;
+
+    // Pseudo random content reaches the clamping corners the gradient of a real scene rarely does
+    for (auto &it : data) {
+        seed = seed * 1103515245 + 12345;
+        it = static_cast<uint8_t>(seed >> 16);
+    }
+    return data;
+}
+
+bool Convert(const std::vector<uint8_t>& in, uint32_t srcFmt, uint32_t sw, uint32_t sh,
+    std::vector<uint8_t>& out, uint32_t dstFmt, uint32_t dw, uint32_t dh)
+{
+    V4l2Image src = {const_cast<uint8_t*>(in.data()), sw, sh, srcFmt, in.size()};
+    out.assign(V4l2ImageSize(dstFmt, dw, dh), 0);
+    V4l2Image dst = {out.data(), dw, dh, dstFmt, out.size()};
+    return V4l2ConvertImage(src, dst) == RC_OK;
+}
+
+// Every kernel set must match the scalar reference bit for bit, single and multi threaded
+uint32_t VerifyPairs(uint32_t sw, uint32_t sh, uint32_t dw, uint32_t dh)
+{
+    uint32_t failures = 0;
+
+    for (auto &src : FORMATS) {
+        std::vector<uint8_t> in = MakeImage(src.fourcc, sw, sh);
+        for (auto &dst : FORMATS) {
+            std::vector<uint8_t> expect;
+            V4l2ConvertSetIsa(V4L2_ISA_SCALAR);
+            V4l2ConvertSetThreads(1);
+            if (!Convert(in, src.fourcc, sw, sh, expect, dst.fourcc, dw, dh)) {
+                printf("FAIL %s->%s %ux%u->%ux%u scalar convert failed\n", src.name, dst.name, sw, sh, dw, dh);
+                failures++;
+                continue;
+            }
+
+            for (auto isa : ISAS) {
+                if (V4l2ConvertSetIsa(isa) != RC_OK) {
+                    continue;
+                }
+                for (uint32_t threads : {1U, 4U}) {
+                    std::vector<uint8_t> out;
+                    V4l2ConvertSetThreads(threads);
+                    if (!Convert(in, src.fourcc, sw, sh, out, dst.fourcc, dw, dh) || out != expect) {
+                        printf("FAIL %s->%s %ux%u->%ux%u %s threads=%u\n", src.name, dst.name, sw, sh, dw, dh,
+                            V4l2ConvertIsaName(isa), threads);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    V4l2ConvertSetIsa(V4L2_ISA_AUTO);
+    V4l2ConvertSetThreads(0);
+    return failures;
+}
+
+// Known values: BT.601 limited range grey, white and the red primary
+uint32_t VerifyReference()
+{
+    struct Probe {
+        uint8_t y, u, v;
+        uint8_t r, g, b;
+    };
+    const Probe probes[] = {
+        {16, 128, 128, 0, 0, 0},
+        {235, 128, 128, 255, 255, 255},
+        {126, 128, 128, 127, 127, 127},
+        {81, 90, 240, 255, 0, 0},
+    };
+    constexpr uint32_t w = 16;
+    constexpr uint32_t h = 2;
+    constexpr int tolerance = 2;
+    uint32_t failures = 0;
+
+    for (auto &p : probes) {
+        std::vector<uint8_t> nv21(w * h * 3 / 2);
+        std::vector<uint8_t> rgba;
+        std::fill(nv21.begin(), nv21.begin() + w * h, p.y);
+        for (uint32_t i = w * h; i < nv21.size(); i += 2) {
+            nv21[i] = p.v;
+            nv21[i + 1] = p.u;
+        }
+        Convert(nv21, V4L2_PIX_FMT_NV21, w, h, rgba, V4L2_PIX_FMT_RGBA32, w, h);
+        if (abs(rgba[0] - p.r) > tolerance || abs(rgba[1] - p.g) > tolerance || abs(rgba[2] - p.b) > tolerance ||
+            rgba[3] != 0xff) {
+            printf("FAIL reference yuv(%u,%u,%u) -> rgb(%u,%u,%u), want (%u,%u,%u)\n", p.y, p.u, p.v,
+                rgba[0], rgba[1], rgba[2], p.r, p.g, p.b);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+void BenchPair(const BenchOptions& options, uint32_t srcFmt, const char* srcName, uint32_t dstFmt,
+    const char* dstName, uint32_t dw, uint32_t dh)
+{
+    std::vector<uint8_t> in = MakeImage(srcFmt, options.width, options.height);
+    std::vector<uint8_t> out;
+
+    for (auto isa : ISAS) {
+        if (V4l2ConvertSetIsa(isa) != RC_OK) {
+            continue;
+        }
+        for (uint32_t threads : {1U, options.threads}) {
+            V4l2ConvertSetThreads(threads);
+            Convert(in, srcFmt, options.width, options.height, out, dstFmt, dw, dh);
+
+            auto begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < options.iterations; i++) {
+                Convert(in, srcFmt, options.width, options.height, out, dstFmt, dw, dh);
+            }
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() /
+                options.iterations;
+
+            printf("%-6s -> %-6s %4ux%-4u -> %4ux%-4u %-6s threads=%-2s %8.2f ms %7.1f Mpix/s\n", srcName, dstName,
+                options.width, options.height, dw, dh, V4l2ConvertIsaName(isa), threads ? std::to_string(threads).c_str() :
+                "auto", us / 1000.0, (double)dw * dh / us);
+        }
+    }
+}
+} // namespace
+
+int BenchMain(int argc, char** argv)
+{
+    BenchOptions options;
+    ParseOptions(argc, argv, options);
+
+    printf("auto selected kernels: %s\n", V4l2ConvertIsaName(V4l2ConvertGetIsa()));
+
+    uint32_t failures = VerifyReference();
+    failures += VerifyPairs(64, 48, 64, 48);
+    failures += VerifyPairs(642, 362, 642, 362);
+    failures += VerifyPairs(1280, 720, 640, 480);
+    failures += VerifyPairs(320, 240, 642, 482);
+    printf("verify: %u failures\n", failures);
+    if (failures != 0 || options.verifyOnly) {
+        return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // The pairs the HAL actually runs: sensor -> NV21 in the adapter, NV21 -> port format in AMLCodecNode
+    BenchPair(options, V4L2_PIX_FMT_NV21, "NV21", V4L2_PIX_FMT_RGBA32, "RGBA32", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_NV21, "NV21", V4L2_PIX_FMT_ABGR32, "ABGR32", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_NV21, "NV21", V4L2_PIX_FMT_RGB24, "RGB24", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_NV21, "NV21", V4L2_PIX_FMT_NV12, "NV12", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_NV21, "NV21", V4L2_PIX_FMT_YVU420, "YV12", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_NV16, "NV16", V4L2_PIX_FMT_NV21, "NV21", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_UYVY, "UYVY", V4L2_PIX_FMT_NV21, "NV21", options.width, options.height);
+    BenchPair(options, V4L2_PIX_FMT_NV21, "NV21", V4L2_PIX_FMT_NV21, "NV21", options.width / 2, options.height / 2);
+
+    return EXIT_SUCCESS;
+}
+} // namespace OHOS::Camera
+
+int main(int argc, char** argv)
+{
+    return OHOS::Camera::BenchMain(argc, argv);
+}
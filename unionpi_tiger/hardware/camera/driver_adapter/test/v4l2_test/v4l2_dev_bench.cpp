@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <getopt.h>
+#include <thread>
+#include <unistd.h>
+#include "v4l2_dev.h"
+#include "v4l2_mock_dev.h"
+
+namespace OHOS::Camera {
+namespace {
+constexpr uint32_t BENCH_MAX_CAMERAS = MAXSTREAMCOUNT;
+constexpr uint32_t BENCH_BUFFERS = 4;
+constexpr uint32_t BENCH_WIDTH = 1280;
+constexpr uint32_t BENCH_HEIGHT = 720;
+
+struct BenchOptions {
+    uint32_t cameras = 2;
+    uint32_t fps = 60;
+    uint32_t seconds = 5;
+    uint32_t slowUs = 12000;
+    int32_t priority = 0;
+    bool pinCpus = false;
+    bool runShared = true;
+    bool runPerStream = true;
+};
+
+struct CameraState {
+    std::string cameraId;
+    int fd = -1;
+    std::vector<std::shared_ptr<FrameSpec>> frames;
+    std::vector<uint64_t> latencyNs;
+    std::atomic<uint64_t> delivered {0};
+};
+
+struct BenchRun {
+    std::shared_ptr<HosV4L2Dev> dev;
+    CameraState cameras[BENCH_MAX_CAMERAS];
+    uint32_t count = 0;
+    uint32_t slowUs = 0;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<FrameSpec>> returned;
+    std::atomic<bool> running {true};
+};
+
+void ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+    int c;
+    while ((c = getopt(argc, argv, "c:f:s:w:p:m:a")) != -1) {
+        switch (c) {
+            case 'c':
+                options.cameras = std::min(static_cast<uint32_t>(atoi(optarg)), BENCH_MAX_CAMERAS);
+                break;
+            case 'f':
+                options.fps = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 's':
+                options.seconds = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'w':
+                options.slowUs = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'p':
+                options.priority = atoi(optarg);
+                break;
+            case 'a':
+                options.pinCpus = true;
+                break;
+            case 'm':
+                options.runShared = strcmp(optarg, "stream") != 0;
+                options.runPerStream = strcmp(optarg, "shared") != 0;
+                break;
+            default:
+                printf("usage: v4l2_dev_bench [-c cameras] [-f fps] [-s seconds] [-w slow_us] "
+                    "[-p fifo_prio] [-a] [-m shared|stream|both]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Runs on the dequeue thread, camera 0 stands in for a stream whose GE2D blit is slow
+void OnFrame(BenchRun* run, std::shared_ptr<FrameSpec> frameSpec)
+{
+    CameraState& cam = run->cameras[frameSpec->bufferPoolId_];
+    uint64_t ready = MockV4L2ReadyTime(cam.fd, frameSpec->buffer_->GetIndex());
+
+    cam.latencyNs.push_back(MockV4L2NowNs() - ready);
+    cam.delivered++;
+    if (frameSpec->bufferPoolId_ == 0 && run->slowUs > 0) {
+        usleep(run->slowUs);
+    }
+
+    std::lock_guard<std::mutex> l(run->lock);
+    run->returned.push_back(frameSpec);
+    run->cv.notify_one();
+}
+
+void ConsumerLoop(BenchRun* run)
+{
+    while (true) {
+        std::unique_lock<std::mutex> l(run->lock);
+        run->cv.wait(l, [run] { return !run->returned.empty() || !run->running.load(); });
+        if (!run->running.load()) {
+            return;
+        }
+        auto frameSpec = run->returned.front();
+        run->returned.pop_front();
+        l.unlock();
+
+        run->dev->QueueBuffer(run->cameras[frameSpec->bufferPoolId_].cameraId, frameSpec);
+    }
+}
+
+RetCode SetupCamera(BenchRun* run, uint32_t i, const BenchOptions& options)
+{
+    CameraState& cam = run->cameras[i];
+    static uint8_t dummy;
+
+    cam.cameraId = "mock_camera_" + std::to_string(i);
+    cam.fd = MockV4L2Open(options.fps, BENCH_WIDTH, BENCH_HEIGHT, V4L2_PIX_FMT_YUYV);
+    if (cam.fd < 0) {
+        return RC_ERROR;
+    }
+    {
+        std::lock_guard<std::mutex> l(HosV4L2Dev::deviceFdLock_);
+        HosV4L2Dev::fdMatch[cam.cameraId] = cam.fd;
+    }
+
+    V4l2WorkerConfig config = {options.pinCpus ? static_cast<int32_t>(i) : -1, options.priority};
+    run->dev->SetWorkerConfig(cam.cameraId, config);
+
+    if (run->dev->ReqBuffers(cam.cameraId, BENCH_BUFFERS) != RC_OK) {
+        return RC_ERROR;
+    }
+
+    for (uint32_t j = 0; j < BENCH_BUFFERS; j++) {
+        auto frameSpec = std::make_shared<FrameSpec>();
+        frameSpec->buffer_ = std::make_shared<IBuffer>();
+        frameSpec->buffer_->SetIndex(j);
+        frameSpec->buffer_->SetSize(BENCH_WIDTH * BENCH_HEIGHT * 2);
+        frameSpec->buffer_->SetVirAddress(&dummy);
+        frameSpec->bufferPoolId_ = i;
+        if (run->dev->CreatBuffer(cam.cameraId, frameSpec) != RC_OK) {
+            return RC_ERROR;
+        }
+        cam.frames.push_back(frameSpec);
+    }
+
+    return RC_OK;
+}
+
+void RunMode(V4l2ThreadMode mode, const BenchOptions& options)
+{
+    constexpr uint32_t p50 = 50;
+    constexpr uint32_t p99 = 99;
+    constexpr uint32_t hundred = 100;
+    BenchRun run;
+
+    run.dev = std::make_shared<HosV4L2Dev>();
+    run.dev->SetThreadMode(mode);
+    run.count = options.cameras;
+    run.slowUs = options.slowUs;
+
+    for (uint32_t i = 0; i < run.count; i++) {
+        if (SetupCamera(&run, i, options) != RC_OK) {
+            printf("setup mock camera %u failed\n", i);
+            return;
+        }
+    }
+
+    run.dev->SetCallback([&run](std::shared_ptr<FrameSpec> frameSpec) { OnFrame(&run, frameSpec); });
+    std::thread consumer(ConsumerLoop, &run);
+
+    for (uint32_t i = 0; i < run.count; i++) {
+        run.dev->StartStream(run.cameras[i].cameraId);
+    }
+    uint64_t begin = MockV4L2NowNs();
+    std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+    double elapsed = (MockV4L2NowNs() - begin) / 1e9;
+
+    for (uint32_t i = 0; i < run.count; i++) {
+        run.dev->StopStream(run.cameras[i].cameraId);
+    }
+    run.running = false;
+    run.cv.notify_all();
+    consumer.join();
+
+    printf("%s mode, %u cameras at %u fps, camera 0 holds the dequeue path %u us per frame\n",
+        mode == V4L2_THREAD_SHARED ? "shared" : "per-stream", run.count, options.fps, options.slowUs);
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < run.count; i++) {
+        CameraState& cam = run.cameras[i];
+        std::vector<uint64_t>& lat = cam.latencyNs;
+        std::sort(lat.begin(), lat.end());
+        total += cam.delivered.load();
+        if (lat.empty()) {
+            printf("  camera %u: no frames\n", i);
+        } else {
+            printf("  camera %u: %6.1f fps  starved %-5llu dequeue latency p50=%8.1fus p99=%8.1fus\n", i,
+                cam.delivered.load() / elapsed, (unsigned long long)MockV4L2Starved(cam.fd),
+                lat[lat.size() * p50 / hundred] / 1000.0, lat[lat.size() * p99 / hundred] / 1000.0);
+        }
+
+        run.dev->ReleaseBuffers(cam.cameraId);
+        {
+            std::lock_guard<std::mutex> l(HosV4L2Dev::deviceFdLock_);
+            HosV4L2Dev::fdMatch.erase(cam.cameraId);
+        }
+        MockV4L2Close(cam.fd);
+    }
+    printf("  aggregate: %.1f fps\n", total / elapsed);
+}
+} // namespace
+
+int BenchMain(int argc, char** argv)
+{
+    BenchOptions options;
+    ParseOptions(argc, argv, options);
+
+    if (options.runShared) {
+        RunMode(V4L2_THREAD_SHARED, options);
+    }
+    if (options.runPerStream) {
+        RunMode(V4L2_THREAD_PER_STREAM, options);
+    }
+
+    return 0;
+}
+} // namespace OHOS::Camera
+
+int main(int argc, char** argv)
+{
+    return OHOS::Camera::BenchMain(argc, argv);
+}
@@ -352,6 +352,12 @@ RetCode V4L2CamFrame(const std::string& cameraID,
 
     CAMERA_LOGD("main test:Exiting V4L2CamFrame thread -- \n");
 
+    V4l2BlitStats stats = {};
+    if (myV4L2Dev->GetBlitStats(cameraID, stats) == RC_OK && stats.frameCount > 0) {
+        CAMERA_LOGD("main test:blit frames = %llu fail = %llu avg = %lluus max = %lluus\n",
+            stats.frameCount, stats.failCount, stats.totalUs / stats.frameCount, stats.maxUs);
+    }
+
     myV4L2Dev->StopStream(cameraID);
     myV4L2Dev->ReleaseBuffers(cameraID);
 
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// <sys/ioctl.h> is deliberately not included, its prototype differs between libcs and this file replaces it
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/videodev2.h>
+#include "v4l2_mock_dev.h"
+
+namespace OHOS::Camera {
+namespace {
+constexpr int MOCK_MAX_DEVICES = 8;
+constexpr uint32_t MOCK_MAX_BUFFERS = 32;
+
+struct MockDev {
+    int fd = -1;
+    uint32_t fps = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pixelFormat = 0;
+    uint32_t count = 0;
+    std::mutex lock;
+    std::deque<uint32_t> pending;
+    std::deque<uint32_t> done;
+    uint64_t readyNs[MOCK_MAX_BUFFERS] = {};
+    std::atomic<uint64_t> starved {0};
+    std::atomic<bool> streaming {false};
+    std::thread* producer = nullptr;
+};
+
+std::atomic<MockDev*> g_mockDevs[MOCK_MAX_DEVICES] = {};
+
+MockDev* FindMock(int fd)
+{
+    for (int i = 0; i < MOCK_MAX_DEVICES; i++) {
+        MockDev* dev = g_mockDevs[i].load(std::memory_order_acquire);
+        if (dev != nullptr && dev->fd == fd) {
+            return dev;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t SizeImage(const MockDev* dev)
+{
+    constexpr uint32_t yuv420Num = 3;
+    constexpr uint32_t yuv420Den = 2;
+    constexpr uint32_t yuv422Bpp = 2;
+
+    if (dev->pixelFormat == V4L2_PIX_FMT_NV21 || dev->pixelFormat == V4L2_PIX_FMT_NV12) {
+        return dev->width * dev->height * yuv420Num / yuv420Den;
+    }
+    return dev->width * dev->height * yuv422Bpp;
+}
+
+void Produce(MockDev* dev)
+{
+    const uint64_t periodNs = 1000000000ULL / dev->fps;
+    struct timespec next = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (dev->streaming.load()) {
+        next.tv_nsec += periodNs;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+
+        std::unique_lock<std::mutex> l(dev->lock);
+        if (dev->pending.empty()) {
+            dev->starved++;
+            continue;
+        }
+        uint32_t index = dev->pending.front();
+        dev->pending.pop_front();
+        dev->readyNs[index] = MockV4L2NowNs();
+        dev->done.push_back(index);
+        l.unlock();
+
+        uint64_t one = 1;
+        write(dev->fd, &one, sizeof(one));
+    }
+}
+
+int MockIoctl(MockDev* dev, unsigned long request, void* arg)
+{
+    switch (request) {
+        case VIDIOC_G_FMT:
+        case VIDIOC_S_FMT: {
+            auto fmt = static_cast<struct v4l2_format*>(arg);
+            fmt->fmt.pix.width = dev->width;
+            fmt->fmt.pix.height = dev->height;
+            fmt->fmt.pix.pixelformat = dev->pixelFormat;
+            fmt->fmt.pix.sizeimage = SizeImage(dev);
+            return 0;
+        }
+        case VIDIOC_REQBUFS: {
+            auto req = static_cast<struct v4l2_requestbuffers*>(arg);
+            if (req->memory == V4L2_MEMORY_DMABUF) {
+                errno = EINVAL;
+                return -1;
+            }
+            std::lock_guard<std::mutex> l(dev->lock);
+            req->count = std::min(req->count, MOCK_MAX_BUFFERS);
+            dev->count = req->count;
+            dev->pending.clear();
+            dev->done.clear();
+            return 0;
+        }
+        case VIDIOC_QUERYBUF: {
+            auto buf = static_cast<struct v4l2_buffer*>(arg);
+            buf->length = SizeImage(dev);
+            return 0;
+        }
+        case VIDIOC_EXPBUF: {
+            // Any fd will do, nothing behind the mock can be blitted
+            auto expbuf = static_cast<struct v4l2_exportbuffer*>(arg);
+            expbuf->fd = dup(dev->fd);
+            return expbuf->fd < 0 ? -1 : 0;
+        }
+        case VIDIOC_QBUF: {
+            auto buf = static_cast<struct v4l2_buffer*>(arg);
+            std::lock_guard<std::mutex> l(dev->lock);
+            if (buf->index >= dev->count) {
+                errno = EINVAL;
+                return -1;
+            }
+            dev->pending.push_back(buf->index);
+            return 0;
+        }
+        case VIDIOC_DQBUF: {
+            auto buf = static_cast<struct v4l2_buffer*>(arg);
+            uint64_t value = 0;
+            if (read(dev->fd, &value, sizeof(value)) < 0) {
+                return -1;
+            }
+            std::lock_guard<std::mutex> l(dev->lock);
+            buf->index = dev->done.front();
+            buf->bytesused = SizeImage(dev);
+            dev->done.pop_front();
+            return 0;
+        }
+        case VIDIOC_STREAMON:
+            if (!dev->streaming.exchange(true)) {
+                dev->producer = new std::thread(Produce, dev);
+            }
+            return 0;
+        case VIDIOC_STREAMOFF:
+            if (dev->streaming.exchange(false)) {
+                dev->producer->join();
+                delete dev->producer;
+                dev->producer = nullptr;
+            }
+            return 0;
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+} // namespace
+
+uint64_t MockV4L2NowNs()
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int MockV4L2Open(uint32_t fps, uint32_t width, uint32_t height, uint32_t pixelFormat)
+{
+    auto dev = new MockDev;
+    dev->fps = fps;
+    dev->width = width;
+    dev->height = height;
+    dev->pixelFormat = pixelFormat;
+    dev->fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+    if (dev->fd < 0) {
+        delete dev;
+        return -1;
+    }
+
+    for (int i = 0; i < MOCK_MAX_DEVICES; i++) {
+        MockDev* expected = nullptr;
+        if (g_mockDevs[i].compare_exchange_strong(expected, dev)) {
+            return dev->fd;
+        }
+    }
+
+    close(dev->fd);
+    delete dev;
+    return -1;
+}
+
+void MockV4L2Close(int fd)
+{
+    for (int i = 0; i < MOCK_MAX_DEVICES; i++) {
+        MockDev* dev = g_mockDevs[i].load();
+        if (dev != nullptr && dev->fd == fd) {
+            MockIoctl(dev, VIDIOC_STREAMOFF, nullptr);
+            g_mockDevs[i].store(nullptr);
+            close(dev->fd);
+            delete dev;
+            return;
+        }
+    }
+}
+
+uint64_t MockV4L2ReadyTime(int fd, uint32_t index)
+{
+    MockDev* dev = FindMock(fd);
+    if (dev == nullptr || index >= MOCK_MAX_BUFFERS) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> l(dev->lock);
+    return dev->readyNs[index];
+}
+
+uint64_t MockV4L2Starved(int fd)
+{
+    MockDev* dev = FindMock(fd);
+    return dev == nullptr ? 0 : dev->starved.load();
+}
+} // namespace OHOS::Camera
+
+extern "C" int ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    va_start(ap, request);
+    void* arg = va_arg(ap, void*);
+    va_end(ap);
+
+    OHOS::Camera::MockDev* dev = OHOS::Camera::FindMock(fd);
+    if (dev == nullptr) {
+        return syscall(SYS_ioctl, fd, request, arg);
+    }
+    return OHOS::Camera::MockIoctl(dev, request, arg);
+}
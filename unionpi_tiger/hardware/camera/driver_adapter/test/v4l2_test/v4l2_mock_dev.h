@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOS_CAMERA_V4L2_MOCK_DEV_H
+#define HOS_CAMERA_V4L2_MOCK_DEV_H
+
+#include <cstdint>
+
+namespace OHOS::Camera {
+/*
+ * A capture device living entirely in user space. The returned fd is an eventfd that becomes
+ * readable whenever a frame is ready, so it can be polled like a real /dev/videoX node, and the
+ * ioctl() calls issued on it are answered by the mock instead of the kernel.
+ */
+int MockV4L2Open(uint32_t fps, uint32_t width, uint32_t height, uint32_t pixelFormat);
+void MockV4L2Close(int fd);
+
+// CLOCK_MONOTONIC time in ns at which buffer index was completed by the mock
+uint64_t MockV4L2ReadyTime(int fd, uint32_t index);
+
+// Frame periods in which the mock had no queued buffer to fill
+uint64_t MockV4L2Starved(int fd);
+
+uint64_t MockV4L2NowNs();
+} // namespace OHOS::Camera
+#endif // HOS_CAMERA_V4L2_MOCK_DEV_H
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <getopt.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "v4l2_trace.h"
+
+namespace OHOS::Camera {
+namespace {
+struct DumpOptions {
+    std::string path = V4L2_TRACE_PATH;
+    uint32_t seconds = 5;
+    bool keepEnabled = false;
+    bool selfTest = false;
+};
+
+struct Samples {
+    std::vector<uint64_t> values;
+
+    void Print(const char* name) const
+    {
+        constexpr uint32_t p50 = 50;
+        constexpr uint32_t p95 = 95;
+        constexpr uint32_t p99 = 99;
+        constexpr uint32_t hundred = 100;
+
+        std::vector<uint64_t> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        printf("  %-28s n=%-6zu p50=%8.2fms p95=%8.2fms p99=%8.2fms max=%8.2fms\n", name, sorted.size(),
+            sorted[sorted.size() * p50 / hundred] / 1e6, sorted[sorted.size() * p95 / hundred] / 1e6,
+            sorted[sorted.size() * p99 / hundred] / 1e6, sorted.back() / 1e6);
+    }
+};
+
+// One frame of one buffer, from DQBUF until it leaves AMLCodecNode
+struct OpenFrame {
+    uint64_t tsNs[V4L2_TRACE_STAGE_COUNT] = {};
+};
+
+struct StreamStats {
+    uint64_t frames = 0;
+    uint64_t delivered = 0;
+    uint64_t dropped = 0;
+    uint64_t incomplete = 0;
+    uint64_t firstOutNs = 0;
+    uint64_t lastOutNs = 0;
+    std::map<std::pair<uint32_t, uint32_t>, Samples> stages;
+    Samples total;
+};
+
+std::atomic<bool> g_stop {false};
+
+void OnSignal(int)
+{
+    g_stop = true;
+}
+
+void ParseOptions(int argc, char** argv, DumpOptions& options)
+{
+    int c;
+    while ((c = getopt(argc, argv, "p:s:kt")) != -1) {
+        switch (c) {
+            case 'p':
+                options.path = optarg;
+                break;
+            case 's':
+                options.seconds = static_cast<uint32_t>(atoi(optarg));
+                break;
+            case 'k':
+                options.keepEnabled = true;
+                break;
+            case 't':
+                options.selfTest = true;
+                break;
+            default:
+                printf("usage: v4l2_trace_dump [-p ring path] [-s seconds] [-k keep tracing enabled] [-t self test]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+class TraceAnalyzer {
+public:
+    void Add(const V4l2TraceEvent& event)
+    {
+        uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(event.streamId)) << 32) |
+            static_cast<uint32_t>(event.bufferIndex);
+        auto it = frames_.find(key);
+
+        if (event.stage == V4L2_TRACE_DQBUF && it != frames_.end()) {
+            Finish(event.streamId, it->second);
+            frames_.erase(it);
+            it = frames_.end();
+        }
+        if (it == frames_.end()) {
+            it = frames_.emplace(key, OpenFrame {}).first;
+        }
+
+        it->second.tsNs[event.stage] = event.tsNs;
+        if (event.stage == V4L2_TRACE_PORT_OUT) {
+            Finish(event.streamId, it->second);
+            frames_.erase(it);
+        }
+    }
+
+    void Print(double seconds, uint64_t lost)
+    {
+        for (auto &frame : frames_) {
+            Finish(static_cast<int32_t>(frame.first >> 32), frame.second);
+        }
+        frames_.clear();
+
+        printf("window %.1f s, %llu records lost to ring overrun\n", seconds, (unsigned long long)lost);
+        for (auto &it : streams_) {
+            const StreamStats& stats = it.second;
+            double fps = 0;
+            if (stats.delivered > 1 && stats.lastOutNs > stats.firstOutNs) {
+                fps = (stats.delivered - 1) * 1e9 / (stats.lastOutNs - stats.firstOutNs);
+            }
+
+            printf("stream %d: frames %llu delivered %llu dropped %llu incomplete %llu, %.2f fps out\n", it.first,
+                (unsigned long long)stats.frames, (unsigned long long)stats.delivered,
+                (unsigned long long)stats.dropped, (unsigned long long)stats.incomplete, fps);
+            for (auto &stage : stats.stages) {
+                std::string name = std::string(V4l2TraceStageName(static_cast<V4l2TraceStage>(stage.first.first))) +
+                    " -> " + V4l2TraceStageName(static_cast<V4l2TraceStage>(stage.first.second));
+                stage.second.Print(name.c_str());
+            }
+            if (!stats.total.values.empty()) {
+                stats.total.Print("dqbuf -> port_out (total)");
+            }
+        }
+    }
+
+private:
+    void Finish(int32_t streamId, const OpenFrame& frame)
+    {
+        StreamStats& stats = streams_[streamId];
+        uint32_t prev = V4L2_TRACE_STAGE_COUNT;
+
+        stats.frames++;
+        if (frame.tsNs[V4L2_TRACE_DROP] != 0) {
+            stats.dropped++;
+        } else if (frame.tsNs[V4L2_TRACE_PORT_OUT] == 0) {
+            stats.incomplete++;
+        } else {
+            stats.delivered++;
+            uint64_t out = frame.tsNs[V4L2_TRACE_PORT_OUT];
+            stats.firstOutNs = stats.firstOutNs == 0 ? out : std::min(stats.firstOutNs, out);
+            stats.lastOutNs = std::max(stats.lastOutNs, out);
+        }
+
+        // Stages are recorded in enum order, a stage the frame skipped is simply left out
+        for (uint32_t stage = 0; stage < V4L2_TRACE_DROP; stage++) {
+            if (frame.tsNs[stage] == 0) {
+                continue;
+            }
+            if (prev != V4L2_TRACE_STAGE_COUNT && frame.tsNs[stage] >= frame.tsNs[prev]) {
+                stats.stages[{prev, stage}].values.push_back(frame.tsNs[stage] - frame.tsNs[prev]);
+            }
+            prev = stage;
+        }
+
+        uint64_t begin = frame.tsNs[V4L2_TRACE_DQBUF];
+        uint64_t end = frame.tsNs[V4L2_TRACE_PORT_OUT];
+        if (begin != 0 && end >= begin && frame.tsNs[V4L2_TRACE_DROP] == 0) {
+            stats.total.values.push_back(end - begin);
+        }
+    }
+
+    std::map<uint64_t, OpenFrame> frames_;
+    std::map<int32_t, StreamStats> streams_;
+};
+
+int Dump(const DumpOptions& options)
+{
+    V4l2TraceReader reader;
+    TraceAnalyzer analyzer;
+    std::vector<V4l2TraceEvent> events;
+    uint64_t lost = 0;
+    constexpr uint32_t pollMs = 10;
+
+    // The camera host looks for the enable file once a second and creates the ring when it sees it
+    int fd = open(V4L2_TRACE_ENABLE_PATH, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("can not create %s\n", V4L2_TRACE_ENABLE_PATH);
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    constexpr uint32_t openRetries = 30;
+    constexpr uint32_t openRetryMs = 100;
+    RetCode rc = reader.Open(options.path.c_str());
+    for (uint32_t i = 0; rc != RC_OK && i < openRetries; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(openRetryMs));
+        rc = reader.Open(options.path.c_str());
+    }
+    if (rc != RC_OK) {
+        printf("can not open trace ring %s, is the camera host streaming?\n", options.path.c_str());
+        if (!options.keepEnabled) {
+            unlink(V4L2_TRACE_ENABLE_PATH);
+        }
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, OnSignal);
+    reader.SetEnabled(true);
+    uint64_t begin = V4l2TraceNowNs();
+    uint64_t end = begin + options.seconds * 1000000000ULL;
+    while (!g_stop && V4l2TraceNowNs() < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollMs));
+        events.clear();
+        reader.Read(events, lost);
+        for (auto &event : events) {
+            analyzer.Add(event);
+        }
+    }
+    if (!options.keepEnabled) {
+        reader.SetEnabled(false);
+        unlink(V4L2_TRACE_ENABLE_PATH);
+    }
+
+    analyzer.Print((V4l2TraceNowNs() - begin) / 1e9, lost);
+    return EXIT_SUCCESS;
+}
+
+// Several writers hammer a private ring while it is read: no record may come back torn,
+// out of order per writer, or go missing without being counted as lost
+int SelfTest(const DumpOptions& options)
+{
+    constexpr int32_t writers = 4;
+    constexpr int32_t recordsPerWriter = 200000;
+    std::string path = options.path + ".selftest";
+    V4l2TraceReader reader;
+    std::vector<V4l2TraceEvent> events;
+    std::atomic<uint32_t> running {writers};
+    std::vector<int32_t> lastIndex(writers, -1);
+    uint64_t lost = 0;
+    uint64_t received = 0;
+    uint64_t failures = 0;
+
+    unlink(path.c_str());
+    if (V4l2TraceInit(path.c_str()) != RC_OK || reader.Open(path.c_str()) != RC_OK) {
+        printf("can not create %s\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+    reader.SetEnabled(true);
+
+    uint64_t begin = V4l2TraceNowNs();
+    std::vector<std::thread> threads;
+    for (int32_t w = 0; w < writers; w++) {
+        threads.emplace_back([w, &running] {
+            for (int32_t i = 0; i < recordsPerWriter; i++) {
+                V4l2TraceRecord(static_cast<V4l2TraceStage>(i % V4L2_TRACE_STAGE_COUNT), w, i);
+            }
+            running--;
+        });
+    }
+
+    auto check = [&]() {
+        for (auto &event : events) {
+            received++;
+            if (event.streamId < 0 || event.streamId >= writers ||
+                event.stage != static_cast<uint32_t>(event.bufferIndex) % V4L2_TRACE_STAGE_COUNT ||
+                event.bufferIndex <= lastIndex[event.streamId]) {
+                failures++;
+                continue;
+            }
+            lastIndex[event.streamId] = event.bufferIndex;
+        }
+        events.clear();
+    };
+    while (running.load() > 0) {
+        reader.Read(events, lost);
+        check();
+        std::this_thread::yield();
+    }
+    uint64_t elapsedNs = V4l2TraceNowNs() - begin;
+    for (auto &it : threads) {
+        it.join();
+    }
+    reader.Read(events, lost);
+    check();
+    unlink(path.c_str());
+
+    uint64_t total = static_cast<uint64_t>(writers) * recordsPerWriter;
+    if (received + lost != total) {
+        failures++;
+    }
+    printf("self test: %llu records, %llu read, %llu lost, %llu bad, %.1f ns per record\n",
+        (unsigned long long)total, (unsigned long long)received, (unsigned long long)lost,
+        (unsigned long long)failures, (double)elapsedNs * writers / total);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+} // namespace
+
+int DumpMain(int argc, char** argv)
+{
+    DumpOptions options;
+    ParseOptions(argc, argv, options);
+
+    return options.selfTest ? SelfTest(options) : Dump(options);
+}
+} // namespace OHOS::Camera
+
+int main(int argc, char** argv)
+{
+    return OHOS::Camera::DumpMain(argc, argv);
+}
@@ -13,56 +13,309 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/prctl.h>
 #include "ipp_algo.h"
 #include "securec.h"
 
 #define MAX_BUFFER_COUNT 100
 
+// Temporal denoise: every output byte is the average of the co-located bytes of up to
+// IPP_MAX_FRAMES input frames. A sample that differs from the first (newest) frame by more
+// than IPP_MOTION_THRESHOLD is replaced by the newest one so that moving edges do not ghost,
+// which also keeps the divisor constant. The filter is purely per byte, so the NV21 luma and
+// interleaved chroma planes go through the same loop.
+#define IPP_MAX_FRAMES 8
+#define IPP_MOTION_THRESHOLD 12
+#define IPP_SPAN_BYTES 512
+#define IPP_STRIPE_ROWS 32
+#define IPP_MAX_WORKERS 4
+#define IPP_RECIP_SHIFT 16
+// Overrides the worker count, so the pool also runs where there is a single core
+#define IPP_WORKERS_ENV "IPP_ALGO_EXAMPLE_WORKERS"
+
+typedef struct {
+    const uint8_t *in[IPP_MAX_FRAMES];
+    int frames;
+    uint8_t *out;
+    unsigned int rowBytes;
+    unsigned int stride;
+    unsigned int rows;
+    int stripeCount;
+} IppJob;
+
+typedef struct {
+    pthread_t threads[IPP_MAX_WORKERS];
+    int threadCount;
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+    unsigned int generation;
+    int running;
+    const IppJob *job;
+    int nextStripe;
+    int pendingStripes;
+} IppWorkerPool;
+
+static IppWorkerPool g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .workCond = PTHREAD_COND_INITIALIZER,
+    .doneCond = PTHREAD_COND_INITIALIZER,
+};
+
+// Serializes Process callers, the pool runs one job at a time
+static pthread_mutex_t g_processLock = PTHREAD_MUTEX_INITIALIZER;
+
+// (sum * g_recip[n]) >> IPP_RECIP_SHIFT rounds sum / n without a division per byte
+static uint32_t g_recip[IPP_MAX_FRAMES + 1];
+
+// Written as plain loops over fixed size spans so the compiler vectorizes them
+static void DenoiseSpan(const IppJob *job, size_t offset, unsigned int len)
+{
+    uint16_t sum[IPP_SPAN_BYTES];
+    const uint8_t *ref = job->in[0] + offset;
+    uint8_t *out = job->out + offset;
+    uint32_t recip = g_recip[job->frames];
+
+    for (unsigned int x = 0; x < len; x++) {
+        sum[x] = ref[x];
+    }
+
+    for (int k = 1; k < job->frames; k++) {
+        const uint8_t *cur = job->in[k] + offset;
+        for (unsigned int x = 0; x < len; x++) {
+            int diff = (int)cur[x] - (int)ref[x];
+            int keep = diff <= IPP_MOTION_THRESHOLD && diff >= -IPP_MOTION_THRESHOLD;
+            sum[x] += keep ? cur[x] : ref[x];
+        }
+    }
+
+    // All reads of this span are done, so out may alias any of the inputs at the same offset
+    for (unsigned int x = 0; x < len; x++) {
+        out[x] = (uint8_t)((sum[x] * recip + (1U << (IPP_RECIP_SHIFT - 1))) >> IPP_RECIP_SHIFT);
+    }
+}
+
+static void ProcessStripe(const IppJob *job, int stripe)
+{
+    unsigned int rowBegin = (unsigned int)stripe * IPP_STRIPE_ROWS;
+    unsigned int rowEnd = rowBegin + IPP_STRIPE_ROWS;
+
+    if (rowEnd > job->rows) {
+        rowEnd = job->rows;
+    }
+
+    for (unsigned int row = rowBegin; row < rowEnd; row++) {
+        size_t base = (size_t)row * job->stride;
+        for (unsigned int x = 0; x < job->rowBytes; x += IPP_SPAN_BYTES) {
+            unsigned int len = job->rowBytes - x;
+            DenoiseSpan(job, base + x, len < IPP_SPAN_BYTES ? len : IPP_SPAN_BYTES);
+        }
+    }
+}
+
+// Must be called with g_pool.lock held, returns with it held
+static void RunStripes(const IppJob *job)
+{
+    while (g_pool.nextStripe < job->stripeCount) {
+        int stripe = g_pool.nextStripe++;
+        pthread_mutex_unlock(&g_pool.lock);
+        ProcessStripe(job, stripe);
+        pthread_mutex_lock(&g_pool.lock);
+        if (--g_pool.pendingStripes == 0) {
+            pthread_cond_signal(&g_pool.doneCond);
+        }
+    }
+}
+
+static void *WorkerLoop(void *arg)
+{
+    unsigned int seen = 0;
+
+    prctl(PR_SET_NAME, "ipp_algo_worker");
+    pthread_mutex_lock(&g_pool.lock);
+    while (1) {
+        while (g_pool.running && (g_pool.job == NULL || g_pool.generation == seen)) {
+            pthread_cond_wait(&g_pool.workCond, &g_pool.lock);
+        }
+        if (!g_pool.running) {
+            break;
+        }
+        seen = g_pool.generation;
+        RunStripes(g_pool.job);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+
+    return NULL;
+}
+
+static void RunJob(const IppJob *job)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.threadCount == 0) {
+        // Started without workers or not started at all, the caller does all the stripes
+        pthread_mutex_unlock(&g_pool.lock);
+        for (int i = 0; i < job->stripeCount; i++) {
+            ProcessStripe(job, i);
+        }
+        return;
+    }
+
+    g_pool.job = job;
+    g_pool.nextStripe = 0;
+    g_pool.pendingStripes = job->stripeCount;
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.workCond);
+
+    // The caller takes stripes too instead of sleeping until the workers are done
+    RunStripes(job);
+    while (g_pool.pendingStripes > 0) {
+        pthread_cond_wait(&g_pool.doneCond, &g_pool.lock);
+    }
+    g_pool.job = NULL;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+static int CheckBuffer(const IppAlgoBuffer *buffer, const IppAlgoBuffer *first, size_t frameBytes)
+{
+    if (buffer == NULL || buffer->addr == NULL || buffer->size < frameBytes) {
+        return -1;
+    }
+    if (buffer->width != first->width || buffer->height != first->height) {
+        return -1;
+    }
+
+    return 0;
+}
+
 int Init(const IppAlgoMeta *meta)
 {
     printf("ipp algo example Init ...\n");
+
+    g_recip[0] = 0;
+    for (uint32_t n = 1; n <= IPP_MAX_FRAMES; n++) {
+        g_recip[n] = ((1U << IPP_RECIP_SHIFT) + n / 2) / n;
+    }
     return 0;
 }
 
 int Start(void)
 {
-    printf("ipp algo example Start ...\n");
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = (cpus > IPP_MAX_WORKERS ? IPP_MAX_WORKERS : (int)cpus) - 1;
+    const char *forced = getenv(IPP_WORKERS_ENV);
+
+    if (forced != NULL && *forced != '\0') {
+        workers = atoi(forced);
+        workers = workers < 0 ? 0 : (workers > IPP_MAX_WORKERS ? IPP_MAX_WORKERS : workers);
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.running) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return 0;
+    }
+    g_pool.running = 1;
+    g_pool.job = NULL;
+    g_pool.generation = 0;
+    g_pool.threadCount = 0;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, WorkerLoop, NULL) != 0) {
+            printf("ipp algo example: worker %d create failed, continue with %d\n", i, i);
+            break;
+        }
+        pthread_mutex_lock(&g_pool.lock);
+        g_pool.threads[g_pool.threadCount++] = thread;
+        pthread_mutex_unlock(&g_pool.lock);
+    }
+
+    printf("ipp algo example Start ... %d workers\n", g_pool.threadCount);
     return 0;
 }
 
 int Flush(void)
 {
+    // Process is synchronous, nothing is ever left in flight
     printf("ipp algo example Flush ...\n");
     return 0;
 }
 
 int Process(IppAlgoBuffer *inBuffer[], int inBufferCount, IppAlgoBuffer *outBuffer, const IppAlgoMeta *meta)
 {
-    printf("ipp algo example Process ...\n");
-    if (inBuffer == NULL || inBufferCount > MAX_BUFFER_COUNT || inBufferCount < 1 ||
-        inBuffer[0] == NULL || inBuffer[0]->addr == NULL) {
-        printf("ipp inBuffer is NULL\n");
+    IppJob job;
+    const IppAlgoBuffer *first;
+    size_t frameBytes;
+
+    if (inBuffer == NULL || inBufferCount > MAX_BUFFER_COUNT || inBufferCount < 1 || inBuffer[0] == NULL) {
         return -1;
     }
 
-    if (outBuffer == NULL || outBuffer->addr == NULL) {
-        printf("ipp outBuffer is NULL\n");
+    // NV21: height luma rows followed by height / 2 interleaved VU rows, all stride bytes apart
+    first = inBuffer[0];
+    job.rowBytes = first->width;
+    job.stride = first->stride ? first->stride : first->width;
+    job.rows = first->height + first->height / 2;
+    if (job.rowBytes == 0 || job.rows == 0 || job.stride < job.rowBytes) {
         return -1;
     }
+    frameBytes = (size_t)job.stride * (job.rows - 1) + job.rowBytes;
 
-    char *in = (char *)(inBuffer[0]->addr);
-    char *out = (char *)(outBuffer->addr);
-    if (memcpy_s(out, outBuffer->size, in, inBuffer[0]->size) != 0) {
-        printf("ipp memcpy_s failed.");
+    if (CheckBuffer(outBuffer, first, frameBytes) != 0) {
         return -1;
     }
 
+    job.frames = inBufferCount < IPP_MAX_FRAMES ? inBufferCount : IPP_MAX_FRAMES;
+    for (int i = 0; i < job.frames; i++) {
+        if (CheckBuffer(inBuffer[i], first, frameBytes) != 0) {
+            return -1;
+        }
+        job.in[i] = (const uint8_t *)inBuffer[i]->addr;
+    }
+    job.out = (uint8_t *)outBuffer->addr;
+    job.stripeCount = (int)((job.rows + IPP_STRIPE_ROWS - 1) / IPP_STRIPE_ROWS);
+
+    if (job.frames == 1) {
+        if (job.out != job.in[0]) {
+            return memcpy_s(job.out, outBuffer->size, job.in[0], frameBytes) == 0 ? 0 : -1;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&g_processLock);
+    RunJob(&job);
+    pthread_mutex_unlock(&g_processLock);
+
     return 0;
 }
 
 int Stop(void)
 {
+    int threadCount;
+
+    // Let an in-flight Process finish before its workers go away
+    pthread_mutex_lock(&g_processLock);
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.running = 0;
+    threadCount = g_pool.threadCount;
+    pthread_cond_broadcast(&g_pool.workCond);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(g_pool.threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.threadCount = 0;
+    pthread_mutex_unlock(&g_pool.lock);
+    pthread_mutex_unlock(&g_processLock);
+
     printf("ipp algo example Stop ...\n");
     return 0;
 }
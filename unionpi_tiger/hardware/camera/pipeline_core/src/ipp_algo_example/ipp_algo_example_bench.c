@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ipp_algo.h"
+
+#define BENCH_MAX_FRAMES 8
+#define BENCH_NOISE_AMPLITUDE 6
+#define BENCH_MOVING_BLOCK 128
+#define BENCH_WORKERS_ENV "IPP_ALGO_EXAMPLE_WORKERS"
+#define BENCH_WORKERS "3"
+
+typedef struct {
+    int frames;
+    int iterations;
+} BenchOptions;
+
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    const char *name;
+} BenchSize;
+
+static const BenchSize BENCH_SIZES[] = {
+    {1920, 1080, "1080p"},
+    {3840, 2160, "4K"},
+};
+
+static uint64_t NowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void ParseOptions(int argc, char **argv, BenchOptions *options)
+{
+    int c;
+    // Without -w the pool gets workers whatever the core count, so its handoff is always checked
+    setenv(BENCH_WORKERS_ENV, BENCH_WORKERS, 0);
+    while ((c = getopt(argc, argv, "f:n:w:")) != -1) {
+        switch (c) {
+            case 'f':
+                options->frames = atoi(optarg);
+                break;
+            case 'n':
+                options->iterations = atoi(optarg);
+                break;
+            case 'w':
+                setenv(BENCH_WORKERS_ENV, optarg, 1);
+                break;
+            default:
+                printf("usage: ipp_algo_example_bench [-f frames] [-n iterations] [-w workers]\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (options->frames < 1 || options->frames > BENCH_MAX_FRAMES || options->iterations < 1) {
+        printf("frames must be 1..%d and iterations > 0\n", BENCH_MAX_FRAMES);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// A smooth gradient scene, the same for every frame apart from a block that moves between them
+static void MakeClean(uint8_t *frame, unsigned int width, unsigned int height, int index)
+{
+    unsigned int blockX = (unsigned int)index * BENCH_MOVING_BLOCK / 2;
+
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            int inBlock = x >= blockX && x < blockX + BENCH_MOVING_BLOCK && y < BENCH_MOVING_BLOCK;
+            frame[(size_t)y * width + x] = inBlock ? 235 : (uint8_t)(32 + (x + y) * 160 / (width + height));
+        }
+    }
+    memset(frame + (size_t)width * height, 128, (size_t)width * height / 2);
+}
+
+static void AddNoise(const uint8_t *clean, uint8_t *noisy, size_t size, uint32_t *seed)
+{
+    for (size_t i = 0; i < size; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        int v = clean[i] + (int)((*seed >> 16) % (2 * BENCH_NOISE_AMPLITUDE + 1)) - BENCH_NOISE_AMPLITUDE;
+        noisy[i] = (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+}
+
+// Luma PSNR against the clean newest frame, outside the moving block
+static double LumaPsnr(const uint8_t *clean, const uint8_t *test, unsigned int width, unsigned int height)
+{
+    double err = 0;
+    size_t count = 0;
+
+    for (unsigned int y = BENCH_MOVING_BLOCK; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            double d = (double)clean[(size_t)y * width + x] - test[(size_t)y * width + x];
+            err += d * d;
+            count++;
+        }
+    }
+    return err == 0 ? 99.0 : 10.0 * log10(255.0 * 255.0 * count / err);
+}
+
+static double TimeProcess(IppAlgoBuffer **in, int frames, IppAlgoBuffer *out, int iterations)
+{
+    uint64_t begin;
+    IppAlgoMeta meta = {0};
+
+    Process(in, frames, out, &meta);
+    begin = NowNs();
+    for (int i = 0; i < iterations; i++) {
+        Process(in, frames, out, &meta);
+    }
+    return (NowNs() - begin) / 1e6 / iterations;
+}
+
+static int BenchSizeRun(const BenchSize *size, const BenchOptions *options)
+{
+    size_t frameBytes = (size_t)size->width * size->height * 3 / 2;
+    uint8_t *clean[BENCH_MAX_FRAMES];
+    uint8_t *noisy[BENCH_MAX_FRAMES];
+    IppAlgoBuffer inBuffers[BENCH_MAX_FRAMES];
+    IppAlgoBuffer *in[BENCH_MAX_FRAMES];
+    uint8_t *inlineOut = malloc(frameBytes);
+    uint8_t *poolOut = malloc(frameBytes);
+    uint8_t *inPlace = malloc(frameBytes);
+    uint32_t seed = 0x2545f491;
+    IppAlgoMeta meta = {0};
+    int failures = 0;
+
+    for (int i = 0; i < options->frames; i++) {
+        clean[i] = malloc(frameBytes);
+        noisy[i] = malloc(frameBytes);
+        MakeClean(clean[i], size->width, size->height, i);
+        AddNoise(clean[i], noisy[i], frameBytes, &seed);
+        inBuffers[i] = (IppAlgoBuffer) {noisy[i], size->width, size->height, size->width, (unsigned int)frameBytes, i};
+        in[i] = &inBuffers[i];
+    }
+
+    IppAlgoBuffer out = {inlineOut, size->width, size->height, size->width, (unsigned int)frameBytes, 0};
+    double inlineMs = TimeProcess(in, options->frames, &out, options->iterations);
+
+    Start();
+    out.addr = poolOut;
+    double poolMs = TimeProcess(in, options->frames, &out, options->iterations);
+
+    // In place on a copy of the newest frame, the way the IPP node hands the same buffer in and out
+    memcpy(inPlace, noisy[0], frameBytes);
+    IppAlgoBuffer *inPlaceIn[BENCH_MAX_FRAMES];
+    IppAlgoBuffer first = inBuffers[0];
+    first.addr = inPlace;
+    inPlaceIn[0] = &first;
+    for (int i = 1; i < options->frames; i++) {
+        inPlaceIn[i] = in[i];
+    }
+    out.addr = inPlace;
+    uint64_t begin = NowNs();
+    Process(inPlaceIn, options->frames, &out, &meta);
+    double inPlaceMs = (NowNs() - begin) / 1e6;
+    Stop();
+
+    if (memcmp(inlineOut, poolOut, frameBytes) != 0) {
+        printf("FAIL %s: pooled output differs from the inline output\n", size->name);
+        failures++;
+    }
+    if (memcmp(inlineOut, inPlace, frameBytes) != 0) {
+        printf("FAIL %s: in place output differs from the out of place output\n", size->name);
+        failures++;
+    }
+
+    double noisyPsnr = LumaPsnr(clean[0], noisy[0], size->width, size->height);
+    double outPsnr = LumaPsnr(clean[0], inlineOut, size->width, size->height);
+    if (options->frames > 1 && outPsnr <= noisyPsnr) {
+        printf("FAIL %s: denoise did not improve PSNR\n", size->name);
+        failures++;
+    }
+
+    printf("%-5s %ux%u frames=%d inline %7.2f ms  pooled %7.2f ms (x%.2f)  in place %7.2f ms  "
+        "PSNR %.2f -> %.2f dB\n", size->name, size->width, size->height, options->frames, inlineMs, poolMs,
+        inlineMs / poolMs, inPlaceMs, noisyPsnr, outPsnr);
+
+    for (int i = 0; i < options->frames; i++) {
+        free(clean[i]);
+        free(noisy[i]);
+    }
+    free(inlineOut);
+    free(poolOut);
+    free(inPlace);
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = {4, 20};
+    IppAlgoMeta meta = {0};
+    int failures = 0;
+
+    ParseOptions(argc, argv, &options);
+    Init(&meta);
+    for (size_t i = 0; i < sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]); i++) {
+        failures += BenchSizeRun(&BENCH_SIZES[i], &options);
+    }
+
+    printf("verify: %d failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
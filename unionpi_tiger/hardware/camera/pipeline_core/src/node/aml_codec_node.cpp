@@ -11,21 +11,29 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 
 #include "securec.h"
 #include "camera.h"
 #include "aml_codec_node.h"
+#include "camera_metadata_operator.h"
 
 #include "vpcodec_1_0.h"
 #include "aml_ge2d.h"
 #include "ge2d_dmabuf.h"
+#include "v4l2_convert.h"
+#include "v4l2_trace.h"
 
 namespace OHOS::Camera {
 #define ENCODER_FRAMERATE (30)
 #define ENCODER_BITRATE (2000000)
 #define ENCODER_GOP (20)
+#define GE2D_POOL_DEPTH (2)
+#define ENCODER_QUEUE_DEPTH (3)
+#define ENCODER_JPEG_QUALITY (95)
 
 uint32_t AMLCodecNode::previewWidth_ = 0;
 uint32_t AMLCodecNode::previewHeight_ = 0;
@@ -76,6 +84,33 @@ static uint32_t pixelFormatOHOSToGe2d(uint32_t bufferFormat)
     return ge2dPixelFmt;
 }
 
+// Same byte orders as the GE2D formats above, for the CPU fallback
+static uint32_t pixelFormatOHOSToV4l2(uint32_t bufferFormat)
+{
+    switch (bufferFormat) {
+        case CAMERA_FORMAT_RGBA_8888:
+            return V4L2_PIX_FMT_RGBA32;
+        case CAMERA_FORMAT_RGBX_8888:
+            return V4L2_PIX_FMT_RGBX32;
+        case CAMERA_FORMAT_RGB_888:
+            return V4L2_PIX_FMT_RGB24;
+        case CAMERA_FORMAT_BGRA_8888:
+            return V4L2_PIX_FMT_ABGR32;
+        case CAMERA_FORMAT_YCRCB_420_P:
+            return V4L2_PIX_FMT_YVU420;
+        case CAMERA_FORMAT_YCBCR_422_SP:
+            return V4L2_PIX_FMT_NV16;
+        case CAMERA_FORMAT_YCRCB_420_SP:
+            return V4L2_PIX_FMT_NV21;
+        case CAMERA_FORMAT_UYVY_422_PKG:
+            return V4L2_PIX_FMT_UYVY;
+        case CAMERA_FORMAT_YCBCR_420_SP:
+            return V4L2_PIX_FMT_NV12;
+        default:
+            return 0;
+    }
+}
+
 static int doBlit(aml_ge2d_t *ge2d, Ge2dCanvasInfo & srcInfo, Ge2dCanvasInfo & dstInfo)
 {
     aml_ge2d_info_t *pge2dinfo = &ge2d->ge2dinfo;
@@ -128,6 +163,11 @@ static int doBlit(aml_ge2d_t *ge2d, Ge2dCanvasInfo & srcInfo, Ge2dCanvasInfo & d
     return ret;
 }
 
+static inline bool sameEncodeParam(const VideoEncodeParam& a, const VideoEncodeParam& b)
+{
+    return a.framerate == b.framerate && a.bitrate == b.bitrate && a.gop == b.gop;
+}
+
 static inline uint64_t getTickMs()
 {
     struct timespec ts = {};
@@ -135,7 +175,8 @@ static inline uint64_t getTickMs()
     return ts.tv_nsec / 1000000ULL + ts.tv_sec * 1000ULL;
 }
 
-AMLCodecNode::AMLCodecNode(const std::string& name, const std::string& type) : NodeBase(name, type)
+AMLCodecNode::AMLCodecNode(const std::string& name, const std::string& type)
+    : NodeBase(name, type), jpegQuality_(ENCODER_JPEG_QUALITY)
 {
     CAMERA_LOGV("%{public}s enter, type(%{public}s)\n", name_.c_str(), type_.c_str());
     ge2d_ = calloc(sizeof(aml_ge2d_t), 1);
@@ -150,11 +191,16 @@ AMLCodecNode::AMLCodecNode(const std::string& name, const std::string& type) : N
         CAMERA_LOGE("aml_ge2d_init() failed.");
         return;
     }
+
+    ge2dPool_ = std::make_unique<Ge2dBufferPool>(((aml_ge2d_t*)ge2d_)->ge2dinfo.ge2d_fd);
 }
 
 AMLCodecNode::~AMLCodecNode()
 {
     CAMERA_LOGI("~AMLCodecNode Node exit.");
+    StopEncodeThread();
+    jpegEnc_.Deinit();
+    ge2dPool_ = nullptr;
     if (ge2d_) {
         aml_ge2d_exit((aml_ge2d_t*)ge2d_);
         CAMERA_LOGD("aml_ge2d_exit()");
@@ -165,7 +211,21 @@ AMLCodecNode::~AMLCodecNode()
 RetCode AMLCodecNode::Start(const int32_t streamId)
 {
     CAMERA_LOGI("AMLCodecNode::Start streamId = %{public}d\n", streamId);
-    vencFrameCnt_ = 0;
+    StartEncodeThread();
+
+    if (ge2dPool_ == nullptr) {
+        return RC_OK;
+    }
+
+    // Reserve the NV21 staging buffers up front so the first frames do not pay for dmabuf_alloc()
+    outPutPorts_ = GetOutPorts();
+    for (auto &it : outPutPorts_) {
+        if (it->format_.streamId_ == streamId && it->format_.w_ > 0 && it->format_.h_ > 0) {
+            size_t size = (size_t)it->format_.w_ * it->format_.h_ * 3 / 2;
+            ge2dPool_->Reserve(streamId, size, GE2D_POOL_DEPTH);
+        }
+    }
+
     return RC_OK;
 }
 
@@ -173,30 +233,97 @@ RetCode AMLCodecNode::Stop(const int32_t streamId)
 {
     CAMERA_LOGI("AMLCodecNode::Stop streamId = %{public}d\n", streamId);
 
-    if (h264Enc_ >= 0) {
-        vl_video_encoder_destory(h264Enc_);
-        h264Enc_ = -1;
+    DrainVideoQueue(streamId);
+    {
+        std::lock_guard<std::mutex> l(encodeLock_);
+        auto it = encoders_.find(streamId);
+        if (it != encoders_.end()) {
+            if (it->second.handle >= 0) {
+                vl_video_encoder_destory(it->second.handle);
+            }
+            CAMERA_LOGI("AMLCodecNode::Stop streamId = %{public}d venc frames = %{public}u", streamId,
+                it->second.frameCnt);
+            encoders_.erase(it);
+        }
+        // The encode queue is shared by all streams, so are its counters
+        CAMERA_LOGI("AMLCodecNode::Stop encode queue totals: queued = %{public}llu, dropped = %{public}llu, " \
+            "max depth = %{public}u", (unsigned long long)encodeQueued_, (unsigned long long)encodeDropped_,
+            encodeMaxDepth_);
     }
-    
+
+    if (ge2dPool_ != nullptr) {
+        CAMERA_LOGI("AMLCodecNode::Stop ge2d pool allocs = %{public}llu",
+            (unsigned long long)ge2dPool_->GetAllocCount());
+        ge2dPool_->ReleaseStream(streamId);
+    }
+
     return RC_OK;
 }
 
 RetCode AMLCodecNode::Flush(const int32_t streamId)
 {
     CAMERA_LOGI("AMLCodecNode::Flush streamId = %{public}d\n", streamId);
+    DrainVideoQueue(streamId);
+    return RC_OK;
+}
+
+RetCode AMLCodecNode::Config(const int32_t streamId, const CaptureMeta& meta)
+{
+    if (meta == nullptr || meta->get() == nullptr) {
+        return RC_OK;
+    }
+
+    common_metadata_header_t* data = meta->get();
+    camera_metadata_item_t entry;
+
+    if (FindCameraMetadataItem(data, OHOS_JPEG_QUALITY, &entry) == 0 && entry.count > 0) {
+        SetJpegQuality((entry.data_type == META_TYPE_BYTE) ? entry.data.u8[0] : (uint32_t)entry.data.i32[0]);
+    }
+
+    // The stream runs at the top of its fps range, bitrate and GOP scale from the 30 fps defaults
+    if (FindCameraMetadataItem(data, OHOS_CONTROL_FPS_RANGES, &entry) == 0 && entry.count >= 2 &&
+        entry.data.i32[1] > 0) {
+        int32_t fps = entry.data.i32[1];
+        VideoEncodeParam param = {
+            fps,
+            (int32_t)((int64_t)ENCODER_BITRATE * fps / ENCODER_FRAMERATE),
+            std::max(ENCODER_GOP * fps / ENCODER_FRAMERATE, 1),
+        };
+        SetVideoEncodeParam(streamId, param);
+    }
+
     return RC_OK;
 }
 
-void AMLCodecNode::encodeJpegToMemory(unsigned char* image, int width, int height, \
+void AMLCodecNode::SetJpegQuality(const uint32_t quality)
+{
+    constexpr uint32_t maxQuality = 100;
+
+    uint32_t clamped = std::min(std::max(quality, 1U), maxQuality);
+    jpegQuality_ = clamped;
+    CAMERA_LOGI("AMLCodecNode::SetJpegQuality quality = %{public}u", clamped);
+}
+
+void AMLCodecNode::encodeJpegToMemory(const uint8_t* nv21, int width, int height, int quality, \
     size_t* jpegSize, unsigned char** jpegBuf)
 {
     struct jpeg_compress_struct cInfo;
     struct jpeg_error_mgr jErr;
-    JSAMPROW row_pointer[1];
-    int row_stride = 0;
-    constexpr uint32_t colorMap = 3;
-    constexpr uint32_t compressionRatio = 100;
-    constexpr uint32_t pixelsThick = 3;
+    constexpr int mcuRows = 16;
+    constexpr int chromaRows = mcuRows / 2;
+    constexpr int colorMap = 3;
+    // Feed NV21 as raw 4:2:0 YCbCr, so libjpeg neither converts colour nor downsamples
+    const int alignedWidth = (width + mcuRows - 1) / mcuRows * mcuRows;
+    const int chromaWidth = alignedWidth / 2;
+    const int chromaHeight = (height + 1) / 2;
+    const uint8_t* vuPlane = nv21 + width * height;
+    std::vector<uint8_t> lumaPad(alignedWidth == width ? 0 : alignedWidth * mcuRows);
+    std::vector<uint8_t> cbRows(chromaWidth * chromaRows);
+    std::vector<uint8_t> crRows(chromaWidth * chromaRows);
+    JSAMPROW yRow[mcuRows];
+    JSAMPROW cbRow[chromaRows];
+    JSAMPROW crRow[chromaRows];
+    JSAMPARRAY planes[colorMap] = {yRow, cbRow, crRow};
 
     cInfo.err = jpeg_std_error(&jErr);
 
@@ -204,29 +331,101 @@ void AMLCodecNode::encodeJpegToMemory(unsigned char* image, int width, int heigh
     cInfo.image_width = width;
     cInfo.image_height = height;
     cInfo.input_components = colorMap;
-    cInfo.in_color_space = JCS_RGB;
+    cInfo.in_color_space = JCS_YCbCr;
 
     jpeg_set_defaults(&cInfo);
-    jpeg_set_quality(&cInfo, compressionRatio, TRUE);
+    jpeg_set_colorspace(&cInfo, JCS_YCbCr);
+    cInfo.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+    cInfo.do_fancy_downsampling = FALSE;
+#endif
+    cInfo.comp_info[0].h_samp_factor = 2;
+    cInfo.comp_info[0].v_samp_factor = 2;
+    cInfo.comp_info[1].h_samp_factor = 1;
+    cInfo.comp_info[1].v_samp_factor = 1;
+    cInfo.comp_info[2].h_samp_factor = 1;
+    cInfo.comp_info[2].v_samp_factor = 1;
+    jpeg_set_quality(&cInfo, quality, TRUE);
     jpeg_mem_dest(&cInfo, jpegBuf, jpegSize);
     jpeg_start_compress(&cInfo, TRUE);
 
-    row_stride = width;
+    for (int i = 0; i < chromaRows; i++) {
+        cbRow[i] = &cbRows[i * chromaWidth];
+        crRow[i] = &crRows[i * chromaWidth];
+    }
+
     while (cInfo.next_scanline < cInfo.image_height) {
-        row_pointer[0] = &image[cInfo.next_scanline * row_stride * pixelsThick];
-        jpeg_write_scanlines(&cInfo, row_pointer, 1);
+        int top = cInfo.next_scanline;
+
+        for (int i = 0; i < mcuRows; i++) {
+            const uint8_t* src = nv21 + std::min(top + i, height - 1) * width;
+            if (lumaPad.empty()) {
+                yRow[i] = (JSAMPROW)src;
+                continue;
+            }
+            yRow[i] = &lumaPad[i * alignedWidth];
+            (void)memcpy_s(yRow[i], alignedWidth, src, width);
+            (void)memset_s(yRow[i] + width, alignedWidth - width, src[width - 1], alignedWidth - width);
+        }
+
+        for (int i = 0; i < chromaRows; i++) {
+            const uint8_t* vu = vuPlane + std::min(top / 2 + i, chromaHeight - 1) * width;
+            for (int x = 0; x < chromaWidth; x++) {
+                int sx = std::min(x, width / 2 - 1) * 2;
+                crRow[i][x] = vu[sx];
+                cbRow[i][x] = vu[sx + 1];
+            }
+        }
+
+        jpeg_write_raw_data(&cInfo, planes, mcuRows);
     }
 
     jpeg_finish_compress(&cInfo);
     jpeg_destroy_compress(&cInfo);
 }
 
+void AMLCodecNode::EncodeForPreviewCpu(std::shared_ptr<IBuffer>& buffer)
+{
+    uint32_t dstFmt = pixelFormatOHOSToV4l2((uint32_t)buffer->GetFormat());
+    uint64_t tickBegin = getTickMs();
+
+    if (!dstFmt) {
+        CAMERA_LOGE("Error: Unsuported dstFmt: %{public}u", buffer->GetFormat());
+        return;
+    }
+
+    if (dstFmt == V4L2_PIX_FMT_NV21) {
+        return;
+    }
+
+    // Same in-place problem as the GE2D path, the stage is kept across frames
+    size_t stageSize = (size_t)buffer->GetWidth() * buffer->GetHeight() * 3 / 2;
+    if (buffer->GetVirAddress() == nullptr || buffer->GetSize() < stageSize) {
+        CAMERA_LOGE("Error: invalid preview buffer for cpu convert");
+        return;
+    }
+    cpuStage_.resize(stageSize);
+    if (memcpy_s(cpuStage_.data(), cpuStage_.size(), buffer->GetVirAddress(), stageSize) != EOK) {
+        return;
+    }
+
+    V4l2Image src = {cpuStage_.data(), buffer->GetWidth(), buffer->GetHeight(), V4L2_PIX_FMT_NV21, stageSize};
+    V4l2Image dst = {(uint8_t *)buffer->GetVirAddress(), buffer->GetWidth(), buffer->GetHeight(), dstFmt,
+        buffer->GetSize()};
+    if (V4l2ConvertImage(src, dst) != RC_OK) {
+        CAMERA_LOGE("Error: cpu convert to %{public}u failed", dstFmt);
+        return;
+    }
+
+    CAMERA_LOGD("cpu convert dstFmt=%{public}u, use_time=%{public}llums", dstFmt, getTickMs() - tickBegin);
+}
+
 void AMLCodecNode::EncodeForPreview(std::shared_ptr<IBuffer>& buffer)
 {
     aml_ge2d_t *ge2d = (aml_ge2d_t *)ge2d_;
-    int ret, dmaFd = 0;
-    uint8_t *vaddrTmp = nullptr;
+    int dmaFd = -1;
     uint32_t dstFmt;
+    size_t stageSize;
     uint64_t tickBegin = getTickMs();
     Ge2dCanvasInfo srcInfo;
     Ge2dCanvasInfo dstInfo;
@@ -236,8 +435,8 @@ void AMLCodecNode::EncodeForPreview(std::shared_ptr<IBuffer>& buffer)
         return;
     }
 
-    if (!ge2d) {
-        CAMERA_LOGE("Error: ge2d == nullptr");
+    if (!ge2d || ge2dPool_ == nullptr) {
+        EncodeForPreviewCpu(buffer);
         return;
     }
 
@@ -252,9 +451,12 @@ void AMLCodecNode::EncodeForPreview(std::shared_ptr<IBuffer>& buffer)
         return;
     }
 
-    dmaFd = dmabuf_alloc(ge2d->ge2dinfo.ge2d_fd, GE2D_BUF_OUTPUT, buffer->GetSize());
+    // The NV21 frame and the converted frame share one buffer, so the source has to be staged.
+    // Stage the NV21 copy (1.5 bytes/pixel) and let the only converting blit write the port buffer.
+    stageSize = (size_t)buffer->GetWidth() * buffer->GetHeight() * 3 / 2;
+    dmaFd = ge2dPool_->Acquire(buffer->GetStreamId(), stageSize);
     if (dmaFd < 0) {
-        CAMERA_LOGE("Error: dmabuf_alloc() failed.");
+        CAMERA_LOGE("Error: no ge2d staging buffer.");
         return;
     }
 
@@ -264,91 +466,101 @@ void AMLCodecNode::EncodeForPreview(std::shared_ptr<IBuffer>& buffer)
     srcInfo.dmaFd = buffer->GetFileDescriptor();
     dstInfo.width = buffer->GetWidth();
     dstInfo.height = buffer->GetHeight();
-    dstInfo.format = dstFmt;
+    dstInfo.format = (uint32_t)GE2D_PIXEL_FORMAT_YCrCb_420_SP;
     dstInfo.dmaFd = dmaFd;
-    doBlit(ge2d, srcInfo, dstInfo);
-
-    srcInfo.width = buffer->GetWidth();
-    srcInfo.height = buffer->GetHeight();
-    srcInfo.format = dstFmt;
-    srcInfo.dmaFd = dmaFd;
-    dstInfo.width = buffer->GetWidth();
-    dstInfo.height = buffer->GetHeight();
-    dstInfo.format = dstFmt;
-    dstInfo.dmaFd = buffer->GetFileDescriptor();
-    doBlit(ge2d, srcInfo, dstInfo);
+    if (doBlit(ge2d, srcInfo, dstInfo) == 0) {
+        srcInfo.dmaFd = dmaFd;
+        dstInfo.format = dstFmt;
+        dstInfo.dmaFd = buffer->GetFileDescriptor();
+        doBlit(ge2d, srcInfo, dstInfo);
+    }
 
-    close(dmaFd);
+    ge2dPool_->Release(dmaFd);
 
     CAMERA_LOGD("srcFmt=%{public}d, dstFmt=%{public}d, use_time=%{public}llums", \
         GE2D_PIXEL_FORMAT_YCrCb_420_SP, dstFmt, getTickMs()-tickBegin);
 }
 
+int32_t AMLCodecNode::EncodeJpegHw(std::shared_ptr<IBuffer>& buffer, uint32_t quality)
+{
+    if (jpegHwFailed_) {
+        return -1;
+    }
+
+    if (!jpegEnc_.IsReady() && jpegEnc_.Init() != RC_OK) {
+        // The encoder is exclusive, do not retry on every shot once it could not be opened
+        jpegHwFailed_ = true;
+        return -1;
+    }
+
+    // The input is staged in the encoder's own buffer, so the JPEG can overwrite the frame in place
+    return jpegEnc_.EncodeNV21((const uint8_t *)buffer->GetVirAddress(), previewWidth_, previewHeight_, \
+        quality, (uint8_t *)buffer->GetVirAddress(), buffer->GetSize());
+}
+
 void AMLCodecNode::EncodeForJpeg(std::shared_ptr<IBuffer>& buffer)
 {
-    aml_ge2d_t *ge2d = (aml_ge2d_t *)ge2d_;
-    int dmaFd = -1;
-    uint8_t *srcBuf = nullptr;
     unsigned char* jBuf = nullptr;
     size_t jpegSize = 0;
-    Ge2dCanvasInfo srcInfo;
-    Ge2dCanvasInfo dstInfo;
+    int32_t hwSize = -1;
+    uint32_t quality = jpegQuality_;
+    uint64_t tickBegin = getTickMs();
+    uint64_t shotGap = 0;
 
     if (buffer == nullptr) {
         CAMERA_LOGI("AMLCodecNode::EncodeForJpeg buffer == nullptr");
         return;
     }
 
-    dmaFd = dmabuf_alloc(ge2d->ge2dinfo.ge2d_fd, GE2D_BUF_OUTPUT, buffer->GetSize());
-    if (dmaFd < 0) {
-        CAMERA_LOGE("Error: dmabuf_alloc() failed.");
-        return;
-    }
-
-    srcInfo.width = previewWidth_;
-    srcInfo.height = previewHeight_;
-    srcInfo.format = (uint32_t)GE2D_PIXEL_FORMAT_YCrCb_420_SP;
-    srcInfo.dmaFd = buffer->GetFileDescriptor();
-    dstInfo.width = previewWidth_;
-    dstInfo.height = previewHeight_;
-    dstInfo.format = (uint32_t)GE2D_PIXEL_FORMAT_RGB_888;
-    dstInfo.dmaFd = dmaFd;
-    doBlit(ge2d, srcInfo, dstInfo);
-
-    srcBuf = (uint8_t *)mmap(NULL, buffer->GetSize(), PROT_READ | PROT_WRITE, MAP_SHARED, dmaFd, 0);
-    if (!srcBuf) {
-        CAMERA_LOGE("Error: mmap() failed.");
-        close(dmaFd);
+    if (buffer->GetVirAddress() == nullptr || !previewWidth_ || !previewHeight_) {
+        CAMERA_LOGE("Error: no NV21 frame to encode.");
         return;
     }
 
-    encodeJpegToMemory(srcBuf, previewWidth_, previewHeight_, &jpegSize, &jBuf);
-    if (memcpy_s(buffer->GetVirAddress(), buffer->GetSize(), jBuf, jpegSize) != EOK) {
-        CAMERA_LOGE("AMLCodecNode::memcpy_s fail!\n");
+    hwSize = EncodeJpegHw(buffer, quality);
+    if (hwSize > 0) {
+        jpegSize = hwSize;
+    } else {
+        encodeJpegToMemory((const uint8_t *)buffer->GetVirAddress(), previewWidth_, previewHeight_, \
+            quality, &jpegSize, &jBuf);
+        if (memcpy_s(buffer->GetVirAddress(), buffer->GetSize(), jBuf, jpegSize) != EOK) {
+            CAMERA_LOGE("AMLCodecNode::memcpy_s fail!\n");
+        }
+        free(jBuf);
     }
 
     buffer->SetEsFrameSize(jpegSize);
-    free(jBuf);
 
-    if (dmaFd >= 0) {
-        munmap(srcBuf, buffer->GetSize());
-        close(dmaFd);
+    uint64_t tickEnd = getTickMs();
+    if (jpegLastShotMs_ != 0) {
+        shotGap = tickEnd - jpegLastShotMs_;
     }
+    jpegLastShotMs_ = tickEnd;
+    jpegShotCnt_++;
 
-    CAMERA_LOGE("AMLCodecNode::EncodeForJpeg jpegSize = %{public}d\n", jpegSize);
+    CAMERA_LOGI("AMLCodecNode::EncodeForJpeg [%{public}u] %{public}s q=%{public}u jpegSize=%{public}zu " \
+        "encode=%{public}llums shot_to_shot=%{public}llums", jpegShotCnt_, (hwSize > 0) ? "hw" : "sw", quality,
+        jpegSize, (unsigned long long)(tickEnd - tickBegin), (unsigned long long)shotGap);
 }
 
-void AMLCodecNode::EncodeForVideo(std::shared_ptr<IBuffer>& buffer)
+void AMLCodecNode::SetVideoEncodeParam(const int32_t streamId, const VideoEncodeParam& param)
 {
+    std::lock_guard<std::mutex> l(encodeLock_);
+    encodeParams_[streamId] = param;
+    CAMERA_LOGI("AMLCodecNode::SetVideoEncodeParam streamId = %{public}d, fps = %{public}d, " \
+        "bitrate = %{public}d, gop = %{public}d", streamId, param.framerate, param.bitrate, param.gop);
+}
+
+void AMLCodecNode::EncodeForVideo(EncodeRequest& request)
+{
+    std::shared_ptr<IBuffer>& buffer = request.buffer;
+    VideoEncoder* encoder = nullptr;
+    VideoEncodeParam param = {ENCODER_FRAMERATE, ENCODER_BITRATE, ENCODER_GOP};
     int datalen = 0;
-    unsigned output_size;
     int idr_flag = 0;
     uint64_t tickBegin = getTickMs();
-    vl_encoder_param_t encoder_param;
-    vl_encode_info_t encode_info;
-    const int framerate = 30;
-    const int bitrate = 2000000;
-    const int gop = 20;
+    vl_encoder_param_t encoder_param = {};
+    vl_encode_info_t encode_info = {};
 
     if (buffer == nullptr) {
         CAMERA_LOGI("buffer == nullptr");
@@ -356,36 +568,54 @@ void AMLCodecNode::EncodeForVideo(std::shared_ptr<IBuffer>& buffer)
     }
 
     CAMERA_LOGD("buffer_size=(%{public}d, %{public}d), preview_size=(%{public}d, %{public}d)", \
-        buffer->GetWidth(), buffer->GetHeight(), previewWidth_, previewHeight_);
+        buffer->GetWidth(), buffer->GetHeight(), request.width, request.height);
+
+    {
+        std::lock_guard<std::mutex> l(encodeLock_);
+        auto it = encodeParams_.find(buffer->GetStreamId());
+        if (it != encodeParams_.end()) {
+            param = it->second;
+        }
+        encoder = &encoders_[buffer->GetStreamId()];
+    }
 
-    if (h264Enc_ < 0) {
-        encoder_param.framerate = framerate;
-        encoder_param.bitrate = bitrate;
-        encoder_param.gop = gop;
-        h264Enc_ = (long)vl_video_encoder_init(CODEC_ID_H264, previewWidth_, previewHeight_, \
+    if (encoder->handle >= 0 && (encoder->width != request.width || encoder->height != request.height ||
+        !sameEncodeParam(encoder->param, param))) {
+        vl_video_encoder_destory(encoder->handle);
+        encoder->handle = -1;
+    }
+
+    if (encoder->handle < 0) {
+        encoder_param.framerate = param.framerate;
+        encoder_param.bitrate = param.bitrate;
+        encoder_param.gop = param.gop;
+        encoder->handle = (long)vl_video_encoder_init(CODEC_ID_H264, request.width, request.height, \
             encoder_param, IMG_FMT_NV21);
-        CAMERA_LOGD("INFO: vl_video_encoder_init(): %{public}s.", (h264Enc_<0)?"FAILED":"SUCCESS");
+        encoder->param = param;
+        encoder->width = request.width;
+        encoder->height = request.height;
+        CAMERA_LOGD("INFO: vl_video_encoder_init(): %{public}s.", (encoder->handle<0)?"FAILED":"SUCCESS");
     }
 
-    if (h264Enc_ < 0) {
+    if (encoder->handle < 0) {
         CAMERA_LOGE("Error: Video Encoder not inited yet.");
+        buffer->SetBufferStatus(CAMERA_BUFFER_STATUS_INVALID);
         return;
     }
 
-    uint8_t *output_buffer = (uint8_t *)malloc(buffer->GetSize());
-    if (!output_buffer) {
-        CAMERA_LOGE("Error: malloc failed.");
-        return;
+    // The bitstream buffer belongs to the stream and only grows, so steady state never allocates
+    if (encoder->bitstream.size() < buffer->GetSize()) {
+        encoder->bitstream.resize(buffer->GetSize());
     }
 
     encode_info.frame_type = FRAME_TYPE_AUTO;
     encode_info.format = 1; /* NV21 */
-    datalen = vl_video_encoder_encode(h264Enc_, encode_info, \
-        (unsigned char*)buffer->GetVirAddress(), output_buffer, &idr_flag);
+    datalen = vl_video_encoder_encode(encoder->handle, encode_info, \
+        (unsigned char*)buffer->GetVirAddress(), encoder->bitstream.data(), &idr_flag);
     if (datalen > 0) {
         struct timespec ts = {};
 
-        memcpy_s(buffer->GetVirAddress(), buffer->GetSize(), output_buffer, datalen);
+        memcpy_s(buffer->GetVirAddress(), buffer->GetSize(), encoder->bitstream.data(), datalen);
         buffer->SetEsFrameSize(datalen);
 
         clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -393,13 +623,181 @@ void AMLCodecNode::EncodeForVideo(std::shared_ptr<IBuffer>& buffer)
 
         buffer->SetEsKeyFrame(idr_flag);
 
-        vencFrameCnt_++;
+        encoder->frameCnt++;
 
         CAMERA_LOGD("[%{public}u] datalen=%{public}d, idr=%{public}d, use_time=%{public}llums", \
-            vencFrameCnt_, datalen, idr_flag, getTickMs()-tickBegin);
+            encoder->frameCnt, datalen, idr_flag, getTickMs()-tickBegin);
+    }
+}
+
+void AMLCodecNode::QueueForVideo(std::shared_ptr<IBuffer>& buffer)
+{
+    std::shared_ptr<IBuffer> dropped = nullptr;
+    EncodeRequest request = {buffer, previewWidth_, previewHeight_};
+    uint32_t depth = 0;
+
+    {
+        std::unique_lock<std::mutex> l(encodeLock_);
+        if (!encodeRunning_) {
+            // No encode thread: claim the encoder like encodeLoop does, so Stop() waits for this frame
+            encodeCv_.wait(l, [this] { return encodingStream_ == -1; });
+            encodingStream_ = buffer->GetStreamId();
+        } else {
+            // Drop the oldest frame rather than stall the delivery thread behind the encoder
+            if (encodeQueue_.size() >= ENCODER_QUEUE_DEPTH) {
+                dropped = encodeQueue_.front().buffer;
+                encodeQueue_.pop_front();
+                encodeDropped_++;
+            }
+            encodeQueue_.push_back(request);
+            encodeQueued_++;
+            depth = encodeQueue_.size();
+            encodeMaxDepth_ = std::max(encodeMaxDepth_, depth);
+        }
+    }
+
+    if (depth == 0) {
+        V4l2TraceRecord(V4L2_TRACE_ENCODE_BEGIN, buffer->GetStreamId(), buffer->GetIndex());
+        EncodeForVideo(request);
+        V4l2TraceRecord(V4L2_TRACE_ENCODE_END, buffer->GetStreamId(), buffer->GetIndex());
+        DeliverToPort(buffer);
+        {
+            std::lock_guard<std::mutex> l(encodeLock_);
+            encodingStream_ = -1;
+        }
+        encodeCv_.notify_all();
+        return;
+    }
+
+    encodeCv_.notify_all();
+    CAMERA_LOGD("AMLCodecNode::QueueForVideo depth = %{public}u", depth);
+
+    if (dropped != nullptr) {
+        V4l2TraceRecord(V4L2_TRACE_DROP, dropped->GetStreamId(), dropped->GetIndex());
+        dropped->SetBufferStatus(CAMERA_BUFFER_STATUS_DROP);
+        DeliverToPort(dropped);
     }
+}
 
-    free(output_buffer);
+void AMLCodecNode::DrainVideoQueue(const int32_t streamId)
+{
+    std::list<EncodeRequest> dropped;
+
+    {
+        std::unique_lock<std::mutex> l(encodeLock_);
+        for (auto it = encodeQueue_.begin(); it != encodeQueue_.end();) {
+            if (it->buffer->GetStreamId() == streamId) {
+                dropped.push_back(*it);
+                it = encodeQueue_.erase(it);
+            } else {
+                it++;
+            }
+        }
+        encodeCv_.wait(l, [this, streamId] { return encodingStream_ != streamId; });
+    }
+
+    for (auto &it : dropped) {
+        V4l2TraceRecord(V4L2_TRACE_DROP, it.buffer->GetStreamId(), it.buffer->GetIndex());
+        it.buffer->SetBufferStatus(CAMERA_BUFFER_STATUS_DROP);
+        DeliverToPort(it.buffer);
+    }
+}
+
+void AMLCodecNode::StartEncodeThread()
+{
+    std::lock_guard<std::mutex> l(encodeLock_);
+    if (encodeThread_ != nullptr) {
+        return;
+    }
+
+    encodeRunning_ = true;
+    encodeThread_ = new (std::nothrow) std::thread([this] { encodeLoop(); });
+    if (encodeThread_ == nullptr) {
+        encodeRunning_ = false;
+        CAMERA_LOGE("AMLCodecNode::StartEncodeThread failed, encoding on the delivery thread");
+    }
+}
+
+void AMLCodecNode::StopEncodeThread()
+{
+    std::thread* thread = nullptr;
+    std::list<EncodeRequest> dropped;
+
+    {
+        std::lock_guard<std::mutex> l(encodeLock_);
+        encodeRunning_ = false;
+        thread = encodeThread_;
+        encodeThread_ = nullptr;
+    }
+
+    if (thread != nullptr) {
+        encodeCv_.notify_all();
+        thread->join();
+        delete thread;
+    }
+
+    {
+        // The loop leaves whatever is still queued, those buffers go back to their pool as drops
+        std::lock_guard<std::mutex> l(encodeLock_);
+        dropped.swap(encodeQueue_);
+        for (auto &it : encoders_) {
+            if (it.second.handle >= 0) {
+                vl_video_encoder_destory(it.second.handle);
+            }
+        }
+        encoders_.clear();
+    }
+
+    for (auto &it : dropped) {
+        V4l2TraceRecord(V4L2_TRACE_DROP, it.buffer->GetStreamId(), it.buffer->GetIndex());
+        it.buffer->SetBufferStatus(CAMERA_BUFFER_STATUS_DROP);
+        DeliverToPort(it.buffer);
+    }
+}
+
+void AMLCodecNode::encodeLoop()
+{
+    prctl(PR_SET_NAME, "aml_venc");
+
+    while (true) {
+        EncodeRequest request;
+        {
+            std::unique_lock<std::mutex> l(encodeLock_);
+            // A frame encoded synchronously before the thread started may still hold the encoder
+            encodeCv_.wait(l, [this] { return !encodeRunning_ || (!encodeQueue_.empty() && encodingStream_ == -1); });
+            if (!encodeRunning_) {
+                break;
+            }
+            request = encodeQueue_.front();
+            encodeQueue_.pop_front();
+            encodingStream_ = request.buffer->GetStreamId();
+        }
+
+        V4l2TraceRecord(V4L2_TRACE_ENCODE_BEGIN, request.buffer->GetStreamId(), request.buffer->GetIndex());
+        EncodeForVideo(request);
+        V4l2TraceRecord(V4L2_TRACE_ENCODE_END, request.buffer->GetStreamId(), request.buffer->GetIndex());
+        DeliverToPort(request.buffer);
+
+        {
+            std::lock_guard<std::mutex> l(encodeLock_);
+            encodingStream_ = -1;
+        }
+        encodeCv_.notify_all();
+    }
+}
+
+void AMLCodecNode::DeliverToPort(std::shared_ptr<IBuffer>& buffer)
+{
+    std::vector<std::shared_ptr<IPort>> ports = GetOutPorts();
+
+    V4l2TraceRecord(V4L2_TRACE_PORT_OUT, buffer->GetStreamId(), buffer->GetIndex());
+    for (auto &it : ports) {
+        if (it->format_.streamId_ == buffer->GetStreamId()) {
+            it->DeliverBuffer(buffer);
+            CAMERA_LOGI("AMLCodecNode deliver buffer streamid = %{public}d", it->format_.streamId_);
+            return;
+        }
+    }
 }
 
 void AMLCodecNode::DeliverBuffer(std::shared_ptr<IBuffer> &buffer)
@@ -410,30 +808,30 @@ void AMLCodecNode::DeliverBuffer(std::shared_ptr<IBuffer> &buffer)
     }
 
     int32_t id = buffer->GetStreamId();
+    V4l2TraceRecord(V4L2_TRACE_DELIVER, id, buffer->GetIndex());
     CAMERA_LOGD("AMLCodecNode::DeliverBuffer ENTER StreamId %{public}d, type: %{public}d",
                 id, buffer->GetEncodeType());
     if (buffer->GetBufferStatus() == CAMERA_BUFFER_STATUS_OK) {
         if (buffer->GetEncodeType() == ENCODE_TYPE_JPEG) {
+            V4l2TraceRecord(V4L2_TRACE_ENCODE_BEGIN, id, buffer->GetIndex());
             EncodeForJpeg(buffer);
+            V4l2TraceRecord(V4L2_TRACE_ENCODE_END, id, buffer->GetIndex());
         } else if (buffer->GetEncodeType() == ENCODE_TYPE_H264 ||
                    buffer->GetEncodeType() == ENCODE_TYPE_H265) {
-            EncodeForVideo(buffer);
+            // Delivered by the encode thread once the bitstream is ready
+            QueueForVideo(buffer);
+            return;
         } else {
             previewWidth_ = buffer->GetWidth();
             previewHeight_ = buffer->GetHeight();
 
+            V4l2TraceRecord(V4L2_TRACE_ENCODE_BEGIN, id, buffer->GetIndex());
             EncodeForPreview(buffer);
+            V4l2TraceRecord(V4L2_TRACE_ENCODE_END, id, buffer->GetIndex());
         }
     }
 
-    outPutPorts_ = GetOutPorts();
-    for (auto &it : outPutPorts_) {
-        if (it->format_.streamId_ == id) {
-            it->DeliverBuffer(buffer);
-            CAMERA_LOGI("AMLCodecNode deliver buffer streamid = %{public}d", it->format_.streamId_);
-            return;
-        }
-    }
+    DeliverToPort(buffer);
 }
 
 RetCode AMLCodecNode::Capture(const int32_t streamId, const int32_t captureId)
@@ -14,7 +14,13 @@
 #ifndef HOS_CAMERA_AMLCODEC_NODE_H
 #define HOS_CAMERA_AMLCODEC_NODE_H
 
+#include <atomic>
 #include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <condition_variable>
 #include <ctime>
 #include <jpeglib.h>
@@ -22,9 +28,17 @@
 #include "utils.h"
 #include "camera.h"
 #include "source_node.h"
+#include "ge2d_buffer_pool.h"
+#include "aml_jpeg_encoder.h"
 
 
 namespace OHOS::Camera {
+using VideoEncodeParam = struct _VideoEncodeParam {
+    int32_t framerate;
+    int32_t bitrate;
+    int32_t gop;
+};
+
 class AMLCodecNode : public NodeBase {
 public:
     AMLCodecNode(const std::string& name, const std::string& type);
@@ -34,21 +48,65 @@ public:
     void DeliverBuffer(std::shared_ptr<IBuffer>& buffer) override;
     virtual RetCode Capture(const int32_t streamId, const int32_t captureId) override;
     RetCode CancelCapture(const int32_t streamId) override;
+    RetCode Config(const int32_t streamId, const CaptureMeta& meta) override;
     RetCode Flush(const int32_t streamId);
+    void SetVideoEncodeParam(const int32_t streamId, const VideoEncodeParam& param);
+    void SetJpegQuality(const uint32_t quality);
 private:
-    void encodeJpegToMemory(unsigned char* image, int width, int height,
+    struct VideoEncoder {
+        long handle = -1;
+        VideoEncodeParam param;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t frameCnt = 0;
+        std::vector<uint8_t> bitstream;
+    };
+
+    struct EncodeRequest {
+        std::shared_ptr<IBuffer> buffer = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+    };
+
+    void encodeJpegToMemory(const uint8_t* nv21, int width, int height, int quality,
             size_t* jpegSize, unsigned char** jpegBuf);
+    int32_t EncodeJpegHw(std::shared_ptr<IBuffer>& buffer, uint32_t quality);
     void EncodeForPreview(std::shared_ptr<IBuffer>& buffer);
+    void EncodeForPreviewCpu(std::shared_ptr<IBuffer>& buffer);
     void EncodeForJpeg(std::shared_ptr<IBuffer>& buffer);
-    void EncodeForVideo(std::shared_ptr<IBuffer>& buffer);
+    void EncodeForVideo(EncodeRequest& request);
+    void QueueForVideo(std::shared_ptr<IBuffer>& buffer);
+    void DrainVideoQueue(const int32_t streamId);
+    void StartEncodeThread();
+    void StopEncodeThread();
+    void encodeLoop();
+    void DeliverToPort(std::shared_ptr<IBuffer>& buffer);
 
     static uint32_t                       previewWidth_;
     static uint32_t                       previewHeight_;
     std::vector<std::shared_ptr<IPort>>   outPutPorts_;
     
-    uint32_t    vencFrameCnt_ = 0;
     void*       ge2d_ = nullptr;
-    long		h264Enc_ = -1;
+    std::unique_ptr<Ge2dBufferPool>       ge2dPool_ = nullptr;
+    std::vector<uint8_t>                  cpuStage_;
+
+    AmlJpegEncoder                        jpegEnc_;
+    bool                                  jpegHwFailed_ = false;
+    std::atomic<uint32_t>                 jpegQuality_; // set from the capture settings thread
+    uint32_t                              jpegShotCnt_ = 0;
+    uint64_t                              jpegLastShotMs_ = 0;
+
+    std::map<int32_t, VideoEncodeParam>   encodeParams_;
+    std::map<int32_t, VideoEncoder>       encoders_;
+    std::list<EncodeRequest>              encodeQueue_;
+    std::mutex                            encodeLock_;
+    std::condition_variable               encodeCv_;
+    std::thread*                          encodeThread_ = nullptr;
+    bool                                  encodeRunning_ = false;
+    int32_t                               encodingStream_ = -1;
+    uint64_t                              encodeQueued_ = 0;
+    uint64_t                              encodeDropped_ = 0;
+    uint32_t                              encodeMaxDepth_ = 0;
 };
 } // namespace OHOS::Camera
 #endif
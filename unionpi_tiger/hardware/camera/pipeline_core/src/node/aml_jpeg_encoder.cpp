@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "securec.h"
+#include "aml_jpeg_encoder.h"
+
+namespace OHOS::Camera {
+// Mirrors kernel/drivers/media/drivers/frame_sink/encoder/jpeg/jpegenc.h
+#define JPEGENC_DEV_NAME "/dev/jpegenc"
+#define JPEGENC_IOC_MAGIC  'J'
+#define JPEGENC_IOC_GET_BUFFINFO _IOW(JPEGENC_IOC_MAGIC, 0x00, uint32_t)
+#define JPEGENC_IOC_CONFIG_INIT _IOW(JPEGENC_IOC_MAGIC, 0x01, uint32_t)
+#define JPEGENC_IOC_NEW_CMD _IOW(JPEGENC_IOC_MAGIC, 0x02, uint32_t)
+#define JPEGENC_IOC_GET_STAGE _IOW(JPEGENC_IOC_MAGIC, 0x03, uint32_t)
+#define JPEGENC_IOC_GET_OUTPUT_SIZE _IOW(JPEGENC_IOC_MAGIC, 0x04, uint32_t)
+
+#define JPEGENC_LOCAL_BUFF 0
+#define JPEGENC_FMT_NV21 2
+#define JPEGENC_FMT_YUV420 4
+#define JPEGENC_FLUSH_FLAG_INPUT 0x1
+#define JPEGENC_FLUSH_FLAG_OUTPUT 0x2
+#define JPEGENC_ENCODER_DONE 4
+
+#define JPEGENC_CMD_SIZE 30
+#define JPEGENC_BUFFINFO_SIZE 7
+#define JPEGENC_TIMEOUT_MS 1000
+
+enum JpegencCmdIndex {
+    CMD_TYPE = 0,
+    CMD_INPUT_FMT,
+    CMD_OUTPUT_FMT,
+    CMD_WIDTH,
+    CMD_HEIGHT,
+    CMD_FRAMESIZE,
+    CMD_SRC,
+    CMD_QUALITY,
+    CMD_QUANT_TABLE,
+    CMD_FLUSH_FLAG,
+};
+
+static inline uint32_t alignUp(uint32_t value, uint32_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+AmlJpegEncoder::~AmlJpegEncoder()
+{
+    Deinit();
+}
+
+RetCode AmlJpegEncoder::Init()
+{
+    uint32_t buffInfo[JPEGENC_BUFFINFO_SIZE] = {0};
+
+    if (fd_ >= 0) {
+        return RC_OK;
+    }
+
+    fd_ = open(JPEGENC_DEV_NAME, O_RDWR);
+    if (fd_ < 0) {
+        CAMERA_LOGE("AmlJpegEncoder: open %{public}s failed", JPEGENC_DEV_NAME);
+        return RC_ERROR;
+    }
+
+    if (ioctl(fd_, JPEGENC_IOC_CONFIG_INIT, nullptr) < 0 || ioctl(fd_, JPEGENC_IOC_GET_BUFFINFO, buffInfo) < 0) {
+        CAMERA_LOGE("AmlJpegEncoder: config jpegenc failed");
+        Deinit();
+        return RC_ERROR;
+    }
+
+    mapSize_ = buffInfo[0];
+    inputOffset_ = buffInfo[1];
+    inputSize_ = buffInfo[2];
+    bitstreamOffset_ = buffInfo[5];
+    bitstreamSize_ = buffInfo[6];
+
+    void* addr = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+        CAMERA_LOGE("AmlJpegEncoder: mmap %{public}zu failed", mapSize_);
+        Deinit();
+        return RC_ERROR;
+    }
+    mapAddr_ = (uint8_t *)addr;
+
+    CAMERA_LOGI("AmlJpegEncoder: input %{public}u bytes, bitstream %{public}u bytes", inputSize_, bitstreamSize_);
+    return RC_OK;
+}
+
+void AmlJpegEncoder::Deinit()
+{
+    if (mapAddr_ != nullptr) {
+        munmap(mapAddr_, mapSize_);
+        mapAddr_ = nullptr;
+    }
+
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool AmlJpegEncoder::WaitDone()
+{
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    uint32_t stage = 0;
+
+    if (poll(&pfd, 1, JPEGENC_TIMEOUT_MS) <= 0) {
+        CAMERA_LOGE("AmlJpegEncoder: encode timeout");
+        return false;
+    }
+
+    if (ioctl(fd_, JPEGENC_IOC_GET_STAGE, &stage) < 0 || stage != JPEGENC_ENCODER_DONE) {
+        CAMERA_LOGE("AmlJpegEncoder: encode failed, stage %{public}u", stage);
+        return false;
+    }
+
+    return true;
+}
+
+int32_t AmlJpegEncoder::EncodeNV21(const uint8_t* nv21, uint32_t width, uint32_t height, uint32_t quality,
+    uint8_t* out, size_t outSize)
+{
+    uint32_t cmd[JPEGENC_CMD_SIZE] = {0};
+    uint32_t outInfo[2] = {0};
+    // The hardware reads NV21 through canvases with a 32 byte stride and 16 line height
+    uint32_t stride = alignUp(width, 32);
+    uint32_t lines = alignUp(height, 16);
+    uint32_t frameSize = stride * lines * 3 / 2;
+
+    if (fd_ < 0 || nv21 == nullptr || out == nullptr || width == 0 || height == 0) {
+        return -1;
+    }
+
+    if (frameSize > inputSize_) {
+        CAMERA_LOGE("AmlJpegEncoder: %{public}ux%{public}u exceeds input buffer", width, height);
+        return -1;
+    }
+
+    uint8_t* input = mapAddr_ + inputOffset_;
+    for (uint32_t y = 0; y < height; y++) {
+        (void)memcpy_s(input + y * stride, width, nv21 + y * width, width);
+    }
+    const uint8_t* srcVU = nv21 + width * height;
+    uint8_t* dstVU = input + stride * lines;
+    for (uint32_t y = 0; y < height / 2; y++) {
+        (void)memcpy_s(dstVU + y * stride, width, srcVU + y * width, width);
+    }
+
+    cmd[CMD_TYPE] = JPEGENC_LOCAL_BUFF;
+    cmd[CMD_INPUT_FMT] = JPEGENC_FMT_NV21;
+    cmd[CMD_OUTPUT_FMT] = JPEGENC_FMT_YUV420;
+    cmd[CMD_WIDTH] = width;
+    cmd[CMD_HEIGHT] = height;
+    cmd[CMD_FRAMESIZE] = frameSize;
+    cmd[CMD_SRC] = 0;
+    cmd[CMD_QUALITY] = quality;
+    cmd[CMD_QUANT_TABLE] = 0;
+    cmd[CMD_FLUSH_FLAG] = JPEGENC_FLUSH_FLAG_INPUT | JPEGENC_FLUSH_FLAG_OUTPUT;
+    if (ioctl(fd_, JPEGENC_IOC_NEW_CMD, cmd) < 0) {
+        CAMERA_LOGE("AmlJpegEncoder: JPEGENC_IOC_NEW_CMD failed");
+        return -1;
+    }
+
+    if (!WaitDone()) {
+        return -1;
+    }
+
+    if (ioctl(fd_, JPEGENC_IOC_GET_OUTPUT_SIZE, outInfo) < 0) {
+        CAMERA_LOGE("AmlJpegEncoder: JPEGENC_IOC_GET_OUTPUT_SIZE failed");
+        return -1;
+    }
+
+    // outInfo[0] is the header length, outInfo[1] the whole stream including it
+    if (outInfo[1] == 0 || outInfo[1] > bitstreamSize_ || outInfo[1] > outSize) {
+        CAMERA_LOGE("AmlJpegEncoder: bad output size %{public}u", outInfo[1]);
+        return -1;
+    }
+
+    if (memcpy_s(out, outSize, mapAddr_ + bitstreamOffset_, outInfo[1]) != EOK) {
+        return -1;
+    }
+
+    return (int32_t)outInfo[1];
+}
+} // namespace OHOS::Camera
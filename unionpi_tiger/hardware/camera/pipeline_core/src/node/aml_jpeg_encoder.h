@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOS_CAMERA_AML_JPEG_ENCODER_H
+#define HOS_CAMERA_AML_JPEG_ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "camera.h"
+
+namespace OHOS::Camera {
+// Userspace side of the frame_sink jpegenc driver, fed with NV21 through its local input buffer
+class AmlJpegEncoder {
+public:
+    AmlJpegEncoder() = default;
+    ~AmlJpegEncoder();
+
+    RetCode Init();
+    void Deinit();
+    bool IsReady() const
+    {
+        return fd_ >= 0;
+    }
+
+    int32_t EncodeNV21(const uint8_t* nv21, uint32_t width, uint32_t height, uint32_t quality,
+        uint8_t* out, size_t outSize);
+
+private:
+    bool WaitDone();
+
+    int fd_ = -1;
+    uint8_t* mapAddr_ = nullptr;
+    size_t mapSize_ = 0;
+    uint32_t inputOffset_ = 0;
+    uint32_t inputSize_ = 0;
+    uint32_t bitstreamOffset_ = 0;
+    uint32_t bitstreamSize_ = 0;
+};
+} // namespace OHOS::Camera
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include "camera.h"
+#include "ge2d_buffer_pool.h"
+
+#include "aml_ge2d.h"
+#include "ge2d_dmabuf.h"
+
+namespace OHOS::Camera {
+Ge2dBufferPool::Ge2dBufferPool(int ge2dFd) : ge2dFd_(ge2dFd) {}
+
+Ge2dBufferPool::~Ge2dBufferPool()
+{
+    Clear();
+}
+
+int Ge2dBufferPool::Allocate(int32_t streamId, size_t size, bool inUse)
+{
+    int dmaFd = dmabuf_alloc(ge2dFd_, GE2D_BUF_OUTPUT, size);
+    if (dmaFd < 0) {
+        CAMERA_LOGE("Ge2dBufferPool: dmabuf_alloc(%{public}zu) failed.", size);
+        return -1;
+    }
+
+    buffers_.push_back({dmaFd, size, streamId, inUse, false});
+    allocCount_++;
+    CAMERA_LOGI("Ge2dBufferPool: alloc fd=%{public}d size=%{public}zu stream=%{public}d total=%{public}zu",
+        dmaFd, size, streamId, buffers_.size());
+
+    return dmaFd;
+}
+
+void Ge2dBufferPool::Free(PoolBuffer& buffer)
+{
+    close(buffer.dmaFd);
+    buffer.dmaFd = -1;
+}
+
+void Ge2dBufferPool::Reserve(int32_t streamId, size_t size, uint32_t count)
+{
+    std::lock_guard<std::mutex> l(lock_);
+
+    uint32_t have = 0;
+    for (auto &it : buffers_) {
+        if (it.streamId == streamId && !it.dropped && it.size >= size) {
+            have++;
+        }
+    }
+
+    while (have < count && Allocate(streamId, size, false) >= 0) {
+        have++;
+    }
+}
+
+int Ge2dBufferPool::Acquire(int32_t streamId, size_t size)
+{
+    std::lock_guard<std::mutex> l(lock_);
+    PoolBuffer* best = nullptr;
+
+    for (auto &it : buffers_) {
+        if (!it.inUse && !it.dropped && it.size >= size && (best == nullptr || it.size < best->size)) {
+            best = &it;
+        }
+    }
+
+    if (best != nullptr) {
+        best->inUse = true;
+        return best->dmaFd;
+    }
+
+    // Only the first frames of an unexpected size get here, the buffer stays in the pool afterwards
+    return Allocate(streamId, size, true);
+}
+
+void Ge2dBufferPool::Release(int dmaFd)
+{
+    std::lock_guard<std::mutex> l(lock_);
+
+    for (auto it = buffers_.begin(); it != buffers_.end(); it++) {
+        if (it->dmaFd == dmaFd) {
+            it->inUse = false;
+            if (it->dropped) {
+                Free(*it);
+                buffers_.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+void Ge2dBufferPool::ReleaseStream(int32_t streamId)
+{
+    std::lock_guard<std::mutex> l(lock_);
+
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+        if (it->streamId != streamId) {
+            it++;
+        } else if (it->inUse) {
+            it->dropped = true;
+            it++;
+        } else {
+            Free(*it);
+            it = buffers_.erase(it);
+        }
+    }
+}
+
+void Ge2dBufferPool::Clear()
+{
+    std::lock_guard<std::mutex> l(lock_);
+
+    for (auto &it : buffers_) {
+        Free(it);
+    }
+    buffers_.clear();
+}
+
+uint64_t Ge2dBufferPool::GetAllocCount()
+{
+    std::lock_guard<std::mutex> l(lock_);
+    return allocCount_;
+}
+} // namespace OHOS::Camera
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOS_CAMERA_GE2D_BUFFER_POOL_H
+#define HOS_CAMERA_GE2D_BUFFER_POOL_H
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace OHOS::Camera {
+// Scratch GE2D output dmabufs that live across frames, handed out best fit by size.
+// Each buffer belongs to the stream that reserved or first acquired it, any stream may borrow an idle one.
+class Ge2dBufferPool {
+public:
+    explicit Ge2dBufferPool(int ge2dFd);
+    ~Ge2dBufferPool();
+
+    void Reserve(int32_t streamId, size_t size, uint32_t count);
+    int Acquire(int32_t streamId, size_t size);
+    void Release(int dmaFd);
+    // Frees the stream's buffers, one still in use when it is released
+    void ReleaseStream(int32_t streamId);
+    void Clear();
+
+    uint64_t GetAllocCount();
+
+private:
+    struct PoolBuffer {
+        int dmaFd;
+        size_t size;
+        int32_t streamId;
+        bool inUse;
+        bool dropped; // its stream stopped while it was in use
+    };
+
+    int Allocate(int32_t streamId, size_t size, bool inUse);
+    void Free(PoolBuffer& buffer);
+
+    int ge2dFd_ = -1;
+    uint64_t allocCount_ = 0;
+    std::vector<PoolBuffer> buffers_;
+    std::mutex lock_;
+};
+} // namespace OHOS::Camera
+#endif
@@ -96,6 +96,8 @@ static void DspDriverRelease(struct HdfDeviceObject *device)
         return;
     }
 
+    DspDeviceRelease();
+
     dspHost = (struct DspHost *)device->service;
     if (dspHost == NULL) {
         AUDIO_DRIVER_LOG_ERR("DspHost is NULL");
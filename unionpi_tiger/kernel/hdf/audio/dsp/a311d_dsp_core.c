@@ -0,0 +1,744 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ *
+ * HDF is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ * See the LICENSE file in the root of this repository for complete details.
+ */
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#endif
+
+#include "a311d_dsp_core.h"
+
+/*
+ * Samples run through the chain as Q27, which leaves 12 dB above full scale for the EQ to boost
+ * into before the DRC brings the level back. Coefficients are worked out once per config or rate
+ * in Q30 and stored as Q28, the per period path only multiplies, adds and shifts.
+ */
+#define ONE_Q30 (1LL << 30)
+#define QUARTER_TURN (0x40000000U)
+#define EIGHTH_TURN (0x20000000U)
+#define COEF_SHIFT (28)
+#define COEF_LIMIT (1LL << 31)
+#define RATIO_LIMIT (1LL << 34)
+#define WORK_SHIFT (27)
+#define WORK_FULL_SCALE (1 << WORK_SHIFT)
+#define WORK_LIMIT ((1 << 29) - 1)
+#define GAIN_SHIFT (24)
+#define DRC_BLOCK_FRAMES (16)
+#define LOG2_FULL_SCALE (WORK_SHIFT << 16)
+#define LOG2_SILENCE (-(32 << 16))
+#define LOG2_10_Q28 (891723283LL)
+#define LOG2_E_Q28 (387270501LL)
+#define HALF_PI_Q30 (1686629713LL)
+#define LN2_Q30 (744261118LL)
+#define US_PER_SEC (1000000LL)
+#define CDB_PER_20_DB (2000)
+#define PERMILLE (1000)
+
+#define MIN_RATE (8000)
+#define MAX_RATE (192000)
+#define EQ_MIN_FREQ (10)
+#define EQ_MAX_FREQ (96000)
+#define EQ_MAX_FREQ_PERMILLE (450)
+#define EQ_MAX_GAIN (1500)
+#define EQ_MIN_Q (100)
+#define EQ_MAX_Q (20000)
+#define DRC_MIN_LEVEL (-9600)
+#define DRC_MIN_RATIO (10)
+#define DRC_MAX_RATIO (1000)
+#define DRC_MAX_MAKEUP (2400)
+#define DRC_MAX_TIME_US (2000000)
+
+#define MAX_CAPTURE_CHANNELS (16)
+#define DEFAULT_RATE (48000)
+#define DEFAULT_BITS (32)
+
+/* log2(1 + k / 32) and 2 ^ (k / 32), Q30 */
+static const int32_t g_log2Table[33] = {
+    0, 47667823, 93912511, 138816582, 182455581, 224898839, 266210141, 306448299,
+    345667660, 383918542, 421247625, 457698295, 493310944, 528123241, 562170370, 595485245,
+    628098702, 660039669, 691335320, 722011213, 752091421, 781598637, 810554283, 838978604,
+    866890747, 894308843, 921250079, 947730758, 973766362, 999371606, 1024560487, 1049346328,
+    1073741824,
+};
+
+static const uint32_t g_exp2Table[33] = {
+    1073741824, 1097253708, 1121280436, 1145833280, 1170923762, 1196563654, 1222764986, 1249540052,
+    1276901417, 1304861917, 1333434672, 1362633090, 1392470869, 1422962010, 1454120821, 1485961921,
+    1518500250, 1551751076, 1585730000, 1620452965, 1655936265, 1692196547, 1729250827, 1767116489,
+    1805811301, 1845353420, 1885761398, 1927054196, 1969251188, 2012372174, 2056437387, 2101467502,
+    2147483648U,
+};
+
+static inline int64_t Div64(int64_t n, int64_t d)
+{
+#ifdef __KERNEL__
+    return div64_s64(n, d);
+#else
+    return n / d;
+#endif
+}
+
+static int64_t DivRound(int64_t n, int64_t d)
+{
+    return (n >= 0) ? Div64(n + d / 2, d) : -Div64(-n + d / 2, d);
+}
+
+static inline int32_t Saturate(int64_t v, int32_t limit)
+{
+    if (v > limit) {
+        return limit;
+    }
+    if (v < -(int64_t)limit - 1) {
+        return -limit - 1;
+    }
+    return (int32_t)v;
+}
+
+/* Q30 product that takes operands well past 32 bits */
+static int64_t Mul30(int64_t a, int64_t b)
+{
+    return ((a * (b >> 15)) >> 15) + ((a * (b & 0x7FFF)) >> 30);
+}
+
+static uint64_t Sqrt64(uint64_t v)
+{
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+/* Taylor series, good to 1e-9 for x in Q30 up to pi / 4 */
+static int32_t SinTaylor(int32_t x)
+{
+    int32_t x2 = (int32_t)(((int64_t)x * x) >> 30);
+    int32_t t = (int32_t)ONE_Q30 - x2 / 72;
+
+    t = (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 42;
+    t = (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 20;
+    t = (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 6;
+    return (int32_t)(((int64_t)x * t) >> 30);
+}
+
+static int32_t CosTaylor(int32_t x)
+{
+    int32_t x2 = (int32_t)(((int64_t)x * x) >> 30);
+    int32_t t = (int32_t)ONE_Q30 - x2 / 90;
+
+    t = (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 56;
+    t = (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 30;
+    t = (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 12;
+    return (int32_t)ONE_Q30 - (int32_t)(((int64_t)x2 * t) >> 30) / 2;
+}
+
+/* Q30 sine of a phase in 2^32ths of a turn */
+static int32_t FixSin(uint32_t phase)
+{
+    uint32_t quadrant = phase >> 30;
+    uint32_t r = phase & (QUARTER_TURN - 1);
+    int32_t s;
+
+    if (quadrant & 1) {
+        r = QUARTER_TURN - r;
+    }
+    if (r <= EIGHTH_TURN) {
+        s = SinTaylor((int32_t)(((int64_t)r * HALF_PI_Q30) >> 30));
+    } else {
+        s = CosTaylor((int32_t)(((int64_t)(QUARTER_TURN - r) * HALF_PI_Q30) >> 30));
+    }
+    return (quadrant >= 2) ? -s : s;
+}
+
+/* Q24 exponent in, Q30 power of two out */
+static int64_t FixExp2(int64_t x)
+{
+    int64_t n = x >> 24;
+    uint32_t f = (uint32_t)(x & 0xFFFFFF);
+    int64_t z = ((int64_t)(f & 0x7FFFF) << 6) * LN2_Q30 >> 30;
+    int64_t z2 = (z * z) >> 30;
+    int64_t e = ONE_Q30 + z + z2 / 2 + ((z2 * z) >> 30) / 6;
+    int64_t v = ((int64_t)g_exp2Table[f >> 19] * e) >> 30;
+
+    if (n >= 0) {
+        return v << n;
+    }
+    return (n > -62) ? (v >> -n) : 0;
+}
+
+/* Q16 log2 of a magnitude, to a thousandth of a dB */
+static int32_t FixLog2(uint32_t v)
+{
+    int32_t n;
+    uint32_t m;
+    uint32_t k;
+    int64_t step;
+    int32_t mantissa;
+
+    if (v == 0) {
+        return LOG2_SILENCE;
+    }
+    n = 31 - __builtin_clz(v);
+    m = v << (31 - n);
+    k = (m >> 26) & 31;
+    step = g_log2Table[k + 1] - g_log2Table[k];
+    mantissa = g_log2Table[k] + (int32_t)((step * ((m >> 10) & 0xFFFF)) >> 16);
+    return (n << 16) + (mantissa >> 14);
+}
+
+/* 0.01 dB to Q24 log2 of the amplitude ratio */
+static int64_t CdbToLog2(int32_t cdb)
+{
+    return DivRound((int64_t)cdb * LOG2_10_Q28, CDB_PER_20_DB) >> 4;
+}
+
+/* Q28 num / den for Q30 operands, scaled down first so the shift cannot overflow */
+static int64_t Ratio28(int64_t num, int64_t den)
+{
+    while (num >= RATIO_LIMIT || num <= -RATIO_LIMIT || den >= RATIO_LIMIT) {
+        num /= 2;
+        den /= 2;
+    }
+    return DivRound(num * (1LL << COEF_SHIFT), den);
+}
+
+/* RBJ cookbook biquads. gain scales the b terms, it keeps the shelf products in range */
+struct BiquadDesign {
+    int64_t b[3];
+    int64_t a[3];
+    int64_t gain;
+};
+
+static void DesignShelf(struct BiquadDesign *d, int64_t amp, int64_t cs, int64_t alpha, bool high)
+{
+    int64_t sign = high ? -1 : 1;
+    int64_t ap1 = amp + ONE_Q30;
+    int64_t am1 = amp - ONE_Q30;
+    int64_t root = 2 * Mul30((int64_t)Sqrt64((uint64_t)amp << 30), alpha);
+
+    d->gain = amp;
+    d->b[0] = ap1 - sign * Mul30(am1, cs) + root;
+    d->b[1] = sign * 2 * (am1 - sign * Mul30(ap1, cs));
+    d->b[2] = ap1 - sign * Mul30(am1, cs) - root;
+    d->a[0] = ap1 + sign * Mul30(am1, cs) + root;
+    d->a[1] = -sign * 2 * (am1 + sign * Mul30(ap1, cs));
+    d->a[2] = ap1 + sign * Mul30(am1, cs) - root;
+}
+
+static int32_t DesignBand(const struct DspEqBand *band, uint32_t rate, struct DspBiquad *biquad)
+{
+    struct BiquadDesign d;
+    uint32_t freq = band->freq;
+    uint32_t maxFreq = rate * EQ_MAX_FREQ_PERMILLE / PERMILLE;
+    uint32_t phase;
+    int64_t sn;
+    int64_t cs;
+    int64_t alpha;
+    int64_t amp;
+    int64_t coef[5];
+    int32_t i;
+
+    if (freq > maxFreq) {
+        freq = maxFreq;
+    }
+    phase = (uint32_t)Div64((int64_t)freq << 32, rate);
+    sn = FixSin(phase);
+    cs = FixSin(phase + QUARTER_TURN);
+    alpha = DivRound(sn * PERMILLE, 2 * (int64_t)band->q);
+    amp = FixExp2(CdbToLog2(band->gain) / 2);
+
+    d.gain = ONE_Q30;
+    switch (band->type) {
+        case DSP_EQ_PEAK:
+            d.b[0] = ONE_Q30 + Mul30(alpha, amp);
+            d.b[1] = -2 * cs;
+            d.b[2] = ONE_Q30 - Mul30(alpha, amp);
+            d.a[0] = ONE_Q30 + DivRound(alpha * ONE_Q30, amp);
+            d.a[1] = -2 * cs;
+            d.a[2] = 2 * ONE_Q30 - d.a[0];
+            break;
+        case DSP_EQ_LOW_SHELF:
+            DesignShelf(&d, amp, cs, alpha, false);
+            break;
+        case DSP_EQ_HIGH_SHELF:
+            DesignShelf(&d, amp, cs, alpha, true);
+            break;
+        case DSP_EQ_LOW_PASS:
+            d.b[0] = (ONE_Q30 - cs) / 2;
+            d.b[1] = ONE_Q30 - cs;
+            d.b[2] = d.b[0];
+            d.a[0] = ONE_Q30 + alpha;
+            d.a[1] = -2 * cs;
+            d.a[2] = ONE_Q30 - alpha;
+            break;
+        case DSP_EQ_HIGH_PASS:
+            d.b[0] = (ONE_Q30 + cs) / 2;
+            d.b[1] = -(ONE_Q30 + cs);
+            d.b[2] = d.b[0];
+            d.a[0] = ONE_Q30 + alpha;
+            d.a[1] = -2 * cs;
+            d.a[2] = ONE_Q30 - alpha;
+            break;
+        default:
+            return HDF_ERR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < 3; i++) {
+        coef[i] = Ratio28(d.b[i], d.a[0]);
+        if (d.gain != ONE_Q30) {
+            coef[i] = Mul30(coef[i], d.gain);
+        }
+    }
+    coef[3] = Ratio28(d.a[1], d.a[0]);
+    coef[4] = Ratio28(d.a[2], d.a[0]);
+    for (i = 0; i < 5; i++) {
+        if (coef[i] >= COEF_LIMIT || coef[i] <= -COEF_LIMIT) {
+            return HDF_ERR_INVALID_PARAM;
+        }
+    }
+
+    biquad->b0 = (int32_t)coef[0];
+    biquad->b1 = (int32_t)coef[1];
+    biquad->b2 = (int32_t)coef[2];
+    biquad->a1 = (int32_t)coef[3];
+    biquad->a2 = (int32_t)coef[4];
+    return HDF_SUCCESS;
+}
+
+/* Q30 one pole coefficient that closes 1 - 1/e of the gap in the given time */
+static int32_t EnvelopeCoef(uint32_t us, uint32_t rate)
+{
+    int64_t x;
+
+    if (us == 0) {
+        return 0;
+    }
+    x = Div64(DRC_BLOCK_FRAMES * LOG2_E_Q28 * US_PER_SEC, (int64_t)us * rate) >> 4;
+    return (int32_t)FixExp2(-x);
+}
+
+/* Q24 gain for a Q16 log2 level */
+static int32_t LevelToGain(int32_t level)
+{
+    return (int32_t)(FixExp2((int64_t)level * (1 << 8)) >> (30 - GAIN_SHIFT));
+}
+
+static void DesignDrc(const struct DspDrcParams *params, uint32_t rate, struct DspDrc *drc)
+{
+    drc->enable = params->enable != 0;
+    if (!drc->enable) {
+        drc->makeup = 0;
+        return;
+    }
+    drc->threshold = (int32_t)(CdbToLog2(params->threshold) >> 8);
+    drc->slope = (int32_t)DivRound((int64_t)(params->ratio - DRC_MIN_RATIO) << 16, params->ratio);
+    drc->makeup = (int32_t)(CdbToLog2(params->makeup) >> 8);
+    drc->ceiling = (int32_t)(CdbToLog2(params->ceiling) >> 8);
+    drc->attack = EnvelopeCoef(params->attackUs, rate);
+    drc->release = EnvelopeCoef(params->releaseUs, rate);
+}
+
+static bool ConfigValid(const struct DspCoreConfig *config)
+{
+    const struct DspDrcParams *drc = &config->drc;
+    uint32_t i;
+
+    if (config->eqBands > DSP_CORE_EQ_BANDS || config->refDelay >= DSP_CORE_REF_FRAMES) {
+        return false;
+    }
+    for (i = 0; i < config->eqBands; i++) {
+        const struct DspEqBand *band = &config->eq[i];
+        if (band->type >= DSP_EQ_TYPE_BUTT || band->freq < EQ_MIN_FREQ || band->freq > EQ_MAX_FREQ ||
+            band->gain > EQ_MAX_GAIN || band->gain < -EQ_MAX_GAIN || band->q < EQ_MIN_Q || band->q > EQ_MAX_Q) {
+            return false;
+        }
+    }
+    if (drc->enable == 0) {
+        return true;
+    }
+    return drc->threshold >= DRC_MIN_LEVEL && drc->threshold <= 0 &&
+        drc->ceiling >= DRC_MIN_LEVEL && drc->ceiling <= 0 &&
+        drc->ratio >= DRC_MIN_RATIO && drc->ratio <= DRC_MAX_RATIO &&
+        drc->makeup >= 0 && drc->makeup <= DRC_MAX_MAKEUP &&
+        drc->attackUs <= DRC_MAX_TIME_US && drc->releaseUs <= DRC_MAX_TIME_US;
+}
+
+static int32_t DesignChain(struct DspCore *core, const struct DspCoreConfig *config, uint32_t rate)
+{
+    struct DspBiquad eq[DSP_CORE_EQ_BANDS];
+    uint32_t i;
+    int32_t ret;
+
+    for (i = 0; i < config->eqBands; i++) {
+        ret = DesignBand(&config->eq[i], rate, &eq[i]);
+        if (ret != HDF_SUCCESS) {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < config->eqBands; i++) {
+        core->eq[i] = eq[i];
+    }
+    core->eqBands = config->eqBands;
+    DesignDrc(&config->drc, rate, &core->drc);
+    return HDF_SUCCESS;
+}
+
+static void ResetChain(struct DspCore *core)
+{
+    static const struct DspBiquadState clear = { 0 };
+    uint32_t i;
+    uint32_t ch;
+
+    for (i = 0; i < DSP_CORE_EQ_BANDS; i++) {
+        for (ch = 0; ch < DSP_CORE_MAX_CHANNELS; ch++) {
+            core->eqState[i][ch] = clear;
+        }
+    }
+    core->drc.env = 0;
+    core->drc.gain = LevelToGain(core->drc.makeup);
+}
+
+static bool FormatValid(const struct DspCoreFormat *format, uint32_t maxChannels)
+{
+    return format->rate >= MIN_RATE && format->rate <= MAX_RATE &&
+        format->channels >= 1 && format->channels <= maxChannels && DspCoreFrameBytes(format) != 0;
+}
+
+uint32_t DspCoreFrameBytes(const struct DspCoreFormat *format)
+{
+    switch (format->bits) {
+        case 16:
+            return format->channels * sizeof(int16_t);
+        case 24:
+        case 32:
+            return format->channels * sizeof(int32_t);
+        default:
+            return 0;
+    }
+}
+
+void DspCoreInit(struct DspCore *core)
+{
+    static const struct DspCoreConfig flat = { 0 };
+    const struct DspCoreFormat format = {
+        .rate = DEFAULT_RATE,
+        .channels = DSP_CORE_MAX_CHANNELS,
+        .bits = DEFAULT_BITS,
+    };
+
+    core->config = flat;
+    core->capture = format;
+    core->ref.written = 0;
+    core->ref.read = 0;
+    core->ref.filled = 0;
+    (void)DspCoreSetRenderFormat(core, &format);
+}
+
+int32_t DspCoreSetConfig(struct DspCore *core, const struct DspCoreConfig *config)
+{
+    bool wasEnabled = core->drc.enable;
+    int32_t ret;
+
+    if (!ConfigValid(config)) {
+        return HDF_ERR_INVALID_PARAM;
+    }
+    ret = DesignChain(core, config, core->render.rate);
+    if (ret != HDF_SUCCESS) {
+        return ret;
+    }
+    if (config->refDelay != core->config.refDelay) {
+        core->ref.synced = false;
+    }
+    core->config = *config;
+    if (!wasEnabled && core->drc.enable) {
+        core->drc.env = 0;
+        core->drc.gain = LevelToGain(core->drc.makeup);
+    }
+    return HDF_SUCCESS;
+}
+
+int32_t DspCoreSetRenderFormat(struct DspCore *core, const struct DspCoreFormat *format)
+{
+    int32_t ret;
+
+    core->renderActive = false;
+    core->ref.synced = false;
+    if (!FormatValid(format, DSP_CORE_MAX_CHANNELS)) {
+        return HDF_ERR_NOT_SUPPORT;
+    }
+
+    core->render = *format;
+    core->ref.channels = format->channels;
+    core->ref.filled = 0;
+    ret = DesignChain(core, &core->config, format->rate);
+    if (ret != HDF_SUCCESS) {
+        /* A config that only fits another rate leaves the stream flat */
+        core->eqBands = 0;
+        core->drc.enable = false;
+    }
+    ResetChain(core);
+    core->renderActive = true;
+    return ret;
+}
+
+int32_t DspCoreSetCaptureFormat(struct DspCore *core, const struct DspCoreFormat *format)
+{
+    if (!FormatValid(format, MAX_CAPTURE_CHANNELS)) {
+        return HDF_ERR_NOT_SUPPORT;
+    }
+    core->capture = *format;
+    core->ref.synced = false;
+    return HDF_SUCCESS;
+}
+
+static void ToWork(const void *data, int32_t *work, uint32_t count, uint32_t bits)
+{
+    uint32_t i;
+
+    if (bits == 16) {
+        const int16_t *src = data;
+        for (i = 0; i < count; i++) {
+            work[i] = (int32_t)src[i] * (1 << (WORK_SHIFT - 15));
+        }
+    } else if (bits == 24) {
+        const int32_t *src = data;
+        for (i = 0; i < count; i++) {
+            work[i] = ((int32_t)((uint32_t)src[i] << 8) >> 8) * (1 << (WORK_SHIFT - 23));
+        }
+    } else {
+        const int32_t *src = data;
+        for (i = 0; i < count; i++) {
+            work[i] = src[i] >> (31 - WORK_SHIFT);
+        }
+    }
+}
+
+static void FromWork(const int32_t *work, void *data, uint32_t count, uint32_t bits)
+{
+    uint32_t i;
+
+    if (bits == 16) {
+        int16_t *dst = data;
+        for (i = 0; i < count; i++) {
+            dst[i] = (int16_t)(work[i] >> (WORK_SHIFT - 15));
+        }
+    } else if (bits == 24) {
+        int32_t *dst = data;
+        for (i = 0; i < count; i++) {
+            dst[i] = work[i] >> (WORK_SHIFT - 23);
+        }
+    } else {
+        int32_t *dst = data;
+        for (i = 0; i < count; i++) {
+            dst[i] = work[i] * (1 << (31 - WORK_SHIFT));
+        }
+    }
+}
+
+/* Direct form I on one channel of a block, with the truncation error fed back */
+static void BiquadBlock(const struct DspBiquad *c, struct DspBiquadState *s, int32_t *x, uint32_t frames,
+                        uint32_t stride)
+{
+    int32_t x1 = s->x1;
+    int32_t x2 = s->x2;
+    int32_t y1 = s->y1;
+    int32_t y2 = s->y2;
+    int64_t err = s->err;
+    uint32_t i;
+
+    for (i = 0; i < frames; i++) {
+        int32_t in = x[i * stride];
+        int64_t acc = (int64_t)c->b0 * in + (int64_t)c->b1 * x1 + (int64_t)c->b2 * x2 -
+            (int64_t)c->a1 * y1 - (int64_t)c->a2 * y2 + err;
+        int32_t out = Saturate(acc >> COEF_SHIFT, WORK_LIMIT);
+
+        err = acc & ((1LL << COEF_SHIFT) - 1);
+        x2 = x1;
+        x1 = in;
+        y2 = y1;
+        y1 = out;
+        x[i * stride] = out;
+    }
+
+    s->x1 = x1;
+    s->x2 = x2;
+    s->y1 = y1;
+    s->y2 = y2;
+    s->err = (int32_t)err;
+}
+
+/* Q24 gain for a Q16 log2 level relative to full scale */
+static int32_t DrcGain(const struct DspDrc *drc, int32_t level)
+{
+    int32_t gain = drc->makeup;
+
+    if (level > drc->threshold) {
+        gain -= (int32_t)(((int64_t)(level - drc->threshold) * drc->slope) >> 16);
+    }
+    if (level + gain > drc->ceiling) {
+        gain = drc->ceiling - level;
+    }
+    return LevelToGain(gain);
+}
+
+/*
+ * The envelope follows the stereo peak of every DRC block, the gain it asks for is reached by the
+ * end of the block in a straight line from where the last block left it.
+ */
+static void DrcProcess(struct DspDrc *drc, int32_t *work, uint32_t frames, uint32_t channels)
+{
+    uint32_t start;
+
+    for (start = 0; start < frames; start += DRC_BLOCK_FRAMES) {
+        uint32_t n = (frames - start < DRC_BLOCK_FRAMES) ? (frames - start) : DRC_BLOCK_FRAMES;
+        int32_t *x = work + start * channels;
+        uint32_t peak = 0;
+        int32_t coef;
+        int32_t target;
+        int32_t step;
+        int32_t gain = drc->gain;
+        uint32_t i;
+        uint32_t ch;
+
+        for (i = 0; i < n * channels; i++) {
+            uint32_t mag = (x[i] < 0) ? (uint32_t)(-(int64_t)x[i]) : (uint32_t)x[i];
+            peak = (mag > peak) ? mag : peak;
+        }
+        coef = (peak > drc->env) ? drc->attack : drc->release;
+        drc->env = (uint32_t)((int64_t)peak + ((((int64_t)drc->env - peak) * coef) >> 30));
+
+        target = DrcGain(drc, FixLog2(drc->env) - LOG2_FULL_SCALE);
+        step = (target - gain) / (int32_t)n;
+        for (i = 0; i < n; i++) {
+            gain += step;
+            for (ch = 0; ch < channels; ch++) {
+                int32_t *sample = &x[i * channels + ch];
+                *sample = Saturate(((int64_t)*sample * gain) >> GAIN_SHIFT, WORK_LIMIT);
+            }
+        }
+        drc->gain = target;
+    }
+}
+
+static void RefWrite(struct DspRef *ref, const int32_t *work, uint32_t frames)
+{
+    uint32_t i;
+    uint32_t ch;
+
+    for (i = 0; i < frames; i++) {
+        int32_t *dst = &ref->frames[((ref->written + i) & (DSP_CORE_REF_FRAMES - 1)) * DSP_CORE_MAX_CHANNELS];
+        for (ch = 0; ch < ref->channels; ch++) {
+            dst[ch] = work[i * ref->channels + ch];
+        }
+    }
+    ref->written += frames;
+    ref->filled = (ref->filled + frames < DSP_CORE_REF_FRAMES) ? ref->filled + frames : DSP_CORE_REF_FRAMES;
+}
+
+void DspCoreProcess(struct DspCore *core, void *data, uint32_t frames)
+{
+    int32_t work[DSP_CORE_BLOCK_FRAMES * DSP_CORE_MAX_CHANNELS];
+    uint32_t channels = core->render.channels;
+    uint32_t frameBytes = DspCoreFrameBytes(&core->render);
+    bool modify = core->eqBands > 0 || core->drc.enable;
+    uint8_t *pos = data;
+
+    if (!core->renderActive || data == NULL) {
+        return;
+    }
+
+    while (frames > 0) {
+        uint32_t n = (frames < DSP_CORE_BLOCK_FRAMES) ? frames : DSP_CORE_BLOCK_FRAMES;
+        uint32_t count = n * channels;
+        uint32_t band;
+        uint32_t i;
+        uint32_t ch;
+
+        ToWork(pos, work, count, core->render.bits);
+        for (band = 0; band < core->eqBands; band++) {
+            for (ch = 0; ch < channels; ch++) {
+                BiquadBlock(&core->eq[band], &core->eqState[band][ch], work + ch, n, channels);
+            }
+        }
+        if (core->drc.enable) {
+            DrcProcess(&core->drc, work, n, channels);
+        }
+        for (i = 0; i < count; i++) {
+            work[i] = Saturate(work[i], WORK_FULL_SCALE - 1);
+        }
+        if (modify) {
+            FromWork(work, pos, count, core->render.bits);
+        }
+        RefWrite(&core->ref, work, n);
+
+        pos += n * frameBytes;
+        frames -= n;
+    }
+}
+
+uint32_t DspCoreReadReference(struct DspCore *core, void *data, uint32_t frames)
+{
+    int32_t work[DSP_CORE_BLOCK_FRAMES];
+    struct DspRef *ref = &core->ref;
+    uint32_t channels = core->capture.channels;
+    uint32_t frameBytes = DspCoreFrameBytes(&core->capture);
+    bool live = core->renderActive && core->render.rate == core->capture.rate;
+    uint32_t matched = 0;
+    uint8_t *pos = data;
+    int32_t lag;
+
+    if (data == NULL || frameBytes == 0) {
+        return 0;
+    }
+
+    lag = (int32_t)(ref->written - ref->read);
+    if (!ref->synced || lag > DSP_CORE_REF_FRAMES || lag < -DSP_CORE_REF_FRAMES) {
+        ref->read = ref->written - core->config.refDelay;
+        ref->synced = true;
+    }
+
+    while (frames > 0) {
+        uint32_t n = (frames < DSP_CORE_BLOCK_FRAMES / channels) ? frames : DSP_CORE_BLOCK_FRAMES / channels;
+        uint32_t i;
+        uint32_t ch;
+
+        for (i = 0; i < n; i++) {
+            int32_t ahead = (int32_t)(ref->written - ref->read);
+            const int32_t *src = &ref->frames[(ref->read & (DSP_CORE_REF_FRAMES - 1)) * DSP_CORE_MAX_CHANNELS];
+            bool valid = live && ahead > 0 && (uint32_t)ahead <= ref->filled;
+
+            for (ch = 0; ch < channels; ch++) {
+                int32_t v = 0;
+                if (valid && channels == 1 && ref->channels == 2) {
+                    v = (src[0] >> 1) + (src[1] >> 1);
+                } else if (valid) {
+                    v = src[ch % ref->channels];
+                }
+                work[i * channels + ch] = v;
+            }
+            matched += valid ? 1 : 0;
+            ref->read++;
+        }
+        FromWork(work, pos, n * channels, core->capture.bits);
+
+        pos += n * frameBytes;
+        frames -= n;
+    }
+    return matched;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ *
+ * HDF is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ * See the LICENSE file in the root of this repository for complete details.
+ */
+
+#ifndef A311D_DSP_CORE_H
+#define A311D_DSP_CORE_H
+
+#include "hdf_base.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* __cplusplus */
+
+/*
+ * The render chain of the A311D DSP: a parametric EQ of biquads, then a compressor with a limiter
+ * on top, then a tap that keeps what was played as the echo reference of the capture path.
+ * Integer only and without allocation, so the same file builds into the kernel and into userspace.
+ * Callers serialize the calls on one core.
+ */
+#define DSP_CORE_MAX_CHANNELS (2)
+#define DSP_CORE_EQ_BANDS (8)
+#define DSP_CORE_REF_FRAMES (8192) // power of two, 170 ms at 48 kHz
+#define DSP_CORE_BLOCK_FRAMES (64)
+
+enum DspEqType {
+    DSP_EQ_PEAK = 0,
+    DSP_EQ_LOW_SHELF,
+    DSP_EQ_HIGH_SHELF,
+    DSP_EQ_LOW_PASS,
+    DSP_EQ_HIGH_PASS,
+    DSP_EQ_TYPE_BUTT,
+};
+
+struct DspEqBand {
+    uint32_t type;  // enum DspEqType
+    uint32_t freq;  // Hz
+    int32_t gain;   // 0.01 dB, within +-15 dB, peak and shelves only
+    uint32_t q;     // 0.001, from 0.1 to 20
+};
+
+struct DspDrcParams {
+    uint32_t enable;
+    int32_t threshold;  // 0.01 dBFS, where compression starts
+    uint32_t ratio;     // 0.1, 10 is 1:1, at most 100:1
+    uint32_t attackUs;
+    uint32_t releaseUs;
+    int32_t makeup;     // 0.01 dB, up to 24 dB
+    int32_t ceiling;    // 0.01 dBFS, the limiter keeps the output level under it
+};
+
+/* What DspEqualizerActive() takes from the application */
+struct DspCoreConfig {
+    uint32_t eqBands;
+    struct DspEqBand eq[DSP_CORE_EQ_BANDS];
+    struct DspDrcParams drc;
+    uint32_t refDelay;  // frames the echo comes back after it is played, below DSP_CORE_REF_FRAMES
+};
+
+struct DspCoreFormat {
+    uint32_t rate;
+    uint32_t channels;
+    uint32_t bits;      // 16, 24 in the low bits of 32, or 32
+};
+
+/* Q28 coefficients, a0 normalized away */
+struct DspBiquad {
+    int32_t b0;
+    int32_t b1;
+    int32_t b2;
+    int32_t a1;
+    int32_t a2;
+};
+
+struct DspBiquadState {
+    int32_t x1;
+    int32_t x2;
+    int32_t y1;
+    int32_t y2;
+    int32_t err;        // what the last output dropped below its lsb, fed back into the next one
+};
+
+/* Levels and gains in log2 Q16 */
+struct DspDrc {
+    bool enable;
+    int32_t threshold;
+    int32_t slope;      // Q16, 1 - 1 / ratio
+    int32_t makeup;
+    int32_t ceiling;
+    int32_t attack;     // Q30 envelope coefficients per DRC block
+    int32_t release;
+    uint32_t env;       // Q27 peak envelope
+    int32_t gain;       // Q24 gain the last block ended on
+};
+
+struct DspRef {
+    int32_t frames[DSP_CORE_REF_FRAMES * DSP_CORE_MAX_CHANNELS];
+    uint32_t channels;
+    uint32_t written;   // frame counters, they wrap
+    uint32_t read;
+    uint32_t filled;    // frames behind written that hold render, up to the whole ring
+    bool synced;
+};
+
+struct DspCore {
+    struct DspCoreConfig config;
+    struct DspCoreFormat render;
+    struct DspCoreFormat capture;
+    bool renderActive;  // the render format is one the chain takes
+    uint32_t eqBands;
+    struct DspBiquad eq[DSP_CORE_EQ_BANDS];
+    struct DspBiquadState eqState[DSP_CORE_EQ_BANDS][DSP_CORE_MAX_CHANNELS];
+    struct DspDrc drc;
+    struct DspRef ref;
+};
+
+/* Flat EQ, no DRC, both directions 48 kHz stereo 32 bit */
+void DspCoreInit(struct DspCore *core);
+
+/* Checks the config and works out the coefficients, the core keeps its old config on failure */
+int32_t DspCoreSetConfig(struct DspCore *core, const struct DspCoreConfig *config);
+
+/*
+ * A new render format redesigns the filters for its rate and starts the chain from silence.
+ * Formats the chain does not take pass through untouched and leave no reference.
+ */
+int32_t DspCoreSetRenderFormat(struct DspCore *core, const struct DspCoreFormat *format);
+int32_t DspCoreSetCaptureFormat(struct DspCore *core, const struct DspCoreFormat *format);
+
+/* Runs a render period through the chain in place and keeps it as reference */
+void DspCoreProcess(struct DspCore *core, void *data, uint32_t frames);
+
+/*
+ * Fills a capture period with the render frames heard refDelay frames after they were played,
+ * in the capture format. Returns how many frames had reference, the others are silence.
+ */
+uint32_t DspCoreReadReference(struct DspCore *core, void *data, uint32_t frames);
+
+uint32_t DspCoreFrameBytes(const struct DspCoreFormat *format);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* __cplusplus */
+
+#endif /* A311D_DSP_CORE_H */
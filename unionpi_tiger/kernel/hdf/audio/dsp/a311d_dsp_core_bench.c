@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2022 Unionman Co., Ltd.
+ *
+ * HDF is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ * See the LICENSE file in the root of this repository for complete details.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "a311d_dsp_core.h"
+
+#define HW_RATE (48000)
+#define PERIOD_FRAMES (480)
+#define BENCH_SECONDS (10)
+#define SETTLE_FRAMES (HW_RATE / 2)
+#define MEASURE_FRAMES (HW_RATE / 2)
+#define MAX_COEF_ERROR (2e-7)
+#define MAX_RESPONSE_ERROR_DB (0.05)
+#define MAX_LEVEL_ERROR_DB (0.25)
+#define GOLDEN_FRAMES (HW_RATE)
+#define GOLDEN_HASH (0x7c75209aU)
+#define FULL_SCALE (2147483648.0)
+#define PI (3.14159265358979323846)
+
+static uint32_t g_seed = 0x12345678;
+
+static uint32_t Rand(void)
+{
+    g_seed = g_seed * 1664525U + 1013904223U;
+    return g_seed;
+}
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double Db(double v)
+{
+    return 20.0 * log10(v);
+}
+
+static struct DspCore *NewCore(const struct DspCoreConfig *config, uint32_t rate)
+{
+    struct DspCore *core = malloc(sizeof(*core));
+    struct DspCoreFormat format = {rate, 2U, 32U};
+
+    if (!core) {
+        return NULL;
+    }
+    DspCoreInit(core);
+    if (DspCoreSetRenderFormat(core, &format) != HDF_SUCCESS || DspCoreSetConfig(core, config) != HDF_SUCCESS) {
+        free(core);
+        return NULL;
+    }
+    return core;
+}
+
+/* The cookbook in double, normalized by a0 */
+static void Design(const struct DspEqBand *band, uint32_t rate, double coef[5])
+{
+    double w = 2.0 * PI * band->freq / rate;
+    double cs = cos(w);
+    double alpha = sin(w) / (2.0 * band->q / 1000.0);
+    double amp = pow(10.0, band->gain / 4000.0);
+    double root = 2.0 * sqrt(amp) * alpha;
+    double b[3];
+    double a[3];
+
+    switch (band->type) {
+        case DSP_EQ_PEAK:
+            b[0] = 1.0 + alpha * amp, b[1] = -2.0 * cs, b[2] = 1.0 - alpha * amp;
+            a[0] = 1.0 + alpha / amp, a[1] = -2.0 * cs, a[2] = 1.0 - alpha / amp;
+            break;
+        case DSP_EQ_LOW_SHELF:
+            b[0] = amp * ((amp + 1) - (amp - 1) * cs + root);
+            b[1] = 2 * amp * ((amp - 1) - (amp + 1) * cs);
+            b[2] = amp * ((amp + 1) - (amp - 1) * cs - root);
+            a[0] = (amp + 1) + (amp - 1) * cs + root;
+            a[1] = -2 * ((amp - 1) + (amp + 1) * cs);
+            a[2] = (amp + 1) + (amp - 1) * cs - root;
+            break;
+        case DSP_EQ_HIGH_SHELF:
+            b[0] = amp * ((amp + 1) + (amp - 1) * cs + root);
+            b[1] = -2 * amp * ((amp - 1) + (amp + 1) * cs);
+            b[2] = amp * ((amp + 1) + (amp - 1) * cs - root);
+            a[0] = (amp + 1) - (amp - 1) * cs + root;
+            a[1] = 2 * ((amp - 1) - (amp + 1) * cs);
+            a[2] = (amp + 1) - (amp - 1) * cs - root;
+            break;
+        case DSP_EQ_LOW_PASS:
+            b[0] = (1 - cs) / 2, b[1] = 1 - cs, b[2] = (1 - cs) / 2;
+            a[0] = 1 + alpha, a[1] = -2 * cs, a[2] = 1 - alpha;
+            break;
+        default:
+            b[0] = (1 + cs) / 2, b[1] = -(1 + cs), b[2] = (1 + cs) / 2;
+            a[0] = 1 + alpha, a[1] = -2 * cs, a[2] = 1 - alpha;
+            break;
+    }
+    coef[0] = b[0] / a[0];
+    coef[1] = b[1] / a[0];
+    coef[2] = b[2] / a[0];
+    coef[3] = a[1] / a[0];
+    coef[4] = a[2] / a[0];
+}
+
+/* |H| of the double design at f */
+static double ResponseDb(const double c[5], double f, uint32_t rate)
+{
+    double w = 2.0 * PI * f / rate;
+    double nr = c[0] + c[1] * cos(w) + c[2] * cos(2 * w);
+    double ni = -c[1] * sin(w) - c[2] * sin(2 * w);
+    double dr = 1.0 + c[3] * cos(w) + c[4] * cos(2 * w);
+    double di = -c[3] * sin(w) - c[4] * sin(2 * w);
+    return 10.0 * log10((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+/*
+ * Runs a stereo tone through the core a period at a time and returns the output peak and rms
+ * over the last MEASURE_FRAMES, in dBFS.
+ */
+static void RunTone(struct DspCore *core, double freq, double amplitude, double *peakDb, double *rmsDb)
+{
+    int32_t period[PERIOD_FRAMES * 2];
+    uint32_t total = SETTLE_FRAMES + MEASURE_FRAMES;
+    double peak = 0.0;
+    double sum = 0.0;
+
+    for (uint32_t done = 0; done < total; done += PERIOD_FRAMES) {
+        for (uint32_t i = 0; i < PERIOD_FRAMES; i++) {
+            double v = amplitude * sin(2.0 * PI * freq * (done + i) / core->render.rate);
+            period[i * 2] = (int32_t)(v * (FULL_SCALE - 1.0));
+            period[i * 2 + 1] = period[i * 2];
+        }
+        DspCoreProcess(core, period, PERIOD_FRAMES);
+        if (done < SETTLE_FRAMES) {
+            continue;
+        }
+        for (uint32_t i = 0; i < PERIOD_FRAMES * 2; i++) {
+            double v = period[i] / FULL_SCALE;
+            peak = fabs(v) > peak ? fabs(v) : peak;
+            sum += v * v;
+        }
+    }
+    *peakDb = Db(peak);
+    *rmsDb = 10.0 * log10(sum / (MEASURE_FRAMES * 2));
+}
+
+static const struct DspEqBand g_bands[] = {
+    {DSP_EQ_PEAK, 1000U, 600, 1000U},
+    {DSP_EQ_PEAK, 100U, -1200, 2000U},
+    {DSP_EQ_PEAK, 20U, 1500, 500U},
+    {DSP_EQ_PEAK, 18000U, -1500, 10000U},
+    {DSP_EQ_LOW_SHELF, 80U, 900, 707U},
+    {DSP_EQ_LOW_SHELF, 300U, -1500, 300U},
+    {DSP_EQ_HIGH_SHELF, 8000U, -600, 707U},
+    {DSP_EQ_HIGH_SHELF, 4000U, 1500, 1000U},
+    {DSP_EQ_LOW_PASS, 12000U, 0, 707U},
+    {DSP_EQ_LOW_PASS, 200U, 0, 5000U},
+    {DSP_EQ_HIGH_PASS, 30U, 0, 707U},
+    {DSP_EQ_HIGH_PASS, 2000U, 0, 100U},
+};
+
+/*
+ * Every band alone: the fixed point coefficients against the double design, then tones below,
+ * at and above the band against the double design's response.
+ */
+static int CheckEq(uint32_t rate)
+{
+    int failures = 0;
+
+    for (size_t b = 0; b < sizeof(g_bands) / sizeof(g_bands[0]); b++) {
+        struct DspCoreConfig config = {0};
+        struct DspCore *core;
+        double want[5];
+        double coefError = 0.0;
+        double responseError = 0.0;
+
+        config.eqBands = 1;
+        config.eq[0] = g_bands[b];
+        core = NewCore(&config, rate);
+        if (!core) {
+            printf("  band %zu at %u: config refused\n", b, rate);
+            failures++;
+            continue;
+        }
+
+        Design(&g_bands[b], rate, want);
+        const int32_t got[5] = {core->eq[0].b0, core->eq[0].b1, core->eq[0].b2, core->eq[0].a1, core->eq[0].a2};
+        for (int i = 0; i < 5; i++) {
+            // Relative to the coefficient past 1, the Q28 step is absolute
+            double e = fabs(got[i] / 268435456.0 - want[i]) / (fabs(want[i]) > 1.0 ? fabs(want[i]) : 1.0);
+            coefError = e > coefError ? e : coefError;
+        }
+
+        const double ratios[] = {0.25, 0.7, 1.0, 1.4, 4.0};
+        for (size_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+            double f = g_bands[b].freq * ratios[r];
+            double peakDb;
+            double rmsDb;
+            if (f < 15.0 || f > rate * 0.45) {
+                continue;
+            }
+            // -20 dBFS leaves the boosts room under the 12 dB the chain has above full scale
+            RunTone(core, f, 0.1, &peakDb, &rmsDb);
+            double e = fabs(rmsDb - (Db(0.1) - 10.0 * log10(2.0) + ResponseDb(want, f, rate)));
+            responseError = e > responseError ? e : responseError;
+        }
+
+        int bad = coefError > MAX_COEF_ERROR || responseError > MAX_RESPONSE_ERROR_DB;
+        if (bad) {
+            printf("  type %u %5u Hz %+6.2f dB Q %.3f at %u: coef error %.2e, response error %.3f dB  FAIL\n",
+                   g_bands[b].type, g_bands[b].freq, g_bands[b].gain / 100.0, g_bands[b].q / 1000.0, rate,
+                   coefError, responseError);
+        }
+        failures += bad;
+        free(core);
+    }
+
+    printf("eq check at %u Hz: %d failures\n", rate, failures);
+    return failures;
+}
+
+/* Static curve of the compressor and the limiter on a steady tone */
+static int CheckDrc(void)
+{
+    struct {
+        const char *use;
+        struct DspDrcParams drc;
+        double inDb;
+        double wantDb;
+    } cases[] = {
+        {"below threshold", {1, -2000, 40, 1000, 100000, 0, 0}, -26.0, -26.0},
+        {"4:1", {1, -2000, 40, 1000, 100000, 0, 0}, -6.0, -16.5},
+        {"2:1 with makeup", {1, -3000, 20, 1000, 100000, 600, 0}, -10.0, -14.0},
+        {"limiter", {1, 0, 10, 0, 50000, 1200, -100}, -6.0, -1.0},
+        {"10:1 under ceiling", {1, -1800, 100, 5000, 200000, 1200, -300}, -3.0, -4.5},
+    };
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct DspCoreConfig config = {0};
+        struct DspCore *core;
+        double peakDb;
+        double rmsDb;
+
+        config.drc = cases[i].drc;
+        core = NewCore(&config, HW_RATE);
+        if (!core) {
+            printf("  %s: config refused\n", cases[i].use);
+            failures++;
+            continue;
+        }
+        RunTone(core, 997.0, pow(10.0, cases[i].inDb / 20.0), &peakDb, &rmsDb);
+        int bad = fabs(peakDb - cases[i].wantDb) > MAX_LEVEL_ERROR_DB;
+        printf("  %-20s %6.1f dBFS in, %6.2f dBFS out, want %6.2f%s\n", cases[i].use, cases[i].inDb, peakDb,
+               cases[i].wantDb, bad ? "  FAIL" : "");
+        failures += bad;
+        free(core);
+    }
+
+    printf("drc check: %d failures\n", failures);
+    return failures;
+}
+
+/*
+ * Render S32 stereo, capture S16 mono and S32 stereo: every reference frame has to be the render
+ * frame refDelay before it, in periods of different sizes on both sides.
+ */
+static int CheckReference(uint32_t captureChannels, uint32_t captureBits)
+{
+    struct DspCoreConfig config = {0};
+    struct DspCoreFormat capture = {HW_RATE, captureChannels, captureBits};
+    struct DspCore *core;
+    int32_t render[PERIOD_FRAMES * 2];
+    int32_t ref[PERIOD_FRAMES * 2];
+    uint32_t rendered = 0;
+    uint32_t captured = 0;
+    uint32_t matched = 0;
+    int failures = 0;
+
+    config.refDelay = 1000;
+    core = NewCore(&config, HW_RATE);
+    if (!core || DspCoreSetCaptureFormat(core, &capture) != HDF_SUCCESS) {
+        free(core);
+        return 1;
+    }
+
+    // Capture starts a period after render and then they take turns
+    for (uint32_t i = 0; i < PERIOD_FRAMES; i++) {
+        render[i * 2] = (int32_t)((rendered + i) * 4096U);
+        render[i * 2 + 1] = captureChannels == 1 ? render[i * 2] : -render[i * 2];
+    }
+    DspCoreProcess(core, render, PERIOD_FRAMES);
+    rendered += PERIOD_FRAMES;
+    (void)DspCoreReadReference(core, ref, 0);
+
+    for (int round = 0; round < 200; round++) {
+        uint32_t n = PERIOD_FRAMES - (Rand() % 200U);
+        for (uint32_t i = 0; i < n; i++) {
+            render[i * 2] = (int32_t)((rendered + i) * 4096U);
+            render[i * 2 + 1] = captureChannels == 1 ? render[i * 2] : -render[i * 2];
+        }
+        DspCoreProcess(core, render, n);
+        rendered += n;
+
+        n = PERIOD_FRAMES - (Rand() % 200U);
+        matched += DspCoreReadReference(core, ref, n);
+        for (uint32_t i = 0; i < n; i++) {
+            int64_t source = (int64_t)captured + i - ((int64_t)config.refDelay - PERIOD_FRAMES);
+            for (uint32_t c = 0; c < captureChannels; c++) {
+                int32_t got = captureBits == 16 ? ((int16_t *)ref)[i * captureChannels + c] :
+                    ref[i * captureChannels + c];
+                int32_t want = 0;
+                if (source >= 0 && source < rendered) {
+                    // Q27 in the ring, so what comes back is the render sample cut to the capture width
+                    int32_t v = (int32_t)((uint32_t)source * 4096U) >> 4;
+                    v = c == 0 ? v : -v;
+                    want = captureBits == 16 ? (v >> 12) : v * 16;
+                }
+                if (got != want && failures++ == 0) {
+                    printf("  x%u S%u frame %u channel %u: got %d want %d\n", captureChannels, captureBits,
+                           captured + i, c, got, want);
+                }
+            }
+        }
+        captured += n;
+    }
+
+    printf("  x%u S%u: %u of %u frames had reference%s\n", captureChannels, captureBits, matched, captured,
+           failures ? "  FAIL" : "");
+    free(core);
+    return failures;
+}
+
+static const struct DspCoreConfig g_full = {
+    .eqBands = DSP_CORE_EQ_BANDS,
+    .eq = {
+        {DSP_EQ_HIGH_PASS, 30U, 0, 707U},
+        {DSP_EQ_LOW_SHELF, 100U, 600, 707U},
+        {DSP_EQ_PEAK, 250U, -300, 1400U},
+        {DSP_EQ_PEAK, 1000U, 200, 1000U},
+        {DSP_EQ_PEAK, 3000U, -400, 2000U},
+        {DSP_EQ_PEAK, 6000U, 300, 1500U},
+        {DSP_EQ_HIGH_SHELF, 10000U, 400, 707U},
+        {DSP_EQ_LOW_PASS, 20000U, 0, 707U},
+    },
+    .drc = {1, -1800, 30, 2000, 200000, 300, -100},
+    .refDelay = 960,
+};
+
+/*
+ * The golden vector: noise and a sweep through the full chain, bit for bit. Any change to the
+ * arithmetic shows here first, the checks above say whether the change is still right.
+ */
+static int CheckGolden(void)
+{
+    struct DspCore *core = NewCore(&g_full, HW_RATE);
+    int32_t period[PERIOD_FRAMES * 2];
+    uint32_t hash = 2166136261U;
+
+    if (!core) {
+        printf("golden vector: config refused\n");
+        return 1;
+    }
+    g_seed = 0x2545F491;
+    for (uint32_t done = 0; done < GOLDEN_FRAMES; done += PERIOD_FRAMES) {
+        for (uint32_t i = 0; i < PERIOD_FRAMES; i++) {
+            double t = (double)(done + i) / HW_RATE;
+            double sweep = 0.5 * sin(2.0 * PI * (20.0 + 10000.0 * t) * t);
+            period[i * 2] = (int32_t)(sweep * FULL_SCALE) + (int32_t)(Rand() >> 4);
+            period[i * 2 + 1] = (int32_t)(-sweep * FULL_SCALE) + (int32_t)(Rand() >> 4);
+        }
+        DspCoreProcess(core, period, PERIOD_FRAMES);
+        const uint8_t *bytes = (const uint8_t *)period;
+        for (size_t i = 0; i < sizeof(period); i++) {
+            hash = (hash ^ bytes[i]) * 16777619U;
+        }
+    }
+    free(core);
+
+    printf("golden vector: %08x, want %08x%s\n", hash, GOLDEN_HASH, hash == GOLDEN_HASH ? "" : "  FAIL");
+    return hash != GOLDEN_HASH;
+}
+
+/* The full chain on the HW format, a period at a time as the DMA asks for it */
+static void Bench(uint32_t bands, bool drc, uint32_t bits)
+{
+    struct DspCoreConfig config = g_full;
+    struct DspCoreFormat format = {HW_RATE, 2U, bits};
+    struct DspCore *core = malloc(sizeof(*core));
+    int32_t period[PERIOD_FRAMES * 2];
+
+    if (!core) {
+        return;
+    }
+    config.eqBands = bands;
+    config.drc.enable = drc;
+    DspCoreInit(core);
+    if (DspCoreSetRenderFormat(core, &format) != HDF_SUCCESS || DspCoreSetConfig(core, &config) != HDF_SUCCESS) {
+        free(core);
+        return;
+    }
+    for (uint32_t i = 0; i < PERIOD_FRAMES * 2; i++) {
+        period[i] = (int32_t)Rand() >> 3;
+    }
+
+    uint32_t periods = BENCH_SECONDS * HW_RATE / PERIOD_FRAMES;
+    double begin = NowMs();
+    for (uint32_t p = 0; p < periods; p++) {
+        DspCoreProcess(core, period, PERIOD_FRAMES);
+    }
+    double ms = NowMs() - begin;
+
+    printf("  %u bands%s S%u: %6.3f%% of a core, %.2f us per %u frame period, %.1f ns per frame\n", bands,
+           drc ? " + drc" : "      ", bits, ms * 100.0 / (BENCH_SECONDS * 1e3), ms * 1e3 / periods,
+           PERIOD_FRAMES, ms * 1e6 / ((double)periods * PERIOD_FRAMES));
+    free(core);
+}
+
+int main(void)
+{
+    int failures = CheckEq(HW_RATE) + CheckEq(44100U) + CheckDrc();
+
+    failures += CheckReference(1U, 16U) + CheckReference(2U, 32U);
+    failures += CheckGolden();
+
+    printf("%d s per chain in %d frame periods\n", BENCH_SECONDS, PERIOD_FRAMES);
+    Bench(0U, false, 32U);
+    Bench(DSP_CORE_EQ_BANDS, false, 32U);
+    Bench(0U, true, 32U);
+    Bench(DSP_CORE_EQ_BANDS, true, 32U);
+    Bench(DSP_CORE_EQ_BANDS, true, 16U);
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -9,11 +9,64 @@
 #include "spi_if.h"
 #include "audio_dsp_if.h"
 #include "audio_driver_log.h"
+#include "hdf_sbuf.h"
+#include "osal_mutex.h"
 
+/*
+ * The HDF audio Makefile only builds a311d_dsp_ops.o from this directory, so the core is built
+ * as part of this translation unit. The userspace bench builds a311d_dsp_core.c on its own.
+ */
+#include "a311d_dsp_core.c"
 #include "a311d_dsp_ops.h"
 
 #define HDF_LOG_TAG a311d_dsp_ops
 
+static struct DspCore g_dspCore;
+static struct OsalMutex g_dspCoreLock;
+static bool g_dspCoreInited = false;
+
+static int32_t FormatToBits(enum AudioFormat format, uint32_t *bits)
+{
+    switch (format) {
+        case AUDIO_FORMAT_PCM_32_BIT:
+            *bits = 32;
+            break;
+        case AUDIO_FORMAT_PCM_24_BIT:
+            *bits = 24;
+            break;
+        case AUDIO_FORMAT_PCM_16_BIT:
+            *bits = 16;
+            break;
+        default:
+            return HDF_ERR_NOT_SUPPORT;
+    }
+    return HDF_SUCCESS;
+}
+
+/* The one buffer the stream dispatcher's sbuf carries */
+static int32_t ReadBuffer(const uint8_t *buf, void **data, uint32_t *size)
+{
+    const void *payload = NULL;
+
+    if (buf == NULL || !HdfSbufReadBuffer((struct HdfSBuf *)buf, &payload, size) || payload == NULL) {
+        AUDIO_DRIVER_LOG_ERR("no buffer in request.");
+        return HDF_ERR_INVALID_PARAM;
+    }
+    *data = (void *)payload;
+    return HDF_SUCCESS;
+}
+
+/* Frames in a buffer of the given format, 0 for a buffer that is not whole frames */
+static uint32_t BufferFrames(const struct DspCoreFormat *format, uint32_t size)
+{
+    uint32_t frameBytes = DspCoreFrameBytes(format);
+
+    if (frameBytes == 0 || size % frameBytes != 0) {
+        return 0;
+    }
+    return size / frameBytes;
+}
+
 int32_t DspDaiStartup(const struct AudioCard *card, const struct DaiDevice *device)
 {
     (void)card;
@@ -23,17 +76,64 @@ int32_t DspDaiStartup(const struct AudioCard *card, const struct DaiDevice *devi
 
 int32_t DspDaiHwParams(const struct AudioCard *card, const struct AudioPcmHwParams *param)
 {
+    struct DspCoreFormat format;
+    int32_t ret;
+
     (void)card;
-    (void)param;
+    if (param == NULL) {
+        AUDIO_DRIVER_LOG_ERR("input para is NULL.");
+        return HDF_ERR_INVALID_PARAM;
+    }
+    if (!g_dspCoreInited) {
+        return HDF_SUCCESS;
+    }
+
+    format.rate = param->rate;
+    format.channels = param->channels;
+    if (FormatToBits(param->format, &format.bits) != HDF_SUCCESS) {
+        format.bits = 0;
+    }
+
+    OsalMutexLock(&g_dspCoreLock);
+    if (param->streamType == AUDIO_RENDER_STREAM) {
+        ret = DspCoreSetRenderFormat(&g_dspCore, &format);
+    } else {
+        ret = DspCoreSetCaptureFormat(&g_dspCore, &format);
+    }
+    OsalMutexUnlock(&g_dspCoreLock);
+
+    /* The DSP is an extra on the path, a format it cannot take still plays unprocessed */
+    if (ret != HDF_SUCCESS) {
+        AUDIO_DRIVER_LOG_INFO("stream %d bypasses dsp: rate %u, channels %u, format %d, ret %d",
+                              param->streamType, param->rate, param->channels, param->format, ret);
+    }
     return HDF_SUCCESS;
 }
 
 int32_t DspDeviceInit(const struct DspDevice *device)
 {
     (void)device;
+    if (g_dspCoreInited) {
+        return HDF_SUCCESS;
+    }
+    if (OsalMutexInit(&g_dspCoreLock) != HDF_SUCCESS) {
+        AUDIO_DRIVER_LOG_ERR("OsalMutexInit failed.");
+        return HDF_FAILURE;
+    }
+    DspCoreInit(&g_dspCore);
+    g_dspCoreInited = true;
     return HDF_SUCCESS;
 }
 
+void DspDeviceRelease(void)
+{
+    if (!g_dspCoreInited) {
+        return;
+    }
+    g_dspCoreInited = false;
+    OsalMutexDestroy(&g_dspCoreLock);
+}
+
 int32_t DspDeviceReadReg(const struct DspDevice *device, const void *msgs, const uint32_t len)
 {
     (void)device;
@@ -55,26 +155,99 @@ int32_t DspDaiDeviceInit(struct AudioCard *card, const struct DaiDevice *device)
     return HDF_SUCCESS;
 }
 
+/* buf carries one render period in the render format, run through the EQ and DRC where it lies */
 int32_t DspDecodeAudioStream(const struct AudioCard *card, const uint8_t *buf, const struct DspDevice *device)
 {
+    void *data = NULL;
+    uint32_t size = 0;
+    uint32_t frames;
+    int32_t ret;
+
     (void)card;
-    (void)buf;
     (void)device;
+    if (!g_dspCoreInited) {
+        return HDF_ERR_NOT_SUPPORT;
+    }
+    ret = ReadBuffer(buf, &data, &size);
+    if (ret != HDF_SUCCESS) {
+        return ret;
+    }
+
+    OsalMutexLock(&g_dspCoreLock);
+    frames = BufferFrames(&g_dspCore.render, size);
+    if (frames != 0) {
+        DspCoreProcess(&g_dspCore, data, frames);
+    }
+    OsalMutexUnlock(&g_dspCoreLock);
+
+    if (frames == 0) {
+        AUDIO_DRIVER_LOG_ERR("%u bytes is not a whole number of render frames.", size);
+        return HDF_ERR_INVALID_PARAM;
+    }
     return HDF_SUCCESS;
 }
 
+/* buf carries a capture period sized buffer, filled with the echo reference for that period */
 int32_t DspEncodeAudioStream(const struct AudioCard *card, const uint8_t *buf, const struct DspDevice *device)
 {
+    void *data = NULL;
+    uint32_t size = 0;
+    uint32_t frames;
+    uint32_t matched = 0;
+    int32_t ret;
+
     (void)card;
-    (void)buf;
     (void)device;
+    if (!g_dspCoreInited) {
+        return HDF_ERR_NOT_SUPPORT;
+    }
+    ret = ReadBuffer(buf, &data, &size);
+    if (ret != HDF_SUCCESS) {
+        return ret;
+    }
+
+    OsalMutexLock(&g_dspCoreLock);
+    frames = BufferFrames(&g_dspCore.capture, size);
+    if (frames != 0) {
+        matched = DspCoreReadReference(&g_dspCore, data, frames);
+    }
+    OsalMutexUnlock(&g_dspCoreLock);
+
+    if (frames == 0) {
+        AUDIO_DRIVER_LOG_ERR("%u bytes is not a whole number of capture frames.", size);
+        return HDF_ERR_INVALID_PARAM;
+    }
+    AUDIO_DRIVER_LOG_DEBUG("reference for %u of %u frames.", matched, frames);
     return HDF_SUCCESS;
 }
 
+/* buf carries a struct DspCoreConfig, the filters are designed here and not per period */
 int32_t DspEqualizerActive(const struct AudioCard *card, const uint8_t *buf, const struct DspDevice *device)
 {
+    void *data = NULL;
+    uint32_t size = 0;
+    int32_t ret;
+
     (void)card;
-    (void)buf;
     (void)device;
-    return HDF_SUCCESS;
+    if (!g_dspCoreInited) {
+        return HDF_ERR_NOT_SUPPORT;
+    }
+    ret = ReadBuffer(buf, &data, &size);
+    if (ret != HDF_SUCCESS) {
+        return ret;
+    }
+    if (size != sizeof(struct DspCoreConfig)) {
+        AUDIO_DRIVER_LOG_ERR("config is %u bytes, expected %zu.", size, sizeof(struct DspCoreConfig));
+        return HDF_ERR_INVALID_PARAM;
+    }
+
+    OsalMutexLock(&g_dspCoreLock);
+    ret = DspCoreSetConfig(&g_dspCore, (const struct DspCoreConfig *)data);
+    OsalMutexUnlock(&g_dspCoreLock);
+
+    if (ret != HDF_SUCCESS) {
+        AUDIO_DRIVER_LOG_ERR("DspCoreSetConfig failed, ret %d.", ret);
+    }
+    return ret;
 }
@@ -19,6 +19,7 @@ extern "C" {
 
 int32_t DspDaiDeviceInit(struct AudioCard *card, const struct DaiDevice *device);
 int32_t DspDeviceInit(const struct DspDevice *device);
+void DspDeviceRelease(void);
 int32_t DspDeviceReadReg(const struct DspDevice *device, const void *msgs, const uint32_t len);
 int32_t DspDeviceWriteReg(const struct DspDevice *device, const void *msgs, const uint32_t len);
 int32_t DspDaiStartup(const struct AudioCard *card, const struct DaiDevice *device);